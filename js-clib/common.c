@@ -25,17 +25,22 @@
 #include <string.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 
 #include "common.h"
 #include "uthash.h"
 
 /// log
 
-void ___log(uint32 level, const char *file_name, const char *function_name, int line_number, char* format, ...)
+volatile uint32 ___log_mask = LOG_ERR | LOG_DBG | LOG_INFO;
+
+static void _log_sync(uint32 level, const char *format, va_list args)
 {
     char buffer[MAX_LOG_MSG];
-    va_list args;
-    va_start (args, format);
     vsnprintf (buffer, MAX_LOG_MSG, format, args);
 
     //do something with the error
@@ -46,13 +51,632 @@ void ___log(uint32 level, const char *file_name, const char *function_name, int
     else
     {
         fprintf(stdout, "%s", buffer);
+    }
+}
+
+/*
+ * Async log
+ *
+ * Every thread owns a single-producer/single-consumer ring, the producer only moves 'head' and
+ * the flusher only moves 'tail', so neither side takes a lock. A record is a header followed by
+ * the captured arguments and a copy of the format, ___log never formats text, it only walks the
+ * format to pick up the arguments with va_arg. Nothing in a record points to the caller's memory,
+ * a format with %n (written by the formatting) is logged synchronously instead.
+ * Rings are linked into a list once and reused after their thread exits.
+ * If a ring is full the message is dropped and counted, logging never blocks the caller.
+ * The flusher sleeps on an eventfd, a producer only writes it when the flusher is about to sleep.
+ *
+ * Binary record (host byte order):
+ *   uint32 magic, uint32 size (bytes after this field), uint32 level, int32 line, uint64 time (ns),
+ *   uint64 thread, uint16 file_len, uint16 func_len, uint16 format_len, uint16 nargs,
+ *   file, function, format, then per argument: uint8 type, value (8 bytes) or uint16 len + bytes.
+ */
 
+enum log_arg_type
+{
+    log_arg_int         = 1,        // long long
+    log_arg_uint        = 2,        // unsigned long long
+    log_arg_double      = 3,
+    log_arg_ptr         = 4,
+    log_arg_str         = 5,        // uint16 length + bytes (no '\0')
+};
+
+#define LOG_REC_PAD         0x80000000      // padding record to the end of the ring
+#define LOG_REC_ALIGN       8
+#define LOG_MAX_ARGS        32
+#define LOG_MAX_STR         (MAX_LOG_MSG/2)
+#define LOG_FLUSH_IOV       64
+
+struct log_record
+{
+    uint32 size;                    // record size including header, aligned
+    uint32 level;
+    int32 line;
+    uint16 nargs;
+    uint16 args_size;
+    const char *file;               // __FILE__ and __func__ are string literals
+    const char *function;
+    const char *format;             // copy after the arguments
+    uint64 time;
+    uint64 thread;
+    uint8 args[0];
+};
+
+struct log_ring
+{
+    struct log_ring *next;
+    uint32 in_use;
+    uint32 dropped;
+    uint32 head;                    // written by producer
+    uint8 _pad[64 - sizeof(void*) - 3*sizeof(uint32)];
+    uint32 tail;                    // written by flusher
+    uint8 buffer[LOG_RING_SIZE];
+};
+
+static struct log_ring *_log_rings = nil;
+static pthread_key_t _log_ring_key;
+static pthread_once_t _log_ring_key_once = PTHREAD_ONCE_INIT;
+static __thread struct log_ring *_log_ring = nil;
+static volatile int _log_async_on = 0;
+static uint32 _log_producers = 0;              // ___log calls between the check of _log_async_on and the publish
+static volatile int _log_stop = 0;
+static int _log_binary_fd = -1;
+static int _log_wake_fd = -1;
+static uint32 _log_sleeping = 0;
+static pthread_t _log_flusher;
+
+static void _log_ring_detach(void *ring)
+{
+    __atomic_store_n(&((struct log_ring*)ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void _log_ring_key_create(void)
+{
+    pthread_key_create(&_log_ring_key, _log_ring_detach);
+}
+
+static struct log_ring *_log_ring_acquire(void)
+{
+    struct log_ring *ring;
+    uint32 unused;
+
+    pthread_once(&_log_ring_key_once, _log_ring_key_create);
+
+    // reuse a ring left by an exited thread
+    for (ring = __atomic_load_n(&_log_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        unused = 0;
+        if (__atomic_compare_exchange_n(&ring->in_use, &unused, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
     }
 
+    if (!ring)
+    {
+        ring = plat_mem_allocate(sizeof(*ring));
+        if (!ring) return nil;
+        ring->in_use = 1;
+        ring->next = __atomic_load_n(&_log_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&_log_rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    pthread_setspecific(_log_ring_key, ring);
+    _log_ring = ring;
+    return ring;
+}
+
+// Walk the format as printf does, only to know which va_arg to take.
+// Width and precision given by '*' are captured as int arguments before the value,
+// a string is copied up to its precision (or LOG_MAX_STR).
+// Return -1 for %n, the caller's variable would be written after the call returned.
+static int _log_capture_args(const char *format, va_list args, uint8 *out, uint16 out_size, uint16 *nargs)
+{
+    const char *p = format;
+    uint16 size = 0, n = 0;
+    int longs, precision;
+    uint8 type;
+    union { long long i; unsigned long long u; double d; void *p; } v;
+
+    while ((p = strchr(p, '%')) != nil && n < LOG_MAX_ARGS)
+    {
+        p++;
+        if (*p == '%') { p++; continue; }
+        while (*p && strchr("-+ #0'", *p)) p++;
+
+        precision = -1;
+        while (*p && (strchr("0123456789.", *p) || *p == '*'))
+        {
+            if (*p == '.')
+            {
+                precision = 0;
+                if (p[1] >= '0' && p[1] <= '9') precision = atoi(p + 1);
+            }
+            else if (*p == '*')
+            {
+                if (size + 9 > out_size) goto done;
+                out[size++] = log_arg_int;
+                v.i = va_arg(args, int);
+                if (precision >= 0) precision = (int)v.i;
+                memcpy(out + size, &v, 8); size += 8; n++;
+            }
+            p++;
+        }
+
+        longs = 0;
+        while (*p && strchr("hlLqjzt", *p))
+        {
+            if (*p == 'l' || *p == 'q' || *p == 'j' || *p == 'z' || *p == 't') longs++;
+            if (*p == 'L') longs = -1;
+            p++;
+        }
+
+        switch (*p)
+        {
+            case 'd': case 'i':
+                type = log_arg_int;
+                v.i = longs > 1 ? va_arg(args, long long) : longs == 1 ? va_arg(args, long) : va_arg(args, int);
+                break;
+            case 'c':
+                type = log_arg_int;
+                v.i = va_arg(args, int);
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                type = log_arg_uint;
+                v.u = longs > 1 ? va_arg(args, unsigned long long) : longs == 1 ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                type = log_arg_double;
+                v.d = longs < 0 ? (double)va_arg(args, long double) : va_arg(args, double);
+                break;
+            case 'n':
+                return -1;
+            case 'p':
+                type = log_arg_ptr;
+                v.p = va_arg(args, void*);
+                break;
+            case 's':
+            {
+                const char *str = va_arg(args, const char*);
+                uint16 len;
+                if (!str) str = "(null)";
+                len = (uint16)strnlen(str, (precision >= 0 && precision < LOG_MAX_STR) ? precision : LOG_MAX_STR);
+                if (size + 3 + len > out_size) goto done;
+                out[size++] = log_arg_str;
+                memcpy(out + size, &len, 2); size += 2;
+                memcpy(out + size, str, len); size += len;
+                n++; p++;
+                continue;
+            }
+            default:
+                goto done;          // unknown conversion, stop capturing
+        }
+
+        if (size + 9 > out_size) goto done;
+        out[size++] = type;
+        memcpy(out + size, &v, 8); size += 8;
+        n++; p++;
+    }
+
+done:
+    *nargs = n;
+    return size;
+}
+
+static uint64 _log_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Return -1 if the message can't be deferred, it is then logged synchronously.
+static int _log_async(struct log_ring *ring, uint32 level, const char *file_name, const char *function_name,
+                      int line_number, const char *format, va_list args)
+{
+    uint8 captured[MAX_LOG_MSG];
+    struct log_record *rec;
+    uint16 nargs, args_size, format_len;
+    uint32 size, head, tail, offset, room;
+    int captured_size;
+
+    captured_size = _log_capture_args(format, args, captured, sizeof(captured), &nargs);
+    if (captured_size < 0) return -1;
+    args_size = (uint16)captured_size;
+    format_len = (uint16)strnlen(format, MAX_LOG_MSG - 1);
+    size = (sizeof(*rec) + args_size + format_len + 1 + LOG_REC_ALIGN - 1) & ~(LOG_REC_ALIGN - 1);
+
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    offset = head & (LOG_RING_SIZE - 1);
+    room = LOG_RING_SIZE - offset;
+
+    if (room < size)
+    {
+        // pad to the end, the record starts again at offset 0
+        if (LOG_RING_SIZE - (head - tail) < room + size) goto drop;
+        if (room >= sizeof(uint32))
+            *(uint32*)(ring->buffer + offset) = room | LOG_REC_PAD;
+        head += room;
+        offset = 0;
+    }
+    else if (LOG_RING_SIZE - (head - tail) < size)
+    {
+        goto drop;
+    }
+
+    rec = (struct log_record*)(ring->buffer + offset);
+    rec->size = size;
+    rec->level = level;
+    rec->line = line_number;
+    rec->nargs = nargs;
+    rec->args_size = args_size;
+    rec->file = file_name;
+    rec->function = function_name;
+    rec->format = (const char*)rec->args + args_size;
+    rec->time = _log_binary_fd >= 0 ? _log_time() : 0;
+    rec->thread = (uint64)pthread_self();
+    memcpy(rec->args, captured, args_size);
+    memcpy(rec->args + args_size, format, format_len);
+    rec->args[args_size + format_len] = '\0';
+
+    __atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+
+    // pairs with the fence in _log_flusher_main, one side sees the other
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_log_sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&_log_sleeping, 0, __ATOMIC_RELAXED))
+    {
+        uint64 one = 1;
+        ssize_t r = write(_log_wake_fd, &one, sizeof(one));
+        (void)r;
+    }
+    return 0;
+
+drop:
+    __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void ___log(uint32 level, const char *file_name, const char *function_name, int line_number, char* format, ...)
+{
+    struct log_ring *ring;
+    va_list args, async_args;
+    int queued = 0;
+    va_start (args, format);
+
+    if (__atomic_load_n(&_log_async_on, __ATOMIC_RELAXED))
+    {
+        // announce the producer, then check again: log_async_stop either sees it and waits
+        // for the record to be published, or we see the stop and log synchronously
+        __atomic_add_fetch(&_log_producers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&_log_async_on, __ATOMIC_SEQ_CST) && ((ring = _log_ring) || (ring = _log_ring_acquire())))
+        {
+            va_copy(async_args, args);
+            queued = _log_async(ring, level, file_name, function_name, line_number, format, async_args) == 0;
+            va_end(async_args);
+        }
+        __atomic_sub_fetch(&_log_producers, 1, __ATOMIC_RELEASE);
+    }
+    if (!queued) _log_sync(level, format, args);
 
     va_end (args);
 }
 
+static const uint8 *_log_next_arg(const uint8 *a, const uint8 *end, uint8 *type, void *value, uint16 *len)
+{
+    if (a >= end) return nil;
+    *type = *a++;
+    if (*type == log_arg_str)
+    {
+        memcpy(len, a, 2);
+        *(const uint8**)value = a + 2;
+        return a + 2 + *len;
+    }
+    memcpy(value, a, 8);
+    return a + 8;
+}
+
+// Format a record like vsnprintf with the captured arguments, one conversion at a time.
+// Integers are passed widened to long long, a precision is written into the conversion,
+// so only a '*' width is left as an extra argument.
+static size_t _log_format(const struct log_record *rec, char *buffer, size_t buffer_size)
+{
+    const char *p = rec->format, *spec;
+    const uint8 *a = rec->args, *end = rec->args + rec->args_size;
+    char conv[48];
+    size_t used = 0, len;
+    int width, precision, has_width, w;
+    uint8 type;
+    uint16 slen;
+    union { long long i; unsigned long long u; double d; void *p; const uint8 *s; } v;
+
+    while (*p && used + 1 < buffer_size)
+    {
+        spec = strchr(p, '%');
+        if (!spec) spec = p + strlen(p);
+        len = spec - p;
+        if (len > buffer_size - used - 1) len = buffer_size - used - 1;
+        memcpy(buffer + used, p, len);
+        used += len;
+        if (!*spec) break;
+
+        p = spec + 1;
+        if (*p == '%') { buffer[used++] = '%'; p++; continue; }
+
+        len = 0;
+        conv[len++] = '%';
+        while (*p && strchr("-+ #0'", *p) && len < 8) conv[len++] = *p++;
+
+        has_width = 0;
+        if (*p == '*')
+        {
+            if (!(a = _log_next_arg(a, end, &type, &v, &slen))) break;
+            width = (int)v.i;
+            has_width = 1;
+            conv[len++] = '*';
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') { if (len < 16) conv[len++] = *p; p++; }
+
+        precision = -1;
+        if (*p == '.')
+        {
+            p++;
+            if (*p == '*')
+            {
+                if (!(a = _log_next_arg(a, end, &type, &v, &slen))) break;
+                precision = (int)v.i;
+                p++;
+            }
+            else
+            {
+                precision = atoi(p);
+                while (*p >= '0' && *p <= '9') p++;
+            }
+        }
+        while (*p && strchr("hlLqjzt", *p)) p++;
+        if (!*p) break;
+
+        if (!(a = _log_next_arg(a, end, &type, &v, &slen))) break;
+
+        if (type == log_arg_str)
+            len += snprintf(conv + len, sizeof(conv) - len, ".%ds", (int)slen);  // already clipped
+        else if (precision >= 0)
+            len += snprintf(conv + len, sizeof(conv) - len, ".%d%s%c", precision,
+                            (type == log_arg_int || type == log_arg_uint) && *p != 'c' ? "ll" : "", *p);
+        else
+            len += snprintf(conv + len, sizeof(conv) - len, "%s%c",
+                            (type == log_arg_int || type == log_arg_uint) && *p != 'c' ? "ll" : "", *p);
+        p++;
+
+        switch (type)
+        {
+            case log_arg_int:
+            case log_arg_uint:
+                if (conv[len - 1] == 'c')
+                    w = has_width ? snprintf(buffer + used, buffer_size - used, conv, width, (int)v.i)
+                                  : snprintf(buffer + used, buffer_size - used, conv, (int)v.i);
+                else
+                    w = has_width ? snprintf(buffer + used, buffer_size - used, conv, width, v.i)
+                                  : snprintf(buffer + used, buffer_size - used, conv, v.i);
+                break;
+            case log_arg_double:
+                w = has_width ? snprintf(buffer + used, buffer_size - used, conv, width, v.d)
+                              : snprintf(buffer + used, buffer_size - used, conv, v.d);
+                break;
+            case log_arg_ptr:
+                w = has_width ? snprintf(buffer + used, buffer_size - used, conv, width, v.p)
+                              : snprintf(buffer + used, buffer_size - used, conv, v.p);
+                break;
+            case log_arg_str:
+                w = has_width ? snprintf(buffer + used, buffer_size - used, conv, width, (const char*)v.s)
+                              : snprintf(buffer + used, buffer_size - used, conv, (const char*)v.s);
+                break;
+            default:
+                w = -1;
+                break;
+        }
+        if (w < 0) break;
+        used += ((size_t)w < buffer_size - used) ? (size_t)w : buffer_size - used - 1;
+    }
+
+    buffer[used] = '\0';
+    return used;
+}
+
+static size_t _log_binary(const struct log_record *rec, uint8 *buffer, size_t buffer_size)
+{
+    uint16 file_len = (uint16)strlen(rec->file);
+    uint16 func_len = (uint16)strlen(rec->function);
+    uint16 format_len = (uint16)strnlen(rec->format, MAX_LOG_MSG);
+    uint32 magic = LOG_BIN_MAGIC, size;
+    size_t total = 8 + 4 + 4 + 8 + 8 + 8 + file_len + func_len + format_len + rec->args_size;
+    uint8 *b = buffer;
+
+    if (total > buffer_size) return 0;
+    size = (uint32)(total - 8);
+
+#define LOG_PUT(ptr, n) do { memcpy(b, ptr, n); b += n; } while (0)
+    LOG_PUT(&magic, 4);
+    LOG_PUT(&size, 4);
+    LOG_PUT(&rec->level, 4);
+    LOG_PUT(&rec->line, 4);
+    LOG_PUT(&rec->time, 8);
+    LOG_PUT(&rec->thread, 8);
+    LOG_PUT(&file_len, 2);
+    LOG_PUT(&func_len, 2);
+    LOG_PUT(&format_len, 2);
+    LOG_PUT(&rec->nargs, 2);
+    LOG_PUT(rec->file, file_len);
+    LOG_PUT(rec->function, func_len);
+    LOG_PUT(rec->format, format_len);
+    LOG_PUT(rec->args, rec->args_size);
+#undef LOG_PUT
+
+    return total;
+}
+
+struct log_batch
+{
+    int fd;
+    int count;
+    size_t used;
+    struct iovec iov[LOG_FLUSH_IOV];
+    char data[LOG_FLUSH_IOV * MAX_LOG_MSG];
+};
+
+static void _log_batch_write(struct log_batch *batch)
+{
+    int i = 0;
+    ssize_t w;
+
+    if (batch->count == 0) return;
+
+    // keep the order with what was printed through stdio before
+    if (batch->fd == STDOUT_FILENO) fflush(stdout);
+    else if (batch->fd == STDERR_FILENO) fflush(stderr);
+
+    while (i < batch->count)
+    {
+        w = writev(batch->fd, batch->iov + i, batch->count - i);
+        if (w < 0) break;
+        while (i < batch->count && (size_t)w >= batch->iov[i].iov_len) w -= batch->iov[i++].iov_len;
+        if (i < batch->count)
+        {
+            batch->iov[i].iov_base = (char*)batch->iov[i].iov_base + w;
+            batch->iov[i].iov_len -= w;
+        }
+    }
+
+    batch->count = 0;
+    batch->used = 0;
+}
+
+static void _log_batch_add(struct log_batch *batch, int fd, const struct log_record *rec)
+{
+    size_t len;
+    char *data;
+
+    if (batch->fd != fd || batch->count == LOG_FLUSH_IOV) _log_batch_write(batch);
+    batch->fd = fd;
+
+    data = batch->data + batch->used;
+    if (_log_binary_fd >= 0)
+        len = _log_binary(rec, (uint8*)data, sizeof(batch->data) - batch->used);
+    else
+        len = _log_format(rec, data, MAX_LOG_MSG);
+    if (len == 0) return;
+
+    batch->iov[batch->count].iov_base = data;
+    batch->iov[batch->count].iov_len = len;
+    batch->count++;
+    batch->used += len;
+    if (sizeof(batch->data) - batch->used < MAX_LOG_MSG * 2) _log_batch_write(batch);
+}
+
+// Drain every ring once, return the number of records written.
+static int _log_drain(struct log_batch *batch)
+{
+    struct log_ring *ring;
+    struct log_record *rec;
+    uint32 head, tail, size, dropped;
+    int n = 0;
+    char msg[64];
+
+    for (ring = __atomic_load_n(&_log_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        tail = ring->tail;
+        while (tail != head)
+        {
+            rec = (struct log_record*)(ring->buffer + (tail & (LOG_RING_SIZE - 1)));
+            if (LOG_RING_SIZE - (tail & (LOG_RING_SIZE - 1)) < sizeof(uint32) || (rec->size & LOG_REC_PAD))
+            {
+                size = LOG_RING_SIZE - (tail & (LOG_RING_SIZE - 1));
+            }
+            else
+            {
+                size = rec->size;
+                _log_batch_add(batch, _log_binary_fd >= 0 ? _log_binary_fd :
+                                      (rec->level & LOG_ERR) ? STDERR_FILENO : STDOUT_FILENO, rec);
+                n++;
+            }
+            tail += size;
+        }
+        // the record memory is owned by the batch copy from now on
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        if ((dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED)) > 0 && _log_binary_fd < 0)
+        {
+            _log_batch_write(batch);
+            snprintf(msg, sizeof(msg), "[LOG] %u messages dropped\n", dropped);
+            fprintf(stderr, "%s", msg);
+        }
+    }
+    _log_batch_write(batch);
+    return n;
+}
+
+static void* _log_flusher_main(void *param)
+{
+    struct log_batch *batch = plat_mem_allocate(sizeof(*batch));
+    uint64 count;
+    ssize_t r;
+
+    (void)param;
+    while (!_log_stop)
+    {
+        if (_log_drain(batch) > 0) continue;
+
+        // announce the sleep, then look once more, a record published meanwhile is seen here
+        // or its producer sees _log_sleeping and wakes us
+        __atomic_store_n(&_log_sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (_log_drain(batch) == 0 && !_log_stop)
+        {
+            r = read(_log_wake_fd, &count, sizeof(count));
+            (void)r;
+        }
+        __atomic_store_n(&_log_sleeping, 0, __ATOMIC_RELAXED);
+    }
+    _log_drain(batch);
+
+    plat_mem_release(batch);
+    return nil;
+}
+
+int log_async_start(int binary_fd)
+{
+    if (_log_async_on) return 0;
+
+    // blocking, the flusher waits in read(), kept open so a late producer never writes a reused fd
+    if (_log_wake_fd < 0 && (_log_wake_fd = eventfd(0, EFD_CLOEXEC)) < 0) return -1;
+
+    _log_binary_fd = binary_fd;
+    _log_stop = 0;
+    if (pthread_create(&_log_flusher, nil, _log_flusher_main, nil) != 0)
+    {
+        return -1;
+    }
+    _log_async_on = 1;
+    return 0;
+}
+
+void log_async_stop(void)
+{
+    uint64 one = 1;
+    ssize_t r;
+
+    if (!_log_async_on) return;
+
+    __atomic_store_n(&_log_async_on, 0, __ATOMIC_SEQ_CST);
+    // records of the producers which passed the check are drained by the flusher below
+    while (__atomic_load_n(&_log_producers, __ATOMIC_SEQ_CST) != 0) sched_yield();
+    _log_stop = 1;
+    r = write(_log_wake_fd, &one, sizeof(one));
+    (void)r;
+    pthread_join(_log_flusher, nil);
+    _log_binary_fd = -1;
+}
+
 
 /// thread
 
@@ -62,7 +686,8 @@ thread* run_thread(thread* thrd, thread_func func, void *param)
         thrd = plat_mem_allocate(sizeof(*thrd));
         thrd->_should_free = true;
     } else {
-        plat_mem_set(thrd, 0, sizeof(*thrd));
+        thrd->inst = nil;                   // keep _param, it may be filled by caller
+        thrd->_should_free = false;
     }
 
     thrd->inst = plat_mem_allocate(sizeof(pthread_t));
@@ -106,7 +731,7 @@ runid run(thread_func func, size_t param_size, void* param)
 
     thread* thrd;
     runid rid;
-    rid = res_create(_run_res_mgn, sizeof(*thrd) + param_size>sizeof(void*)?param_size:sizeof(void*), (void**)&thrd);
+    rid = res_create(_run_res_mgn, sizeof(*thrd) - sizeof(void*) + (param_size>sizeof(void*)?param_size:sizeof(void*)), (void**)&thrd);
 
     if (param>0)
     {
@@ -151,6 +776,183 @@ void run_done(void)
     }
 }
 
+/// mpsc queue
+
+void mpsc_init(struct mpsc_queue *q)
+{
+    q->stub.next = nil;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+void mpsc_push(struct mpsc_queue *q, struct mpsc_node *node)
+{
+    struct mpsc_node *prev;
+
+    node->next = nil;
+    prev = __atomic_exchange_n(&q->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+struct mpsc_node* mpsc_pop(struct mpsc_queue *q)
+{
+    struct mpsc_node *tail = q->tail;
+    struct mpsc_node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &q->stub)
+    {
+        if (!next) return nil;
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next)
+    {
+        q->tail = next;
+        return tail;
+    }
+
+    // tail is the last node, it can't be popped before stub is queued behind it
+    if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) return nil;
+    mpsc_push(q, &q->stub);
+
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next)
+    {
+        q->tail = next;
+        return tail;
+    }
+    return nil;
+}
+
+/// job
+
+struct job_
+{
+    struct mpsc_node node;          // first member, cast from mpsc_node
+    job_func func;
+    uint8 data[0];
+};
+
+static struct mpsc_queue _job_queue;
+static int _job_fd = -1;
+static int _job_signaled = 0;
+static int _job_refs = 0;
+
+int job_init(void)
+{
+    if (_job_fd >= 0) return 0;
+
+    mpsc_init(&_job_queue);
+    _job_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return _job_fd >= 0 ? 0 : -1;
+}
+
+int job_fd(void)
+{
+    return _job_fd;
+}
+
+static void _job_signal(void)
+{
+    uint64 one = 1;
+
+    // only the first post after a drain pays for the syscall
+    if (!__atomic_exchange_n(&_job_signaled, 1, __ATOMIC_SEQ_CST))
+    {
+        ssize_t r = write(_job_fd, &one, sizeof(one));
+        (void)r;
+    }
+}
+
+void* job_alloc(job_func func, size_t data_size)
+{
+    struct job_ *job = plat_mem_allocate(sizeof(*job) + data_size);
+    if (!job) return nil;
+
+    job->func = func;
+    return job->data;
+}
+
+int job_submit(void* data)
+{
+    struct job_ *job = (struct job_*)((uint8*)data - offsetof(struct job_, data));
+
+    if (_job_fd < 0)
+    {
+        plat_mem_release(job);
+        return -1;
+    }
+
+    mpsc_push(&_job_queue, &job->node);
+    _job_signal();
+    return 0;
+}
+
+int job_post(job_func func, size_t data_size, void* data)
+{
+    void *job_data = job_alloc(func, data_size);
+    if (!job_data) return -1;
+
+    if (data_size > 0) plat_mem_copy(job_data, data, data_size);
+    return job_submit(job_data);
+}
+
+int job_run_pending(void *context, int max)
+{
+    struct job_ *job;
+    uint64 count;
+    ssize_t r;
+    int n = 0;
+
+    if (_job_fd < 0) return 0;
+
+    r = read(_job_fd, &count, sizeof(count));        // reset, it is nonblocking
+    (void)r;
+    __atomic_store_n(&_job_signaled, 0, __ATOMIC_SEQ_CST);
+
+    while (n < max && (job = (struct job_*)mpsc_pop(&_job_queue)) != nil)
+    {
+        job->func(context, job->data);
+        plat_mem_release(job);
+        n++;
+    }
+
+    // batch is full, stay readable for the next loop iteration
+    if (n == max) _job_signal();
+
+    return n;
+}
+
+void job_ref(void)
+{
+    __atomic_add_fetch(&_job_refs, 1, __ATOMIC_SEQ_CST);
+}
+
+void job_unref(void)
+{
+    __atomic_sub_fetch(&_job_refs, 1, __ATOMIC_SEQ_CST);
+    if (_job_fd >= 0) _job_signal();                // let the main loop check job_active()
+}
+
+int job_active(void)
+{
+    return __atomic_load_n(&_job_refs, __ATOMIC_SEQ_CST) > 0;
+}
+
+void job_done(void)
+{
+    struct job_ *job;
+
+    if (_job_fd < 0) return;
+
+    // drop what was never run
+    while ((job = (struct job_*)mpsc_pop(&_job_queue)) != nil) plat_mem_release(job);
+    close(_job_fd);
+    _job_fd = -1;
+}
+
 /// resource
 
 struct res_
@@ -33,9 +33,16 @@
 #define LOG_ERR             0x01000000
 #define LOG_DBG             0x02000000
 #define LOG_INFO            0x04000000
+#define LOG_TYPE_MASK       0xFF000000
+
+// Types enabled in ___log_mask are logged, a message without type bit is always logged.
+// The mask is checked inline, so a disabled message costs one load and one test.
+extern volatile uint32 ___log_mask;
+#define log_enabled(level)  (!((level) & LOG_TYPE_MASK) || ((level) & ___log_mask))
+#define log_set_mask(mask)  (___log_mask = (mask))
 
 void ___log(uint32 level, const char *file_name, const char *function_name, int line_number, char* format, ...);
-#define log(level, format, args...)             ___log(level, __FILE__, __func__, __LINE__, format, ##args)
+#define log(level, format, args...)             do { if (log_enabled(level)) ___log(level, __FILE__, __func__, __LINE__, format, ##args); } while (0)
 #define log_err(level, format, args...)         log((level | LOG_ERR), format, ##args)
 #define log_dbg(level, format, args...)         log((level | LOG_DBG), format, ##args)
 #define log_info(level, format, args...)        log((level | LOG_INFO), format, ##args)
@@ -53,6 +60,17 @@ enum handle_type
 };
 
 
+// Async logging, messages are queued in a per-thread ring and written by a flusher thread.
+// Arguments and the format are captured by value (strings are copied) and formatted by the flusher,
+// a format with %n is logged synchronously.
+// binary_fd < 0 keeps the text output (stdout/stderr), else binary records are written to binary_fd.
+#define LOG_RING_SIZE       (64*1024)       // bytes per thread, power of 2
+#define LOG_BIN_MAGIC       0x4A534C47      // "JSLG"
+
+int log_async_start(int binary_fd);
+void log_async_stop(void);              // flush all queued messages and stop the flusher
+
+
 /// thread
 typedef void* (*thread_func)(void *param);
 
@@ -77,6 +95,42 @@ runid run(thread_func func, size_t param_size, void* param);
 void run_cancel(runid rid);
 void run_done(void);            // only call before program exit
 
+/// mpsc queue, lock-free, any thread pushes and only one thread pops
+struct mpsc_node
+{
+    struct mpsc_node *volatile next;
+};
+
+struct mpsc_queue
+{
+    struct mpsc_node *volatile head;        // last pushed, producers swap it
+    struct mpsc_node *tail;                 // next to pop, owned by the consumer
+    struct mpsc_node stub;
+};
+
+void mpsc_init(struct mpsc_queue *q);
+void mpsc_push(struct mpsc_queue *q, struct mpsc_node *node);
+struct mpsc_node* mpsc_pop(struct mpsc_queue *q);         // nil if empty (or a push is half done)
+
+/// job, run a function on the main thread
+// Native threads (mongoose loops, run() workers, I/O completions) post jobs,
+// the main thread drains them in batches from its loop and may call into v7.
+// A job source calls job_ref() while it can post, the main loop keeps running until all sources unref.
+#define JOB_BATCH           64
+
+typedef void (*job_func)(void *context, void *data);
+
+int job_init(void);
+int job_fd(void);                                       // readable when jobs are pending (eventfd)
+int job_post(job_func func, size_t data_size, void* data);    // data is copied, thread safe
+void* job_alloc(job_func func, size_t data_size);        // fill data in place, then job_submit it
+int job_submit(void* data);
+int job_run_pending(void *context, int max);            // main thread only, return jobs ran
+void job_ref(void);
+void job_unref(void);
+int job_active(void);
+void job_done(void);
+
 /// resource management
 typedef void* resource_management_t;
 typedef void* resource_t;
@@ -23,6 +23,7 @@
 
 #include "jsc_file.h"
 #include "common.h"
+#include "plat_io.h"
 #include <unistd.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -53,7 +54,7 @@ static enum v7_err jsc_pwd(struct v7 *v7, v7_val_t* result)
     if (path)
     {
         *result = v7_mk_string(v7, path, ~0, 1);
-        plat_mem_release(path);
+        free(path);                                     // from libc
         return V7_OK;
     }
     else
@@ -228,36 +229,12 @@ static enum v7_err jsc_realpath(struct v7 *v7, v7_val_t* result)
 }
 
 
-static char *_read_text_file(const char *path, size_t *size) {
-    FILE *fp;
-    char *data = NULL;
-    if ((fp = fopen(path, "rb")) == NULL) {
-
-    } else if (fseek(fp, 0, SEEK_END) != 0) {
-        fclose(fp);
-    } else {
-        *size = ftell(fp);
-        data = (char *) plat_mem_allocate(*size + 1);
-        if (data != NULL) {
-            fseek(fp, 0, SEEK_SET); /* Some platforms might not have rewind(), Oo */
-            if (fread(data, *size, 1, fp) != *size) {
-                plat_mem_release(data);
-                return NULL;
-            }
-            data[*size] = '\0';
-        }
-        fclose(fp);
-    }
-    return data;
-}
-
 static enum v7_err jsc_cat(struct v7 *v7, v7_val_t* result)
 {
-    size_t file_size;
     int c = 0, i;
     int argc = v7_argc(v7);
     v7_val_t array = v7_mk_array(v7);
-    char *buff;
+    const plat_io_resource *res;
 
     for (i=0; i<argc; i++)
     {
@@ -273,11 +250,11 @@ static enum v7_err jsc_cat(struct v7 *v7, v7_val_t* result)
                 if (!v7_is_string(item)) continue;
                 const char *cstr = v7_to_cstring(v7, &item);
                 if (cstr == NULL) continue;
-                buff = _read_text_file(cstr, &file_size);
-                if (buff != NULL)
+                res = plat_io_resource_open(cstr);
+                if (res != NULL)
                 {
-                    v7_array_push(v7, array, v7_mk_string(v7, buff, file_size, 1));
-                    plat_mem_release(buff);
+                    v7_array_push(v7, array, v7_mk_string(v7, res->data, res->size, 1));
+                    plat_io_resource_close(res);
                 }
                 c++;
             }
@@ -287,11 +264,11 @@ static enum v7_err jsc_cat(struct v7 *v7, v7_val_t* result)
         if (!v7_is_string(obj)) continue;
         const char *cstr = v7_to_cstring(v7, &obj);
         if (cstr == NULL) continue;
-        buff = _read_text_file(cstr, &file_size);
-        if (buff != NULL)
+        res = plat_io_resource_open(cstr);
+        if (res != NULL)
         {
-            v7_array_push(v7, array, v7_mk_string(v7, buff, file_size, 1));
-            plat_mem_release(buff);
+            v7_array_push(v7, array, v7_mk_string(v7, res->data, res->size, 1));
+            plat_io_resource_close(res);
         }
         c++;
     }
@@ -487,7 +464,7 @@ static enum v7_err jsc_readline(struct v7 *v7, v7_val_t* result)
                     else
                         *result = v7_mk_null();
 
-                    if (lineptr) plat_mem_release(lineptr);
+                    if (lineptr) free(lineptr);                 // from libc
                 }
             }
         }
@@ -519,7 +496,7 @@ static enum v7_err jsc_writestring(struct v7 *v7, v7_val_t* result)
                         p = v7_stringify(v7, v7_arg(v7, i), buf, sizeof(buf), V7_STRINGIFY_DEFAULT);
                         fprintf(hdl->file, "%s", p);
                         if (p != buf) {
-                            plat_mem_release(p);
+                            free(p);                            // from v7
                         }
                     }
                 }
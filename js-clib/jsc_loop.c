@@ -0,0 +1,571 @@
+/*
+ * Shell.js (jssh), JavaScript shell
+ * Copyright (C) 2015 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "jsc_loop.h"
+#include "common.h"
+#include "uthash.h"
+
+/// timers
+// Hierarchical timing wheel with 1ms ticks: a root wheel of 256 slots and 4 wheels of 64 slots,
+// about 49 days in total. Insert and cancel are O(1) list operations, a slot of an upper wheel is
+// cascaded down when the lower wheel wraps.
+// Timer records live in chunks that are never freed, their JS values are owned once per chunk,
+// so a timer costs no v7_own/v7_disown. A timer id carries a generation to detect stale ids.
+
+#define TIMER_CHUNK             1024
+#define TIMER_MAX_CHUNKS        4096            // 4M timers
+#define TIMER_MAX               (TIMER_CHUNK * TIMER_MAX_CHUNKS)
+
+#define WHEEL_ROOT_BITS         8
+#define WHEEL_BITS              6
+#define WHEEL_LEVELS            4               // wheels above the root
+#define WHEEL_ROOT_SIZE         (1 << WHEEL_ROOT_BITS)
+#define WHEEL_SIZE              (1 << WHEEL_BITS)
+#define WHEEL_ROOT_MASK         (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_MASK              (WHEEL_SIZE - 1)
+
+struct loop_link
+{
+    struct loop_link *prev, *next;
+};
+
+enum loop_timer_state
+{
+    timer_free          = 0,
+    timer_wheel         = 1,            // counted in s_wheel.count
+    timer_immediate     = 2,
+    timer_running       = 3,
+};
+
+struct loop_timer
+{
+    struct loop_link link;              // first member, wheel slot, immediate list or free list
+    uint64 expire;                      // ms, monotonic
+    uint32 interval;                    // ms, 0 if not repeated
+    uint32 index;
+    uint32 gen;
+    uint8 state;
+    v7_val_t func;
+    v7_val_t args;
+};
+
+struct loop_watcher
+{
+    int fd;
+    bool ref;
+    loop_watch_func func;
+    void *data;
+    UT_hash_handle hh;
+};
+
+static struct
+{
+    uint64 tick;                        // next ms to run
+    uint32 count;                       // timers in the wheel
+    struct loop_link root[WHEEL_ROOT_SIZE];
+    struct loop_link level[WHEEL_LEVELS][WHEEL_SIZE];
+} s_wheel;
+
+static struct loop_link s_immediates;
+static struct loop_link s_free_timers;
+static struct loop_timer *s_timer_chunks[TIMER_MAX_CHUNKS];
+static uint32 s_timer_chunk_count = 0;
+
+static int s_epoll_fd = -1;
+static struct loop_watcher *s_watchers = nil;
+static uint32 s_watcher_refs = 0;
+
+static void _link_init(struct loop_link *l)
+{
+    l->prev = l->next = l;
+}
+
+static bool _link_empty(struct loop_link *head)
+{
+    return head->next == head;
+}
+
+static void _link_add_tail(struct loop_link *head, struct loop_link *l)
+{
+    l->prev = head->prev;
+    l->next = head;
+    head->prev->next = l;
+    head->prev = l;
+}
+
+static void _link_del(struct loop_link *l)
+{
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    l->prev = l->next = l;
+}
+
+// move all entries of from into the empty list to
+static void _link_move(struct loop_link *from, struct loop_link *to)
+{
+    if (_link_empty(from))
+    {
+        _link_init(to);
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    _link_init(from);
+}
+
+static uint64 _loop_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void _wheel_add(struct loop_timer *t)
+{
+    uint64 expire = t->expire, delta, span;
+    struct loop_link *slot;
+    int level;
+
+    if (expire < s_wheel.tick) expire = s_wheel.tick;          // overdue, run in the next slot
+    delta = expire - s_wheel.tick;
+
+    if (delta < WHEEL_ROOT_SIZE)
+    {
+        slot = &s_wheel.root[expire & WHEEL_ROOT_MASK];
+    }
+    else
+    {
+        span = WHEEL_ROOT_SIZE;
+        for (level = 0; level < WHEEL_LEVELS - 1; level++)
+        {
+            span <<= WHEEL_BITS;
+            if (delta < span) break;
+        }
+        if (level == WHEEL_LEVELS - 1)
+        {
+            span <<= WHEEL_BITS;
+            if (delta >= span) expire = s_wheel.tick + span - 1;    // re-added when it reaches the root
+        }
+        slot = &s_wheel.level[level][(expire >> (WHEEL_ROOT_BITS + level * WHEEL_BITS)) & WHEEL_MASK];
+    }
+
+    _link_add_tail(slot, &t->link);
+    t->state = timer_wheel;
+    s_wheel.count++;
+}
+
+static void _wheel_del(struct loop_timer *t)
+{
+    _link_del(&t->link);
+    t->state = timer_running;
+    s_wheel.count--;
+}
+
+static void _wheel_cascade(void)
+{
+    struct loop_link list, *l;
+    uint32 idx;
+    int level;
+
+    for (level = 0; level < WHEEL_LEVELS; level++)
+    {
+        idx = (uint32)(s_wheel.tick >> (WHEEL_ROOT_BITS + level * WHEEL_BITS)) & WHEEL_MASK;
+        _link_move(&s_wheel.level[level][idx], &list);
+        while (!_link_empty(&list))
+        {
+            l = list.next;
+            _wheel_del((struct loop_timer*)l);
+            _wheel_add((struct loop_timer*)l);
+        }
+        if (idx != 0) break;
+    }
+}
+
+// ms until the next root slot with timers (or the next cascade), -1 if no timer
+static int _wheel_timeout(uint64 now)
+{
+    uint64 t;
+
+    if (s_wheel.count == 0) return -1;
+    if (s_wheel.tick <= now) return 0;
+
+    // slot t runs once now >= t, a cascade happens at a multiple of the root size
+    for (t = s_wheel.tick; _link_empty(&s_wheel.root[t & WHEEL_ROOT_MASK]); t++)
+    {
+        if (((t + 1) & WHEEL_ROOT_MASK) == 0)
+        {
+            t++;
+            break;
+        }
+    }
+    return (t - now) > INT_MAX ? INT_MAX : (int)(t - now);
+}
+
+static struct loop_timer* _timer_at(uint32 index)
+{
+    return &s_timer_chunks[index / TIMER_CHUNK][index % TIMER_CHUNK];
+}
+
+static struct loop_timer* _timer_alloc(struct v7 *v7)
+{
+    struct loop_timer *chunk, *t;
+    uint32 i;
+
+    if (_link_empty(&s_free_timers))
+    {
+        if (s_timer_chunk_count == TIMER_MAX_CHUNKS) return nil;
+
+        chunk = plat_mem_allocate(sizeof(*chunk) * TIMER_CHUNK);
+        if (!chunk) return nil;
+        s_timer_chunks[s_timer_chunk_count] = chunk;
+
+        for (i = 0; i < TIMER_CHUNK; i++)
+        {
+            t = &chunk[i];
+            t->index = s_timer_chunk_count * TIMER_CHUNK + i;
+            t->func = v7_mk_undefined();
+            t->args = v7_mk_undefined();
+            v7_own(v7, &t->func);
+            v7_own(v7, &t->args);
+            _link_add_tail(&s_free_timers, &t->link);
+        }
+        s_timer_chunk_count++;
+    }
+
+    t = (struct loop_timer*)s_free_timers.next;
+    _link_del(&t->link);
+    t->state = timer_running;
+    return t;
+}
+
+static void _timer_free(struct loop_timer *t)
+{
+    if (t->state == timer_wheel) s_wheel.count--;
+    _link_del(&t->link);
+    t->state = timer_free;
+    t->gen++;
+    t->func = v7_mk_undefined();
+    t->args = v7_mk_undefined();
+    _link_add_tail(&s_free_timers, &t->link);
+}
+
+static double _timer_id(struct loop_timer *t)
+{
+    return (double)(t->gen & 0xFFFFF) * TIMER_MAX + t->index + 1;
+}
+
+static struct loop_timer* _timer_find(double id)
+{
+    uint64 n;
+    uint32 index, gen;
+    struct loop_timer *t;
+
+    if (!(id >= 1)) return nil;
+    n = (uint64)id - 1;
+    index = (uint32)(n % TIMER_MAX);
+    gen = (uint32)(n / TIMER_MAX);
+    if (index >= s_timer_chunk_count * TIMER_CHUNK) return nil;
+
+    t = _timer_at(index);
+    return (t->state != timer_free && (t->gen & 0xFFFFF) == gen) ? t : nil;
+}
+
+static void _timer_fire(struct v7 *v7, struct loop_timer *t)
+{
+    uint32 gen = t->gen;
+    v7_val_t res;
+
+    if (v7_apply(v7, t->func, v7_mk_undefined(), t->args, &res) != V7_OK)
+    {
+        v7_print_error(stderr, v7, "timer", res);
+    }
+
+    if (t->gen != gen) return;                      // cleared by the callback
+
+    if (t->interval > 0)
+    {
+        t->expire = _loop_now() + t->interval;
+        _wheel_add(t);
+    }
+    else
+    {
+        _timer_free(t);
+    }
+}
+
+static void _timer_run_expired(struct v7 *v7, uint64 now)
+{
+    struct loop_link pending;
+    struct loop_timer *t;
+
+    if (s_wheel.count == 0)
+    {
+        s_wheel.tick = now + 1;
+        return;
+    }
+
+    while (s_wheel.tick <= now)
+    {
+        if ((s_wheel.tick & WHEEL_ROOT_MASK) == 0) _wheel_cascade();
+
+        _link_move(&s_wheel.root[s_wheel.tick & WHEEL_ROOT_MASK], &pending);
+        s_wheel.tick++;
+
+        while (!_link_empty(&pending))
+        {
+            t = (struct loop_timer*)pending.next;
+            _wheel_del(t);
+
+            if (t->expire >= s_wheel.tick)
+                _wheel_add(t);                      // a clamped long timer, not yet
+            else
+                _timer_fire(v7, t);
+        }
+    }
+}
+
+static void _timer_run_immediates(struct v7 *v7)
+{
+    struct loop_link pending;
+    struct loop_timer *t;
+
+    // immediates queued by these callbacks run in the next iteration
+    _link_move(&s_immediates, &pending);
+    while (!_link_empty(&pending))
+    {
+        t = (struct loop_timer*)pending.next;
+        _link_del(&t->link);
+        t->state = timer_running;
+        _timer_fire(v7, t);
+    }
+}
+
+static enum v7_err _timer_create(struct v7 *v7, int delay_arg, uint32 repeat, v7_val_t* result)
+{
+    int argc = v7_argc(v7), i;
+    v7_val_t func = v7_arg(v7, 0);
+    double delay = 0;
+    struct loop_timer *t;
+
+    *result = v7_mk_undefined();
+    if (!v7_is_callable(v7, func)) return V7_INVALID_ARG;
+
+    if (delay_arg > 0 && argc > 1)
+    {
+        delay = v7_to_number(v7_arg(v7, 1));
+        if (!(delay >= 1)) delay = repeat ? 1 : 0;
+        if (delay > UINT_MAX) delay = UINT_MAX;
+    }
+
+    t = _timer_alloc(v7);
+    if (!t) return V7_INTERNAL_ERROR;
+
+    t->func = func;
+    if (argc > delay_arg + 1)
+    {
+        t->args = v7_mk_array(v7);
+        for (i = delay_arg + 1; i < argc; i++) v7_array_push(v7, t->args, v7_arg(v7, i));
+    }
+
+    if (delay_arg > 0)
+    {
+        t->interval = repeat ? (uint32)delay : 0;
+        t->expire = _loop_now() + (uint64)delay;
+        _wheel_add(t);
+    }
+    else
+    {
+        t->interval = 0;
+        t->state = timer_immediate;
+        _link_add_tail(&s_immediates, &t->link);
+    }
+
+    *result = v7_mk_number(_timer_id(t));
+    return V7_OK;
+}
+
+static enum v7_err jsc_setTimeout(struct v7 *v7, v7_val_t* result)
+{
+    return _timer_create(v7, 1, 0, result);
+}
+
+static enum v7_err jsc_setInterval(struct v7 *v7, v7_val_t* result)
+{
+    return _timer_create(v7, 1, 1, result);
+}
+
+static enum v7_err jsc_setImmediate(struct v7 *v7, v7_val_t* result)
+{
+    return _timer_create(v7, 0, 0, result);
+}
+
+static enum v7_err jsc_clearTimer(struct v7 *v7, v7_val_t* result)
+{
+    v7_val_t id = v7_arg(v7, 0);
+    struct loop_timer *t;
+
+    if (v7_is_number(id) && (t = _timer_find(v7_to_number(id))) != nil)
+    {
+        _timer_free(t);
+    }
+
+    *result = v7_mk_undefined();
+    return V7_OK;
+}
+
+/// loop
+
+int jsc_loop_watch(int fd, loop_watch_func func, void *data, bool ref)
+{
+    struct loop_watcher *w;
+    struct epoll_event ev;
+
+    HASH_FIND_INT(s_watchers, &fd, w);
+    if (w) return -1;
+
+    w = plat_mem_allocate(sizeof(*w));
+    if (!w) return -1;
+    w->fd = fd;
+    w->ref = ref;
+    w->func = func;
+    w->data = data;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = w;
+    if (epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        plat_mem_release(w);
+        return -1;
+    }
+
+    HASH_ADD_INT(s_watchers, fd, w);
+    if (ref) s_watcher_refs++;
+    return 0;
+}
+
+void jsc_loop_unwatch(int fd)
+{
+    struct loop_watcher *w;
+
+    HASH_FIND_INT(s_watchers, &fd, w);
+    if (!w) return;
+
+    epoll_ctl(s_epoll_fd, EPOLL_CTL_DEL, fd, nil);
+    HASH_DEL(s_watchers, w);
+    if (w->ref) s_watcher_refs--;
+    plat_mem_release(w);
+}
+
+static void _loop_run_jobs(struct v7 *v7, int fd, void *data)
+{
+    (void)fd;
+    (void)data;
+    job_run_pending(v7, JOB_BATCH);
+}
+
+void jsc_loop_run(struct v7 *v7)
+{
+    struct epoll_event events[64];
+    struct loop_watcher *w;
+    int n, i, timeout;
+    uint64 now;
+
+    if (job_fd() >= 0) jsc_loop_watch(job_fd(), _loop_run_jobs, nil, false);
+
+    for (;;)
+    {
+        _timer_run_immediates(v7);
+        now = _loop_now();
+        _timer_run_expired(v7, now);
+
+        if (_link_empty(&s_immediates) && s_wheel.count == 0 && s_watcher_refs == 0 && !job_active())
+            break;
+
+        timeout = _link_empty(&s_immediates) ? _wheel_timeout(_loop_now()) : 0;
+        n = epoll_wait(s_epoll_fd, events, sizeof(events) / sizeof(events[0]), timeout);
+        for (i = 0; i < n; i++)
+        {
+            w = events[i].data.ptr;
+            w->func(v7, w->fd, w->data);
+        }
+    }
+
+    // jobs posted before the last source went away
+    while (job_run_pending(v7, JOB_BATCH) > 0);
+    if (job_fd() >= 0) jsc_loop_unwatch(job_fd());
+}
+
+void jsc_install_loop_lib(struct v7 *v7)
+{
+    int i, j;
+
+    _link_init(&s_immediates);
+    _link_init(&s_free_timers);
+    for (i = 0; i < WHEEL_ROOT_SIZE; i++) _link_init(&s_wheel.root[i]);
+    for (i = 0; i < WHEEL_LEVELS; i++)
+        for (j = 0; j < WHEEL_SIZE; j++) _link_init(&s_wheel.level[i][j]);
+    s_wheel.tick = _loop_now();
+    s_wheel.count = 0;
+
+    s_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    v7_set_method(v7, v7_get_global(v7), "setTimeout", &jsc_setTimeout);
+    v7_set_method(v7, v7_get_global(v7), "setInterval", &jsc_setInterval);
+    v7_set_method(v7, v7_get_global(v7), "setImmediate", &jsc_setImmediate);
+    v7_set_method(v7, v7_get_global(v7), "clearTimeout", &jsc_clearTimer);
+    v7_set_method(v7, v7_get_global(v7), "clearInterval", &jsc_clearTimer);
+    v7_set_method(v7, v7_get_global(v7), "clearImmediate", &jsc_clearTimer);
+}
+
+void jsc_uninstall_loop_lib(struct v7 *v7)
+{
+    struct loop_watcher *w, *tmp;
+    int i, j;
+
+    HASH_ITER(hh, s_watchers, w, tmp)
+    {
+        HASH_DEL(s_watchers, w);
+        plat_mem_release(w);
+    }
+    s_watcher_refs = 0;
+
+    if (s_epoll_fd >= 0) close(s_epoll_fd);
+    s_epoll_fd = -1;
+
+    // disown in reverse order, each v7_disown then finds its value at the end
+    for (i = (int)s_timer_chunk_count - 1; i >= 0; i--)
+    {
+        for (j = TIMER_CHUNK - 1; j >= 0; j--)
+        {
+            v7_disown(v7, &s_timer_chunks[i][j].args);
+            v7_disown(v7, &s_timer_chunks[i][j].func);
+        }
+        plat_mem_release(s_timer_chunks[i]);
+        s_timer_chunks[i] = nil;
+    }
+    s_timer_chunk_count = 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Shell.js (jssh), JavaScript shell
+ * Copyright (C) 2015 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef SHELL_JS_JSC_LOOP_H
+#define SHELL_JS_JSC_LOOP_H
+
+#include "v7.h"
+#include "plat_type.h"
+
+/// main event loop (epoll), setTimeout, setInterval and setImmediate
+
+typedef void (*loop_watch_func)(struct v7 *v7, int fd, void *data);
+
+void jsc_install_loop_lib(struct v7 *v7);
+void jsc_uninstall_loop_lib(struct v7 *v7);
+
+// Call func when fd is readable. A watcher with ref keeps the loop running.
+int jsc_loop_watch(int fd, loop_watch_func func, void *data, bool ref);
+void jsc_loop_unwatch(int fd);
+
+// Run until no timer, immediate, referenced watcher or job source is left.
+void jsc_loop_run(struct v7 *v7);
+
+#endif //SHELL_JS_JSC_LOOP_H
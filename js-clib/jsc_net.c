@@ -24,25 +24,243 @@
 #include "mongoose.h"
 #include "common.h"
 
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "uthash.h"
+
+/// httpd
+// The mongoose loop runs in its own thread and never touches v7. With a JS handler each
+// request is posted as a job to the main thread, the reply comes back through a mpsc
+// queue and an eventfd that the mongoose loop polls like a socket.
+// httpdstop() sets the stop flag and wakes the loop through the same eventfd, the thread then
+// frees mongoose and drops its job reference so the main loop can end.
+
+struct httpd_conn
+{
+    uint32 id;
+    struct mg_connection *nc;
+    UT_hash_handle hh;
+};
+
+struct httpd_server
+{
+    struct mg_mgr mgr;
+    struct mpsc_queue replies;
+    int wakeup_fd;
+    int wakeup_signaled;
+    uint32 last_conn_id;
+    struct httpd_conn *conns;           // by id, mongoose thread only
+    struct v7_call_handle *handler;     // main thread only
+    bool has_handler;
+    bool running;
+    int stop;                           // set by the main thread, the mongoose loop exits
+    char port[16];
+};
+
+struct httpd_request
+{
+    struct httpd_server *server;
+    uint32 conn_id;
+    uint32 method_len, uri_len, query_len, body_len;
+    char text[0];                       // method, uri, query and body
+};
+
+struct httpd_reply
+{
+    struct mpsc_node node;
+    uint32 conn_id;
+    int status;
+    size_t body_len;
+    char body[0];
+};
+
 struct mg_serve_http_opts s_http_server_opts;
+static struct httpd_server s_httpd;
+
+static void _httpd_reply(struct httpd_server *server, uint32 conn_id, int status, const char *body, size_t body_len)
+{
+    uint64 one = 1;
+    ssize_t r;
+    struct httpd_reply *reply = plat_mem_allocate(sizeof(*reply) + body_len);
+    if (!reply) return;
+
+    reply->conn_id = conn_id;
+    reply->status = status;
+    reply->body_len = body_len;
+    plat_mem_copy(reply->body, body, body_len);
+    mpsc_push(&server->replies, &reply->node);
+
+    if (!__atomic_exchange_n(&server->wakeup_signaled, 1, __ATOMIC_SEQ_CST))
+    {
+        r = write(server->wakeup_fd, &one, sizeof(one));
+        (void)r;
+    }
+}
+
+// main thread
+static void _httpd_request_job(void *context, void *data)
+{
+    struct v7 *v7 = context;
+    struct httpd_request *req = data;
+    struct httpd_server *server = req->server;
+    const char *text = req->text;
+    v7_val_t obj, res = v7_mk_undefined();
+    const char *body;
+    size_t body_len = 0;
+    char buf[100], *p = nil;
+    int status = 200;
+
+    // the mongoose thread may be freeing the connections already
+    if (__atomic_load_n(&server->stop, __ATOMIC_SEQ_CST)) return;
+
+    obj = v7_mk_object(v7);
+    v7_own(v7, &obj);
+    v7_set(v7, obj, "method", ~0, v7_mk_string(v7, text, req->method_len, 1));
+    text += req->method_len;
+    v7_set(v7, obj, "uri", ~0, v7_mk_string(v7, text, req->uri_len, 1));
+    text += req->uri_len;
+    v7_set(v7, obj, "query", ~0, v7_mk_string(v7, text, req->query_len, 1));
+    text += req->query_len;
+    v7_set(v7, obj, "body", ~0, v7_mk_string(v7, text, req->body_len, 1));
+
+    if (v7_call_prepared(v7, server->handler, &obj, 1, &res) != V7_OK)
+    {
+        status = 500;
+        body = "";
+    }
+    else if (v7_is_string(res))
+    {
+        body = v7_get_string_data(v7, &res, &body_len);
+    }
+    else if (v7_is_undefined(res))
+    {
+        body = "";
+    }
+    else
+    {
+        body = p = v7_stringify(v7, res, buf, sizeof(buf), V7_STRINGIFY_DEFAULT);
+        body_len = strlen(body);
+    }
+
+    _httpd_reply(server, req->conn_id, status, body, body_len);
+
+    if (p && p != buf) free(p);                 // from v7
+    v7_disown(v7, &obj);
+}
+
+// mongoose thread
+static void _httpd_post_request(struct httpd_server *server, struct httpd_conn *conn, struct http_message *hm)
+{
+    struct httpd_request *req;
+    char *text;
+
+    req = job_alloc(_httpd_request_job, sizeof(*req) + hm->method.len + hm->uri.len + hm->query_string.len + hm->body.len);
+    if (!req)
+    {
+        mg_send_head(conn->nc, 503, 0, NULL);
+        return;
+    }
+
+    req->server = server;
+    req->conn_id = conn->id;
+    req->method_len = (uint32)hm->method.len;
+    req->uri_len = (uint32)hm->uri.len;
+    req->query_len = (uint32)hm->query_string.len;
+    req->body_len = (uint32)hm->body.len;
+
+    text = req->text;
+    plat_mem_copy(text, hm->method.p, req->method_len);
+    text += req->method_len;
+    plat_mem_copy(text, hm->uri.p, req->uri_len);
+    text += req->uri_len;
+    plat_mem_copy(text, hm->query_string.p, req->query_len);
+    text += req->query_len;
+    plat_mem_copy(text, hm->body.p, req->body_len);
+
+    job_submit(req);
+}
+
 static void _httpd_handler(struct mg_connection *nc, int ev, void *p)
 {
-    if (ev == MG_EV_HTTP_REQUEST) {
-        //mg_serve_http(nc, (struct http_message *) p, s_http_server_opts);
-        mg_send_head(nc, 200, 10, NULL);
-        mg_printf(nc, "1234567890");
-        //mg_close_conn(nc);
+    struct httpd_server *server = nc->mgr->user_data;
+    struct httpd_conn *conn = nc->user_data;
+
+    switch (ev)
+    {
+        case MG_EV_ACCEPT:
+            conn = plat_mem_allocate(sizeof(*conn));
+            if (!conn) break;
+            conn->id = ++server->last_conn_id;
+            conn->nc = nc;
+            HASH_ADD_INT(server->conns, id, conn);
+            nc->user_data = conn;
+            break;
+        case MG_EV_HTTP_REQUEST:
+            if (server->has_handler && conn)
+            {
+                _httpd_post_request(server, conn, (struct http_message *) p);
+            }
+            else
+            {
+                //mg_serve_http(nc, (struct http_message *) p, s_http_server_opts);
+                mg_send_head(nc, 200, 10, NULL);
+                mg_printf(nc, "1234567890");
+                //mg_close_conn(nc);
+            }
+            break;
+        case MG_EV_CLOSE:
+            if (conn)
+            {
+                HASH_DEL(server->conns, conn);
+                plat_mem_release(conn);
+                nc->user_data = nil;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// mongoose thread, the eventfd is readable when replies are queued
+static void _httpd_wakeup_handler(struct mg_connection *nc, int ev, void *p)
+{
+    struct httpd_server *server = nc->mgr->user_data;
+    struct httpd_reply *reply;
+    struct httpd_conn *conn;
+
+    if (ev != MG_EV_RECV) return;
+
+    mbuf_remove(&nc->recv_mbuf, nc->recv_mbuf.len);
+    __atomic_store_n(&server->wakeup_signaled, 0, __ATOMIC_SEQ_CST);
+
+    while ((reply = (struct httpd_reply*)mpsc_pop(&server->replies)) != nil)
+    {
+        HASH_FIND_INT(server->conns, &reply->conn_id, conn);
+        if (conn)
+        {
+            // the connection may be gone, then the reply is dropped
+            mg_send_head(conn->nc, reply->status, reply->body_len, NULL);
+            mg_send(conn->nc, reply->body, (int)reply->body_len);
+        }
+        plat_mem_release(reply);
     }
 }
 
 static void* _httpd(void* param)
 {
-    const char *s_http_port = "8080";
-    struct mg_mgr mgr;
+    struct httpd_server *server = *(struct httpd_server**)param;
+    struct httpd_reply *reply;
     struct mg_connection *nc;
 
-    mg_mgr_init(&mgr, &s_http_server_opts);
-    nc = mg_bind(&mgr, s_http_port, _httpd_handler);
+    mg_mgr_init(&server->mgr, server);
+    nc = mg_bind(&server->mgr, server->port, _httpd_handler);
+    if (!nc)
+    {
+        log_err(0, "Failed to start web server on port %s\n", server->port);
+        job_unref();
+        return NULL;
+    }
 
     // Set up HTTP server parameters
     mg_set_protocol_http_websocket(nc);
@@ -50,29 +268,88 @@ static void* _httpd(void* param)
     s_http_server_opts.dav_document_root = "/";  // Allow access via WebDav
     s_http_server_opts.enable_directory_listing = "yes";
 
-    printf("Starting web server on port %s\n", s_http_port);
-    for (;;) {
-        mg_mgr_poll(&mgr, 1000);
+    // mongoose closes its own copy, the main thread may still write to wakeup_fd after the loop ends
+    mg_add_sock(&server->mgr, dup(server->wakeup_fd), _httpd_wakeup_handler);
+
+    log_info(0, "Starting web server on port %s\n", server->port);
+    while (!__atomic_load_n(&server->stop, __ATOMIC_SEQ_CST)) {
+        mg_mgr_poll(&server->mgr, 1000);
     }
-    mg_mgr_free(&mgr);
+
+    // no reply is queued after stop, drop the ones not sent yet
+    while ((reply = (struct httpd_reply*)mpsc_pop(&server->replies)) != nil) plat_mem_release(reply);
+    mg_mgr_free(&server->mgr);
+    log_info(0, "Stopped web server on port %s\n", server->port);
+    job_unref();
 
     return NULL;
 }
 
 static enum v7_err jsc_httpd(struct v7* v7, v7_val_t* result)
 {
-    run(_httpd, 0, NULL);
+    struct httpd_server *server = &s_httpd;
+    int argc = v7_argc(v7), i;
+    v7_val_t arg, handler = v7_mk_undefined();
 
     *result = v7_mk_undefined();
+    if (server->running) return V7_OK;
+
+    snprintf(server->port, sizeof(server->port), "8080");
+    for (i = 0; i < argc; i++)
+    {
+        arg = v7_arg(v7, i);
+        if (v7_is_number(arg))
+        {
+            snprintf(server->port, sizeof(server->port), "%d", (int)v7_to_number(arg));
+        }
+        else if (v7_is_string(arg))
+        {
+            snprintf(server->port, sizeof(server->port), "%s", v7_to_cstring(v7, &arg));
+        }
+        else if (v7_is_callable(v7, arg))
+        {
+            handler = arg;
+            server->has_handler = true;
+        }
+    }
+
+    server->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->wakeup_fd < 0) return V7_INTERNAL_ERROR;
+    mpsc_init(&server->replies);
+    if (server->has_handler) server->handler = v7_call_prepare(v7, handler, v7_mk_undefined());
+
+    server->running = true;
+    job_ref();
+    run(_httpd, sizeof(server), &server);
+
+    return V7_OK;
+}
+
+// The server is not started again once stopped.
+static enum v7_err jsc_httpdstop(struct v7* v7, v7_val_t* result)
+{
+    struct httpd_server *server = &s_httpd;
+    uint64 one = 1;
+    ssize_t r;
+
+    *result = v7_mk_boolean(server->running && !server->stop);
+    if (!server->running || server->stop) return V7_OK;
+
+    __atomic_store_n(&server->stop, 1, __ATOMIC_SEQ_CST);
+    r = write(server->wakeup_fd, &one, sizeof(one));
+    (void)r;
+
     return V7_OK;
 }
 
 void jsc_install_net_lib(struct v7* v7)
 {
     v7_set_method(v7, v7_get_global(v7), "httpd", &jsc_httpd);
+    v7_set_method(v7, v7_get_global(v7), "httpdstop", &jsc_httpdstop);
 }
 
 void jsc_uninstall_net_lib(struct v7* v7)
 {
-
+    if (s_httpd.has_handler) v7_call_handle_free(v7, s_httpd.handler);
+    if (s_httpd.running) close(s_httpd.wakeup_fd);
 }
@@ -33,7 +33,7 @@ static enum v7_err jsc_exec(struct v7 *v7, v7_val_t* result)
 
 
 
-        plat_mem_release(path);
+        free(path);                                     // from v7
     }
 
     *result = v7_mk_undefined();
@@ -22,13 +22,17 @@
 //
 
 #include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "plat_io.h"
 #include "common.h"
 #include "v7.h"
 #include "jsc_sys.h"
 #include "jsc_file.h"
 #include "jsc_net.h"
+#include "jsc_loop.h"
 
-char *read_file(const char *path, size_t *size);
 void print_err_and_res(enum v7_err err, v7_val_t result);
 const char *errs_string[6] = {
         [V7_OK] = "OK",
@@ -41,6 +45,7 @@ const char *errs_string[6] = {
 
 void install_all_js_clibs(struct v7 *v7)
 {
+    jsc_install_loop_lib(v7);
     jsc_install_sys_lib(v7);
     jsc_install_file_lib(v7);
     jsc_install_net_lib(v7);
@@ -51,27 +56,107 @@ void uninstall_all_js_clibs(struct v7 *v7)
     jsc_uninstall_net_lib(v7);
     jsc_uninstall_file_lib(v7);
     jsc_uninstall_sys_lib(v7);
+    jsc_uninstall_loop_lib(v7);
+}
+
+/// interactive mode, stdin is read by the main loop so timers and jobs keep running
+struct repl_input
+{
+    char *buf;
+    size_t len;
+    size_t size;
+    bool eof;
+};
+
+static void repl_exec(struct v7 *v7, char *line)
+{
+    enum v7_err err;
+    v7_val_t exec_result;
+
+    err = v7_exec(v7, line, &exec_result);
+    if (err != V7_OK) print_err_and_res(err, exec_result);
+    printf(">>> ");
+    fflush(stdout);
+}
+
+static void repl_read(struct v7 *v7, int fd, void *data)
+{
+    struct repl_input *in = data;
+    char *line, *eol;
+    ssize_t n;
+
+    if (in->size - in->len < 1024)
+    {
+        in->size = in->size ? in->size * 2 : 4096;
+        in->buf = realloc(in->buf, in->size);
+    }
+
+    n = read(fd, in->buf + in->len, in->size - in->len - 1);
+    if (n <= 0)
+    {
+        // EOF, run what is left like getline() would
+        if (in->len > 0)
+        {
+            in->buf[in->len] = '\0';
+            repl_exec(v7, in->buf);
+        }
+        in->len = 0;
+        in->eof = true;
+        jsc_loop_unwatch(fd);
+        return;
+    }
+    in->len += n;
+
+    line = in->buf;
+    while ((eol = memchr(line, '\n', in->buf + in->len - line)) != NULL)
+    {
+        *eol = '\0';
+        repl_exec(v7, line);
+        line = eol + 1;
+    }
+    in->len -= line - in->buf;
+    memmove(in->buf, line, in->len);
 }
 
 int main(int argc, char *argv[]) {
     enum v7_err err;
     v7_val_t exec_result;
     struct v7 *v7;
+    int log_bin_fd = -1;
+    struct repl_input repl = { NULL, 0, 0, false };
+    const plat_io_resource **js_res = NULL;       // precompiled bcode points into its source, keep until v7 is gone
+    struct v7_mk_opts opts;
+    int first = 1;                                  // first script in argv
+    int i;
+
+    memset(&opts, 0, sizeof(opts));
+    if (argc > 1 && strcmp(argv[1], "--no-opt") == 0)
+    {
+        // run compiled bcode as is, to compare with the optimized code
+        opts.no_bcode_opt = 1;
+        first++;
+    }
 
-    v7 = v7_create();
+    v7 = v7_create_opt(opts);
+    job_init();
     install_all_js_clibs(v7);
 
-    if (argc > 1)
+    if (argc > first)
     {
-        int i;
-        for (i=1; i<argc; i++)
+        // scripts log through the flusher thread, interactive mode keeps logs in order with the prompt
+        const char *log_bin_path = getenv("JSSH_LOG_BINARY");
+        log_bin_fd = log_bin_path ? open(log_bin_path, O_WRONLY | O_CREAT | O_APPEND, 0644) : -1;
+        log_async_start(log_bin_fd);
+        js_res = plat_mem_allocate(sizeof(*js_res) * argc);
+
+        for (i=first; i<argc; i++)
         {
 
-            const char *js_path = argv[i];
-            size_t js_size = 0;
-            char *js_code = read_file(js_path, &js_size);
+            const plat_io_resource *res = plat_io_resource_open(argv[i]);
+            const char *js_code = res ? res->data : NULL;
 
-            if (js_size > 2)
+            if (js_res) js_res[i] = res;
+            if (res && res->size > 2)
             {
                 if (js_code[0] == '#' && js_code[1] == '!') {
                     js_code += 2;
@@ -89,49 +174,34 @@ int main(int argc, char *argv[]) {
     }
     else
     {
-        char *js_string = NULL;
-        size_t js_string_len = 0;
-
         printf("Shell.js 0.1\n>>> ");
-        while ((getline(&js_string, &js_string_len, stdin)) != -1) {
-            err = v7_exec(v7, js_string, &exec_result);
-            if (err != V7_OK) print_err_and_res(err, exec_result);
-            printf(">>> ");
+        fflush(stdout);
+        if (jsc_loop_watch(STDIN_FILENO, repl_read, &repl, true) != 0)
+        {
+            // epoll refuses regular files (jssh < script.js), read them before the loop starts
+            while (!repl.eof) repl_read(v7, STDIN_FILENO, &repl);
         }
-
-        free(js_string);
     }
 
+    // timers, immediates, stdin and jobs posted by native threads
+    jsc_loop_run(v7);
+    free(repl.buf);
+
     run_done();
     uninstall_all_js_clibs(v7);
     v7_destroy(v7);
+    job_done();
 
-    return 0;
-}
+    for (i = first; js_res && i < argc; i++) plat_io_resource_close(js_res[i]);
+    plat_mem_release(js_res);
 
+    log_async_stop();
+    if (log_bin_fd >= 0) close(log_bin_fd);
 
-char *read_file(const char *path, size_t *size) {
-    FILE *fp;
-    char *data = NULL;
-    if ((fp = fopen(path, "rb")) == NULL) {
-    } else if (fseek(fp, 0, SEEK_END) != 0) {
-        fclose(fp);
-    } else {
-        *size = ftell(fp);
-        data = (char *) malloc(*size + 1);
-        if (data != NULL) {
-            fseek(fp, 0, SEEK_SET); /* Some platforms might not have rewind(), Oo */
-            if (fread(data, 1, *size, fp) != *size) {
-                free(data);
-                return NULL;
-            }
-            data[*size] = '\0';
-        }
-        fclose(fp);
-    }
-    return data;
+    return 0;
 }
 
+
 void print_err_and_res(enum v7_err err, v7_val_t result)
 {
     printf("err: %s, result: %llx\n", errs_string[err], (long long int)result);
@@ -0,0 +1,435 @@
+/*
+ * plat_c, platform independent library for c
+ * Copyright (C) 2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "plat_alloc.h"
+
+#define PLAT_BLOCK_MAGIC            0x504C0000u     // "PL"
+#define PLAT_BLOCK_MAGIC_MASK       0xFFFF0000u
+#define PLAT_BLOCK_CLASS_MASK       0x000000FFu
+#define PLAT_BLOCK_DIRTY            0x00000100u     // used before, not known to be zero
+#define PLAT_BLOCK_LARGE            0xFF
+#define PLAT_BLOCK_ARENA            0xFE
+
+#define PLAT_CACHE_BATCH            32              // blocks moved between a thread and a class
+#define PLAT_CACHE_MAX              (PLAT_CACHE_BATCH * 2)
+
+struct plat_block
+{
+    uint32 tag;                     // magic | flags | class
+    uint32 _reserved;
+    size_t size;                    // size asked for
+};                                  // 16 bytes, keeps the payload 16 bytes aligned
+
+struct plat_free_block
+{
+    struct plat_block header;
+    struct plat_free_block *next;
+};
+
+struct plat_class
+{
+    pthread_mutex_t mutex;
+    struct plat_free_block *free;
+    uint8 *bump;                    // untouched part of the last slab
+    uint8 *bump_end;
+};
+
+struct plat_thread_cache
+{
+    struct plat_free_block *free[PLAT_ALLOC_CLASSES];
+    uint32 count[PLAT_ALLOC_CLASSES];
+    plat_arena *arena;
+};
+
+struct plat_arena_chunk
+{
+    struct plat_arena_chunk *next;
+    size_t size;
+    size_t used;
+    size_t _pad;
+    uint8 data[0];
+};
+
+struct plat_arena
+{
+    struct plat_arena_chunk *chunks;
+    size_t chunk_size;
+    plat_arena *prev;               // pushed before this one
+};
+
+static const size_t _class_size[PLAT_ALLOC_CLASSES] = {
+        16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384,
+        448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048, 2560, 3072, 3584, 4096,
+};
+
+static struct plat_class _classes[PLAT_ALLOC_CLASSES];
+static uint8 _class_of_16[PLAT_ALLOC_MAX_SMALL / 16 + 1];          // (size + 15) / 16 -> class
+static pthread_once_t _alloc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _cache_key;
+static __thread struct plat_thread_cache *_cache = NULL;
+
+static int64 _live_bytes[PLAT_ALLOC_CLASSES];
+static int64 _live_blocks[PLAT_ALLOC_CLASSES];
+static int64 _large_live_bytes, _large_live_blocks, _slab_bytes;
+
+#define _stat_add(v, n)     __atomic_add_fetch(&(v), (n), __ATOMIC_RELAXED)
+
+static void _cache_destroy(void *cache);
+
+static void _alloc_init(void)
+{
+    int i, c = 0;
+
+    for (i = 0; i < PLAT_ALLOC_CLASSES; i++)
+    {
+        pthread_mutex_init(&_classes[i].mutex, NULL);
+    }
+    for (i = 0; i <= PLAT_ALLOC_MAX_SMALL / 16; i++)
+    {
+        while (_class_size[c] < (size_t)i * 16) c++;
+        _class_of_16[i] = (uint8)c;
+    }
+    pthread_key_create(&_cache_key, _cache_destroy);
+}
+
+static struct plat_thread_cache* _cache_get(void)
+{
+    if (!_cache)
+    {
+        pthread_once(&_alloc_once, _alloc_init);
+        _cache = calloc(1, sizeof(*_cache));
+        if (_cache) pthread_setspecific(_cache_key, _cache);
+    }
+    return _cache;
+}
+
+// move a batch of blocks from the class into the cache, carve a new slab if needed
+static int _class_refill(struct plat_thread_cache *cache, int c)
+{
+    struct plat_class *cls = &_classes[c];
+    size_t block_size = sizeof(struct plat_block) + _class_size[c];
+    struct plat_free_block *b;
+    int n = 0;
+
+    pthread_mutex_lock(&cls->mutex);
+    while (n < PLAT_CACHE_BATCH)
+    {
+        if (cls->free)
+        {
+            b = cls->free;
+            cls->free = b->next;
+        }
+        else
+        {
+            if (cls->bump + block_size > cls->bump_end)
+            {
+                if (n > 0) break;
+                cls->bump = calloc(1, PLAT_ALLOC_SLAB_SIZE);          // zero, blocks start clean
+                if (!cls->bump)
+                {
+                    cls->bump_end = NULL;
+                    break;
+                }
+                cls->bump_end = cls->bump + PLAT_ALLOC_SLAB_SIZE;
+                _stat_add(_slab_bytes, PLAT_ALLOC_SLAB_SIZE);
+            }
+            b = (struct plat_free_block*)cls->bump;
+            cls->bump += block_size;
+            b->header.tag = PLAT_BLOCK_MAGIC | c;
+        }
+        b->next = cache->free[c];
+        cache->free[c] = b;
+        cache->count[c]++;
+        n++;
+    }
+    pthread_mutex_unlock(&cls->mutex);
+
+    return n;
+}
+
+static void _class_give_back(struct plat_thread_cache *cache, int c, uint32 keep)
+{
+    struct plat_class *cls = &_classes[c];
+    struct plat_free_block *b;
+
+    pthread_mutex_lock(&cls->mutex);
+    while (cache->count[c] > keep)
+    {
+        b = cache->free[c];
+        cache->free[c] = b->next;
+        cache->count[c]--;
+        b->next = cls->free;
+        cls->free = b;
+    }
+    pthread_mutex_unlock(&cls->mutex);
+}
+
+static void _cache_destroy(void *cache)
+{
+    int c;
+
+    for (c = 0; c < PLAT_ALLOC_CLASSES; c++)
+    {
+        _class_give_back(cache, c, 0);
+    }
+    free(cache);
+}
+
+void plat_alloc_thread_flush(void)
+{
+    int c;
+
+    if (!_cache) return;
+    for (c = 0; c < PLAT_ALLOC_CLASSES; c++)
+    {
+        if (_cache->count[c]) _class_give_back(_cache, c, 0);
+    }
+}
+
+static inline int _size_class(size_t size)
+{
+    return _class_of_16[(size + 15) >> 4];
+}
+
+void* plat_alloc(size_t size, uint32 flags)
+{
+    struct plat_thread_cache *cache = _cache_get();
+    struct plat_free_block *b;
+    struct plat_block *h;
+    int c;
+
+    if ((flags & PLAT_ALLOC_ARENA) && cache && cache->arena)
+    {
+        return plat_arena_alloc(cache->arena, size, flags);
+    }
+
+    if (size > PLAT_ALLOC_MAX_SMALL || !cache)
+    {
+        if (size > ((size_t)-1) - sizeof(*h)) return NULL;
+        h = (flags & PLAT_ALLOC_ZERO) ? calloc(1, sizeof(*h) + size) : malloc(sizeof(*h) + size);
+        if (!h) return NULL;
+        h->tag = PLAT_BLOCK_MAGIC | PLAT_BLOCK_LARGE;
+        h->size = size;
+        _stat_add(_large_live_bytes, (int64)size);
+        _stat_add(_large_live_blocks, 1);
+        return h + 1;
+    }
+
+    c = _size_class(size);
+    if (!cache->free[c] && _class_refill(cache, c) == 0) return NULL;
+
+    b = cache->free[c];
+    cache->free[c] = b->next;
+    cache->count[c]--;
+
+    h = &b->header;
+    if ((flags & PLAT_ALLOC_ZERO) && (h->tag & PLAT_BLOCK_DIRTY))
+    {
+        memset(h + 1, 0, size);
+    }
+    else if (flags & PLAT_ALLOC_ZERO)
+    {
+        b->next = NULL;                 // the only word written while the block was free
+    }
+    h->tag = PLAT_BLOCK_MAGIC | c;
+    h->size = size;
+
+    _stat_add(_live_bytes[c], (int64)size);
+    _stat_add(_live_blocks[c], 1);
+    return h + 1;
+}
+
+void plat_free(void *mem)
+{
+    struct plat_thread_cache *cache;
+    struct plat_free_block *b;
+    struct plat_block *h;
+    uint32 c;
+
+    if (!mem) return;
+
+    h = (struct plat_block*)mem - 1;
+    if ((h->tag & PLAT_BLOCK_MAGIC_MASK) != PLAT_BLOCK_MAGIC) abort();        // not ours
+
+    c = h->tag & PLAT_BLOCK_CLASS_MASK;
+    if (c == PLAT_BLOCK_ARENA) return;
+    if (c == PLAT_BLOCK_LARGE)
+    {
+        _stat_add(_large_live_bytes, -(int64)h->size);
+        _stat_add(_large_live_blocks, -1);
+        h->tag = 0;
+        free(h);
+        return;
+    }
+
+    _stat_add(_live_bytes[c], -(int64)h->size);
+    _stat_add(_live_blocks[c], -1);
+
+    cache = _cache_get();
+    b = (struct plat_free_block*)h;
+    h->tag = PLAT_BLOCK_MAGIC | PLAT_BLOCK_DIRTY | c;
+    b->next = cache->free[c];
+    cache->free[c] = b;
+    if (++cache->count[c] > PLAT_CACHE_MAX) _class_give_back(cache, c, PLAT_CACHE_BATCH);
+}
+
+size_t plat_alloc_size(const void *mem)
+{
+    return mem ? ((const struct plat_block*)mem - 1)->size : 0;
+}
+
+void* plat_realloc(void *mem, size_t size, uint32 flags)
+{
+    struct plat_block *h;
+    uint32 c;
+    void *new_mem;
+    size_t old_size;
+
+    if (!mem) return plat_alloc(size, flags);
+
+    h = (struct plat_block*)mem - 1;
+    old_size = h->size;
+    c = h->tag & PLAT_BLOCK_CLASS_MASK;
+
+    // stays in its slab block
+    if (c < PLAT_ALLOC_CLASSES && size <= _class_size[c])
+    {
+        if ((flags & PLAT_ALLOC_ZERO) && size > old_size) memset((uint8*)mem + old_size, 0, size - old_size);
+        _stat_add(_live_bytes[c], (int64)size - (int64)old_size);
+        h->size = size;
+        return mem;
+    }
+
+    if (c == PLAT_BLOCK_LARGE && size > PLAT_ALLOC_MAX_SMALL)
+    {
+        h = realloc(h, sizeof(*h) + size);
+        if (!h) return NULL;
+        if ((flags & PLAT_ALLOC_ZERO) && size > old_size) memset((uint8*)(h + 1) + old_size, 0, size - old_size);
+        _stat_add(_large_live_bytes, (int64)size - (int64)old_size);
+        h->size = size;
+        return h + 1;
+    }
+
+    new_mem = plat_alloc(size, flags & ~PLAT_ALLOC_ZERO);
+    if (!new_mem) return NULL;
+    memcpy(new_mem, mem, old_size < size ? old_size : size);
+    if ((flags & PLAT_ALLOC_ZERO) && size > old_size) memset((uint8*)new_mem + old_size, 0, size - old_size);
+    plat_free(mem);
+    return new_mem;
+}
+
+void plat_alloc_get_stats(struct plat_alloc_stats *stats)
+{
+    int c;
+
+    for (c = 0; c < PLAT_ALLOC_CLASSES; c++)
+    {
+        stats->class_size[c] = _class_size[c];
+        stats->live_bytes[c] = __atomic_load_n(&_live_bytes[c], __ATOMIC_RELAXED);
+        stats->live_blocks[c] = __atomic_load_n(&_live_blocks[c], __ATOMIC_RELAXED);
+    }
+    stats->large_live_bytes = __atomic_load_n(&_large_live_bytes, __ATOMIC_RELAXED);
+    stats->large_live_blocks = __atomic_load_n(&_large_live_blocks, __ATOMIC_RELAXED);
+    stats->slab_bytes = __atomic_load_n(&_slab_bytes, __ATOMIC_RELAXED);
+}
+
+/// arena
+
+plat_arena* plat_arena_create(size_t chunk_size)
+{
+    plat_arena *arena = calloc(1, sizeof(*arena));
+    if (!arena) return NULL;
+
+    arena->chunk_size = chunk_size ? chunk_size : PLAT_ALLOC_SLAB_SIZE;
+    return arena;
+}
+
+void* plat_arena_alloc(plat_arena *arena, size_t size, uint32 flags)
+{
+    struct plat_arena_chunk *chunk = arena->chunks;
+    struct plat_block *h;
+    size_t need = (sizeof(*h) + size + 15) & ~(size_t)15;
+
+    if (!chunk || chunk->size - chunk->used < need)
+    {
+        size_t chunk_size = need > arena->chunk_size ? need : arena->chunk_size;
+        chunk = malloc(sizeof(*chunk) + chunk_size);
+        if (!chunk) return NULL;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    h = (struct plat_block*)(chunk->data + chunk->used);
+    chunk->used += need;
+    h->tag = PLAT_BLOCK_MAGIC | PLAT_BLOCK_ARENA;
+    h->size = size;
+    if (flags & PLAT_ALLOC_ZERO) memset(h + 1, 0, size);
+    return h + 1;
+}
+
+void plat_arena_reset(plat_arena *arena)
+{
+    struct plat_arena_chunk *chunk, *next;
+
+    if (!arena->chunks) return;
+
+    // keep the newest chunk for the next round
+    for (chunk = arena->chunks->next; chunk; chunk = next)
+    {
+        next = chunk->next;
+        free(chunk);
+    }
+    arena->chunks->next = NULL;
+    arena->chunks->used = 0;
+}
+
+void plat_arena_destroy(plat_arena *arena)
+{
+    struct plat_arena_chunk *chunk, *next;
+
+    for (chunk = arena->chunks; chunk; chunk = next)
+    {
+        next = chunk->next;
+        free(chunk);
+    }
+    free(arena);
+}
+
+void plat_arena_push(plat_arena *arena)
+{
+    struct plat_thread_cache *cache = _cache_get();
+    if (!cache) return;
+
+    arena->prev = cache->arena;
+    cache->arena = arena;
+}
+
+void plat_arena_pop(void)
+{
+    struct plat_thread_cache *cache = _cache_get();
+    if (!cache || !cache->arena) return;
+
+    cache->arena = cache->arena->prev;
+}
@@ -0,0 +1,73 @@
+/*
+ * plat_c, platform independent library for c
+ * Copyright (C) 2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _PLAT_C_ALLOC_
+#define _PLAT_C_ALLOC_
+
+/**
+ * Allocator behind plat_mem_allocate/plat_mem_release
+ * 1. Small sizes (<= PLAT_ALLOC_MAX_SMALL) come from size-class slabs, each thread keeps a cache
+ *    of free blocks per class and only takes the class lock to refill or to give blocks back.
+ * 2. Larger sizes go to calloc/malloc.
+ * 3. An arena pushed on the current thread serves the allocations of that thread that ask for
+ *    it (PLAT_ALLOC_ARENA) until it is popped, others (log rings, jobs, ...) never land in it.
+ *    Releasing an arena block is a no-op, plat_arena_reset frees them all at once.
+ * 4. Memory is zeroed on demand (PLAT_ALLOC_ZERO), blocks never used since their slab was
+ *    created are known to be zero and are not cleared again.
+ * Every block has a 16 bytes header, so any pointer passed to plat_mem_release must come
+ * from this allocator, memory from libc (getline, getcwd, ...) is released by free().
+ */
+
+#include "plat_type.h"
+#include <stddef.h>
+
+#define PLAT_ALLOC_ZERO             0x01            // zero the memory
+#define PLAT_ALLOC_ARENA            0x02            // from the arena pushed on this thread, if any
+
+#define PLAT_ALLOC_CLASSES          28
+#define PLAT_ALLOC_MAX_SMALL        4096
+#define PLAT_ALLOC_SLAB_SIZE        (64*1024)
+
+typedef struct plat_arena plat_arena;
+
+struct plat_alloc_stats
+{
+    size_t class_size[PLAT_ALLOC_CLASSES];
+    int64 live_bytes[PLAT_ALLOC_CLASSES];          // requested bytes alive per class
+    int64 live_blocks[PLAT_ALLOC_CLASSES];
+    int64 large_live_bytes;
+    int64 large_live_blocks;
+    int64 slab_bytes;                               // memory held by slabs
+};
+
+void* plat_alloc(size_t size, uint32 flags);
+void* plat_realloc(void *mem, size_t size, uint32 flags);     // flags apply to the grown part
+void plat_free(void *mem);
+size_t plat_alloc_size(const void *mem);                       // size asked for mem
+void plat_alloc_get_stats(struct plat_alloc_stats *stats);
+void plat_alloc_thread_flush(void);                           // give the cache of this thread back
+
+plat_arena* plat_arena_create(size_t chunk_size);
+void* plat_arena_alloc(plat_arena *arena, size_t size, uint32 flags);
+void plat_arena_reset(plat_arena *arena);
+void plat_arena_destroy(plat_arena *arena);
+void plat_arena_push(plat_arena *arena);       // PLAT_ALLOC_ARENA of this thread uses arena
+void plat_arena_pop(void);
+
+#endif //_PLAT_C_ALLOC_
@@ -0,0 +1,363 @@
+/*
+ * plat_c, platform independent library for c
+ * Copyright (C) 2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "plat_io.h"
+#include "plat_mem.h"
+#include "uthash.h"
+
+struct io_entry;
+
+// path as asked by the caller, made absolute -> entry, saves realpath() on hits
+struct io_alias
+{
+    char *name;
+    struct io_entry *entry;
+    struct io_alias *next;                  // aliases of the same entry
+    UT_hash_handle hh;
+};
+
+struct io_entry
+{
+    plat_io_resource res;                   // must be first
+    char *path;                             // canonical
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t file_size;
+    void *map;
+    size_t map_len;
+    uint32 refs;
+    bool cached;                            // in the table, else freed by the last close
+    uint64 checked_ms;
+    struct io_entry *lru_prev, *lru_next;   // most recently used first
+    struct io_alias *aliases;
+    UT_hash_handle hh;
+};
+
+static pthread_mutex_t _io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct io_entry *_io_entries = NULL;
+static struct io_alias *_io_aliases = NULL;
+static struct io_entry *_io_lru_head = NULL, *_io_lru_tail = NULL;
+static size_t _io_bytes = 0;
+static size_t _io_budget = PLAT_IO_CACHE_BUDGET;
+static uint32 _io_validate_ms = PLAT_IO_CACHE_VALIDATE_MS;
+
+static uint64 _io_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool _io_same_file(struct io_entry *e, const struct stat *st)
+{
+    return e->dev == st->st_dev && e->ino == st->st_ino && e->file_size == st->st_size
+           && e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void _io_lru_unlink(struct io_entry *e)
+{
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else _io_lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else _io_lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void _io_lru_front(struct io_entry *e)
+{
+    if (_io_lru_head == e) return;
+    if (e->lru_prev || _io_lru_tail == e) _io_lru_unlink(e);
+    e->lru_next = _io_lru_head;
+    if (_io_lru_head) _io_lru_head->lru_prev = e;
+    _io_lru_head = e;
+    if (!_io_lru_tail) _io_lru_tail = e;
+}
+
+static void _io_entry_free(struct io_entry *e)
+{
+    munmap(e->map, e->map_len);
+    free(e->path);                          // from realpath()
+    plat_mem_release(e);
+}
+
+// Take the entry out of the table, it is freed now or by its last close.
+static void _io_uncache(struct io_entry *e)
+{
+    struct io_alias *a, *next;
+
+    for (a = e->aliases; a; a = next)
+    {
+        next = a->next;
+        HASH_DEL(_io_aliases, a);
+        plat_mem_release(a->name);
+        plat_mem_release(a);
+    }
+    e->aliases = NULL;
+
+    HASH_DEL(_io_entries, e);
+    _io_lru_unlink(e);
+    _io_bytes -= e->map_len;
+    e->cached = false;
+
+    if (e->refs == 0) _io_entry_free(e);
+}
+
+static void _io_evict(void)
+{
+    struct io_entry *e = _io_lru_tail, *prev;
+
+    while (_io_bytes > _io_budget && e)
+    {
+        prev = e->lru_prev;
+        if (e->refs == 0) _io_uncache(e);
+        e = prev;
+    }
+}
+
+static void _io_del_alias(struct io_alias *a)
+{
+    struct io_alias **p = &a->entry->aliases;
+
+    while (*p != a) p = &(*p)->next;
+    *p = a->next;
+    HASH_DEL(_io_aliases, a);
+    plat_mem_release(a->name);
+    plat_mem_release(a);
+}
+
+// A relative name is another file after chdir(), so aliases are keyed by the cwd joined with it.
+// NULL if that does not fit in buf, the name is then resolved without an alias.
+static const char* _io_alias_key(const char *path, char *buf, size_t size)
+{
+    size_t cwd_len, len = strlen(path);
+
+    if (path[0] == '/') return path;
+    if (!getcwd(buf, size)) return NULL;
+    cwd_len = strlen(buf);
+    if (cwd_len + 1 + len + 1 > size) return NULL;
+    buf[cwd_len] = '/';
+    plat_mem_copy(buf + cwd_len + 1, path, len + 1);
+    return buf;
+}
+
+static void _io_add_alias(struct io_entry *e, const char *name)
+{
+    size_t len = strlen(name);
+    struct io_alias *a = plat_mem_allocate(sizeof(*a));
+    if (!a) return;
+
+    a->name = plat_mem_allocate_raw(len + 1);
+    if (!a->name)
+    {
+        plat_mem_release(a);
+        return;
+    }
+    plat_mem_copy(a->name, name, len + 1);
+    a->entry = e;
+    a->next = e->aliases;
+    e->aliases = a;
+    HASH_ADD_KEYPTR(hh, _io_aliases, a->name, len, a);
+}
+
+// An anonymous mapping one byte longer than the file keeps the data NUL terminated,
+// the file is mapped over its head. Like any mapped file, truncating it while in use is not safe.
+static struct io_entry* _io_load(char *path)
+{
+    struct io_entry *e;
+    struct stat st;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t map_len;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    map_len = ((size_t)st.st_size + 1 + page - 1) & ~(page - 1);
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size > 0 && mmap(map, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(map, map_len);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    e = plat_mem_allocate(sizeof(*e));
+    if (!e)
+    {
+        munmap(map, map_len);
+        return NULL;
+    }
+    e->res.data = map;
+    e->res.size = (size_t)st.st_size;
+    e->path = path;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->mtime = st.st_mtim;
+    e->file_size = st.st_size;
+    e->map = map;
+    e->map_len = map_len;
+    e->cached = true;
+    e->checked_ms = _io_now_ms();
+
+    HASH_ADD_KEYPTR(hh, _io_entries, e->path, strlen(e->path), e);
+    _io_lru_front(e);
+    _io_bytes += map_len;
+    return e;
+}
+
+const plat_io_resource* plat_io_resource_open(const char *path)
+{
+    struct io_alias *a = NULL;
+    struct io_entry *e = NULL;
+    struct stat st;
+    uint64 now;
+    char *canonical;
+    char key_buf[PATH_MAX];
+    const char *key;
+
+    if (!path) return NULL;
+
+    pthread_mutex_lock(&_io_mutex);
+    now = _io_now_ms();
+
+    key = _io_alias_key(path, key_buf, sizeof(key_buf));
+    if (key) HASH_FIND_STR(_io_aliases, key, a);
+    if (a)
+    {
+        e = a->entry;
+        if (_io_validate_ms != PLAT_IO_CACHE_NO_VALIDATE && now - e->checked_ms >= _io_validate_ms)
+        {
+            // the name is checked, it may lead to another file (symlink, rename) while the entry is fine
+            if (stat(key, &st) == 0 && _io_same_file(e, &st))
+            {
+                e->checked_ms = now;
+            }
+            else if (stat(e->path, &st) == 0 && _io_same_file(e, &st))
+            {
+                _io_del_alias(a);
+                e = NULL;
+            }
+            else
+            {
+                _io_uncache(e);
+                e = NULL;
+            }
+        }
+    }
+
+    if (!e)
+    {
+        canonical = realpath(path, NULL);
+        if (!canonical)
+        {
+            pthread_mutex_unlock(&_io_mutex);
+            return NULL;
+        }
+
+        HASH_FIND_STR(_io_entries, canonical, e);
+        if (e)
+        {
+            // another name of a cached file
+            if (stat(canonical, &st) == 0 && _io_same_file(e, &st))
+            {
+                e->checked_ms = now;
+            }
+            else
+            {
+                _io_uncache(e);
+                e = NULL;
+            }
+        }
+
+        if (e) free(canonical);
+        else if (!(e = _io_load(canonical)))
+        {
+            free(canonical);
+            pthread_mutex_unlock(&_io_mutex);
+            return NULL;
+        }
+        if (key) _io_add_alias(e, key);
+    }
+
+    e->refs++;
+    _io_lru_front(e);
+    _io_evict();
+    pthread_mutex_unlock(&_io_mutex);
+
+    return &e->res;
+}
+
+void plat_io_resource_close(const plat_io_resource *res)
+{
+    struct io_entry *e = (struct io_entry*)res;
+
+    if (!e) return;
+
+    pthread_mutex_lock(&_io_mutex);
+    if (e->refs > 0 && --e->refs == 0)
+    {
+        if (!e->cached) _io_entry_free(e);
+        else _io_evict();
+    }
+    pthread_mutex_unlock(&_io_mutex);
+}
+
+void plat_io_cache_config(size_t budget, uint32 validate_ms)
+{
+    pthread_mutex_lock(&_io_mutex);
+    _io_budget = budget;
+    _io_validate_ms = validate_ms;
+    _io_evict();
+    pthread_mutex_unlock(&_io_mutex);
+}
+
+void plat_io_cache_clear(void)
+{
+    struct io_entry *e, *tmp;
+
+    pthread_mutex_lock(&_io_mutex);
+    HASH_ITER(hh, _io_entries, e, tmp)
+    {
+        if (e->refs == 0) _io_uncache(e);
+    }
+    pthread_mutex_unlock(&_io_mutex);
+}
@@ -31,6 +31,7 @@
 // add header
 #else
 #include <stdio.h>
+#include <stdlib.h>
 #endif
 #endif
 
@@ -78,7 +79,13 @@ plat_inline int plat_io_get_resource(const char* resource_name, void** content_m
         return -1;
     }
 
-    fread(*content_memory, *size, 1, f);
+    if (fread(*content_memory, *size, 1, f) != 1)
+    {
+        free(*content_memory);
+        *content_memory = NULL;
+        fclose(f);
+        return -1;
+    }
     fclose(f);
 
     return 0;
@@ -86,4 +93,34 @@ plat_inline int plat_io_get_resource(const char* resource_name, void** content_m
 }
 
 
+#if !_NO_STD_INC_ && !defined(__KERNEL__)
+#include <stddef.h>
+
+/**
+ * Resource cache
+ * Files are mapped read only and kept by canonical path, inode and mtime, a repeated open is a hash
+ * lookup. Data is always NUL terminated. Unused resources are unmapped in LRU order once the
+ * mapped bytes exceed the budget. A cached file is stat-ed again at most once per validate interval
+ * and mapped again if it changed, views of the old one stay mapped until closed (a file replaced by
+ * rename keeps its old content, one rewritten in place shows the new bytes).
+ */
+
+#define PLAT_IO_CACHE_BUDGET            (64*1024*1024)
+#define PLAT_IO_CACHE_VALIDATE_MS       1000
+#define PLAT_IO_CACHE_NO_VALIDATE       ((uint32)~0)
+
+typedef struct plat_io_resource
+{
+    const char *data;           // read only
+    size_t size;
+} plat_io_resource;
+
+const plat_io_resource* plat_io_resource_open(const char *path);      // NULL if it can't be read
+void plat_io_resource_close(const plat_io_resource *res);
+void plat_io_cache_config(size_t budget, uint32 validate_ms);
+void plat_io_cache_clear(void);                                         // unmap unused resources
+
+#endif
+
+
 #endif //_PLAT_C_IO_
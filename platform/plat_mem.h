@@ -32,10 +32,11 @@
 #else
 #include <stdlib.h>
 #include <string.h>
+#include "plat_alloc.h"
 #endif
 #endif
 
-plat_inline void* plat_mem_allocate(uint size)
+plat_inline void* plat_mem_allocate(size_t size)
 {
 #if _NO_STD_INC_
     return NULL;
@@ -44,9 +45,39 @@ plat_inline void* plat_mem_allocate(uint size)
     // TO-DO: implement
     return NULL;
 #else
-    void* mem = malloc(size);
-    if (mem) memset(mem, 0, size);
-    return mem;
+    return plat_alloc(size, PLAT_ALLOC_ZERO);
+#endif
+#endif
+}
+
+
+// Not zeroed, for memory which is filled right away.
+plat_inline void* plat_mem_allocate_raw(size_t size)
+{
+#if _NO_STD_INC_
+    return NULL;
+#else
+#ifdef __KERNEL__
+    // TO-DO: implement
+    return NULL;
+#else
+    return plat_alloc(size, 0);
+#endif
+#endif
+}
+
+
+// Grown part is zeroed.
+plat_inline void* plat_mem_reallocate(void* mem, size_t size)
+{
+#if _NO_STD_INC_
+    return NULL;
+#else
+#ifdef __KERNEL__
+    // TO-DO: implement
+    return NULL;
+#else
+    return plat_realloc(mem, size, PLAT_ALLOC_ZERO);
 #endif
 #endif
 }
@@ -58,13 +89,13 @@ plat_inline void plat_mem_release(void* mem)
 #ifdef __KERNEL__
     // TO-DO: implement
 #else
-    if (mem) free(mem);
+    plat_free(mem);
 #endif
 #endif
 }
 
 
-plat_inline void plat_mem_copy(void* dest, const void* src, uint size)
+plat_inline void plat_mem_copy(void* dest, const void* src, size_t size)
 {
 #if !_NO_STD_INC_
 #ifdef __KERNEL__
@@ -76,7 +107,7 @@ plat_inline void plat_mem_copy(void* dest, const void* src, uint size)
 }
 
 
-plat_inline void plat_mem_move(void* dest, void* src, uint size)
+plat_inline void plat_mem_move(void* dest, void* src, size_t size)
 {
 #if !_NO_STD_INC_
 #ifdef __KERNEL__
@@ -88,7 +119,7 @@ plat_inline void plat_mem_move(void* dest, void* src, uint size)
 }
 
 
-plat_inline void plat_mem_set(void* dest, char value, uint size)
+plat_inline void plat_mem_set(void* dest, char value, size_t size)
 {
 #if !_NO_STD_INC_
 #ifdef __KERNEL__
@@ -24,7 +24,7 @@
 /**
  * Managed memory API
  * 1. Declare a pool
- *    mgn_memory_pool pool;
+ *    mgn_memory_pool pool = NULL;
  * 2. Allocate a memory
  *    void *m0 = mgn_mem_alloc(&pool, 100);
  * 3. Release a memory
@@ -41,64 +41,197 @@
  *    mgn_mem_autorelease(&pool, m0);
  * 7. Release unused memories (auto)
  *    mgn_mem_release_unused(&pool);
- * 8. Release all memories
+ *    or drain a scope, memories autoreleased inside it are released when it is popped
+ *    mgn_mem_autorelease_push(&pool);
+ *    ... mgn_mem_autorelease(&pool, m1); ...
+ *    mgn_mem_autorelease_pop(&pool);
+ * 8. Release all memories (and the pool)
  *    mgn_mem_release_all(&pool);
  *
+ * Size and retained count live in a header right before the memory, retain/release don't search,
+ * so only memories of the pool may be passed in (the header is checked by a magic number).
+ * Released blocks up to MGN_MEM_MAX_CACHED bytes are kept in per-class free lists of the pool.
+ * Define MGN_MEM_TRACE to 1 to print every allocation and release.
  */
 
 
 #include "plat_type.h"
 #include "plat_mem.h"
 #include "plat_io.h"
-#include "uthash.h"
+
+#define MGN_MEM_MAGIC                   0x4D474E4Du             // "MGNM"
+#define MGN_MEM_CLASSES                 9                       // 16, 32, ... 4096
+#define MGN_MEM_MAX_CACHED              4096
+#define MGN_MEM_CACHE_PER_CLASS         64
+#define MGN_MEM_NO_CLASS                MGN_MEM_CLASSES
+#define MGN_MEM_SCOPE_CHUNK             254                     // autoreleased memories per chunk
 
 typedef struct _MGN_MEM_ {
-    void *m;  // memory
+    struct _MGN_MEM_ *prev, *next;      // live blocks of the pool, or free list of a class
+    struct _MGN_MEM_POOL_ *pool;        // owner
     size_t s; // memory size
     size_t r; // retained count
-    // ***** Hash table anchor *****
-    UT_hash_handle hh; /* makes this structure hashable */
-} mgn_memory, *mgn_memory_pool;
+    uint32 c; // size class
+    uint32 magic;
+} __attribute__((aligned(16))) mgn_memory;
+
+// Memories autoreleased in scopes, a NULL item marks where a scope starts.
+struct _MGN_MEM_SCOPE_CHUNK_ {
+    struct _MGN_MEM_SCOPE_CHUNK_ *prev;
+    size_t n;
+    mgn_memory *items[MGN_MEM_SCOPE_CHUNK];
+};
+
+struct _MGN_MEM_POOL_ {
+    mgn_memory *live;
+    size_t count;                                   // live blocks
+    mgn_memory *free[MGN_MEM_CLASSES];
+    uint32 free_count[MGN_MEM_CLASSES];
+    struct _MGN_MEM_SCOPE_CHUNK_ *scope;            // last chunk
+    struct _MGN_MEM_SCOPE_CHUNK_ *scope_spare;      // emptied chunk kept for the next push
+    size_t scopes;                                  // scope depth
+};
+
+typedef struct _MGN_MEM_POOL_ *mgn_memory_pool;
+
+#ifndef MGN_MEM_TRACE
+#define MGN_MEM_TRACE                   0
+#endif
 
-#if 0
-#define print_mgn_mem_err plat_io_printf_err
-#define print_mgn_mem_dbg
-#else
 #define print_mgn_mem_err plat_io_printf_err
+#if MGN_MEM_TRACE
 #define print_mgn_mem_dbg plat_io_printf_std
+#else
+#define print_mgn_mem_dbg(...)
 #endif
 
 #define MGN_MEM_REALLOCATE_IF_MULTI_OWNERS        1
 
+#define _mgn_mem_header(mem)            ((mgn_memory*)(mem) - 1)
+#define _mgn_mem_payload(mgn_m)         ((void*)((mgn_memory*)(mgn_m) + 1))
+
+static inline uint32 _mgn_mem_class(size_t size)
+{
+    uint32 c = 0;
+    size_t cap = 16;
+    if (size > MGN_MEM_MAX_CACHED) return MGN_MEM_NO_CLASS;
+    while (cap < size) { cap <<= 1; c++; }
+    return c;
+}
+
+static inline size_t _mgn_mem_capacity(mgn_memory *mgn_m)
+{
+    return mgn_m->c == MGN_MEM_NO_CLASS ? mgn_m->s : ((size_t)16 << mgn_m->c);
+}
+
+// Find the header of a memory of this pool.
+static inline mgn_memory* _mgn_mem_find(mgn_memory_pool *pool, void *origin_mem)
+{
+    mgn_memory *mgn_m;
+    if (NULL == origin_mem || NULL == *pool) return NULL;
+    mgn_m = _mgn_mem_header(origin_mem);
+    if (MGN_MEM_MAGIC != mgn_m->magic || *pool != mgn_m->pool) return NULL;
+    return mgn_m;
+}
+
+static inline struct _MGN_MEM_POOL_* _mgn_mem_pool(mgn_memory_pool *pool)
+{
+    if (NULL == *pool) *pool = plat_mem_allocate(sizeof(**pool));
+    return *pool;
+}
+
+static inline mgn_memory* _mgn_mem_new(mgn_memory_pool *pool, size_t new_size)
+{
+    mgn_memory *mgn_m;
+    uint32 c;
+
+    if (NULL == _mgn_mem_pool(pool)) return NULL;
+
+    c = _mgn_mem_class(new_size);
+    if (c != MGN_MEM_NO_CLASS && NULL != (*pool)->free[c])
+    {
+        mgn_m = (*pool)->free[c];
+        (*pool)->free[c] = mgn_m->next;
+        (*pool)->free_count[c]--;
+        plat_mem_set(_mgn_mem_payload(mgn_m), 0, new_size);            // a zero memory
+    }
+    else
+    {
+        mgn_m = plat_mem_allocate(sizeof(*mgn_m) + (c == MGN_MEM_NO_CLASS ? new_size : ((size_t)16 << c)));
+        if (NULL == mgn_m) return NULL;
+    }
+
+    mgn_m->pool = *pool;
+    mgn_m->s = new_size;
+    mgn_m->r = 1;
+    mgn_m->c = c;
+    mgn_m->magic = MGN_MEM_MAGIC;
+
+    mgn_m->prev = NULL;
+    mgn_m->next = (*pool)->live;
+    if (mgn_m->next) mgn_m->next->prev = mgn_m;
+    (*pool)->live = mgn_m;
+    (*pool)->count++;
+
+    print_mgn_mem_dbg("[MGN_MEM] Added memory (%p), size %zu - %zu left\n", _mgn_mem_payload(mgn_m), mgn_m->s, (*pool)->count);
+    return mgn_m;
+}
+
+static inline void _mgn_mem_delete(mgn_memory_pool *pool, mgn_memory *mgn_m)
+{
+    struct _MGN_MEM_POOL_ *p = *pool;
+
+    if (mgn_m->prev) mgn_m->prev->next = mgn_m->next;
+    else p->live = mgn_m->next;
+    if (mgn_m->next) mgn_m->next->prev = mgn_m->prev;
+    p->count--;
+
+    print_mgn_mem_dbg("[MGN_MEM] Removed memory (%p), size %zu - %zu left\n", _mgn_mem_payload(mgn_m), mgn_m->s, p->count);
+
+    mgn_m->magic = 0;
+    if (mgn_m->c != MGN_MEM_NO_CLASS && p->free_count[mgn_m->c] < MGN_MEM_CACHE_PER_CLASS)
+    {
+        mgn_m->next = p->free[mgn_m->c];
+        p->free[mgn_m->c] = mgn_m;
+        p->free_count[mgn_m->c]++;
+    }
+    else
+    {
+        plat_mem_release(mgn_m);
+    }
+}
+
 // This function shuold be used carefully, caller should always have its ownership,
 // else it is difficult to decide how to maintain retained count.
 // Should never call this function after autorelease.
 static inline void* mgn_mem_ralloc(mgn_memory_pool *pool, void *origin_mem, size_t new_size)
 {
     if (new_size == 0) return NULL;
-    mgn_memory *mgn_m = NULL;
-    HASH_FIND_PTR((*pool), &origin_mem, mgn_m);
+    mgn_memory *mgn_m = _mgn_mem_find(pool, origin_mem);
     if (NULL != mgn_m)
     {
         if (new_size > mgn_m->s)
         {
             if (1 == mgn_m->r)
             {
+                if (new_size <= _mgn_mem_capacity(mgn_m))
+                {
+                    // still fits its block
+                    plat_mem_set((uint8*)origin_mem + mgn_m->s, 0, new_size - mgn_m->s);
+                    mgn_m->s = new_size;
+                    return origin_mem;
+                }
+
                 // realloc a new one
-                HASH_DEL((*pool), mgn_m);
-                void *new_m = plat_mem_allocate(new_size);
+                mgn_memory *new_m = _mgn_mem_new(pool, new_size);
                 if (NULL == new_m)
                 {
                     print_mgn_mem_err("[MGN_MEM] Allocate memory error\n");
                     return NULL;                                    // error
                 }
-                plat_mem_copy(new_m, mgn_m->m, mgn_m->s);           // clone
-                plat_mem_release(mgn_m->m);
-                print_mgn_mem_dbg("[MGN_MEM] Removed memory (%p), size %zu - %u left\n", mgn_m->m, mgn_m->s, HASH_COUNT(*pool));
-                mgn_m->m = new_m;
-                mgn_m->s = new_size;
-                HASH_ADD_PTR((*pool), m, mgn_m);                    // reset key
-                print_mgn_mem_dbg("[MGN_MEM] Added memory (%p), size %zu - %u left\n", mgn_m->m, mgn_m->s, HASH_COUNT(*pool));
+                plat_mem_copy(_mgn_mem_payload(new_m), origin_mem, mgn_m->s);      // clone
+                _mgn_mem_delete(pool, mgn_m);
+                mgn_m = new_m;
             }
             else
             {
@@ -107,25 +240,13 @@ static inline void* mgn_mem_ralloc(mgn_memory_pool *pool, void *origin_mem, size
 #if MGN_MEM_REALLOCATE_IF_MULTI_OWNERS
                 // create a new one
                 size_t old_size = mgn_m->s;
-                mgn_m = plat_mem_allocate(sizeof(*mgn_m));              // allocate a zero memory
+                mgn_m = _mgn_mem_new(pool, new_size);                   // allocate a zero memory
                 if (NULL == mgn_m)
                 {
                     print_mgn_mem_err("[MGN_MEM] Allocate memory error\n");
                     return NULL;                                        // error
                 }
-                void *new_m = plat_mem_allocate(new_size);              // allocate a zero memory
-                if (NULL == new_m)
-                {
-                    print_mgn_mem_err("[MGN_MEM] Allocate memory error\n");
-                    plat_mem_release(mgn_m);
-                    return NULL;                                        // error
-                }
-                plat_mem_copy(new_m, origin_mem, old_size);             // clone
-                mgn_m->m = new_m;
-                mgn_m->s = new_size;
-                mgn_m->r = 1;
-                HASH_ADD_PTR((*pool), m, mgn_m);
-                print_mgn_mem_dbg("[MGN_MEM] Added memory (%p), size %zu - %u left\n", mgn_m->m, mgn_m->s, HASH_COUNT(*pool));
+                plat_mem_copy(_mgn_mem_payload(mgn_m), origin_mem, old_size);      // clone
 #else
                 // let user to decide how to do
                 return NULL;
@@ -140,27 +261,15 @@ static inline void* mgn_mem_ralloc(mgn_memory_pool *pool, void *origin_mem, size
             print_mgn_mem_err("[MGN_MEM] Who's memory (%p)?\n", origin_mem);
             return NULL;                                       // where the origin_mem from?
         }
-        mgn_m = plat_mem_allocate(sizeof(*mgn_m));             // allocate a zero memory
+        mgn_m = _mgn_mem_new(pool, new_size);                  // allocate a zero memory
         if (NULL == mgn_m)
         {
             print_mgn_mem_err("[MGN_MEM] Allocate memory error\n");
             return NULL;                                       // error
         }
-        void *new_m = plat_mem_allocate(new_size);             // allocate a zero memory
-        if (NULL == new_m)
-        {
-            print_mgn_mem_err("[MGN_MEM] Allocate memory error\n");
-            plat_mem_release(mgn_m);
-            return NULL;                                       // error
-        }
-        mgn_m->m = new_m;
-        mgn_m->s = new_size;
-        mgn_m->r = 1;
-        HASH_ADD_PTR((*pool), m, mgn_m);
-        print_mgn_mem_dbg("[MGN_MEM] Added memory (%p), size %zu - %u left\n", mgn_m->m, mgn_m->s, HASH_COUNT(*pool));
     }
 
-    return mgn_m->m;
+    return _mgn_mem_payload(mgn_m);
 }
 
 static inline void* mgn_mem_alloc(mgn_memory_pool *pool, size_t new_size)
@@ -170,12 +279,11 @@ static inline void* mgn_mem_alloc(mgn_memory_pool *pool, size_t new_size)
 
 static inline void* mgn_mem_retain(mgn_memory_pool *pool, void *origin_mem)
 {
-    mgn_memory *mgn_m = NULL;
-    HASH_FIND_PTR((*pool), &origin_mem, mgn_m);
+    mgn_memory *mgn_m = _mgn_mem_find(pool, origin_mem);
     if (NULL != mgn_m)
     {
         mgn_m->r++;
-        return mgn_m->m;
+        return origin_mem;
     }
     print_mgn_mem_err("[MGN_MEM] Who's memory (%p)?\n", origin_mem);
     return NULL;
@@ -183,23 +291,19 @@ static inline void* mgn_mem_retain(mgn_memory_pool *pool, void *origin_mem)
 
 static inline void _mgn_mem_release(mgn_memory_pool *pool, void *origin_mem, int release)
 {
-    mgn_memory *mgn_m = NULL;
-    HASH_FIND_PTR((*pool), &origin_mem, mgn_m);
+    mgn_memory *mgn_m = _mgn_mem_find(pool, origin_mem);
     if (NULL != mgn_m)
     {
         if (0 == mgn_m->r)
         {
             // error
-            print_mgn_mem_err("MGN_MEM] Memory (%p) can't be released, retained count is zero.\n", mgn_m->m);
+            print_mgn_mem_err("MGN_MEM] Memory (%p) can't be released, retained count is zero.\n", origin_mem);
             return;
         }
         mgn_m->r--;
         if (0 == mgn_m->r && release)
         {
-            HASH_DEL((*pool), mgn_m);
-            plat_mem_release(mgn_m->m);
-            print_mgn_mem_dbg("[MGN_MEM] Removed memory (%p), size %zu - %u left\n", mgn_m->m, mgn_m->s, HASH_COUNT(*pool));
-            plat_mem_release(mgn_m);
+            _mgn_mem_delete(pool, mgn_m);
         }
     }
     else ;                                                   // error case ?
@@ -210,22 +314,91 @@ static inline void mgn_mem_release(mgn_memory_pool *pool, void *origin_mem)
     _mgn_mem_release(pool, origin_mem, 1);
 }
 
+static inline int _mgn_mem_scope_add(struct _MGN_MEM_POOL_ *p, mgn_memory *mgn_m)
+{
+    struct _MGN_MEM_SCOPE_CHUNK_ *chunk = p->scope;
+    if (NULL == chunk || MGN_MEM_SCOPE_CHUNK == chunk->n)
+    {
+        if (p->scope_spare)
+        {
+            chunk = p->scope_spare;
+            p->scope_spare = NULL;
+        }
+        else
+        {
+            chunk = plat_mem_allocate_raw(sizeof(*chunk));
+            if (NULL == chunk) return -1;
+        }
+        chunk->prev = p->scope;
+        chunk->n = 0;
+        p->scope = chunk;
+    }
+    chunk->items[chunk->n++] = mgn_m;
+    return 0;
+}
+
+// Inside a scope, the retained count is kept until the scope is popped.
 static inline void mgn_mem_autorelease(mgn_memory_pool *pool, void *origin_mem)
 {
+    mgn_memory *mgn_m;
+    if (NULL != *pool && (*pool)->scopes > 0 && NULL != (mgn_m = _mgn_mem_find(pool, origin_mem)))
+    {
+        if (0 == _mgn_mem_scope_add(*pool, mgn_m)) return;
+        print_mgn_mem_err("[MGN_MEM] Allocate memory error\n");
+    }
     _mgn_mem_release(pool, origin_mem, 0);
 }
 
+static inline int mgn_mem_autorelease_push(mgn_memory_pool *pool)
+{
+    struct _MGN_MEM_POOL_ *p = _mgn_mem_pool(pool);
+    if (NULL == p || 0 != _mgn_mem_scope_add(p, NULL))
+    {
+        print_mgn_mem_err("[MGN_MEM] Allocate memory error\n");
+        return -1;
+    }
+    p->scopes++;
+    return 0;
+}
+
+// Release memories autoreleased since the last push, O(k) in their number.
+static inline void mgn_mem_autorelease_pop(mgn_memory_pool *pool)
+{
+    struct _MGN_MEM_POOL_ *p = *pool;
+    struct _MGN_MEM_SCOPE_CHUNK_ *chunk;
+    mgn_memory *mgn_m;
+
+    if (NULL == p || 0 == p->scopes) return;
+
+    while (NULL != (chunk = p->scope))
+    {
+        if (0 == chunk->n)
+        {
+            p->scope = chunk->prev;
+            if (p->scope_spare) plat_mem_release(chunk);
+            else p->scope_spare = chunk;
+            continue;
+        }
+        mgn_m = chunk->items[--chunk->n];
+        if (NULL == mgn_m) break;                           // start of the scope
+        if (mgn_m->r > 0 && 0 == --mgn_m->r)
+        {
+            _mgn_mem_delete(pool, mgn_m);
+        }
+    }
+    p->scopes--;
+}
+
 static inline void mgn_mem_release_unused(mgn_memory_pool *pool)
 {
     mgn_memory *mgn_m, *tmp;
-    HASH_ITER(hh, (*pool), mgn_m, tmp)
+    if (NULL == *pool) return;
+    for (mgn_m = (*pool)->live; mgn_m; mgn_m = tmp)
     {
+        tmp = mgn_m->next;
         if (0 == mgn_m->r)
         {
-            HASH_DEL((*pool), mgn_m);
-            plat_mem_release(mgn_m->m);
-            print_mgn_mem_dbg("[MGN_MEM] Removed memory (%p), size %zu - %u left\n", mgn_m->m, mgn_m->s, HASH_COUNT(*pool));
-            plat_mem_release(mgn_m);
+            _mgn_mem_delete(pool, mgn_m);
         }
     }
 }
@@ -233,14 +406,32 @@ static inline void mgn_mem_release_unused(mgn_memory_pool *pool)
 static inline void mgn_mem_release_all(mgn_memory_pool *pool)
 {
     mgn_memory *mgn_m, *tmp;
-    HASH_ITER(hh, (*pool), mgn_m, tmp)
+    uint32 c;
+    if (NULL == *pool) return;
+    for (mgn_m = (*pool)->live; mgn_m; mgn_m = tmp)
     {
-        HASH_DEL((*pool), mgn_m);
-        plat_mem_release(mgn_m->m);
-        print_mgn_mem_dbg("[MGN_MEM] Removed memory (%p), size %zu - %u left\n", mgn_m->m, mgn_m->s, HASH_COUNT(*pool));
+        tmp = mgn_m->next;
+        print_mgn_mem_dbg("[MGN_MEM] Removed memory (%p), size %zu - %zu left\n", _mgn_mem_payload(mgn_m), mgn_m->s, --(*pool)->count);
         plat_mem_release(mgn_m);
     }
+    for (c = 0; c < MGN_MEM_CLASSES; c++)
+    {
+        for (mgn_m = (*pool)->free[c]; mgn_m; mgn_m = tmp)
+        {
+            tmp = mgn_m->next;
+            plat_mem_release(mgn_m);
+        }
+    }
+    while (NULL != (*pool)->scope)
+    {
+        struct _MGN_MEM_SCOPE_CHUNK_ *chunk = (*pool)->scope;
+        (*pool)->scope = chunk->prev;
+        plat_mem_release(chunk);
+    }
+    plat_mem_release((*pool)->scope_spare);
+    plat_mem_release(*pool);
+    *pool = NULL;
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,133 @@
+/*
+ * plat_c, platform independent library for c
+ * Copyright (C) 2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plat_alloc.h"
+
+static int _failed = 0;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); _failed++; } } while (0)
+
+static int _is_zero(const void *mem, size_t size)
+{
+    const uint8 *p = mem;
+    size_t i;
+
+    for (i = 0; i < size; i++) if (p[i]) return 0;
+    return 1;
+}
+
+static int64 _live_blocks(void)
+{
+    struct plat_alloc_stats stats;
+    int64 n;
+    int c;
+
+    plat_alloc_get_stats(&stats);
+    n = stats.large_live_blocks;
+    for (c = 0; c < PLAT_ALLOC_CLASSES; c++) n += stats.live_blocks[c];
+    return n;
+}
+
+int main(void)
+{
+    plat_arena *arena;
+    int64 live;
+    uint8 *a, *b, *c;
+    int i;
+
+    live = _live_blocks();
+
+    // small and large blocks, a released block comes back zeroed when asked
+    a = plat_alloc(24, 0);
+    b = plat_alloc(PLAT_ALLOC_MAX_SMALL + 1, PLAT_ALLOC_ZERO);
+    CHECK(a && b);
+    CHECK(((uintptr_t)a & 15) == 0 && ((uintptr_t)b & 15) == 0);
+    CHECK(plat_alloc_size(a) == 24);
+    CHECK(plat_alloc_size(b) == PLAT_ALLOC_MAX_SMALL + 1);
+    CHECK(_is_zero(b, PLAT_ALLOC_MAX_SMALL + 1));
+    CHECK(_live_blocks() == live + 2);
+    memset(a, 0xAA, 24);
+    plat_free(a);
+    a = plat_alloc(24, PLAT_ALLOC_ZERO);
+    CHECK(a && _is_zero(a, 24));
+    plat_free(a);
+    plat_free(b);
+    CHECK(_live_blocks() == live);
+
+    // realloc keeps the content and zeroes the grown part, within a class and across classes
+    a = plat_alloc(20, 0);
+    memcpy(a, "0123456789", 10);
+    a = plat_realloc(a, 30, PLAT_ALLOC_ZERO);
+    CHECK(a && memcmp(a, "0123456789", 10) == 0);
+    CHECK(plat_alloc_size(a) == 30 && _is_zero(a + 20, 10));
+    a = plat_realloc(a, 10000, PLAT_ALLOC_ZERO);
+    CHECK(a && memcmp(a, "0123456789", 10) == 0);
+    CHECK(_is_zero(a + 30, 10000 - 30));
+    plat_free(a);
+    CHECK(_live_blocks() == live);
+
+    // many blocks through the thread cache and back to the classes
+    {
+        void *blocks[1000];
+        for (i = 0; i < 1000; i++) blocks[i] = plat_alloc((size_t)(i % 300) + 1, 0);
+        CHECK(_live_blocks() == live + 1000);
+        for (i = 0; i < 1000; i++) plat_free(blocks[i]);
+        plat_alloc_thread_flush();
+        CHECK(_live_blocks() == live);
+    }
+
+    // the pushed arena only serves allocations asking for it
+    arena = plat_arena_create(256);
+    CHECK(arena != NULL);
+    plat_arena_push(arena);
+    a = plat_alloc(32, PLAT_ALLOC_ARENA | PLAT_ALLOC_ZERO);
+    b = plat_alloc(32, 0);
+    CHECK(a && b && _is_zero(a, 32));
+    CHECK(_live_blocks() == live + 1);              // only b is a slab block
+    plat_free(a);                                   // no-op
+    plat_free(b);
+    CHECK(_live_blocks() == live);
+    plat_arena_pop();
+    c = plat_alloc(32, PLAT_ALLOC_ARENA);           // no arena pushed anymore
+    CHECK(c && _live_blocks() == live + 1);
+    plat_free(c);
+
+    // a block larger than the chunk size gets a chunk of its own
+    a = plat_arena_alloc(arena, 1000, 0);
+    CHECK(a != NULL);
+    memset(a, 0x55, 1000);
+
+    // reset keeps the newest chunk and hands it out from the start again
+    plat_arena_reset(arena);
+    b = plat_arena_alloc(arena, 16, 0);
+    CHECK(b == a);
+    c = plat_arena_alloc(arena, 16, PLAT_ALLOC_ZERO);
+    CHECK(c > b && _is_zero(c, 16));
+    plat_arena_destroy(arena);
+    CHECK(_live_blocks() == live);
+
+    if (_failed) fprintf(stderr, "%d check(s) failed\n", _failed);
+    return _failed ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * plat_c, platform independent library for c
+ * Copyright (C) 2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "plat_io.h"
+
+static int _failed = 0;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); _failed++; } } while (0)
+
+static void _write_file(const char *path, const char *content)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) return;
+    fputs(content, f);
+    fclose(f);
+}
+
+static int _read_is(const char *path, const char *content)
+{
+    const plat_io_resource *res = plat_io_resource_open(path);
+    int same = res && strcmp(res->data, content) == 0;
+
+    plat_io_resource_close(res);
+    return same;
+}
+
+// a new file under the name, a cached entry keeps the old content
+static void _replace_file(const char *path, const char *content)
+{
+    char tmp[PATH_MAX];
+
+    snprintf(tmp, sizeof(tmp), "%s.new", path);
+    _write_file(tmp, content);
+    rename(tmp, path);
+}
+
+int main(void)
+{
+    char root[] = "/tmp/plat_io_test.XXXXXX";
+    char path[sizeof(root) + 16];
+    const plat_io_resource *r1, *r2;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (!mkdtemp(root)) return 1;
+    snprintf(path, sizeof(path), "%s/a", root);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/b", root);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/a/x.txt", root);
+    _write_file(path, "a");
+    snprintf(path, sizeof(path), "%s/b/x.txt", root);
+    _write_file(path, "b");
+
+    // a relative name opens the file of the current directory, also right after another one was cached
+    snprintf(path, sizeof(path), "%s/a", root);
+    CHECK(chdir(path) == 0);
+    CHECK(_read_is("x.txt", "a"));
+    snprintf(path, sizeof(path), "%s/b", root);
+    CHECK(chdir(path) == 0);
+    CHECK(_read_is("x.txt", "b"));
+    CHECK(_read_is("../a/x.txt", "a"));
+    snprintf(path, sizeof(path), "%s/a", root);
+    CHECK(chdir(path) == 0);
+    CHECK(_read_is("x.txt", "a"));
+
+    // a name that leads to another file is dropped on validation
+    plat_io_cache_config(PLAT_IO_CACHE_BUDGET, 0);
+    _write_file("y.txt", "new");
+    CHECK(rename("y.txt", "x.txt") == 0);
+    CHECK(_read_is("x.txt", "new"));
+
+    // the absolute name and relative names of a file share one entry, all of them are aliases
+    plat_io_cache_config(PLAT_IO_CACHE_BUDGET, PLAT_IO_CACHE_NO_VALIDATE);
+    snprintf(path, sizeof(path), "%s/a/x.txt", root);
+    r1 = plat_io_resource_open("x.txt");
+    r2 = plat_io_resource_open(path);
+    CHECK(r1 && r1 == r2);
+    plat_io_resource_close(r2);
+    r2 = plat_io_resource_open("../a/x.txt");
+    CHECK(r1 == r2);
+    plat_io_resource_close(r2);
+    plat_io_resource_close(r1);
+    _replace_file(path, "renamed");
+    CHECK(_read_is(path, "new"));                       // not validated, served by the alias
+    CHECK(_read_is("x.txt", "new"));
+    plat_io_cache_clear();
+    CHECK(_read_is(path, "renamed"));
+    CHECK(_read_is("x.txt", "renamed"));
+
+    // unused files are unmapped in LRU order once they exceed the budget
+    plat_io_cache_clear();
+    plat_io_cache_config(page, PLAT_IO_CACHE_NO_VALIDATE);
+    _write_file("1.txt", "1");
+    _write_file("2.txt", "2");
+    CHECK(_read_is("1.txt", "1"));
+    CHECK(_read_is("2.txt", "2"));                      // 1.txt is evicted
+    _replace_file("1.txt", "1 again");
+    _replace_file("2.txt", "2 again");
+    CHECK(_read_is("2.txt", "2"));                      // still cached
+    CHECK(_read_is("1.txt", "1 again"));                // mapped again, 2.txt is evicted
+    CHECK(_read_is("2.txt", "2 again"));
+
+    // a file in use is not evicted, it goes once it is closed
+    plat_io_cache_config(PLAT_IO_CACHE_BUDGET, PLAT_IO_CACHE_NO_VALIDATE);
+    r1 = plat_io_resource_open("1.txt");
+    CHECK(_read_is("2.txt", "2 again"));
+    plat_io_cache_config(0, PLAT_IO_CACHE_NO_VALIDATE);
+    plat_io_cache_clear();
+    CHECK(r1 && strcmp(r1->data, "1 again") == 0);
+    _replace_file("1.txt", "1 third");
+    _replace_file("2.txt", "2 third");
+    CHECK(_read_is("2.txt", "2 third"));
+    r2 = plat_io_resource_open("1.txt");
+    CHECK(r2 == r1);                                    // still cached
+    plat_io_resource_close(r2);
+    plat_io_resource_close(r1);
+    CHECK(_read_is("1.txt", "1 third"));
+
+    // a changed file is mapped again, the old mapping stays valid until its last close
+    plat_io_cache_config(PLAT_IO_CACHE_BUDGET, 0);
+    r1 = plat_io_resource_open("1.txt");
+    r2 = plat_io_resource_open("1.txt");
+    _replace_file("1.txt", "1 fourth");
+    CHECK(_read_is("1.txt", "1 fourth"));
+    plat_io_cache_clear();
+    CHECK(r1 && r1 == r2 && strcmp(r1->data, "1 third") == 0);
+    plat_io_resource_close(r1);
+    CHECK(strcmp(r2->data, "1 third") == 0 && r2->size == 7);
+    plat_io_resource_close(r2);
+
+    plat_io_cache_clear();
+    unlink("1.txt");
+    unlink("2.txt");
+    snprintf(path, sizeof(path), "%s/a/x.txt", root);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/b/x.txt", root);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/a", root);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/b", root);
+    rmdir(path);
+    rmdir(root);
+
+    if (_failed) fprintf(stderr, "%d check(s) failed\n", _failed);
+    return _failed ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * plat_c, platform independent library for c
+ * Copyright (C) 2016 Yuchi (yuchi518@gmail.com)
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. For the terms of this
+ * license, see <http://www.gnu.org/licenses>.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plat_mgn_mem.h"
+
+static int _failed = 0;
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); _failed++; } } while (0)
+
+static int _is_zero(const void *mem, size_t size)
+{
+    const uint8 *p = mem;
+    size_t i;
+
+    for (i = 0; i < size; i++) if (p[i]) return 0;
+    return 1;
+}
+
+static void _test_header(void)
+{
+    mgn_memory_pool pool = NULL, other = NULL;
+    mgn_memory *h;
+    uint8 *m0, *m1, *m2;
+
+    // the header right before the memory knows its pool, size and retained count
+    m0 = mgn_mem_alloc(&pool, 20);
+    CHECK(m0 != NULL && pool != NULL);
+    h = _mgn_mem_header(m0);
+    CHECK(h->magic == MGN_MEM_MAGIC && h->pool == pool);
+    CHECK(h->s == 20 && h->r == 1 && h->c == _mgn_mem_class(20));
+    CHECK(_mgn_mem_find(&pool, m0) == h);
+    CHECK(_is_zero(m0, 20));
+    CHECK(pool->count == 1);
+
+    CHECK(mgn_mem_retain(&pool, m0) == m0);
+    CHECK(h->r == 2);
+    mgn_mem_release(&pool, m0);
+    CHECK(h->r == 1 && pool->count == 1);
+
+    // memories of another pool or not from a pool at all are refused
+    m1 = mgn_mem_alloc(&other, 20);
+    CHECK(_mgn_mem_find(&pool, m1) == NULL);
+    CHECK(mgn_mem_retain(&pool, m1) == NULL);
+    CHECK(_mgn_mem_header(m1)->r == 1);
+    mgn_mem_release_all(&other);
+    CHECK(other == NULL);
+
+    // growing within the capacity of the class keeps the block
+    memset(m0, 0xAA, 20);
+    m1 = mgn_mem_ralloc(&pool, m0, 32);
+    CHECK(m1 == m0 && h->s == 32);
+    CHECK(m1[19] == 0xAA && _is_zero(m1 + 20, 12));
+
+    // beyond it the content moves to a new block
+    m2 = mgn_mem_ralloc(&pool, m1, 5000);
+    CHECK(m2 != NULL && m2 != m1);
+    CHECK(m2[0] == 0xAA && m2[31] == 0 && _is_zero(m2 + 32, 5000 - 32));
+    h = _mgn_mem_header(m2);
+    CHECK(h->s == 5000 && h->c == MGN_MEM_NO_CLASS && h->r == 1);
+    CHECK(pool->count == 1);
+    CHECK(_mgn_mem_find(&pool, m1) == NULL);              // the old block went to its free list
+    CHECK(pool->free_count[_mgn_mem_class(32)] == 1);
+
+    // a block of the free list comes back zeroed
+    m1 = mgn_mem_alloc(&pool, 30);
+    CHECK(m1 == m0 && _is_zero(m1, 30));
+    CHECK(pool->free_count[_mgn_mem_class(32)] == 0);
+
+    // more than one owner, ralloc gives up one ownership and returns a copy
+    mgn_mem_retain(&pool, m1);
+    m1[0] = 7;
+    m0 = mgn_mem_ralloc(&pool, m1, 100);
+    CHECK(m0 != NULL && m0 != m1 && m0[0] == 7);
+    CHECK(_mgn_mem_header(m1)->r == 1 && _mgn_mem_header(m0)->r == 1);
+    CHECK(pool->count == 3);
+
+    mgn_mem_release(&pool, m0);
+    mgn_mem_release(&pool, m1);
+    mgn_mem_release(&pool, m2);
+    CHECK(pool->count == 0 && pool->live == NULL);
+    mgn_mem_release_all(&pool);
+    CHECK(pool == NULL);
+}
+
+static void _test_scopes(void)
+{
+    mgn_memory_pool pool = NULL;
+    uint8 *outer, *inner, *kept, *m;
+    uint8 *many[MGN_MEM_SCOPE_CHUNK * 2 + 3];
+    size_t i;
+
+    // outside a scope autorelease only drops the count, release_unused frees it
+    m = mgn_mem_alloc(&pool, 16);
+    mgn_mem_autorelease(&pool, m);
+    CHECK(_mgn_mem_header(m)->r == 0 && pool->count == 1);
+    mgn_mem_release_unused(&pool);
+    CHECK(pool->count == 0);
+
+    // nested scopes, popping the inner one releases only what it collected
+    CHECK(mgn_mem_autorelease_push(&pool) == 0);
+    outer = mgn_mem_alloc(&pool, 16);
+    mgn_mem_autorelease(&pool, outer);
+    CHECK(_mgn_mem_header(outer)->r == 1);                 // kept until the scope is popped
+
+    CHECK(mgn_mem_autorelease_push(&pool) == 0);
+    CHECK(pool->scopes == 2);
+    inner = mgn_mem_alloc(&pool, 16);
+    mgn_mem_autorelease(&pool, inner);
+    kept = mgn_mem_alloc(&pool, 16);
+    mgn_mem_retain(&pool, kept);
+    mgn_mem_autorelease(&pool, kept);
+    CHECK(pool->count == 3);
+    mgn_mem_autorelease_pop(&pool);
+    CHECK(pool->scopes == 1 && pool->count == 2);
+    CHECK(_mgn_mem_find(&pool, inner) == NULL);
+    CHECK(_mgn_mem_find(&pool, outer) != NULL);
+    CHECK(_mgn_mem_find(&pool, kept) != NULL && _mgn_mem_header(kept)->r == 1);
+
+    // a scope spanning several chunks
+    CHECK(mgn_mem_autorelease_push(&pool) == 0);
+    for (i = 0; i < sizeof(many) / sizeof(many[0]); i++)
+    {
+        many[i] = mgn_mem_alloc(&pool, 16);
+        mgn_mem_autorelease(&pool, many[i]);
+    }
+    CHECK(pool->count == 2 + sizeof(many) / sizeof(many[0]));
+    mgn_mem_autorelease_pop(&pool);
+    CHECK(pool->scopes == 1 && pool->count == 2);
+    CHECK(_mgn_mem_find(&pool, outer) != NULL);
+
+    mgn_mem_autorelease_pop(&pool);
+    CHECK(pool->scopes == 0 && pool->count == 1);
+    CHECK(_mgn_mem_find(&pool, outer) == NULL);
+
+    // popping without a scope does nothing
+    mgn_mem_autorelease_pop(&pool);
+    CHECK(pool->scopes == 0 && pool->count == 1);
+
+    mgn_mem_release(&pool, kept);
+    CHECK(pool->count == 0);
+
+    // release_all also frees a scope left open
+    CHECK(mgn_mem_autorelease_push(&pool) == 0);
+    m = mgn_mem_alloc(&pool, 16);
+    mgn_mem_autorelease(&pool, m);
+    mgn_mem_release_all(&pool);
+    CHECK(pool == NULL);
+}
+
+int main(void)
+{
+    _test_header();
+    _test_scopes();
+
+    if (_failed) fprintf(stderr, "%d check(s) failed\n", _failed);
+    return _failed ? 1 : 0;
+}
@@ -306,6 +306,753 @@ static const char *test_closure(void) {
   return NULL;
 }
 
+static const char *test_frame_slots(void) {
+  struct v7 *v7 = v7_create();
+
+  /* slotted arguments and locals */
+  ASSERT_EVAL_OK(v7,
+                 "function sum(n){var s = 0, i; for (i = 0; i < n; i++) "
+                 "s += i; return s}");
+  ASSERT_EVAL_EQ(v7, "sum(10);", "45");
+  ASSERT_EVAL_EQ(v7, "(function(a){var b = a; b++; ++b; b -= 1; return b})(1)",
+                 "2");
+  ASSERT_EVAL_EQ(v7, "(function(a){return typeof a + typeof b; var b})(1)",
+                 "\"numberundefined\"");
+  ASSERT_EVAL_JS_EXPR_EQ(
+      v7, "(function(o){var k, r = []; for (k in o) r.push(k); return r})"
+          "({a: 1})",
+      "['a']");
+  ASSERT_EVAL_EQ(v7, "(function(a, a){return a})(1, 2)", "2");
+  ASSERT_EVAL_EQ(v7, "(function(){return g(); function g(){return 3}})()",
+                 "3");
+  ASSERT_EVAL_EQ(v7, "(function(x){return arguments[0] + x})(4)", "8");
+
+  /* recursion and unwinding through slotted frames */
+  ASSERT_EVAL_OK(v7, "function fib(n){return n < 2 ? n : fib(n-1) + fib(n-2)}");
+  ASSERT_EVAL_EQ(v7, "fib(15);", "610");
+  ASSERT_EVAL_OK(v7, "function thr(a){var b = a * 2; if (a > 0) throw b}");
+  ASSERT_EVAL_JS_EXPR_EQ(
+      v7, "(function(){var r, w = 9; try {thr(3)} catch (x) {r = x} "
+          "return [r, w]})()",
+      "[6, 9]");
+  ASSERT_EVAL_JS_EXPR_EQ(
+      v7, "(function(m){var t = 1; return [1, 2].map(function(v){return v * "
+          "m}).concat(t)})(3)",
+      "[3, 6, 1]");
+
+  /* names which stay on the scope object */
+  ASSERT_EVAL_OK(v7, "function mk(){var c = 0; return function(){return ++c}}");
+  ASSERT_EVAL_OK(v7, "var inc = mk(); inc();");
+  ASSERT_EVAL_EQ(v7, "inc();", "2");
+  ASSERT_EVAL_JS_EXPR_EQ(
+      v7, "(function(e){try {throw 3} catch (e) {var z = e} return [e, z]})(7)",
+      "[7, 3]");
+  ASSERT_EVAL_EQ(v7, "(function(){var x = 5; return eval('x')})()", "5");
+  ASSERT_EVAL_EQ(
+      v7, "(function(){var x = 5; return (function(){return eval('x')})()})()",
+      "5");
+  ASSERT_EVAL_EQ(v7, "(function f(){return typeof f})()", "\"function\"");
+  ASSERT_EVAL_EQ(v7, "(function(){var d = 1; return delete d})()", "false");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_shapes(void) {
+  struct v7 *v7 = v7_create();
+  val_t a, b;
+
+  /* objects built the same way share the shape */
+  ASSERT_EVAL_OK(v7, "function P(x, y){this.x = x; this.y = y}");
+  ASSERT_EQ(v7_exec(v7, "new P(1, 2)", &a), V7_OK);
+  ASSERT_EQ(v7_exec(v7, "new P(3, 4)", &b), V7_OK);
+  ASSERT(v7_to_object(a)->shape != 0);
+  ASSERT_EQ(v7_to_object(a)->shape, v7_to_object(b)->shape);
+  ASSERT_EQ(v7_exec(v7, "({y: 1, x: 2})", &b), V7_OK);
+  ASSERT(v7_to_object(a)->shape != v7_to_object(b)->shape);
+
+  /* lookups past the list and the index limits */
+  ASSERT_EVAL_OK(v7,
+                 "function fill(n){var o = {}, i; for (i = 0; i < n; i++) "
+                 "o['p' + i] = i; return o}");
+  ASSERT_EVAL_OK(v7,
+                 "function chk(o, n){var i; for (i = 0; i < n; i++) "
+                 "if (o['p' + i] !== i) return i; return o.q === undefined}");
+  ASSERT_EVAL_EQ(v7, "chk(fill(9), 9)", "true");
+  ASSERT_EVAL_EQ(v7, "chk(fill(40), 40)", "true");
+  ASSERT_EVAL_EQ(v7, "chk(fill(100), 100)", "true");
+  ASSERT_EVAL_EQ(v7, "var o = fill(20); o.p3 = 'x'; o.p3 + o.p19", "\"x19\"");
+  ASSERT_EVAL_EQ(v7, "Object.keys(fill(20)).length", "20");
+
+  /* large objects are indexed by name and keep their shape */
+  ASSERT_EQ(v7_exec(v7, "fill(8)", &a), V7_OK);
+  ASSERT(v7_to_object(a)->index == NULL);
+  ASSERT_EQ(v7_exec(v7, "fill(20)", &a), V7_OK);
+  ASSERT(v7_to_object(a)->index != NULL);
+  ASSERT(v7_to_object(a)->shape != V7_SHAPE_DICT);
+  ASSERT_EVAL_OK(v7, "function g19(o){return o.p19}");
+  ASSERT_EVAL_EQ(v7, "var o = fill(20); [g19(o), g19(fill(20)), g19(o)]",
+                 "[19,19,19]");
+  ASSERT_EVAL_EQ(v7, "delete o.p19; [g19(o), g19(fill(20))]",
+                 "[undefined,19]");
+
+  /* changes other than adding a property */
+  ASSERT_EVAL_EQ(v7, "var o = fill(20); delete o.p5; o.p5 = 7; o.p5 + o.p6",
+                 "13");
+  ASSERT_EVAL_EQ(v7, "o.hasOwnProperty('p5') && !o.hasOwnProperty('p20')",
+                 "true");
+  ASSERT_EVAL_JS_EXPR_EQ(
+      v7, "var a = new Array(); a.x = 1; for (var i = 0; i < 12; i++) "
+          "a[i] = i; a.splice(1, 9); a",
+      "[0, 10, 11]");
+  ASSERT_EVAL_EQ(v7, "a[1] + a[2]", "21");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_inline_caches(void) {
+  struct v7 *v7 = v7_create();
+  val_t c, proto;
+
+  /* each access site below is cached after the first call */
+  ASSERT_EVAL_OK(v7, "function get(o){return o.m()}");
+  ASSERT_EVAL_OK(v7, "function gx(o){return o.x}");
+  ASSERT_EVAL_OK(v7, "function setx(o, v){o.x = v; return o.x}");
+
+  /* shadowing, and changes up the prototype chain */
+  ASSERT_EVAL_OK(v7,
+                 "function P(){} P.prototype.m = function(){return 'P'}; "
+                 "var a = new P(), b = new P(); get(a); get(b);");
+  ASSERT_EVAL_EQ(v7, "b.m = function(){return 'own'}; get(a) + get(b)",
+                 "\"Pown\"");
+  ASSERT_EVAL_OK(v7,
+                 "var G = {m: function(){return 'G'}}, M = Object.create(G), "
+                 "c = Object.create(M); get(c);");
+  ASSERT_EVAL_EQ(v7, "M.m = function(){return 'M'}; get(c)", "\"M\"");
+  ASSERT_EVAL_EQ(v7, "delete M.m; get(c)", "\"G\"");
+  ASSERT_EQ(v7_exec(v7, "c", &c), V7_OK);
+  ASSERT_EQ(v7_exec(v7, "P.prototype", &proto), V7_OK);
+  v7_set_proto(v7, c, proto);
+  ASSERT_EVAL_EQ(v7, "get(c)", "\"P\"");
+  ASSERT_EVAL_EQ(v7, "delete P.prototype.m; typeof a.m", "\"undefined\"");
+
+  /* own properties by shape, and objects without one */
+  ASSERT_EVAL_EQ(v7, "gx({x: 1, y: 2}) + gx({y: 3, x: 4}) + gx({x: 5, y: 6})",
+                 "10");
+  ASSERT_EVAL_OK(v7,
+                 "var big = Object.create({x: 7}); for (var i = 0; i < 100; "
+                 "i++) big['k' + i] = i;");
+  ASSERT_EVAL_EQ(v7, "gx(big)", "7");
+  ASSERT_EVAL_EQ(v7, "big.x = 8; gx(big)", "8");
+
+  /* assignments */
+  ASSERT_EVAL_OK(v7, "var w = {x: 1}; setx(w, 2);");
+  ASSERT_EVAL_EQ(v7, "setx(w, 3)", "3");
+  ASSERT_EVAL_EQ(v7,
+                 "Object.defineProperty(w, 'x', {writable: false}); "
+                 "setx(w, 4)",
+                 "3");
+
+  /* variables, primitives and builtins */
+  ASSERT_EVAL_OK(v7, "gv = 1; function rg(){return gv}; rg();");
+  ASSERT_EVAL_EQ(v7, "gv = 2; rg()", "2");
+  ASSERT_EVAL_EQ(v7, "delete gv; (function(){try {return rg()} catch (e) "
+                     "{return 'gone'}})()",
+                 "\"gone\"");
+  ASSERT_EVAL_OK(v7, "function ls(s){return s.length + s.charAt(0)}");
+  ASSERT_EVAL_EQ(v7, "ls('abc') + ls('hello')", "\"3a5h\"");
+  ASSERT_EVAL_OK(v7, "function pu(a){a.push(9); return a.length}");
+  ASSERT_EVAL_EQ(v7, "pu([1, 2]) + pu([])", "4");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_prop_index(void) {
+  struct v7 *v7 = v7_create();
+  val_t m;
+
+  /* the global object, with as many names as the jsc_* libs add */
+  ASSERT_EVAL_OK(v7, "for (var g = 0; g < 100; g++) this['g' + g] = g;");
+  ASSERT(v7_to_object(v7_get_global(v7))->index != NULL);
+  ASSERT_EVAL_EQ(v7, "g99 + g0 + typeof Object", "\"99function\"");
+
+  ASSERT_EQ(v7_exec(v7,
+                    "var m = {}, i; for (i = 0; i < 500; i++) m['k' + i] = i; "
+                    "m",
+                    &m),
+            V7_OK);
+  ASSERT(v7_to_object(m)->index != NULL);
+  ASSERT_EVAL_EQ(v7, "m.k0 + m.k250 + m.k499", "749");
+  ASSERT_EVAL_EQ(v7, "for (i = 0; i < 500; i += 2) delete m['k' + i]; m.k250",
+                 "undefined");
+  ASSERT_EVAL_EQ(v7,
+                 "var bad = 0; for (i = 0; i < 500; i++) if (m['k' + i] !== "
+                 "(i % 2 ? i : undefined)) bad++; bad",
+                 "0");
+  ASSERT_EVAL_EQ(v7, "m.k250 = 'x'; m.k250 + Object.keys(m).length",
+                 "\"x251\"");
+  ASSERT_EVAL_EQ(v7, "m.hasOwnProperty('k1') && !m.hasOwnProperty('k2')",
+                 "true");
+  ASSERT_EVAL_EQ(v7, "typeof m.toString", "\"function\"");
+
+  /* a small object which lost a property grows past the threshold */
+  ASSERT_EQ(v7_exec(v7,
+                    "var d = {a: 1}; delete d.a; for (i = 0; i < 40; i++) "
+                    "d['p' + i] = i; d",
+                    &m),
+            V7_OK);
+  ASSERT(v7_to_object(m)->index != NULL);
+  ASSERT_EVAL_EQ(v7, "d.p0 + d.p39 + (d.a === undefined)", "40");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_atoms(void) {
+  struct v7 *v7 = v7_create();
+  val_t a, b, o;
+
+  a = v7_mk_atom(v7, "longName", 8);
+  b = v7_mk_atom(v7, "longName", 8);
+  ASSERT((a & V7_TAG_MASK) == V7_TAG_STRING_D);
+  ASSERT(a == b);
+  ASSERT(v7_mk_string(v7, "longName", 8, 1) == a);
+  ASSERT(v7_find_atom(v7, "longName", 8) == a);
+  ASSERT(v7_find_atom(v7, "noSuchAtom", 10) == V7_UNDEFINED);
+  /* built-in dictionary strings are atoms too */
+  ASSERT((v7_mk_atom(v7, "prototype", 9) & V7_TAG_MASK) == V7_TAG_STRING_D);
+  /* too short or too long for an atom */
+  ASSERT((v7_mk_atom(v7, "abc", 3) & V7_TAG_MASK) != V7_TAG_STRING_D);
+  a = v7_mk_atom(v7,
+                 "x123456789012345678901234567890123456789012345678901234567890"
+                 "1234",
+                 65);
+  ASSERT(v7_is_string(a) && (a & V7_TAG_MASK) != V7_TAG_STRING_D);
+
+  /* names of new properties become atoms */
+  ASSERT_EQ(v7_exec(v7, "var o = {}; o['some' + 'Name'] = 1; o", &o), V7_OK);
+  ASSERT((v7_to_object(o)->properties->name & V7_TAG_MASK) ==
+         V7_TAG_STRING_D);
+  ASSERT_EVAL_EQ(v7, "o.someName + o['so' + 'meName']", "2");
+  ASSERT_EVAL_EQ(v7, "o.otherName === undefined", "true");
+
+  /* objects in dictionary mode keep their names as they are */
+  ASSERT_EQ(v7_exec(v7,
+                    "var e = {a: 1}; delete e.a; e['fresh' + '_name'] = 2; e",
+                    &o),
+            V7_OK);
+  ASSERT((v7_to_object(o)->properties->name & V7_TAG_MASK) !=
+         V7_TAG_STRING_D);
+  ASSERT_EVAL_EQ(v7, "e.fresh_name + e['fresh' + '_name']", "4");
+  ASSERT_EVAL_EQ(v7, "e.someName === undefined", "true");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/* Runs serialized bcode of `src` and returns how much `foreign_strings` grew */
+static size_t run_serialized(struct v7 *v7, const char *src, char *buf,
+                             size_t size, val_t *res) {
+  FILE *fp = tmpfile();
+  size_t n, len = v7->foreign_strings.len;
+
+  if (fp == NULL || v7_compile(src, 1, 1, fp) != V7_OK) return ~0;
+  n = ftell(fp);
+  rewind(fp);
+  if (n > size || fread(buf, 1, n, fp) != n) n = 0;
+  fclose(fp);
+  if (b_exec(v7, buf, n, V7_UNDEFINED, V7_UNDEFINED, V7_UNDEFINED, 0, 0, 0,
+             res) != V7_OK) {
+    return ~0;
+  }
+  return v7->foreign_strings.len - len;
+}
+
+static const char *test_bcode_vals(void) {
+  struct v7 *v7 = v7_create();
+  static char buf1[1024], buf2[1024];
+  val_t v, f;
+  size_t grown;
+
+  /* strings of serialized bcode are made once, however often they're used */
+  grown = run_serialized(v7,
+                         "function isError(codeName) {"
+                         "  return codeName === 'errorCode'; }"
+                         "var i, n = 0; for (i = 0; i < 10; i++) "
+                         "  if (isError('errorCode')) n++; n",
+                         buf1, sizeof(buf1), &v);
+  ASSERT(grown != (size_t) ~0);
+  ASSERT_EQ(v7_to_number(v), 10);
+  v7_destroy(v7);
+  v7 = v7_create();
+  ASSERT_EQ(run_serialized(v7,
+                           "function isError(codeName) {"
+                           "  return codeName === 'errorCode'; }"
+                           "var i, n = 0; for (i = 0; i < 1000; i++) "
+                           "  if (isError('errorCode')) n++; n",
+                           buf2, sizeof(buf2), &v),
+            grown);
+  ASSERT_EQ(v7_to_number(v), 1000);
+
+  /* names are made once too */
+  ASSERT_EQ(v7_exec(v7,
+                    "function longerName(firstArg) { var localName = firstArg;"
+                    "  return localName; } longerName",
+                    &f),
+            V7_OK);
+  ASSERT(to_js_function(f)->bcode->vals == NULL);
+  ASSERT_EVAL_EQ(v7, "longerName('x') + longerName('y')", "\"xy\"");
+  ASSERT(to_js_function(f)->bcode->vals != NULL);
+  ASSERT_EQ(to_js_function(f)->bcode->vals_cnt, 3);
+  ASSERT_EVAL_EQ(v7, "longerName.name", "\"longerName\"");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_try_stack(void) {
+  struct v7 *v7 = v7_create();
+
+  /* loops and `switch` are blocks of the frame's own "try stack" */
+  ASSERT_EVAL_EQ(v7,
+                 "var n = 0, i, j; for (i = 0; i < 10; i++) { "
+                 "  for (j = 0; j < 10; j++) { switch (j) { case 3: continue; "
+                 "  case 7: break; default: n++; } if (j == 8) break; } } n",
+                 "70");
+  ASSERT(v7->call_stack->blocks == NULL ||
+         v7->call_stack->blocks == v7->call_stack->blocks_buf);
+  ASSERT_EQ(v7->call_stack->blocks_cnt, 0);
+
+  /* more blocks than the frame holds without allocating */
+  ASSERT_EVAL_EQ(v7,
+                 "function deep(x) { var a, b, c, d, e, f, g, h, k, m; "
+                 "  for (a = 0; a < 1; a++) for (b = 0; b < 1; b++) "
+                 "  for (c = 0; c < 1; c++) for (d = 0; d < 1; d++) "
+                 "  for (e = 0; e < 1; e++) for (f = 0; f < 1; f++) "
+                 "  for (g = 0; g < 1; g++) for (h = 0; h < 1; h++) "
+                 "  for (k = 0; k < 1; k++) for (m = 0; m < 1; m++) "
+                 "  try { if (x) throw x; return 'r'; } finally { x = 0; } } "
+                 "var r = ''; try { deep(0); r += deep(0); deep('t'); } "
+                 "catch (err) { r += err; } r",
+                 "\"rt\"");
+  ASSERT_EVAL_EQ(v7,
+                 "var s = ''; for (i = 0; i < 3; i++) { try { "
+                 "  for (j = 0; j < 3; j++) { if (j == i) throw j; } "
+                 "} catch (e) { s += e; } finally { s += '.'; } } s",
+                 "\"0.1.2.\"");
+  ASSERT_EQ(v7->call_stack->blocks_cnt, 0);
+
+  /* nested scripts don't see the blocks of the script which runs them */
+  ASSERT_EVAL_EQ(v7,
+                 "var t = ''; for (i = 0; i < 2; i++) { try { "
+                 "  t += eval('for (var q = 0; q < 2; q++) {} q'); "
+                 "  eval('throw 5'); } catch (e) { t += e; } } t",
+                 "\"2525\"");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_call_frames(void) {
+  struct v7 *v7 = v7_create();
+  val_t v;
+
+  /* `arguments` is made only for functions which refer to it */
+  ASSERT_EQ(eval(v7, "function add(a, b) { return a + b; }", &v), V7_OK);
+  v = v7_get(v7, v7->vals.global_object, "add", 3);
+  ASSERT(to_js_function(v)->bcode->no_arguments);
+  ASSERT_EQ(eval(v7, "function cnt(a) { return arguments.length; }", &v),
+            V7_OK);
+  v = v7_get(v7, v7->vals.global_object, "cnt", 3);
+  ASSERT(!to_js_function(v)->bcode->no_arguments);
+
+  ASSERT_EVAL_EQ(v7, "[add(1, 2), add(1), add(1, 2, 3), cnt(1, 2, 3), cnt()]",
+                 "[3,NaN,3,3,0]");
+  ASSERT_EVAL_EQ(v7, "(function(a, b) { return typeof b; })(1)",
+                 "\"undefined\"");
+  ASSERT_EVAL_EQ(v7, "(function() { return eval('arguments[1]'); })(1, 2)",
+                 "2");
+  ASSERT_EVAL_EQ(
+      v7, "(function(a) { return (function() { return arguments[0]; })(a); })(5)",
+      "5");
+  ASSERT_EVAL_EQ(v7,
+                 "(function(a) { var f = function() { return a; }; "
+                 "  return f(); })({x: 1}).x",
+                 "1");
+
+  /* frames are reused, a few of them are kept */
+  ASSERT_EVAL_EQ(v7,
+                 "function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }"
+                 "fib(15)",
+                 "610");
+  ASSERT(v7->free_frames != NULL);
+  ASSERT_EVAL_EQ(v7,
+                 "function down(n) { if (n == 0) throw 'bottom'; down(n - 1); }"
+                 "var r; try { down(200); } catch (e) { r = e; } r",
+                 "\"bottom\"");
+  ASSERT(v7->free_frames_cnt == V7_FRAME_POOL_SIZE);
+  ASSERT(v7->call_stack->prev == NULL);
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_max_stack(void) {
+  struct v7 *v7 = v7_create();
+  val_t v;
+
+  /* the statement value, the operands */
+  ASSERT_EQ(eval(v7, "function add(a, b) { return a + b; }", &v), V7_OK);
+  v = v7_get(v7, v7->vals.global_object, "add", 3);
+  ASSERT_EQ(to_js_function(v)->bcode->max_stack, 3);
+  /* and `this`, the function and the arguments of both calls */
+  ASSERT_EQ(eval(v7, "function g(a, b) { return add(a, add(b, 1)); }", &v),
+            V7_OK);
+  v = v7_get(v7, v7->vals.global_object, "g", 1);
+  ASSERT_EQ(to_js_function(v)->bcode->max_stack, 8);
+
+  /* loops and `try` blocks don't make the depth grow */
+  ASSERT_EQ(eval(v7,
+                 "function l(o) { var s = 0, k, i;"
+                 "  for (k in o) s += o[k];"
+                 "  for (k in o) s += o[k];"
+                 "  for (i = 0; i < 3; i++) {"
+                 "    try { s += add(i, 1); } catch (e) { s--; }"
+                 "    finally { s += 2; }"
+                 "  }"
+                 "  return s; }",
+                 &v),
+            V7_OK);
+  v = v7_get(v7, v7->vals.global_object, "l", 1);
+  ASSERT(to_js_function(v)->bcode->max_stack <= 10);
+  ASSERT_EVAL_EQ(v7, "l({a: 1, b: 2})", "18");
+
+  /* deep stacks: the stack grows when entering the functions */
+  ASSERT_EVAL_EQ(v7,
+                 "function deep(n) { return n == 0 ? 0 :"
+                 "  [n, deep(n - 1) + 1, {x: [n, n]}][1]; } deep(500)",
+                 "500");
+  ASSERT_EVAL_EQ(v7,
+                 "function thr(n) { try { if (n == 0) throw [1, 2];"
+                 "  return thr(n - 1); } catch (e) { return e.length + n; } }"
+                 "thr(300)",
+                 "2");
+  ASSERT(v7->stack.len == 0);
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/* Counts the instructions of function `name`, or those equal to `op` */
+static int count_ops(struct v7 *v7, const char *name, int op) {
+  val_t v = v7_get(v7, v7->vals.global_object, name, ~0);
+  struct bcode *bcode = to_js_function(v)->bcode;
+  const char *p = bcode_end_names(bcode->ops.p, bcode->names_cnt);
+  const char *end = bcode->ops.p + bcode->ops.len;
+  int n = 0;
+
+  for (; p < end; p = bcode_next_op(bcode, p)) {
+    n += (op == OP_MAX || (uint8_t) *p == op);
+  }
+  return n;
+}
+
+/*
+ * Creates a VM that optimizes the compiled bcode and one that runs it as is,
+ * and evaluates `src` in both
+ */
+static const char *create_opt_vms(struct v7 *vms[2], const char *src) {
+  struct v7_mk_opts opts;
+  val_t v;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.no_bcode_opt = 1;
+  vms[0] = v7_create();
+  vms[1] = v7_create_opt(opts);
+  ASSERT_EQ(eval(vms[0], src, &v), V7_OK);
+  ASSERT_EQ(eval(vms[1], src, &v), V7_OK);
+  return NULL;
+}
+
+/* Each of `cases` is an expression and the result it gives in both VMs */
+#define ASSERT_OPT_VMS_EVAL_EQ(vms, cases)                   \
+  do {                                                       \
+    size_t i_;                                               \
+    for (i_ = 0; i_ < ARRAY_SIZE(cases); i_++) {             \
+      ASSERT_EVAL_EQ((vms)[0], cases[i_][0], cases[i_][1]); \
+      ASSERT_EVAL_EQ((vms)[1], cases[i_][0], cases[i_][1]); \
+    }                                                        \
+  } while (0)
+
+static const char *test_bcode_opt(void) {
+  const char *src =
+      "function f(o) { var s = 0;"
+      "  for (var i = 0; i < 3; i++) s = s + o.a * 2 + 3 * 4;"
+      "  return s; }"
+      "function k() { if (!1) return 5; return 2 * 3 + 1; 4; }"
+      "function c() { return 1 + 2 * 3 - 4 / 2; }";
+  static const char *cases[][2] = {
+    {"f({a: 5})", "66"},
+    {"k()", "7"},
+    {"c()", "5"},
+    /* folded constants give what the operators give at run time */
+    {"1 + 2 * 3 - 4 / 2", "5"},
+    {"1 / -0", "-Infinity"},
+    {"1 / (0 * -1)", "-Infinity"},
+    {"0 / 0", "NaN"},
+    {"(0 / 0) == (0 / 0)", "false"},
+    {"(0 / 0) != (0 / 0)", "true"},
+    {"1 === 1.0", "true"},
+    {"~5 | 1 << 4", "-6"},
+    {"7 % 3 > 0 && !0", "true"},
+    {"'a' + 1 + 2", "\"a12\""},
+    {"if (1) 2; else 3", "2"},
+    {"var n = 0; do { n++; } while (0); n", "1"},
+    {"var n = 0; while (1) { if (++n > 3) break; } n", "4"},
+    {"var n = 0; try { n = 1; } finally { n += 2 * 3; } n", "7"},
+  };
+  struct v7 *vms[2];
+  const char *err;
+
+  if ((err = create_opt_vms(vms, src)) != NULL) return err;
+  ASSERT_OPT_VMS_EVAL_EQ(vms, cases);
+
+  /* fused super-instructions, only in the optimized code */
+  ASSERT_EQ(count_ops(vms[0], "f", OP_GET_PROP), 1);
+  ASSERT(count_ops(vms[0], "f", OP_SET_LOCAL_DROP) > 0);
+  ASSERT_EQ(count_ops(vms[1], "f", OP_GET_PROP), 0);
+  ASSERT_EQ(count_ops(vms[1], "f", OP_SET_LOCAL_DROP), 0);
+  ASSERT(count_ops(vms[0], "f", OP_MAX) < count_ops(vms[1], "f", OP_MAX));
+
+  /* the constant branches and the dead code are gone */
+  ASSERT_EQ(count_ops(vms[0], "k", OP_MAX), 3);
+  ASSERT_EQ(count_ops(vms[0], "k", OP_PUSH_LIT), 1);
+  ASSERT(count_ops(vms[1], "k", OP_MAX) > 3);
+
+  /* the arithmetic is done by the compiler */
+  ASSERT_EQ(count_ops(vms[0], "c", OP_ADD) + count_ops(vms[0], "c", OP_MUL) +
+                count_ops(vms[0], "c", OP_DIV),
+            0);
+  ASSERT(count_ops(vms[1], "c", OP_MUL) > 0);
+
+  v7_destroy(vms[1]);
+  v7_destroy(vms[0]);
+  return NULL;
+}
+
+static const char *test_loop_ops(void) {
+  struct v7 *v7 = v7_create();
+  val_t v;
+
+  ASSERT_EQ(eval(v7,
+                 "function sum(n) { var s = 0;"
+                 "  for (var i = 0; i < n; i++) s += i;"
+                 "  for (; n >= 1; --n) {}"
+                 "  return s + n; }",
+                 &v),
+            V7_OK);
+  ASSERT_EVAL_EQ(v7, "sum(10)", "45");
+  ASSERT_EQ(count_ops(v7, "sum", OP_INC_LOCAL), 1);
+  ASSERT_EQ(count_ops(v7, "sum", OP_DEC_LOCAL), 1);
+  ASSERT_EQ(count_ops(v7, "sum", OP_JMP_LT), 1);
+  ASSERT_EQ(count_ops(v7, "sum", OP_JMP_GE), 1);
+  /* the value of `--n` isn't used */
+  ASSERT_EQ(count_ops(v7, "sum", OP_SUB), 0);
+
+  /* `++` and `--` convert to numbers */
+  ASSERT_EVAL_EQ(v7, "var a = '5', b = a++; [a, b, ++a, a--, --a]",
+                 "[6,5,7,7,5]");
+  ASSERT_EVAL_EQ(v7, "(function() { var a = '5', b = a++;"
+                 "  return [a, b, ++a, a--, --a]; })()",
+                 "[6,5,7,7,5]");
+  ASSERT_EVAL_EQ(v7, "var u; u++", "NaN");
+  ASSERT_EVAL_EQ(v7, "1 / (function() { var z = -0; return z++; })()",
+                 "-Infinity");
+  ASSERT_EVAL_EQ(v7,
+                 "var calls = 0, o = {valueOf: function() { calls++; "
+                 "return 2; }}, p = o;"
+                 "[o++, o, (function(x) { return [x--, x]; })(p), calls]",
+                 "[2,3,[2,1],2]");
+  ASSERT_EVAL_EQ(v7, "Object.defineProperty(this, 'ro', {value: 3});"
+                 "[ro++, ro, ++ro]",
+                 "[3,3,4]");
+  ASSERT_EVAL_EQ(v7, "try { nope++; } catch (e) { e instanceof ReferenceError }",
+                 "true");
+  ASSERT_EVAL_EQ(v7, "(function() { 'use strict';"
+                 "  try { nope--; } catch (e) { return e instanceof "
+                 "ReferenceError; } })()",
+                 "true");
+
+  /* compare-and-branch: strings, objects and `NaN` */
+  ASSERT_EVAL_EQ(v7,
+                 "var n = 0, s;"
+                 "for (s = 'a'; s <= 'c';"
+                 "     s = String.fromCharCode(s.charCodeAt(0) + 1)) n++; n",
+                 "3");
+  ASSERT_EVAL_EQ(v7, "n = 0; for (var x = 0; x < NaN; x++) n++; n", "0");
+  ASSERT_EVAL_EQ(v7, "n = 0; do n++; while (n > NaN); n", "1");
+  ASSERT_EVAL_EQ(v7, "n = 0; while ({valueOf: function() { return n; }} < 3) "
+                 "n++; n",
+                 "3");
+  ASSERT_EVAL_EQ(v7, "n = 0; for (var y = 5; y > 0; y -= 2) n++; n", "3");
+
+  /* the fast paths of two numbers */
+  ASSERT_EVAL_EQ(v7, "[1 + 2, 1 + '2', 5 - true, 2 * 3.5, '6' * '7']",
+                 "[3,\"12\",4,7,42]");
+  ASSERT_EVAL_NUM_EQ(v7, "var i = 0, j = 0; (i / j)", NAN);
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_switch_table(void) {
+  const char *src =
+      "function f(x) { var r = '';"
+      "  switch (x) {"
+      "    case 1: r += 'a';"
+      "    case 2: r += 'b'; break;"
+      "    case 4: r += 'd'; break;"
+      "    case -1: r += 'm';"
+      "    case 1: r += 'e'; break;"
+      "    default: r += 'z';"
+      "    case 3: r += 'c';"
+      "  } return r; }"
+      "function g(s) {"
+      "  switch (s) {"
+      "    case 'foo': return 1; case 'bar': return 2; case '': return 3;"
+      "    case 'foo': return 4; case '10': return 5;"
+      "  } return 0; }"
+      "function h(x, y) {"
+      "  switch (x) { case 1: return 1; case y: return 2; case 3: return 3; }"
+      "  return 0; }"
+      "var vf = [1, 2, 3, 4, 5, -1, 0, -0, 1.5, NaN, '1', '4', true, null,"
+      "  {valueOf: function() { return 2; }}, 4294967297];"
+      "var vg = ['foo', 'bar', '', 'fo', 'foo2', 10, '10'];";
+  /* the other types go on to the `==` comparisons */
+  static const char *cases[][2] = {
+    {"vf.map(f)",
+     "[\"ab\",\"b\",\"c\",\"d\",\"zc\",\"me\",\"zc\",\"zc\",\"zc\",\"zc\","
+     "\"ab\",\"d\",\"ab\",\"zc\",\"b\",\"zc\"]"},
+    {"vg.map(g)", "[1,2,3,0,0,5,5]"},
+    {"[h(1, 2), h(2, 2), h(3, 3), h('3', 5)]", "[1,2,2,3]"},
+    {"var n = 0; for (var i = 0; i < 10; i++) {"
+     "  switch (i % 4) { case 0: n += 1; break;"
+     "    case 1: n += 10; continue; case 2: n += 100; break;"
+     "    case 3: n += 1000; }"
+     "  n += 10000; } n",
+     "72233"},
+  };
+  struct v7 *vms[2];
+  const char *err;
+  int i;
+
+  if ((err = create_opt_vms(vms, src)) != NULL) return err;
+  ASSERT_OPT_VMS_EVAL_EQ(vms, cases);
+
+  /* the tables are built by the compiler, with or without optimization */
+  for (i = 0; i < 2; i++) {
+    ASSERT_EQ(count_ops(vms[i], "f", OP_SWITCH_NUM), 1);
+    ASSERT_EQ(count_ops(vms[i], "g", OP_SWITCH_STR), 1);
+    /* not all of the labels are constant */
+    ASSERT_EQ(count_ops(vms[i], "h", OP_SWITCH_NUM), 0);
+  }
+
+  v7_destroy(vms[1]);
+  v7_destroy(vms[0]);
+  return NULL;
+}
+
+static const char *test_generators(void) {
+  struct v7 *v7 = v7_create();
+  val_t v;
+
+  ASSERT_EQ(eval(v7,
+                 "function* g(a) { var x = yield a;"
+                 "  try { yield x + 1; } finally { log.push('fin'); }"
+                 "  return 9; }"
+                 "function* cnt(n) {"
+                 "  for (var i = 0; i < n; i++) {"
+                 "    try { yield i; } catch (e) { log.push(e); } } }"
+                 "function* inner() { try { throw 1; }"
+                 "  catch (e) { var q = yield e; yield q + e; } }"
+                 "function drain(it) { var r, a = [];"
+                 "  while (!(r = it.next()).done) a.push(r.value); return a; }"
+                 "var log = [];",
+                 &v),
+            V7_OK);
+
+  ASSERT_EVAL_EQ(v7, "var it = g(1); [it.next(), it.next(5)]",
+                 "[{\"value\":1,\"done\":false},"
+                 "{\"value\":6,\"done\":false}]");
+  ASSERT_EVAL_EQ(v7, "[it.next().value, it.next().done, log]",
+                 "[9,true,[\"fin\"]]");
+  ASSERT_EVAL_EQ(v7, "drain(cnt(4))", "[0,1,2,3]");
+  /* `throw` is caught in the generator, `return` ends it */
+  ASSERT_EVAL_EQ(v7,
+                 "log = []; it = cnt(3); it.next();"
+                 "[it.throw('x').value, it.return(7).value, it.next().done,"
+                 " log]",
+                 "[1,7,true,[\"x\"]]");
+  ASSERT_EVAL_EQ(v7, "it = inner(); [it.next().value, it.next(10).value]",
+                 "[1,11]");
+  ASSERT_EVAL_EQ(v7, "({k: 3, m: function*() { yield this.k; }}).m().next()",
+                 "{\"value\":3,\"done\":false}");
+  ASSERT_EVAL_ERR(v7, "g(1).throw(new Error('e'))", V7_EXEC_EXCEPTION);
+  ASSERT_EVAL_ERR(v7, "Object.getPrototypeOf(g(1)).next.call({})",
+                  V7_EXEC_EXCEPTION);
+  ASSERT_EVAL_ERR(v7, "function f() { yield 1; }", V7_SYNTAX_ERROR);
+
+  /* the body runs up to the first `await`, the rest when the jobs run */
+  ASSERT_EQ(eval(v7,
+                 "log = [];"
+                 "async function a(x) { log.push('a'); var y = await x;"
+                 "  log.push(y); return y * 2; }"
+                 "async function b() { await 0; throw 'no'; }"
+                 "a(Promise.resolve(21)).then(function(v) { log.push(v); });"
+                 "b()['catch'](function(e) { log.push(e); });"
+                 "log.push('sync');",
+                 &v),
+            V7_OK);
+  ASSERT_EVAL_EQ(v7, "log", "[\"a\",\"sync\",21,42,\"no\"]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+#ifdef V7_ENABLE_JIT
+static const char *test_jit(void) {
+  struct v7 *v7 = v7_create();
+  val_t v;
+
+  ASSERT_EQ(eval(v7,
+                 "function f(a, n) { var s = 0, i;"
+                 "  for (i = 0; i < n; i++) {"
+                 "    s += a.x * i - (i & 3) + (i >= n / 2 ? 1 : -1);"
+                 "    if (i == n - 2) a.x = '1';"
+                 "  }"
+                 "  return s; }",
+                 &v),
+            V7_OK);
+  ASSERT_EVAL_EQ(v7, "f({x: 2}, 3000)", "8989501");
+  ASSERT(to_js_function(v7_get(v7, v7->vals.global_object, "f", 1))
+             ->bcode->jit != NULL);
+
+  /* native code leaves where it can't go on, results don't change */
+  ASSERT_EVAL_EQ(v7, "f({x: 2}, 3000)", "8989501");
+  ASSERT_EVAL_EQ(v7, "f({x: 'a'}, 2)", "NaN");
+  ASSERT_EVAL_EQ(v7, "f(Object.create({x: 3}), 4)", "6");
+  ASSERT_EVAL_EQ(v7, "f({x: 1}, '3')", "-1");
+  ASSERT_EVAL_EQ(v7, "var g = 0; for (var k = 0; k < 2000; k++) g += k % 7;"
+                 "g += 0.5; g",
+                 "5995.5");
+
+  v7_destroy(v7);
+  return NULL;
+}
+#endif
+
 static enum v7_err adder(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   double sum = 0;
@@ -319,6 +1066,68 @@ static enum v7_err adder(struct v7 *v7, v7_val_t *res) {
   return rcode;
 }
 
+static int args_on_stack;
+
+/* Joins its arguments, running the first one first when it is a string */
+static enum v7_err args_joiner(struct v7 *v7, v7_val_t *res) {
+  enum v7_err rcode = V7_OK;
+  char buf[100] = "";
+  unsigned long i;
+  v7_val_t v;
+
+  args_on_stack = (v7->vals.arguments == V7_TAG_NOVALUE);
+  if (v7_argc(v7) > 0 && v7_is_string(v7_arg(v7, 0))) {
+    size_t len;
+    const char *code;
+    v = v7_arg(v7, 0);
+    code = v7_get_string_data(v7, &v, &len);
+    snprintf(buf, sizeof(buf), "%.*s", (int) len, code);
+    rcode = v7_exec(v7, buf, &v);
+    if (rcode != V7_OK) return rcode;
+    buf[0] = '\0';
+  }
+  for (i = 0; i < v7_argc(v7); i++) {
+    size_t n = strlen(buf);
+    v = v7_arg(v7, i);
+    v7_stringify(v7, v, buf + n, sizeof(buf) - n, V7_STRINGIFY_DEFAULT);
+  }
+  *res = v7_mk_string(v7, buf, strlen(buf), 1);
+  return V7_OK;
+}
+
+static enum v7_err args_counter(struct v7 *v7, v7_val_t *res) {
+  *res = v7_mk_number(v7_array_length(v7, v7_get_arguments(v7)));
+  return V7_OK;
+}
+
+static const char *test_cfunction_args(void) {
+  struct v7 *v7 = v7_create();
+  v7_val_t g = v7_get_global(v7);
+
+  v7_set(v7, g, "joiner", 6, v7_mk_cfunction(args_joiner));
+  v7_set(v7, g, "counter", 7, v7_mk_cfunction(args_counter));
+
+  /* arguments are read right from the stack */
+  ASSERT_EVAL_EQ(v7, "joiner(1, 2, 3) + joiner()", "\"123\"");
+  ASSERT(args_on_stack);
+  ASSERT_EVAL_EQ(v7, "var f = joiner; [f(4), f.call(null, 5, 6)]",
+                 "[\"4\",\"56\"]");
+
+  /* the array is made when asked for */
+  ASSERT_EVAL_EQ(v7, "counter(1, 'a', {}) + counter()", "3");
+  ASSERT_EVAL_EQ(v7, "counter.apply(null, [1, 2])", "2");
+
+  /* arguments survive calls back into JS which grow the stack */
+  ASSERT_EVAL_EQ(
+      v7,
+      "joiner('var s = 0; for (var i = 0; i < 100; i++) s += joiner(i);', 7)",
+      "\"var s = 0; for (var i = 0; i < 100; i++) s += joiner(i);7\"");
+  ASSERT_EVAL_EQ(v7, "[1, 2].map(joiner)", "[\"101,2\",\"211,2\"]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
 static const char *test_native_functions(void) {
   struct v7 *v7 = v7_create();
 
@@ -819,10 +1628,98 @@ static const char *test_apply(void) {
   return NULL;
 }
 
-#ifdef V7_ENABLE_DENSE_ARRAYS
+/* Calls its first argument with the rest, passed right from the stack */
+static enum v7_err call_forwarder(struct v7 *v7, v7_val_t *res) {
+  struct v7_call_handle h;
+  val_t *argv;
+
+  /* so that pushing the call makes the stack grow */
+  mbuf_trim(&v7->stack);
+  argv = (val_t *) (v7->stack.buf + v7->args_base);
+  call_handle_init(&h, v7_arg(v7, 0), v7_mk_undefined());
+  return b_call(v7, &h, argv + 1, (int) v7_argc(v7) - 1, res);
+}
+
+static const char *test_call(void) {
+  struct v7 *v7 = v7_create();
+  struct v7_call_handle *h;
+  val_t v, fn, argv[3];
+  int i;
+
+  argv[0] = v7_mk_number(1);
+  argv[1] = v7_mk_number(2);
+  argv[2] = v7_mk_number(3);
+
+  ASSERT_EQ(eval(v7, "function f(a, b){return [this.x, a, b, arguments.length]}",
+                 &v),
+            V7_OK);
+  fn = v7_get(v7, v7->vals.global_object, "f", 1);
+  ASSERT_EQ(eval(v7, "({x: 'x'})", &v), V7_OK);
+  ASSERT_EQ(v7_call(v7, fn, v, argv, 3, &v), V7_OK);
+  ASSERT(check_value(v7, v, "[\"x\",1,2,3]"));
+  ASSERT_EQ(v7_call(v7, fn, v7_mk_undefined(), NULL, 0, &v), V7_OK);
+  ASSERT(check_value(v7, v, "[undefined,undefined,undefined,0]"));
+
+  fn = v7_get(v7, v7->vals.global_object, "Math", 4);
+  fn = v7_get(v7, fn, "max", 3);
+  ASSERT_EQ(v7_call(v7, fn, v7_mk_undefined(), argv, 3, &v), V7_OK);
+  ASSERT(check_num(v7, v, 3));
+
+  ASSERT_EQ(eval(v7, "function t(){throw 2}", &v), V7_OK);
+  fn = v7_get(v7, v7->vals.global_object, "t", 1);
+  ASSERT_EQ(v7_call(v7, fn, v7_mk_undefined(), NULL, 0, &v),
+            V7_EXEC_EXCEPTION);
+  ASSERT(check_num(v7, v, 2));
+  ASSERT_EQ(v7_call(v7, v7_mk_number(1), v7_mk_undefined(), NULL, 0, &v),
+            V7_EXEC_EXCEPTION);
+  ASSERT(v7_call_prepare(v7, v7_mk_number(1), v7_mk_undefined()) == NULL);
+
+  /* the handle keeps the function alive */
+  ASSERT_EQ(eval(v7, "(function(){ var s = 0; return function(a, b) {"
+                     "  return s += a + (b || 0); }; })()",
+                 &v),
+            V7_OK);
+  h = v7_call_prepare(v7, v, v7_mk_undefined());
+  ASSERT(h != NULL);
+  v = v7_mk_undefined();
+  for (i = 0; i < 100; i++) {
+    v7_gc(v7, 1);
+    ASSERT_EQ(v7_call_prepared(v7, h, argv, 1 + i % 3, &v), V7_OK);
+  }
+  ASSERT(check_num(v7, v, 232));
+  v7_call_handle_free(v7, h);
+
+  /* arguments taken from the stack while it grows */
+  v7_set(v7, v7->vals.global_object, "fwd", 3,
+         v7_mk_cfunction(call_forwarder));
+  ASSERT_EVAL_EQ(v7, "fwd(function(a, b, c){ return a + b + c; }, 1, 2, 3)",
+                 "6");
+  ASSERT_EVAL_EQ(v7, "fwd(Math.min, 3, 1, 2)", "1");
+
+  /* callbacks of Array methods */
+  ASSERT_EVAL_EQ(v7,
+                 "var o = {k: 10}; [1, 2, 3].map(function(x, i){ return "
+                 "x * this.k + i; }, o)",
+                 "[10,21,32]");
+  ASSERT_EVAL_EQ(v7, "[3, 1, 2].sort(function(a, b){ return a - b; })",
+                 "[1,2,3]");
+  /* a string `this` moved by the GC while the callbacks run */
+  ASSERT_EVAL_EQ(v7,
+                 "[1, 2].map(function(x){ for (var i = 0; i < 20000; i++) "
+                 "{ var o = {a: i}; } return String(this); }, "
+                 "'a long this string' + ' value here')",
+                 "[\"a long this string value here\","
+                 "\"a long this string value here\"]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
 static const char *test_dense_arrays(void) {
   struct v7 *v7 = v7_create();
-  val_t a;
+  val_t a, v, name = V7_UNDEFINED;
+  v7_prop_attr_t attrs = 0;
+  void *h;
 
   a = v7_mk_dense_array(v7);
 
@@ -862,12 +1759,83 @@ static const char *test_dense_arrays(void) {
 
   /* ensure that a zero length dense arrays is correctly recognized */
   a = v7_mk_dense_array(v7);
-  ASSERT(v7_next_prop(v7, a, NULL) == NULL);
+  h = v7_next_prop(NULL, a, NULL, NULL, &attrs);
+  ASSERT(h != NULL && (attrs & _V7_PROPERTY_HIDDEN));
+  ASSERT(v7_next_prop(h, a, NULL, NULL, NULL) == NULL);
+
+  /* the public iterator yields the elements as arrays used to list them */
+  ASSERT_EQ(eval(v7, "[10, 20, , 30]", &a), V7_OK);
+  h = v7_next_prop(NULL, a, &name, &v, &attrs);
+  ASSERT(h != NULL && check_str(v7, name, "3") && check_num(v7, v, 30));
+  ASSERT_EQ(attrs, 0);
+  h = v7_next_prop(h, a, &name, &v, NULL);
+  ASSERT(h != NULL && check_str(v7, name, "1") && check_num(v7, v, 20));
+  h = v7_next_prop(h, a, &name, &v, NULL);
+  ASSERT(h != NULL && check_str(v7, name, "0") && check_num(v7, v, 10));
+  h = v7_next_prop(h, a, NULL, NULL, &attrs);
+  ASSERT(h != NULL && (attrs & _V7_PROPERTY_HIDDEN));
+  ASSERT(v7_next_prop(h, a, NULL, NULL, NULL) == NULL);
+
+  /* the internal one yields them in order */
+  h = obj_next_prop(v7, NULL, a, &name, NULL, &attrs);
+  ASSERT(h != NULL && check_str(v7, name, "0") && attrs == 0);
+  h = obj_next_prop(v7, h, a, &name, NULL, NULL);
+  ASSERT(h != NULL && check_str(v7, name, "1"));
+  h = obj_next_prop(v7, h, a, &name, NULL, NULL);
+  ASSERT(h != NULL && check_str(v7, name, "3"));
+  h = obj_next_prop(v7, h, a, NULL, NULL, &attrs);
+  ASSERT(h != NULL && (attrs & _V7_PROPERTY_HIDDEN));
+
+  /* literals are dense, and so is the interpreter writing to them */
+  ASSERT_EVAL_EQ(v7, "a=[]; for (i = 0; i < 5; i++) a[i] = i * i; a",
+                 "[0,1,4,9,16]");
+  ASSERT_EVAL_EQ(v7, "a=[1,,3]; [a.length, 1 in a, a[1]]",
+                 "[3,false,undefined]");
+  ASSERT_EVAL_EQ(v7, "a=[1,2,3]; delete a[1]; [a.length, 1 in a]",
+                 "[3,false]");
+  ASSERT_EVAL_EQ(v7, "a=[1,2]; a[4]=5; [a.length, 3 in a, a[4]]",
+                 "[5,false,5]");
+  ASSERT_EVAL_EQ(v7, "a=[5,,7]; a.x=1; k=[]; for (i in a) k.push(i); k",
+                 "[\"0\",\"2\",\"x\"]");
+  ASSERT_EVAL_EQ(v7, "Object.keys([5,,7])", "[\"0\",\"2\"]");
+  ASSERT_EVAL_EQ(v7, "a=[1,2]; a['01']=3; a['1']=9; [a.length, a[1], a['01']]",
+                 "[2,9,3]");
+  ASSERT_EVAL_EQ(v7, "a=[1,2,3]; a.splice(1,1,'a','b'); a",
+                 "[1,\"a\",\"b\",3]");
+  ASSERT_EVAL_EQ(v7, "a=[]; a.splice(0,0,1,2); a", "[1,2]");
+  ASSERT_EVAL_EQ(v7, "a=[1,2,3]; Object.preventExtensions(a); a[0]=0; a[3]=4; a",
+                 "[0,2,3]");
+  ASSERT_EVAL_EQ(v7, "Array.prototype[1]='p'; a=[0,,2][1]; "
+                     "delete Array.prototype[1]; a",
+                 "\"p\"");
+
+  /* sparse writes demote the array to a plain object */
+  ASSERT_EVAL_EQ(v7, "a=[1,2]; a[100000]=3; [a.length, a[1], 2 in a, "
+                     "Object.keys(a).length]",
+                 "[100001,2,false,3]");
+  ASSERT_EVAL_EQ(v7, "a=[1,2]; a[100000]=3; a[2]=0; a.length", "100001");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_dense_arrays_gc(void) {
+  struct v7 *v7 = v7_create();
+
+  /* the GC sees the elements, including the ones only they refer to */
+  ASSERT_EVAL_OK(v7, "objs=[]; for (i = 0; i < 1000; i++) objs.push({x: i}); "
+                     "fns=[]; for (i = 0; i < 100; i++) "
+                     "fns.push(function(k){return function(){return k}}(i))");
+  v7_gc(v7, 1);
+  ASSERT_EVAL_OK(v7, "for (i = 0; i < 1000; i++) [{y: i}, function(){}]");
+  v7_gc(v7, 1);
+  ASSERT_EVAL_EQ(v7, "s=0; for (i = 0; i < 100; i++) s += fns[i](); "
+                     "[objs[999].x, s]",
+                 "[999,4950]");
 
   v7_destroy(v7);
   return NULL;
 }
-#endif
 
 static const char *test_parser(void) {
   int i;
@@ -3882,10 +4850,28 @@ static const char *run_all_tests(const char *filter, double *total_elapsed) {
   RUN_TEST(test_string_encoding);
   RUN_TEST(test_is_true);
   RUN_TEST(test_closure);
+  RUN_TEST(test_frame_slots);
+  RUN_TEST(test_shapes);
+  RUN_TEST(test_inline_caches);
+  RUN_TEST(test_prop_index);
+  RUN_TEST(test_atoms);
+  RUN_TEST(test_bcode_vals);
+  RUN_TEST(test_try_stack);
+  RUN_TEST(test_call_frames);
+  RUN_TEST(test_max_stack);
+  RUN_TEST(test_bcode_opt);
+  RUN_TEST(test_loop_ops);
+  RUN_TEST(test_switch_table);
+  RUN_TEST(test_generators);
+#ifdef V7_ENABLE_JIT
+  RUN_TEST(test_jit);
+#endif
   RUN_TEST(test_native_functions);
+  RUN_TEST(test_cfunction_args);
   RUN_TEST(test_stdlib);
   RUN_TEST(test_runtime);
   RUN_TEST(test_apply);
+  RUN_TEST(test_call);
   RUN_TEST(test_parser);
 #ifndef V7_LARGE_AST
   RUN_TEST(test_parser_large_ast);
@@ -3893,9 +4879,8 @@ static const char *run_all_tests(const char *filter, double *total_elapsed) {
   RUN_TEST(test_interpreter);
   RUN_TEST(test_interp_unescape);
   RUN_TEST(test_strings);
-#ifdef V7_ENABLE_DENSE_ARRAYS
   RUN_TEST(test_dense_arrays);
-#endif
+  RUN_TEST(test_dense_arrays_gc);
 #ifdef V7_ENABLE_FILE
   RUN_TEST(test_file);
 #endif
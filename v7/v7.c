@@ -1559,6 +1559,7 @@ void cr_context_free(struct cr_ctx *p_ctx);
 #define V7_ENABLE__Date__UTC 1
 #define V7_ENABLE__Math 1
 #define V7_ENABLE__Math__atan2 1
+#define V7_ENABLE__Promise 1
 #define V7_ENABLE__RegExp 1
 
 #endif /* V7_BUILD_PROFILE == V7_BUILD_PROFILE_MEDIUM */
@@ -1630,6 +1631,7 @@ void cr_context_free(struct cr_ctx *p_ctx);
 #define V7_ENABLE__Object__keys 1
 #define V7_ENABLE__Object__preventExtensions 1
 #define V7_ENABLE__Object__propertyIsEnumerable 1
+#define V7_ENABLE__Promise 1
 #define V7_ENABLE__RegExp 1
 #define V7_ENABLE__StackTrace 1
 #define V7_ENABLE__String__localeCompare 1
@@ -2113,6 +2115,8 @@ struct v7_pstate {
   int in_loop;      /* True if in a loop */
   int in_switch;    /* True if in a switch block */
   int in_strict;    /* True if in strict mode */
+  int in_generator; /* True if in a generator function, `yield` is allowed */
+  int in_async;     /* True if in an async function, `await` is allowed */
 };
 
 V7_PRIVATE enum v7_err parse(struct v7 *v7, struct ast *ast, const char *, int,
@@ -2256,6 +2260,11 @@ enum ast_tag {
 
   AST_USE_STRICT,
 
+  AST_GENERATOR,
+  AST_ASYNC,
+  AST_YIELD,
+  AST_AWAIT,
+
   AST_MAX_TAG
 };
 
@@ -2552,17 +2561,43 @@ enum v7_type {
   V7_NUM_TYPES
 };
 
+/* Number of local blocks a call frame holds without allocating */
+#define V7_FRAME_BLOCKS 8
+
+/* Number of unwound call frames kept for reuse */
+#define V7_FRAME_POOL_SIZE 64
+
 struct v7_call_frame {
   struct v7_call_frame *prev;
   size_t stack_size;
   struct bcode *bcode;
   char *bcode_ops;
+  /* offset of the caller's frame slots in `v7->stack` */
+  size_t slots_base;
   struct {
     val_t scope;
-    val_t try_stack;
     val_t this_obj;
+    /*
+     * Unlike the above, not the caller's: the record of the generator which
+     * runs in the frame, see `bcode_gen_suspend()`
+     */
+    val_t gen;
   } vals;
   unsigned is_constructor : 1;
+
+  /*
+   * "Try stack": local blocks (`try`, loops, `switch`) of the frame which
+   * control is in, innermost last, see `eval_try_push()`. Items are made by
+   * `LBLOCK_ITEM_CREATE()`. `blocks` is NULL until the first block, then
+   * points to `blocks_buf` until there are too many blocks for it. Blocks
+   * below `blocks_base` belong to the script which runs a nested one (see
+   * `b_exec()`) and are invisible to it.
+   */
+  int64_t *blocks;
+  unsigned int blocks_cnt;
+  unsigned int blocks_size;
+  unsigned int blocks_base;
+  int64_t blocks_buf[V7_FRAME_BLOCKS];
 };
 
 /*
@@ -2611,6 +2646,18 @@ struct v7_vals {
    * See also `is_returned` below
    */
   val_t returned_value;
+
+  /* prototype of generator objects, see `std_generator.c` */
+  val_t generator_prototype;
+
+  /*
+   * Internals of the promises of `js_stdlib.c`: the driver of async
+   * functions, the queue of the jobs of settled promises and the function
+   * which runs them. Undefined without `V7_ENABLE__Promise`.
+   */
+  val_t async_run;
+  val_t jobs;
+  val_t run_jobs;
 };
 
 struct v7 {
@@ -2627,6 +2674,13 @@ struct v7 {
    */
   struct v7_call_frame *call_stack;
 
+  /*
+   * Unwound call frames kept for reuse, linked through `prev`. At most
+   * `V7_FRAME_POOL_SIZE` of them.
+   */
+  struct v7_call_frame *free_frames;
+  unsigned int free_frames_cnt;
+
   /*
    * Bcode executes until it reaches `bottom_call_stack`. For top-level code,
    * it's empty object created inside `v7_create_opt()`. For some "inner"
@@ -2637,6 +2691,14 @@ struct v7 {
 
   struct mbuf stack; /* value stack for bcode interpreter */
 
+  /*
+   * Arguments of the current cfunction call when `vals.arguments` is
+   * `V7_TAG_NOVALUE`: `args_cnt` values at the byte offset `args_base` of
+   * `stack`. See `call_cfunction()`.
+   */
+  size_t args_base;
+  unsigned long args_cnt;
+
   struct mbuf owned_strings;   /* Sequence of (varint len, char data[]) */
   struct mbuf foreign_strings; /* Sequence of (varint len, char *data) */
 
@@ -2646,6 +2708,22 @@ struct v7 {
   struct gc_arena generic_object_arena;
   struct gc_arena function_arena;
   struct gc_arena property_arena;
+
+  struct mbuf shapes;       /* `struct v7_shape`, indexed by shape id */
+  uint32_t *shape_buckets;  /* shape transitions: chains of shape ids + 1 */
+  size_t shape_buckets_cnt; /* power of 2 */
+  /*
+   * Bumped whenever a cached property lookup (see `struct bcode_ic`) may go
+   * stale: a property is deleted, a watched object gets a new one or a new
+   * prototype, or GC runs.
+   */
+  uint32_t prop_epoch;
+
+  /* Atoms past the built-in dictionary, `struct v7_vec`; see `v7_mk_atom()` */
+  struct mbuf atoms;
+  /* Atoms by hash: open addressing, entries are `hash << 32 | (index + 1)` */
+  uint64_t *atom_table;
+  uint32_t atom_table_mask;
 #if V7_ENABLE__Memory__stats
   size_t function_arena_ast_size;
   size_t bcode_ops_size;
@@ -2762,6 +2840,10 @@ struct v7 {
   unsigned int is_stack_neutral : 1;
   /* true if precompiling; affects compiler bcode choices */
   unsigned int is_precompiling : 1;
+  /* true if compiled bcode is run as is, see `bcode_optimize()` */
+  unsigned int no_bcode_opt : 1;
+  /* true while the jobs of promises run, see `bcode_run_jobs()` */
+  unsigned int is_running_jobs : 1;
 };
 
 struct v7_property {
@@ -2775,6 +2857,63 @@ struct v7_property {
   val_t value; /* Property value */
 };
 
+/*
+ * Shape (hidden class): describes own property names of an object in the
+ * order they were added, so that objects which got the same names in the same
+ * order share it. Shapes form a tree of transitions rooted at the empty shape
+ * `0`; they're referenced by id (index in `v7->shapes`) and live as long as
+ * the v7 instance.
+ *
+ * An object which loses a property, or outgrows `V7_SHAPE_MAX_PROPS`, goes to
+ * the dictionary mode `V7_SHAPE_DICT`, where only the property list is kept.
+ */
+struct v7_shape {
+  uint32_t parent; /* shape without the last name */
+  uint32_t count;  /* number of names; the last one has index `count - 1` */
+  uint32_t hash;   /* hash of the last name */
+  uint32_t next;   /* next shape id + 1 in the same `v7->shape_buckets` chain */
+  char *name;      /* the last name, not null-terminated */
+  size_t name_len;
+  /*
+   * Name lookup table for shapes with more than `V7_SHAPE_LIST_MAX` names,
+   * built on the first lookup: open addressing, entries are ids + 1 of the
+   * shapes which added the names.
+   */
+  uint32_t *table;
+  uint32_t table_mask;
+};
+
+#define V7_SHAPE_DICT ((uint32_t) ~0)
+/* Shapes with at most that many names are looked up walking their parents */
+#define V7_SHAPE_LIST_MAX 8
+#define V7_SHAPE_MAX_PROPS 64
+#define V7_SHAPES_MAX 65536
+
+/*
+ * Private object attribute: a cached lookup depends on the object not getting
+ * new properties (it's on the prototype chain, or a receiver without a shape),
+ * so changes to it bump `v7->prop_epoch`
+ */
+#define _V7_OBJ_WATCHED (1 << 4)
+
+/*
+ * Hash index of the properties of an object, attached once it has
+ * `V7_PROP_INDEX_MIN` of them: open addressing with linear probing, the
+ * number of entries is a power of 2. Smaller objects walk the list.
+ */
+struct v7_prop_index_entry {
+  uint32_t hash;
+  struct v7_property *prop; /* NULL if the entry is empty */
+};
+
+struct v7_prop_index {
+  uint32_t mask; /* number of entries - 1 */
+  uint32_t count;
+  struct v7_prop_index_entry entries[1];
+};
+
+#define V7_PROP_INDEX_MIN 16
+
 /*
  * "base object": structure which is shared between objects and functions.
  */
@@ -2786,6 +2925,10 @@ struct v7_object {
   entity_id_part_t entity_id_base;
   entity_id_part_t entity_id_spec;
 #endif
+  /* shape id, see `struct v7_shape` */
+  uint32_t shape;
+  /* Own properties by name, for large objects with or without a shape */
+  struct v7_prop_index *index;
 };
 
 /*
@@ -3054,6 +3197,35 @@ V7_PRIVATE int v7_is_generic_object(v7_val_t v);
 
 V7_PRIVATE struct v7_property *v7_mk_property(struct v7 *v7);
 
+V7_PRIVATE void shapes_init(struct v7 *v7);
+V7_PRIVATE void shapes_destroy(struct v7 *v7);
+
+/* Returns index of the name in the given shape, or -1 if there's no such */
+V7_PRIVATE int shape_find(struct v7 *v7, uint32_t id, const char *name,
+                          size_t len);
+
+/*
+ * Switches the object to the dictionary mode. Should be called whenever the
+ * property list is changed other than by adding a property in
+ * `def_property_v()`, after the change.
+ */
+V7_PRIVATE void obj_shape_drop(struct v7 *v7, struct v7_object *o);
+
+/* Should be called after the property `p` is unlinked from the object */
+V7_PRIVATE void obj_prop_unlinked(struct v7 *v7, struct v7_object *o,
+                                  struct v7_property *p);
+
+/*
+ * Returns own property `name` of the object, which has index `idx` in the
+ * object's shape
+ */
+V7_PRIVATE struct v7_property *obj_shape_slot(struct v7 *v7,
+                                              struct v7_object *o,
+                                              uint32_t idx, val_t name);
+
+/* Invalidates all cached property lookups */
+V7_PRIVATE void prop_epoch_bump(struct v7 *v7);
+
 V7_PRIVATE struct v7_property *v7_get_own_property2(struct v7 *v7, val_t obj,
                                                     const char *name,
                                                     size_t len,
@@ -3146,6 +3318,14 @@ WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err v7_property_value(struct v7 *v7, val_t obj,
                                          struct v7_property *p, val_t *res);
 
+/*
+ * Like `v7_next_prop()`, but the elements of dense arrays come from the first
+ * one, as for-in and `Object.keys()` list them
+ */
+V7_PRIVATE void *obj_next_prop(struct v7 *v7, void *handle, val_t obj,
+                               val_t *name, val_t *value,
+                               v7_prop_attr_t *attrs);
+
 /*
  * Set new prototype `proto` for the given object `obj`. Returns `0` at
  * success, `-1` at failure (it may fail if given `obj` is a function object:
@@ -3222,6 +3402,34 @@ V7_PRIVATE enum v7_err v7_char_code_at(struct v7 *v7, v7_val_t s, v7_val_t at,
 V7_PRIVATE int s_cmp(struct v7 *, val_t a, val_t b);
 V7_PRIVATE val_t s_concat(struct v7 *, val_t, val_t);
 
+/*
+ * Atoms are interned strings longer than 5 bytes (shorter ones are inlined
+ * in `val_t` anyway) and at most `V7_ATOM_MAX_LEN` bytes. They are
+ * `V7_TAG_STRING_D` strings: indices below the size of the built-in
+ * dictionary refer to it, the rest to `v7->atoms`. Atoms live as long as the
+ * v7 instance, and `v7_mk_string()` returns the atom for a string which has
+ * one, so two atoms are equal iff their values are.
+ */
+#define V7_ATOM_MAX_LEN 64
+#ifdef V7_FREEZE
+/* frozen snapshots can only refer to the built-in dictionary */
+#define V7_ATOMS_MAX 0
+#else
+#define V7_ATOMS_MAX 8192
+#endif
+
+V7_PRIVATE void atoms_init(struct v7 *v7);
+V7_PRIVATE void atoms_destroy(struct v7 *v7);
+
+/*
+ * Returns the atom for the given string, making it if needed, or just a new
+ * string if it can't be an atom.
+ */
+V7_PRIVATE val_t v7_mk_atom(struct v7 *v7, const char *p, size_t len);
+
+/* Returns the existing atom for the given string, or `undefined` */
+V7_PRIVATE val_t v7_find_atom(struct v7 *v7, const char *p, size_t len);
+
 /*
  * Convert a C string to to an unsigned integer.
  * `ok` will be set to true if the string conforms to
@@ -3257,6 +3465,89 @@ V7_PRIVATE size_t unescape(const char *s, size_t len, char *to);
 
 #endif /* V7_STRING_H_INCLUDED */
 #ifdef V7_MODULE_LINES
+#line 1 "./v7/src/jit.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+#ifndef JIT_H_INCLUDED
+#define JIT_H_INCLUDED
+
+/* Amalgamated: #include "v7/src/internal.h" */
+
+/*
+ * Baseline JIT, enabled by `V7_ENABLE_JIT`: once a bcode gets hot, its
+ * instructions are translated one by one into x86-64 code working on the same
+ * data stack and frame slots as `eval_bcode()`. The native code handles
+ * numbers, locals, cached properties and jumps; whatever else it leaves at
+ * the instruction, which the interpreter runs, and the native code is entered
+ * again at the next instruction.
+ */
+#ifdef V7_ENABLE_JIT
+
+#if !defined(__x86_64__) || defined(_WIN32)
+#error "V7_ENABLE_JIT needs an x86-64 POSIX target"
+#endif
+
+/* Tracing shows what the interpreter runs, so it disables the JIT */
+#ifdef V7_BCODE_TRACE
+#undef V7_ENABLE_JIT
+#endif
+
+#endif /* V7_ENABLE_JIT */
+
+#ifdef V7_ENABLE_JIT
+
+/* Entries and backward jumps after which a bcode is compiled */
+#ifndef V7_JIT_THRESHOLD
+#define V7_JIT_THRESHOLD 1000
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+struct bcode;
+
+struct jit_code {
+  /* the entry thunk, then an instruction after another, see `jit_compile()` */
+  char *code;
+  size_t map_len;
+  /*
+   * Offset in `code` of each instruction, by its offset in the bcode `ops`;
+   * 0 if the native code can't run the instruction and shouldn't be entered
+   * there.
+   */
+  uint32_t *entry;
+};
+
+/*
+ * Compiles the bcode, if it can: afterwards `bcode->jit` is set. Called by
+ * the interpreter when the bcode gets hot.
+ */
+V7_PRIVATE void jit_compile(struct v7 *v7, struct bcode *bcode);
+
+/*
+ * Runs the native code of the bcode from the instruction at offset `off`,
+ * which should have an entry, with the frame slots at `slots_base` of the
+ * data stack. Returns the offset of the instruction to be run by the
+ * interpreter.
+ */
+V7_PRIVATE size_t jit_run(struct v7 *v7, struct bcode *bcode, size_t off,
+                          size_t slots_base);
+
+V7_PRIVATE void jit_free(struct bcode *bcode);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_JIT */
+
+#endif /* JIT_H_INCLUDED */
+#ifdef V7_MODULE_LINES
 #line 1 "./v7/src/bcode.h"
 #endif
 /*
@@ -3282,6 +3573,7 @@ V7_PRIVATE size_t unescape(const char *s, size_t len, char *to);
 
 /* Amalgamated: #include "v7/src/internal.h" */
 /* Amalgamated: #include "v7/src/types.h" */
+/* Amalgamated: #include "v7/src/jit.h" */
 /* Amalgamated: #include "common/mbuf.h" */
 
 enum bcode_inline_lit_type_tag {
@@ -3781,11 +4073,176 @@ enum opcode {
    */
   OP_EXIT_CATCH,
 
+  /*
+   * Prologue of a function which keeps some of its locals in frame slots, see
+   * `compile_frame_slots()`. Takes a varint number of slots, and then a varint
+   * per each name but the function name: `0` if the name lives on the scope
+   * object, or its slot index + 1.
+   *
+   * It's consumed by `OP_CALL` at function entry; executing it is a no-op.
+   *
+   * `( -- )`
+   */
+  OP_FRAME_SLOTS,
+
+  /*
+   * Takes a varint argument -- index of the frame slot of the current
+   * function, pushes its value onto the stack.
+   *
+   * `( -- a )`
+   */
+  OP_GET_LOCAL,
+
+  /*
+   * Takes a varint argument -- index of the frame slot of the current
+   * function, sets its value to the TOS. Leaves the value on the stack.
+   *
+   * `( a -- a )`
+   */
+  OP_SET_LOCAL,
+
+  /*
+   * Super-instructions, made by `bcode_optimize()` out of the common sequences
+   * of the instructions above.
+   */
+
+  /*
+   * `OP_PUSH_LIT` + `OP_GET`: takes the property name from the literal
+   * argument.
+   *
+   * `( a -- a.n )`
+   */
+  OP_GET_PROP,
+
+  /*
+   * `OP_SET_LOCAL` + `OP_DROP`: takes a varint argument -- index of the frame
+   * slot.
+   *
+   * `( a -- )`
+   */
+  OP_SET_LOCAL_DROP,
+
+  /*
+   * Instructions of the common loop idioms, emitted by the compiler.
+   */
+
+  /*
+   * `a++` of a variable: takes the variable name from the literal argument,
+   * converts the value of the variable to a number `n`, stores `n + 1`, and
+   * pushes `n`. `++a` adds one to the result, see `bcode_op_inc_var()`.
+   *
+   * `( -- n )`
+   */
+  OP_INC_VAR,
+  /*
+   * Like `OP_INC_VAR`, but stores `n - 1`.
+   *
+   * `( -- n )`
+   */
+  OP_DEC_VAR,
+  /*
+   * Like `OP_INC_VAR`, but takes a varint argument -- index of the frame slot
+   * of the current function.
+   *
+   * `( -- n )`
+   */
+  OP_INC_LOCAL,
+  /*
+   * Like `OP_INC_LOCAL`, but stores `n - 1`.
+   *
+   * `( -- n )`
+   */
+  OP_DEC_LOCAL,
+  /*
+   * `OP_LT` + `OP_JMP_TRUE`: takes two values from the stack and performs a
+   * jump if `a < b`. `OP_JMP_LE`, `OP_JMP_GT` and `OP_JMP_GE` are the same
+   * for `<=`, `>` and `>=`. See `compile_cond_jmp()`.
+   *
+   * `( a b -- )`
+   */
+  OP_JMP_LT,
+  OP_JMP_LE,
+  OP_JMP_GT,
+  OP_JMP_GE,
+
+  /*
+   * Jump tables of the `switch` statements whose case labels are all
+   * constant, see `bcode_op_switch()`. Both take the target of the default
+   * case, the length of the whole instruction, and the table:
+   *
+   * - `OP_SWITCH_NUM`: the int32 label of the first entry, then a target per
+   *   integer up to the last label; 0 for the integers which aren't labels;
+   * - `OP_SWITCH_STR`: the size of the hash table (a power of two), then
+   *   the table of offsets of the entries from the opcode, 0 for the empty
+   *   ones; then the entries: the target, the length and the bytes of the
+   *   label.
+   *
+   * If `a` is a number (or a string, respectively), jumps to the target of
+   * the label equal to `a`, or to the default case if there's none. Other
+   * values go on to the `OP_EQ` comparisons which follow.
+   *
+   * if `a` is of the type of the labels: `( a -- )`
+   * otherwise: `( a -- a )`
+   */
+  OP_SWITCH_NUM,
+  OP_SWITCH_STR,
+
+  /*
+   * Generators, see `bcode_gen_suspend()`.
+   */
+
+  /*
+   * First instruction of the body of a generator function (byte argument 0)
+   * or an async function (1). Suspends the call right away and returns a new
+   * generator object in its stead; an async function returns the promise of
+   * the generator run by the async driver of `js_stdlib.c`.
+   *
+   * `( -- )`
+   */
+  OP_GEN_START,
+
+  /*
+   * Suspends the generator which runs in the current function: its frames
+   * and data stack are saved into the generator record, and `a` is returned
+   * to whoever resumed it. When the generator is resumed, `b` is the value
+   * it's resumed with (for `next()`).
+   *
+   * `( a -- b )`
+   */
+  OP_YIELD,
+
+  /*
+   * Resumes the generator whose record is `g`, see `b_resume()`. Takes a byte
+   * argument: `enum gen_resume`. When the generator yields or returns, `r` is
+   * the value.
+   *
+   * `( g v -- r )`
+   */
+  OP_RESUME,
+
   OP_MAX,
 };
 
 typedef uint32_t bcode_off_t;
 
+/*
+ * Inline cache of the `OP_GET`, `OP_SET` or `OP_GET_VAR` instruction: the
+ * property found last time, valid for receivers with the same shape (or the
+ * same receiver, if it has no shape) and prototype, until `v7->prop_epoch`
+ * changes.
+ */
+struct bcode_ic {
+  val_t name;
+  uintptr_t key;            /* `shape << 1 | 1`, or the receiver itself */
+  struct v7_object *proto;  /* the receiver's prototype */
+  struct v7_property *prop; /* unless `index` is set */
+  uint32_t index;           /* index of own property in the shape + 1 */
+  uint32_t epoch;
+};
+
+/* Max number of inline caches in one bcode */
+#define BCODE_IC_MAX 0xffff
+
 /*
  * Each JS function will have one bcode structure
  * containing the instruction stream, a literal table, and function
@@ -3813,7 +4270,14 @@ struct bcode {
   struct v7_vec lit;
 
   /* Reference count */
-  uint8_t refcnt;
+  uint32_t refcnt;
+
+  /*
+   * Maximum number of values the instructions keep on the data stack at once,
+   * computed by `bcode_builder_finalize()`. Entering the bcode reserves that
+   * much stack, see `bcode_reserve_stack()`.
+   */
+  uint32_t max_stack;
 
   /* Total number of null-terminated strings in the beginning of `ops` */
   unsigned int names_cnt : V7_NAMES_CNT_WIDTH;
@@ -3832,6 +4296,44 @@ struct bcode {
   unsigned int ops_in_rom : 1;
   /* Set for deserialized bcode. Used for metrics only */
   unsigned int deserialized : 1;
+
+  /*
+   * Set by the compiler for a function which never refers to `arguments`, so
+   * that calling it doesn't make the `arguments` array. It isn't serialized:
+   * deserialized functions always get `arguments`.
+   */
+  unsigned int no_arguments : 1;
+
+  /*
+   * Inline caches, allocated when the first cached instruction runs.
+   * `ic_map` has an entry for each byte of `ops`: index of the instruction's
+   * cache in `ics` + 1, or 0.
+   */
+  uint16_t *ic_map;
+  struct bcode_ic *ics;
+  uint16_t ics_cnt;
+
+  /*
+   * Values of the names and of the inline string literals of `ops`, made
+   * when first needed so that running the bcode doesn't make the same strings
+   * again and again (see `bcode_next_name_v()`, `bcode_decode_lit()`). The
+   * names come first; strings are found by their offset in `ops` through
+   * `strs`: open addressing, entries are `offset << 32 | (index + 1)`, 0
+   * meaning empty. GC marks `vals` along with the literal table.
+   */
+  val_t *vals;
+  uint64_t *strs;
+  uint32_t vals_cnt;
+  uint32_t strs_mask;
+
+#ifdef V7_ENABLE_JIT
+  /*
+   * Native code, see `jit_compile()`: made when `jit_hot`, which counts
+   * entries and backward jumps, reaches `V7_JIT_THRESHOLD`.
+   */
+  struct jit_code *jit;
+  uint32_t jit_hot;
+#endif
 };
 
 /*
@@ -3844,6 +4346,18 @@ struct bcode_builder {
 
   struct mbuf ops; /* names + instruction opcode */
   struct mbuf lit; /* literal table */
+
+  /*
+   * Names which the function keeps in frame slots, indexed by slot (see
+   * `compile_frame_slots()`). Array of `struct frame_slot`.
+   */
+  struct mbuf slots;
+};
+
+/* Name of a frame slot; points to the AST being compiled */
+struct frame_slot {
+  const char *name;
+  size_t len;
 };
 
 enum bcode_ser_lit_tag {
@@ -3856,6 +4370,7 @@ enum bcode_ser_lit_tag {
 V7_PRIVATE void bcode_builder_init(struct v7 *v7,
                                    struct bcode_builder *bbuilder,
                                    struct bcode *bcode);
+V7_PRIVATE void bcode_optimize(struct bcode_builder *bbuilder);
 V7_PRIVATE void bcode_builder_finalize(struct bcode_builder *bbuilder);
 
 V7_PRIVATE void bcode_init(struct bcode *bcode, uint8_t strict_mode);
@@ -4004,10 +4519,10 @@ V7_PRIVATE char *bcode_next_name(char *ops, char **pname, size_t *plen);
 
 /*
  * Like `bcode_next_name()`, but instead of yielding a C string, it yields a
- * `val_t` value (via `res`).
+ * `val_t` value (via `res`). `idx` is the index of the name at `ops`.
  */
 V7_PRIVATE char *bcode_next_name_v(struct v7 *v7, struct bcode *bcode,
-                                   char *ops, val_t *res);
+                                   size_t idx, char *ops, val_t *res);
 V7_PRIVATE bcode_off_t bcode_pos(struct bcode_builder *bbuilder);
 V7_PRIVATE bcode_off_t bcode_add_target(struct bcode_builder *bbuilder);
 V7_PRIVATE bcode_off_t
@@ -4015,6 +4530,29 @@ bcode_op_target(struct bcode_builder *bbuilder, uint8_t op);
 V7_PRIVATE void bcode_patch_target(struct bcode_builder *bbuilder,
                                    bcode_off_t label, bcode_off_t target);
 
+/* Constant case label of a `switch`, see `bcode_op_switch()` */
+struct bcode_switch_case {
+  double num;
+  /* the label is a string if not NULL; points to the AST being compiled */
+  const char *str;
+  size_t len;
+  /* location of the target in the jump table, 0 for repeated labels */
+  bcode_off_t label;
+};
+
+/*
+ * Appends `OP_SWITCH_NUM` or `OP_SWITCH_STR` with a jump table of the `cnt`
+ * case labels `cases`, if they're worth it: all of them are strings, or all
+ * of them are integers of a small range. Returns the location of the target
+ * of the default case, or 0 if there is no table.
+ */
+V7_PRIVATE bcode_off_t bcode_op_switch(struct bcode_builder *bbuilder,
+                                       struct bcode_switch_case *cases,
+                                       size_t cnt);
+
+/* Hash of the labels of `OP_SWITCH_STR` */
+V7_PRIVATE uint32_t bcode_switch_hash(const char *s, size_t len);
+
 V7_PRIVATE void bcode_add_varint(struct bcode_builder *bbuilder, size_t value);
 /*
  * Reads varint-encoded integer from the provided pointer, and adjusts
@@ -4252,6 +4790,13 @@ extern "C" {
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err eval_bcode(struct v7 *v7, struct bcode *bcode);
 
+/*
+ * Arithmetic and comparison of numbers, the way the instructions do it. Used
+ * to fold constants as well, see `bcode_optimize()`.
+ */
+V7_PRIVATE double b_num_bin_op(enum opcode op, double a, double b);
+V7_PRIVATE int b_bool_bin_op(enum opcode op, double a, double b);
+
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err b_apply(struct v7 *v7, v7_val_t func, v7_val_t this_obj,
                                v7_val_t args, uint8_t is_constructor,
@@ -4263,6 +4808,43 @@ V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
                               v7_val_t this_object, int is_json, int fr,
                               uint8_t is_constructor, v7_val_t *res);
 
+/*
+ * Call of a function from C with the arguments in a C array, see `v7_call()`.
+ * The caller puts `this`, the function and the arguments on the data stack,
+ * so a JS function is called by a bcode which is just `OP_CALL`; it lives in
+ * the handle and is the same for every call with the same number of
+ * arguments.
+ */
+/* Calls through `b_apply()` with up to this many arguments take the argv path */
+#define V7_CALL_ARGV_SIZE 8
+
+struct v7_call_handle {
+  v7_val_t func;
+  v7_val_t this_obj;
+  struct bcode bcode;
+  char ops[3];
+};
+
+V7_PRIVATE void call_handle_init(struct v7_call_handle *h, v7_val_t func,
+                                 v7_val_t this_obj);
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err b_call(struct v7 *v7, struct v7_call_handle *h,
+                              const v7_val_t *argv, int argc, v7_val_t *res);
+
+/* How a generator is resumed, see `OP_RESUME` */
+enum gen_resume { GEN_RESUME_NEXT, GEN_RESUME_RETURN, GEN_RESUME_THROW };
+
+/*
+ * Resumes the generator whose record is `gen` with `v`, like its `next()`,
+ * `return()` or `throw()` does. `res` is the value it yields or returns;
+ * `done` is set if it has returned.
+ */
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err b_resume(struct v7 *v7, v7_val_t gen,
+                                enum gen_resume how, v7_val_t v,
+                                v7_val_t *res, int *done);
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -4285,10 +4867,36 @@ V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
 extern "C" {
 #endif /* __cplusplus */
 
+/*
+ * Writes past the end of a dense array fill the gap with holes as long as it
+ * is not longer than this, or than the array itself. Farther writes demote the
+ * array to a plain object.
+ */
+#ifndef V7_DENSE_ARRAY_MAX_GAP
+#define V7_DENSE_ARRAY_MAX_GAP 1024
+#endif
+
 V7_PRIVATE v7_val_t v7_mk_dense_array(struct v7 *v7);
 V7_PRIVATE val_t
 v7_array_get2(struct v7 *v7, v7_val_t arr, unsigned long index, int *has);
 
+V7_PRIVATE int is_array_index(const char *s, size_t len, unsigned long *res);
+V7_PRIVATE struct mbuf *dense_array_buf(struct v7_object *o);
+V7_PRIVATE int dense_array_put(struct v7 *v7, v7_val_t arr,
+                               unsigned long index, v7_val_t v);
+V7_PRIVATE void dense_array_demote(struct v7 *v7, v7_val_t arr);
+V7_PRIVATE int dense_array_set_length(struct v7 *v7, v7_val_t arr,
+                                      unsigned long len);
+
+/*
+ * Fast paths of the interpreter for `arr[key]` with a numeric `key`: return 1
+ * if they did the job, 0 if the generic property code has to.
+ */
+V7_PRIVATE int dense_array_get_v(struct v7 *v7, v7_val_t arr, v7_val_t key,
+                                 v7_val_t *res);
+V7_PRIVATE int dense_array_set_v(struct v7 *v7, v7_val_t arr, v7_val_t key,
+                                 v7_val_t v);
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -4962,6 +5570,30 @@ V7_PRIVATE void init_function(struct v7 *v7);
 
 #endif /* STD_FUNCTION_H_INCLUDED */
 #ifdef V7_MODULE_LINES
+#line 1 "./v7/src/std_generator.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+#ifndef STD_GENERATOR_H_INCLUDED
+#define STD_GENERATOR_H_INCLUDED
+
+/* Amalgamated: #include "v7/src/internal.h" */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+V7_PRIVATE void init_generator(struct v7 *v7);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* STD_GENERATOR_H_INCLUDED */
+#ifdef V7_MODULE_LINES
 #line 1 "./v7/src/std_json.h"
 #endif
 /*
@@ -9047,7 +9679,7 @@ static enum v7_err _ubjson_render_cont(struct v7 *v7, struct ubjson_ctx *ctx) {
         cs_ubjson_open_object(buf);
       }
 
-      cur->v.p = v7_next_prop(cur->v.p, obj, &name, NULL, NULL);
+      cur->v.p = obj_next_prop(v7, cur->v.p, obj, &name, NULL, NULL);
 
       if (cur->v.p == NULL) {
         cs_ubjson_close_object(buf);
@@ -10302,6 +10934,14 @@ const struct ast_node_def ast_node_defs[] = {
     AST_ENTRY("NULL", 0, 0, 0, 0),       /* struct {} */
     AST_ENTRY("UNDEF", 0, 0, 0, 0),      /* struct {} */
     AST_ENTRY("USE_STRICT", 0, 0, 0, 0), /* struct {} */
+    /*
+     * Markers of the body of `function *` and `async function`, before
+     * `USE_STRICT`.
+     */
+    AST_ENTRY("GENERATOR", 0, 0, 0, 0), /* struct {} */
+    AST_ENTRY("ASYNC", 0, 0, 0, 0),     /* struct {} */
+    AST_ENTRY("YIELD", 0, 0, 0, 1),     /* struct { child expr; } */
+    AST_ENTRY("AWAIT", 0, 0, 0, 1),     /* struct { child expr; } */
 };
 
 V7_STATIC_ASSERT(AST_MAX_TAG < 256, ast_tag_should_fit_in_char);
@@ -10709,6 +11349,24 @@ static const char *op_names[] = {
   "CONTINUE",
   "ENTER_CATCH",
   "EXIT_CATCH",
+  "FRAME_SLOTS",
+  "GET_LOCAL",
+  "SET_LOCAL",
+  "GET_PROP",
+  "SET_LOCAL_DROP",
+  "INC_VAR",
+  "DEC_VAR",
+  "INC_LOCAL",
+  "DEC_LOCAL",
+  "JMP_LT",
+  "JMP_LE",
+  "JMP_GT",
+  "JMP_GE",
+  "SWITCH_NUM",
+  "SWITCH_STR",
+  "GEN_START",
+  "YIELD",
+  "RESUME",
 };
 /* clang-format on */
 
@@ -10746,1903 +11404,3741 @@ V7_PRIVATE void bcode_builder_init(struct v7 *v7,
 
   mbuf_init(&bbuilder->ops, 0);
   mbuf_init(&bbuilder->lit, 0);
+  mbuf_init(&bbuilder->slots, 0);
 }
 
-/*
- * Finalize bcode builder: propagate data to the bcode and transfer the
- * ownership from builder to bcode
- */
-V7_PRIVATE void bcode_builder_finalize(struct bcode_builder *bbuilder) {
-  mbuf_trim(&bbuilder->ops);
-  bbuilder->bcode->ops.p = bbuilder->ops.buf;
-  bbuilder->bcode->ops.len = bbuilder->ops.len;
-  mbuf_init(&bbuilder->ops, 0);
-
-  mbuf_trim(&bbuilder->lit);
-  bbuilder->bcode->lit.p = bbuilder->lit.buf;
-  bbuilder->bcode->lit.len = bbuilder->lit.len;
-  mbuf_init(&bbuilder->lit, 0);
-
-  memset(bbuilder, 0x00, sizeof(*bbuilder));
+/* Skips a varint at `p`, returns the pointer past it */
+static const char *bcode_skip_varint(const char *p, size_t *pval) {
+  int llen;
+  size_t val = decode_varint((const unsigned char *) p, &llen);
+  if (pval != NULL) *pval = val;
+  return p + llen;
 }
 
-#if defined(V7_BCODE_DUMP) || defined(V7_BCODE_TRACE)
-V7_PRIVATE void dump_op(struct v7 *v7, FILE *f, struct bcode *bcode,
-                        char **ops) {
-  char *p = *ops;
+/*
+ * Skips the literal operand at `p` (right after the opcode), see
+ * `bcode_op_lit()`. Returns the pointer past it.
+ */
+static const char *bcode_skip_lit(const char *p) {
+  size_t tag, len;
 
-  assert(*p < OP_MAX);
-  fprintf(f, "%zu: %s", (size_t)(p - bcode->ops.p), op_names[(uint8_t) *p]);
-  switch (*p) {
-    case OP_PUSH_LIT:
-    case OP_SAFE_GET_VAR:
-    case OP_GET_VAR:
-    case OP_SET_VAR: {
-      size_t idx = bcode_get_varint(&p);
-      fprintf(f, "(%lu): ", (unsigned long) idx);
-      v7_fprint(f, v7, ((val_t *) bcode->lit.p)[idx]);
+  p = bcode_skip_varint(p, &tag);
+  switch (tag) {
+    case BCODE_INLINE_STRING_TYPE_TAG:
+      p = bcode_skip_varint(p, &len);
+      p += len + 1 /* nul term */;
       break;
-    }
-    case OP_CALL:
-    case OP_NEW:
-      p++;
-      fprintf(f, "(%d)", *p);
+    case BCODE_INLINE_NUMBER_TYPE_TAG:
+      p += sizeof(val_t);
+      break;
+    case BCODE_INLINE_FUNC_TYPE_TAG:
+      /* serialized function: literals (none), args, names, ops */
+      p = bcode_skip_varint(p, NULL);
+      p = bcode_skip_varint(p, NULL);
+      p = bcode_skip_varint(p, NULL);
+      p = bcode_skip_varint(p, &len);
+      p += len;
+      break;
+    default:
+      /* index in the literal table */
       break;
+  }
+  return p;
+}
+
+/* Returns 1 if the instruction takes a jump target, see `bcode_get_target()` */
+static int bcode_op_has_target(enum opcode op) {
+  switch (op) {
     case OP_JMP:
-    case OP_JMP_FALSE:
     case OP_JMP_TRUE:
+    case OP_JMP_FALSE:
     case OP_JMP_TRUE_DROP:
     case OP_JMP_IF_CONTINUE:
     case OP_TRY_PUSH_CATCH:
     case OP_TRY_PUSH_FINALLY:
     case OP_TRY_PUSH_LOOP:
-    case OP_TRY_PUSH_SWITCH: {
-      bcode_off_t target;
-      p++;
-      memcpy(&target, p, sizeof(target));
-      fprintf(f, "(%lu)", (unsigned long) target);
-      p += sizeof(target) - 1;
-      break;
-    }
+    case OP_TRY_PUSH_SWITCH:
+    case OP_JMP_LT:
+    case OP_JMP_LE:
+    case OP_JMP_GT:
+    case OP_JMP_GE:
+    case OP_SWITCH_NUM:
+    case OP_SWITCH_STR:
+      return 1;
     default:
-      break;
+      return 0;
   }
-  fprintf(f, "\n");
-  *ops = p;
 }
-#endif
 
-#ifdef V7_BCODE_DUMP
-V7_PRIVATE void dump_bcode(struct v7 *v7, FILE *f, struct bcode *bcode) {
-  char *p = bcode_end_names(bcode->ops.p, bcode->names_cnt);
-  char *end = bcode->ops.p + bcode->ops.len;
-  for (; p < end; p++) {
-    dump_op(v7, f, bcode, &p);
+/*
+ * Returns the pointer past the instruction at `p`, that is, past its opcode
+ * and its operands (see `enum opcode`)
+ */
+static const char *bcode_next_op(const struct bcode *bcode, const char *p) {
+  enum opcode op = (enum opcode)(uint8_t) *p++;
+  size_t n;
+
+  switch (op) {
+    case OP_PUSH_LIT:
+    case OP_GET_VAR:
+    case OP_SAFE_GET_VAR:
+    case OP_SET_VAR:
+    case OP_ENTER_CATCH:
+    case OP_GET_PROP:
+    case OP_INC_VAR:
+    case OP_DEC_VAR:
+      return bcode_skip_lit(p);
+    case OP_CALL:
+    case OP_NEW:
+    case OP_GEN_START:
+    case OP_RESUME:
+      return p + 1;
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_DROP:
+    case OP_INC_LOCAL:
+    case OP_DEC_LOCAL:
+      return bcode_skip_varint(p, NULL);
+    case OP_FRAME_SLOTS:
+      /* number of slots, then an entry per name but the function one */
+      for (n = 0; n < bcode->names_cnt; n++) {
+        p = bcode_skip_varint(p, NULL);
+      }
+      return p;
+    case OP_SWITCH_NUM:
+    case OP_SWITCH_STR: {
+      uint32_t len;
+      memcpy(&len, p + sizeof(bcode_off_t), sizeof(len));
+      return p - 1 + len;
+    }
+    default:
+      return bcode_op_has_target(op) ? p + sizeof(bcode_off_t) : p;
   }
 }
-#endif
 
-V7_PRIVATE void bcode_init(struct bcode *bcode, uint8_t strict_mode) {
-  memset(bcode, 0x00, sizeof(*bcode));
-  bcode->refcnt = 0;
-  bcode->args_cnt = 0;
-  bcode->strict_mode = strict_mode;
-}
+/* Size of the header of `OP_SWITCH_NUM` and `OP_SWITCH_STR` */
+#define BCODE_SWITCH_HDR (1 + sizeof(bcode_off_t) + 2 * sizeof(uint32_t))
 
-V7_PRIVATE void bcode_free(struct v7 *v7, struct bcode *bcode) {
-  (void) v7;
-#if V7_ENABLE__Memory__stats
-  if (!bcode->ops_in_rom) {
-    v7->bcode_ops_size -= bcode->ops.len;
-  }
+/*
+ * Returns the location of the next case target of the `OP_SWITCH_NUM` or
+ * `OP_SWITCH_STR` instruction at `p` after `prev` (NULL for the first one),
+ * or NULL if there are no more. The targets of the missing labels are 0.
+ */
+static char *bcode_switch_next_case(const char *p, char *prev) {
+  const char *end = bcode_next_op(NULL, p);
+  uint32_t size, len;
 
-  v7->bcode_lit_total_size -= bcode->lit.len;
-  if (bcode->deserialized) {
-    v7->bcode_lit_deser_size -= bcode->lit.len;
+  if (*p == OP_SWITCH_NUM) {
+    prev = prev == NULL ? (char *) p + BCODE_SWITCH_HDR
+                        : prev + sizeof(bcode_off_t);
+  } else if (prev == NULL) {
+    memcpy(&size, p + BCODE_SWITCH_HDR - sizeof(size), sizeof(size));
+    prev = (char *) p + BCODE_SWITCH_HDR + size * sizeof(uint32_t);
+  } else {
+    memcpy(&len, prev + sizeof(bcode_off_t), sizeof(len));
+    prev += sizeof(bcode_off_t) + sizeof(len) + len;
   }
-#endif
+  return prev < end ? prev : NULL;
+}
 
-  if (!bcode->ops_in_rom) {
-    free(bcode->ops.p);
+V7_PRIVATE uint32_t bcode_switch_hash(const char *s, size_t len) {
+  /* FNV-1a */
+  uint32_t h = 2166136261u;
+  while (len-- > 0) {
+    h = (h ^ (uint8_t) *s++) * 16777619u;
   }
-  memset(&bcode->ops, 0x00, sizeof(bcode->ops));
-
-  free(bcode->lit.p);
-  memset(&bcode->lit, 0x00, sizeof(bcode->lit));
-
-  bcode->refcnt = 0;
+  return h;
 }
 
-V7_PRIVATE void retain_bcode(struct v7 *v7, struct bcode *b) {
-  (void) v7;
-  if (!b->frozen) {
-    b->refcnt++;
-  }
+/*
+ * Records the stack depth `depth` at the jump target `target`: targets keep
+ * the deepest of the depths they're reached with, plus one, so that 0 means
+ * no jump seen yet. Returns 1 if the recorded depth has changed.
+ */
+static int bcode_max_stack_edge(int *at, size_t len, bcode_off_t target,
+                                int depth) {
+  if (depth < 0) depth = 0;
+  if (target > len || at[target] >= depth + 1) return 0;
+  at[target] = depth + 1;
+  return 1;
 }
 
-V7_PRIVATE void release_bcode(struct v7 *v7, struct bcode *b) {
-  (void) v7;
-  if (b->frozen) return;
+/*
+ * Returns the maximum number of values the instructions of the bcode keep on
+ * the data stack, see `struct bcode::max_stack`.
+ *
+ * The instructions are walked in order, following the stack effect of each
+ * of them (see `enum opcode`). Jump targets take the deepest of the depths
+ * they're reached with; backward jumps are accounted for by walking again
+ * until the depths settle. The result may overestimate, it must never
+ * underestimate: `PUSH()` doesn't check for room.
+ */
+static uint32_t bcode_calc_max_stack(struct bcode *bcode) {
+  const char *ops = bcode->ops.p;
+  const char *start = bcode_end_names(bcode->ops.p, bcode->names_cnt);
+  const char *end = ops + bcode->ops.len, *p, *next;
+  size_t len = bcode->ops.len;
+  int depth, max = 0, changed = 1, pass;
+  int *at;
 
-  assert(b->refcnt > 0);
-  if (b->refcnt != 0) b->refcnt--;
+  if (start >= end) return 0;
 
-  if (b->refcnt == 0) {
-    bcode_free(v7, b);
-    free(b);
+  at = (int *) calloc(len + 1, sizeof(*at));
+  if (at == NULL) {
+    /* no instruction pushes more than two values */
+    return (uint32_t)(len * 2);
   }
-}
 
-V7_PRIVATE void bcode_op(struct bcode_builder *bbuilder, uint8_t op) {
-  bcode_ops_append(bbuilder, &op, 1);
-}
+  for (pass = 0; changed && pass < 8; pass++) {
+    enum opcode prev = OP_MAX;
+    changed = 0;
+    depth = 0;
+    for (p = start; p < end; p = next) {
+      enum opcode op = (enum opcode)(uint8_t) *p;
+      size_t off = p - ops;
+      bcode_off_t target;
+      int delta = 0, edge = 0, falls = 1;
 
-/*
- * Appends varint-encoded integer to the `ops` mbuf
- */
-V7_PRIVATE void bcode_add_varint(struct bcode_builder *bbuilder, size_t value) {
-  int k = calc_llen(value); /* Calculate how many bytes length takes */
-  int offset = bbuilder->ops.len;
+      next = bcode_next_op(bcode, p);
+      if (next > end) break;
 
-  /* Allocate buffer */
-  bcode_ops_append(bbuilder, NULL, k);
+      /* after an unconditional jump, the depth is the one of the target */
+      if (at[off] > 0 && (prev == OP_MAX || at[off] - 1 > depth)) {
+        depth = at[off] - 1;
+      }
 
-  /* Write value */
-  encode_varint(value, (unsigned char *) bbuilder->ops.buf + offset);
-}
+      switch (op) {
+        case OP_DROP:
+        case OP_SWAP_DROP:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_REM:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_LSHIFT:
+        case OP_RSHIFT:
+        case OP_URSHIFT:
+        case OP_OR:
+        case OP_XOR:
+        case OP_AND:
+        case OP_EQ_EQ:
+        case OP_EQ:
+        case OP_NE:
+        case OP_NE_NE:
+        case OP_LT:
+        case OP_LE:
+        case OP_GT:
+        case OP_GE:
+        case OP_INSTANCEOF:
+        case OP_IN:
+        case OP_GET:
+        case OP_DELETE:
+        case OP_ENTER_CATCH:
+        case OP_SET_LOCAL_DROP:
+          delta = -1;
+          break;
+        case OP_DUP:
+        case OP_PUSH_UNDEFINED:
+        case OP_PUSH_NULL:
+        case OP_PUSH_THIS:
+        case OP_PUSH_TRUE:
+        case OP_PUSH_FALSE:
+        case OP_PUSH_ZERO:
+        case OP_PUSH_ONE:
+        case OP_PUSH_LIT:
+        case OP_GET_VAR:
+        case OP_SAFE_GET_VAR:
+        case OP_GET_LOCAL:
+        case OP_CREATE_OBJ:
+        case OP_CREATE_ARR:
+        case OP_INC_VAR:
+        case OP_DEC_VAR:
+        case OP_INC_LOCAL:
+        case OP_DEC_LOCAL:
+          delta = 1;
+          break;
+        case OP_2DUP:
+        case OP_NEXT_PROP:
+          /* `( o h -- o h k true )`, or `( o h -- false )`: see below */
+          delta = 2;
+          break;
+        case OP_SET:
+          delta = -2;
+          break;
+        case OP_RESUME:
+          delta = -1;
+          break;
+        case OP_CALL:
+        case OP_NEW:
+          /* `( this func args -- res )`, `argc` is a byte operand */
+          delta = -((int) (uint8_t) p[1] + 1);
+          break;
+        case OP_JMP:
+          falls = 0;
+          break;
+        case OP_JMP_TRUE:
+        case OP_JMP_FALSE:
+          delta = edge = -1;
+          if (op == OP_JMP_FALSE && prev == OP_NEXT_PROP) {
+            /* no more properties: just `false` was pushed */
+            edge -= 3;
+          }
+          break;
+        case OP_JMP_TRUE_DROP:
+          delta = -1;
+          edge = -2;
+          break;
+        case OP_JMP_LT:
+        case OP_JMP_LE:
+        case OP_JMP_GT:
+        case OP_JMP_GE:
+          delta = edge = -2;
+          break;
+        case OP_SWITCH_NUM:
+        case OP_SWITCH_STR: {
+          char *c = NULL;
+          edge = -1;
+          while ((c = bcode_switch_next_case(p, c)) != NULL) {
+            memcpy(&target, c, sizeof(target));
+            if (target != 0) {
+              changed |= bcode_max_stack_edge(at, len, target, depth + edge);
+            }
+          }
+          break;
+        }
+        case OP_TRY_PUSH_CATCH:
+          /* the catch block is entered with the thrown value pushed */
+          edge = 1;
+          break;
+        case OP_THROW:
+          delta = -1;
+          falls = 0;
+          break;
+        case OP_RET:
+        case OP_BREAK:
+        case OP_CONTINUE:
+          falls = 0;
+          break;
+        default:
+          /* `( a -- b )` or `( -- )` */
+          break;
+      }
 
-V7_PRIVATE size_t bcode_get_varint(char **ops) {
-  size_t ret = 0;
-  int len = 0;
-  (*ops)++;
-  ret = decode_varint((unsigned char *) *ops, &len);
-  *ops += len - 1;
-  return ret;
-}
+      if (bcode_op_has_target(op)) {
+        memcpy(&target, p + 1, sizeof(target));
+        changed |= bcode_max_stack_edge(at, len, target, depth + edge);
+      }
 
-static int bcode_is_inline_string(struct v7 *v7, val_t val) {
-  uint64_t tag = val & V7_TAG_MASK;
-  if (v7->is_precompiling && v7_is_string(val)) {
-    return 1;
+      depth += delta;
+      if (depth < 0) depth = 0;
+      if (depth > max) max = depth;
+      /*
+       * The code after a jump is reached by other jumps only, but keep the
+       * depth for the code which isn't a target (yet)
+       */
+      prev = falls ? op : OP_MAX;
+    }
   }
-  return tag == V7_TAG_STRING_I || tag == V7_TAG_STRING_5;
-}
 
-static int bcode_is_inline_func(struct v7 *v7, val_t val) {
-  return (v7->is_precompiling && is_js_function(val));
+  free(at);
+  if (changed) {
+    /* the depths haven't settled, which the compiler never does */
+    return (uint32_t)(len * 2);
+  }
+  return (uint32_t) max;
 }
 
-V7_PRIVATE lit_t bcode_add_lit(struct bcode_builder *bbuilder, val_t val) {
-  lit_t lit;
-  memset(&lit, 0, sizeof(lit));
-
-  if (bcode_is_inline_string(bbuilder->v7, val) ||
-      bcode_is_inline_func(bbuilder->v7, val) || v7_is_number(val)) {
-    /* literal should be inlined (it's `bcode_op_lit()` who does this) */
-    lit.mode = LIT_MODE__INLINED;
-    lit.v.inline_val = val;
-  } else {
-    /* literal will now be added to the literal table */
-    lit.mode = LIT_MODE__TABLE;
-    lit.v.lit_idx = bbuilder->lit.len / sizeof(val);
-
-#if V7_ENABLE__Memory__stats
-    bbuilder->v7->bcode_lit_total_size -= bbuilder->lit.len;
-    if (bbuilder->bcode->deserialized) {
-      bbuilder->v7->bcode_lit_deser_size -= bbuilder->lit.len;
-    }
-#endif
+/* An instruction being optimized, see `bcode_optimize()` */
+struct bcode_opt_insn {
+  /* offset and length of the instruction in the original `ops` */
+  size_t off;
+  size_t len;
+  /* for jumps: index of the target instruction, or the count for the end */
+  size_t target;
+  /* offset in the optimized `ops` */
+  size_t new_off;
+  /* value of a constant, valid if `is_const` */
+  val_t cval;
+  uint8_t op;
+  /* the instruction is jumped to */
+  unsigned int is_target : 1;
+  /* the instruction can be reached */
+  unsigned int reached : 1;
+  /* left in the optimized `ops` */
+  unsigned int live : 1;
+  /* pushes `cval` */
+  unsigned int is_const : 1;
+  /* replaced by pushing `cval` */
+  unsigned int folded : 1;
+};
 
-    mbuf_append(&bbuilder->lit, &val, sizeof(val));
+/* Returns the index of the live instruction after `i`, or `cnt` */
+static size_t bcode_opt_next(struct bcode_opt_insn *in, size_t cnt, size_t i) {
+  for (i++; i < cnt && !in[i].live; i++) {
+  }
+  return i;
+}
 
-    /*
-     * immediately propagate current lit buffer to the bcode, so that GC will
-     * be aware of it
-     */
-    bbuilder->bcode->lit.p = bbuilder->lit.buf;
-    bbuilder->bcode->lit.len = bbuilder->lit.len;
+/* Returns the index of the first live instruction from `i` on, or `cnt` */
+static size_t bcode_opt_live(struct bcode_opt_insn *in, size_t cnt, size_t i) {
+  while (i < cnt && !in[i].live) i++;
+  return i;
+}
 
-#if V7_ENABLE__Memory__stats
-    bbuilder->v7->bcode_lit_total_size += bbuilder->lit.len;
-    if (bbuilder->bcode->deserialized) {
-      bbuilder->v7->bcode_lit_deser_size += bbuilder->lit.len;
+/*
+ * Marks the live instructions which live jumps go to. `index` maps the
+ * offsets in `ops` to the instructions, for the cases of the jump tables.
+ */
+static void bcode_opt_mark_targets(struct bcode_opt_insn *in, size_t cnt,
+                                   const char *ops, const size_t *index) {
+  size_t i, t;
+  for (i = 0; i < cnt; i++) {
+    in[i].is_target = 0;
+  }
+  for (i = 0; i < cnt; i++) {
+    char *c = NULL;
+    bcode_off_t target;
+    if (!in[i].live || !bcode_op_has_target((enum opcode) in[i].op)) {
+      continue;
+    }
+    if ((t = bcode_opt_live(in, cnt, in[i].target)) < cnt) {
+      in[t].is_target = 1;
+    }
+    if (in[i].op != OP_SWITCH_NUM && in[i].op != OP_SWITCH_STR) continue;
+    while ((c = bcode_switch_next_case(ops + in[i].off, c)) != NULL) {
+      memcpy(&target, c, sizeof(target));
+      if (target != 0 && (t = bcode_opt_live(in, cnt, index[target])) < cnt) {
+        in[t].is_target = 1;
+      }
     }
-#endif
   }
-  return lit;
 }
 
-#if 0
-V7_PRIVATE v7_val_t bcode_get_lit(struct bcode *bcode, size_t idx) {
-  val_t ret;
-  memcpy(&ret, bcode->lit.p + (size_t) idx * sizeof(ret), sizeof(ret));
-  return ret;
+/* Returns the index of the live instruction before `i`, or `i` if none */
+static size_t bcode_opt_prev(struct bcode_opt_insn *in, size_t i) {
+  size_t j = i;
+  while (j > 0) {
+    if (in[--j].live) return j;
+  }
+  return i;
 }
-#endif
 
-static const char *bcode_deserialize_func(struct v7 *v7, struct bcode *bcode,
-                                          const char *data);
+/* Replaces the instruction with pushing the constant `v` */
+static void bcode_opt_fold(struct bcode_opt_insn *insn, val_t v) {
+  insn->cval = v;
+  insn->is_const = 1;
+  insn->folded = 1;
+  insn->op = OP_PUSH_LIT;
+}
 
-V7_PRIVATE v7_val_t
-bcode_decode_lit(struct v7 *v7, struct bcode *bcode, char **ops) {
-  struct v7_vec *vec = &bcode->lit;
-  size_t idx = bcode_get_varint(ops);
-  switch (idx) {
-    case BCODE_INLINE_STRING_TYPE_TAG: {
-      val_t res;
-      size_t len = bcode_get_varint(ops);
-      res = v7_mk_string(
-          v7, (const char *) *ops + 1 /*skip BCODE_INLINE_STRING_TYPE_TAG*/,
-          len, !bcode->ops_in_rom);
-      *ops += len + 1;
-      return res;
-      break;
+/*
+ * Folds the constants pushed by `a` (and `b` for binary operators) operated by
+ * `op` into `a`. Returns 1 if folded. Only numbers are folded (and booleans by
+ * `!`), the same way `eval_bcode()` computes them.
+ */
+static int bcode_opt_fold_op(struct v7 *v7, struct bcode_opt_insn *a,
+                             struct bcode_opt_insn *b, enum opcode op) {
+  double x = v7_is_number(a->cval) ? v7_to_number(a->cval) : 0;
+  double y = b != NULL && v7_is_number(b->cval) ? v7_to_number(b->cval) : 0;
+
+  if (b == NULL) {
+    if (op == OP_LOGICAL_NOT) {
+      bcode_opt_fold(a, v7_mk_boolean(!v7_is_truthy(v7, a->cval)));
+      return 1;
+    } else if (!v7_is_number(a->cval)) {
+      return 0;
     }
-    case BCODE_INLINE_NUMBER_TYPE_TAG: {
-      val_t res;
-      memcpy(&res, *ops + 1 /*skip BCODE_INLINE_NUMBER_TYPE_TAG*/, sizeof(res));
-      *ops += sizeof(res);
-      return res;
-      break;
+    switch (op) {
+      case OP_NOT:
+        bcode_opt_fold(a, v7_mk_number(~(int32_t) x));
+        return 1;
+      case OP_NEG:
+        bcode_opt_fold(a, v7_mk_number(-x));
+        return 1;
+      case OP_POS:
+        return 1;
+      default:
+        return 0;
     }
-    case BCODE_INLINE_FUNC_TYPE_TAG: {
-      /*
-       * Create half-done function: without scope but _with_ prototype. Scope
-       * will be set by `bcode_instantiate_function()`.
-       *
-       * The fact that the prototype is already set will make
-       * `bcode_instantiate_function()` just set scope on this function,
-       * instead of creating a new one.
-       */
-      val_t res = mk_js_function(v7, NULL, v7_mk_object(v7));
-
-      /* Create bcode in this half-done function */
-      struct v7_js_function *func = to_js_function(res);
-
-      func->bcode = (struct bcode *) calloc(1, sizeof(*func->bcode));
-      bcode_init(func->bcode, bcode->strict_mode);
-      retain_bcode(v7, func->bcode);
-
-      /* deserialize the function's bcode from `ops` */
-      *ops = (char *) bcode_deserialize_func(
-          v7, func->bcode, *ops + 1 /*skip BCODE_INLINE_FUNC_TYPE_TAG*/);
-
-      /* decrement *ops, because it will be incremented by `eval_bcode` soon */
-      *ops -= 1;
+  }
 
-      return res;
+  if (!v7_is_number(a->cval) || !v7_is_number(b->cval)) {
+    return 0;
+  }
+  switch (op) {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_REM:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_LSHIFT:
+    case OP_RSHIFT:
+    case OP_URSHIFT:
+    case OP_OR:
+    case OP_XOR:
+    case OP_AND:
+      bcode_opt_fold(a, v7_mk_number(b_num_bin_op(op, x, y)));
+      break;
+    case OP_EQ_EQ:
+    case OP_NE_NE:
+      /* numbers are compared as values, see `OP_EQ_EQ` */
+      bcode_opt_fold(a, v7_mk_boolean((op == OP_EQ_EQ) ==
+                                      (a->cval == b->cval &&
+                                       a->cval != V7_TAG_NAN)));
+      break;
+    case OP_EQ:
+    case OP_NE:
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+      bcode_opt_fold(a, v7_mk_boolean(b_bool_bin_op(op, x, y)));
       break;
-    }
     default:
-      return ((val_t *) vec->p)[idx - BCODE_MAX_INLINE_TYPE_TAG];
+      return 0;
   }
+  return 1;
 }
 
-V7_PRIVATE void bcode_op_lit(struct bcode_builder *bbuilder, enum opcode op,
-                             lit_t lit) {
-  bcode_op(bbuilder, op);
-
-  switch (lit.mode) {
-    case LIT_MODE__TABLE:
-      bcode_add_varint(bbuilder, lit.v.lit_idx + BCODE_MAX_INLINE_TYPE_TAG);
-      break;
-
-    case LIT_MODE__INLINED:
-      if (v7_is_string(lit.v.inline_val)) {
-        size_t len;
-        const char *s =
-            v7_get_string_data(bbuilder->v7, &lit.v.inline_val, &len);
-        bcode_add_varint(bbuilder, BCODE_INLINE_STRING_TYPE_TAG);
-        bcode_add_varint(bbuilder, len);
-        bcode_ops_append(bbuilder, s, len + 1 /* nul term */);
-      } else if (v7_is_number(lit.v.inline_val)) {
-        bcode_add_varint(bbuilder, BCODE_INLINE_NUMBER_TYPE_TAG);
-        /*
-         * TODO(dfrank): we can save some memory by storing string
-         * representation of a number here, instead of wasting 8 bytes for each
-         * number.
-         *
-         * Alternatively, we can add more tags for integers, like
-         * `BCODE_INLINE_S08_TYPE_TAG`, `BCODE_INLINE_S16_TYPE_TAG`, etc, since
-         * integers are the most common numbers for sure.
-         */
-        bcode_ops_append(bbuilder, &lit.v.inline_val, sizeof(lit.v.inline_val));
-      } else if (is_js_function(lit.v.inline_val)) {
 /*
- * TODO(dfrank): implement `bcode_serialize_*` more generically, so
- * that they can write to buffer instead of a `FILE`. Then, remove this
- * workaround with `CS_PLATFORM == CS_P_UNIX`, `tmpfile()`, etc.
+ * Optimizes the instructions made by the builder, before it's finalized:
+ *
+ * - folds operators on number constants, and conditional jumps on constants;
+ * - threads jumps to unconditional jumps;
+ * - drops the unreachable code (e.g. after `OP_RET` or `OP_THROW`), and jumps
+ *   to the next instruction;
+ * - fuses common sequences into super-instructions (`OP_GET_PROP`, ...).
+ *
+ * Folding and fusing never cross a jump target. Does nothing if
+ * `v7->no_bcode_opt` is set.
  */
-#if CS_PLATFORM == CS_P_UNIX
-        struct v7_js_function *func;
-        FILE *fp = tmpfile();
-        long len = 0;
-        char *p;
+V7_PRIVATE void bcode_optimize(struct bcode_builder *bbuilder) {
+  struct bcode *bcode = bbuilder->bcode;
+  struct v7 *v7 = bbuilder->v7;
+  char *ops = bbuilder->ops.buf;
+  const char *start, *end = ops + bbuilder->ops.len, *p;
+  struct bcode_opt_insn *in = NULL;
+  size_t *index = NULL, *work = NULL, *resolve = NULL;
+  size_t cnt = 0, i, j, k, l, work_cnt;
+  struct mbuf out;
+  int changed;
 
-        func = to_js_function(lit.v.inline_val);
+  if (v7->no_bcode_opt || bbuilder->ops.len == 0) return;
 
-        /* we inline functions if only we're precompiling */
-        assert(bbuilder->v7->is_precompiling);
+  start = bcode_end_names(ops, bcode->names_cnt);
 
-        bcode_add_varint(bbuilder, BCODE_INLINE_FUNC_TYPE_TAG);
-        bcode_serialize_func(bbuilder->v7, func->bcode, fp);
+  for (p = start; p < end; p = bcode_next_op(bcode, p)) {
+    cnt++;
+  }
+  if (p != end || cnt == 0) goto clean;
 
-        fflush(fp);
+  in = (struct bcode_opt_insn *) calloc(cnt, sizeof(*in));
+  index = (size_t *) malloc((bbuilder->ops.len + 1) * sizeof(*index));
+  work = (size_t *) malloc(cnt * sizeof(*work));
+  resolve = (size_t *) malloc((cnt + 1) * sizeof(*resolve));
+  if (in == NULL || index == NULL || work == NULL || resolve == NULL) {
+    goto clean;
+  }
 
-        len = ftell(fp);
+  /* decode the instructions, and their constants */
+  memset(index, 0xff, (bbuilder->ops.len + 1) * sizeof(*index));
+  for (i = 0, p = start; p < end; i++) {
+    in[i].off = p - ops;
+    in[i].op = (uint8_t) *p;
+    in[i].live = 1;
+    index[in[i].off] = i;
+    p = bcode_next_op(bcode, p);
+    in[i].len = p - ops - in[i].off;
 
-        p = (char *) mmap(NULL, len, PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+    switch (in[i].op) {
+      case OP_PUSH_ZERO:
+      case OP_PUSH_ONE:
+        in[i].is_const = 1;
+        in[i].cval = v7_mk_number(in[i].op == OP_PUSH_ONE);
+        break;
+      case OP_PUSH_TRUE:
+      case OP_PUSH_FALSE:
+        in[i].is_const = 1;
+        in[i].cval = v7_mk_boolean(in[i].op == OP_PUSH_TRUE);
+        break;
+      case OP_PUSH_LIT: {
+        size_t tag;
+        const char *q = bcode_skip_varint(ops + in[i].off + 1, &tag);
+        if (tag == BCODE_INLINE_NUMBER_TYPE_TAG) {
+          memcpy(&in[i].cval, q, sizeof(in[i].cval));
+          in[i].is_const = 1;
+        } else if (tag >= BCODE_MAX_INLINE_TYPE_TAG) {
+          in[i].cval =
+              ((val_t *) bbuilder->lit.buf)[tag - BCODE_MAX_INLINE_TYPE_TAG];
+          in[i].is_const = v7_is_number(in[i].cval);
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  index[bbuilder->ops.len] = cnt;
 
-        bcode_ops_append(bbuilder, p, len);
+  /* resolve the jump targets; give up on the ones we don't understand */
+  for (i = 0; i < cnt; i++) {
+    bcode_off_t target;
+    if (!bcode_op_has_target((enum opcode) in[i].op)) continue;
+    memcpy(&target, ops + in[i].off + 1, sizeof(target));
+    if (target > bbuilder->ops.len || index[target] == (size_t) ~0) {
+      goto clean;
+    }
+    in[i].target = index[target];
+    if (in[i].op == OP_SWITCH_NUM || in[i].op == OP_SWITCH_STR) {
+      char *c = NULL;
+      while ((c = bcode_switch_next_case(ops + in[i].off, c)) != NULL) {
+        memcpy(&target, c, sizeof(target));
+        if (target > bbuilder->ops.len ||
+            (target != 0 && index[target] == (size_t) ~0)) {
+          goto clean;
+        }
+      }
+    }
+  }
 
-        fclose(fp);
-#endif
+  /* fold constants */
+  bcode_opt_mark_targets(in, cnt, ops, index);
+  for (i = 0; i < cnt; i = j) {
+    j = bcode_opt_next(in, cnt, i);
+    if (!in[i].live || !in[i].is_const || j == cnt || in[j].is_target) {
+      continue;
+    }
+    if (in[j].op == OP_JMP_TRUE || in[j].op == OP_JMP_FALSE) {
+      /* a jump on a constant is either always taken, or never */
+      if (v7_is_truthy(v7, in[i].cval) == (in[j].op == OP_JMP_TRUE)) {
+        in[i].op = OP_JMP;
+        in[i].target = in[j].target;
+        in[i].is_const = in[i].folded = 0;
       } else {
-        /* invalid type of inlined value */
-        abort();
+        in[i].live = 0;
       }
-      break;
-
-    default:
-      /* invalid literal mode */
-      abort();
-      break;
+      in[j].live = 0;
+      j = bcode_opt_prev(in, i);
+    } else if (bcode_opt_fold_op(v7, &in[i], NULL, (enum opcode) in[j].op)) {
+      in[j].live = 0;
+      j = bcode_opt_prev(in, i);
+    } else if (in[j].is_const &&
+               (k = bcode_opt_next(in, cnt, j)) < cnt && !in[k].is_target &&
+               bcode_opt_fold_op(v7, &in[i], &in[j], (enum opcode) in[k].op)) {
+      in[j].live = in[k].live = 0;
+      j = bcode_opt_prev(in, i);
+    }
+  }
+
+  /* thread jumps to unconditional jumps */
+  for (i = 0; i < cnt; i++) {
+    int hops;
+    switch (in[i].op) {
+      case OP_JMP:
+      case OP_JMP_TRUE:
+      case OP_JMP_FALSE:
+      case OP_JMP_TRUE_DROP:
+      case OP_JMP_LT:
+      case OP_JMP_LE:
+      case OP_JMP_GT:
+      case OP_JMP_GE:
+        for (hops = 0; hops < 8; hops++) {
+          j = bcode_opt_live(in, cnt, in[i].target);
+          if (j == cnt || in[j].op != OP_JMP || in[j].target == j) break;
+          in[i].target = in[j].target;
+        }
+        break;
+      default:
+        break;
+    }
   }
-}
-
-V7_PRIVATE void bcode_push_lit(struct bcode_builder *bbuilder, lit_t lit) {
-  bcode_op_lit(bbuilder, OP_PUSH_LIT, lit);
-}
-
-WARN_UNUSED_RESULT
-V7_PRIVATE enum v7_err bcode_add_name(struct bcode_builder *bbuilder,
-                                      const char *p, size_t len, size_t *idx) {
-  enum v7_err rcode = V7_OK;
-  int llen;
-  size_t ops_index;
 
-  /*
-   * if name length is not provided, assume it's null-terminated and calculate
-   * it
-   */
-  if (len == ~((size_t) 0)) {
-    len = strlen(p);
+  /* drop the unreachable code */
+  work_cnt = 0;
+  if ((k = bcode_opt_live(in, cnt, 0)) < cnt) {
+    in[k].reached = 1;
+    work[work_cnt++] = k;
+  }
+  while (work_cnt > 0) {
+    i = work[--work_cnt];
+    k = cnt;
+    if (bcode_op_has_target((enum opcode) in[i].op)) {
+      k = bcode_opt_live(in, cnt, in[i].target);
+    }
+    if (k < cnt && !in[k].reached) {
+      in[k].reached = 1;
+      work[work_cnt++] = k;
+    }
+    if (in[i].op == OP_SWITCH_NUM || in[i].op == OP_SWITCH_STR) {
+      char *c = NULL;
+      bcode_off_t target;
+      while ((c = bcode_switch_next_case(ops + in[i].off, c)) != NULL) {
+        memcpy(&target, c, sizeof(target));
+        if (target != 0 &&
+            (k = bcode_opt_live(in, cnt, index[target])) < cnt &&
+            !in[k].reached) {
+          in[k].reached = 1;
+          work[work_cnt++] = k;
+        }
+      }
+    }
+    switch (in[i].op) {
+      case OP_JMP:
+      case OP_RET:
+      case OP_THROW:
+      case OP_BREAK:
+      case OP_CONTINUE:
+        break;
+      default:
+        k = bcode_opt_next(in, cnt, i);
+        if (k < cnt && !in[k].reached) {
+          in[k].reached = 1;
+          work[work_cnt++] = k;
+        }
+        break;
+    }
+  }
+  for (i = 0; i < cnt; i++) {
+    if (!in[i].reached) in[i].live = 0;
+  }
+
+  /* fuse super-instructions */
+  bcode_opt_mark_targets(in, cnt, ops, index);
+  for (i = 0; i < cnt; i = j) {
+    j = bcode_opt_next(in, cnt, i);
+    if (!in[i].live || j == cnt || in[j].is_target) continue;
+    if (in[i].op == OP_PUSH_LIT && !in[i].folded && in[j].op == OP_GET) {
+      in[i].op = OP_GET_PROP;
+    } else if (in[i].op == OP_SET_LOCAL && in[j].op == OP_DROP) {
+      in[i].op = OP_SET_LOCAL_DROP;
+    } else if (in[i].op >= OP_INC_VAR && in[i].op <= OP_DEC_LOCAL &&
+               in[j].op == OP_PUSH_ONE &&
+               (k = bcode_opt_next(in, cnt, j)) < cnt && !in[k].is_target &&
+               (in[k].op == OP_ADD || in[k].op == OP_SUB) &&
+               (l = bcode_opt_next(in, cnt, k)) < cnt && !in[l].is_target &&
+               in[l].op == OP_DROP) {
+      /* `++a` whose value is dropped, see `bcode_op_inc_var()` */
+      in[k].live = 0;
+    } else {
+      continue;
+    }
+    in[j].live = 0;
+    j = bcode_opt_next(in, cnt, j);
   }
 
-  /* if index at which to put name is not provided, we'll append at the end */
-  if (idx != NULL) {
-    ops_index = *idx;
-  } else {
-    ops_index = bbuilder->ops.len;
+  /* drop jumps to the next instruction, until no more */
+  do {
+    changed = 0;
+    resolve[cnt] = cnt;
+    for (i = cnt; i-- > 0;) {
+      resolve[i] = in[i].live ? i : resolve[i + 1];
+    }
+    for (i = 0; i < cnt; i++) {
+      if (in[i].live && in[i].op == OP_JMP &&
+          resolve[in[i].target] == bcode_opt_next(in, cnt, i)) {
+        in[i].live = 0;
+        changed = 1;
+      }
+    }
+  } while (changed);
+
+  /* lay the instructions out, and write them */
+  mbuf_init(&out, bbuilder->ops.len);
+  mbuf_append(&out, ops, start - ops);
+  for (i = 0; i < cnt; i++) {
+    in[i].new_off = out.len;
+    if (!in[i].live) continue;
+    if (in[i].folded) {
+      uint8_t buf[2] = {OP_PUSH_LIT, BCODE_INLINE_NUMBER_TYPE_TAG};
+      if (v7_is_boolean(in[i].cval)) {
+        buf[0] = v7_is_truthy(v7, in[i].cval) ? OP_PUSH_TRUE : OP_PUSH_FALSE;
+        mbuf_append(&out, buf, 1);
+      } else if (in[i].cval == v7_mk_number(0) ||
+                 in[i].cval == v7_mk_number(1)) {
+        buf[0] = in[i].cval == v7_mk_number(0) ? OP_PUSH_ZERO : OP_PUSH_ONE;
+        mbuf_append(&out, buf, 1);
+      } else {
+        /* inline literal, see `bcode_op_lit()` */
+        mbuf_append(&out, buf, 2);
+        mbuf_append(&out, &in[i].cval, sizeof(in[i].cval));
+      }
+    } else if (in[i].op == OP_SWITCH_NUM || in[i].op == OP_SWITCH_STR) {
+      /* the targets are written below */
+      mbuf_append(&out, ops + in[i].off, in[i].len);
+    } else if (bcode_op_has_target((enum opcode) in[i].op)) {
+      /* the target is written below */
+      mbuf_append(&out, &in[i].op, 1);
+      mbuf_append(&out, NULL, sizeof(bcode_off_t));
+    } else {
+      mbuf_append(&out, ops + in[i].off, in[i].len);
+      out.buf[in[i].new_off] = (char) in[i].op;
+    }
+  }
+  for (i = cnt; i-- > 0;) {
+    resolve[i] = in[i].live ? in[i].new_off : resolve[i + 1];
+  }
+  resolve[cnt] = out.len;
+  for (i = 0; i < cnt; i++) {
+    if (in[i].live && bcode_op_has_target((enum opcode) in[i].op)) {
+      bcode_off_t target = (bcode_off_t) resolve[in[i].target];
+      char *c = NULL;
+      memcpy(out.buf + in[i].new_off + 1, &target, sizeof(target));
+      if (in[i].op != OP_SWITCH_NUM && in[i].op != OP_SWITCH_STR) continue;
+      while ((c = bcode_switch_next_case(out.buf + in[i].new_off, c)) !=
+             NULL) {
+        memcpy(&target, c, sizeof(target));
+        if (target != 0) {
+          target = (bcode_off_t) resolve[index[target]];
+          memcpy(c, &target, sizeof(target));
+        }
+      }
+    }
   }
 
-  /* calculate how much varint len will take */
-  llen = calc_llen(len);
+  mbuf_free(&bbuilder->ops);
+  bbuilder->ops = out;
 
-  /* reserve space in `ops` buffer */
-  mbuf_insert(&bbuilder->ops, ops_index, NULL, llen + len + 1 /*null-term*/);
+clean:
+  free(in);
+  free(index);
+  free(work);
+  free(resolve);
+}
 
-  {
-    char *ops = bbuilder->ops.buf + ops_index;
+/*
+ * Finalize bcode builder: propagate data to the bcode and transfer the
+ * ownership from builder to bcode
+ */
+V7_PRIVATE void bcode_builder_finalize(struct bcode_builder *bbuilder) {
+  mbuf_trim(&bbuilder->ops);
+  bbuilder->bcode->ops.p = bbuilder->ops.buf;
+  bbuilder->bcode->ops.len = bbuilder->ops.len;
+  mbuf_init(&bbuilder->ops, 0);
 
-    /* put varint len */
-    ops += encode_varint(len, (unsigned char *) ops);
+  mbuf_trim(&bbuilder->lit);
+  bbuilder->bcode->lit.p = bbuilder->lit.buf;
+  bbuilder->bcode->lit.len = bbuilder->lit.len;
+  mbuf_init(&bbuilder->lit, 0);
 
-    /* put string */
-    memcpy(ops, p, len);
-    ops += len;
+  mbuf_free(&bbuilder->slots);
 
-    /* null-terminate */
-    *ops++ = 0x00;
+  bbuilder->bcode->max_stack = bcode_calc_max_stack(bbuilder->bcode);
 
-    if (idx != NULL) {
-      *idx = ops - bbuilder->ops.buf;
-    }
-  }
+  memset(bbuilder, 0x00, sizeof(*bbuilder));
+}
 
-  /* maintain total number of names */
-  if (bbuilder->bcode->names_cnt < V7_NAMES_CNT_MAX) {
-    bbuilder->bcode->names_cnt++;
-  } else {
-    rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "Too many local variables");
-  }
+#if defined(V7_BCODE_DUMP) || defined(V7_BCODE_TRACE)
+V7_PRIVATE void dump_op(struct v7 *v7, FILE *f, struct bcode *bcode,
+                        char **ops) {
+  char *p = *ops;
 
-  return rcode;
+  assert(*p < OP_MAX);
+  fprintf(f, "%zu: %s", (size_t)(p - bcode->ops.p), op_names[(uint8_t) *p]);
+  switch (*p) {
+    case OP_PUSH_LIT:
+    case OP_SAFE_GET_VAR:
+    case OP_GET_VAR:
+    case OP_SET_VAR:
+    case OP_ENTER_CATCH:
+    case OP_GET_PROP:
+    case OP_INC_VAR:
+    case OP_DEC_VAR: {
+      val_t lit = bcode_decode_lit(v7, bcode, &p);
+      fprintf(f, ": ");
+      if (is_js_function(lit)) {
+        /* it may not be printable yet, while the stdlib is being made */
+        fprintf(f, "[function]");
+      } else {
+        v7_fprint(f, v7, lit);
+      }
+      break;
+    }
+    case OP_CALL:
+    case OP_NEW:
+    case OP_GEN_START:
+    case OP_RESUME:
+      p++;
+      fprintf(f, "(%d)", *p);
+      break;
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_DROP:
+    case OP_INC_LOCAL:
+    case OP_DEC_LOCAL:
+      fprintf(f, "(%lu)", (unsigned long) bcode_get_varint(&p));
+      break;
+    case OP_FRAME_SLOTS: {
+      size_t i;
+      fprintf(f, "(%lu):", (unsigned long) bcode_get_varint(&p));
+      for (i = 1; i < bcode->names_cnt; i++) {
+        fprintf(f, " %lu", (unsigned long) bcode_get_varint(&p));
+      }
+      break;
+    }
+    case OP_JMP:
+    case OP_JMP_FALSE:
+    case OP_JMP_TRUE:
+    case OP_JMP_TRUE_DROP:
+    case OP_JMP_IF_CONTINUE:
+    case OP_TRY_PUSH_CATCH:
+    case OP_TRY_PUSH_FINALLY:
+    case OP_TRY_PUSH_LOOP:
+    case OP_TRY_PUSH_SWITCH:
+    case OP_JMP_LT:
+    case OP_JMP_LE:
+    case OP_JMP_GT:
+    case OP_JMP_GE: {
+      bcode_off_t target;
+      p++;
+      memcpy(&target, p, sizeof(target));
+      fprintf(f, "(%lu)", (unsigned long) target);
+      p += sizeof(target) - 1;
+      break;
+    }
+    case OP_SWITCH_NUM:
+    case OP_SWITCH_STR: {
+      bcode_off_t target;
+      int32_t lo;
+      char *c = NULL;
+      memcpy(&target, p + 1, sizeof(target));
+      memcpy(&lo, p + BCODE_SWITCH_HDR - sizeof(lo), sizeof(lo));
+      fprintf(f, "(%lu):", (unsigned long) target);
+      while ((c = bcode_switch_next_case(p, c)) != NULL) {
+        memcpy(&target, c, sizeof(target));
+        if (*p == OP_SWITCH_NUM) {
+          if (target != 0) {
+            fprintf(f, " %d->%lu", (int) lo, (unsigned long) target);
+          }
+          lo++;
+        } else {
+          uint32_t len;
+          memcpy(&len, c + sizeof(target), sizeof(len));
+          fprintf(f, " \"%.*s\"->%lu", (int) len,
+                  c + sizeof(target) + sizeof(len), (unsigned long) target);
+        }
+      }
+      p = (char *) bcode_next_op(bcode, p) - 1;
+      break;
+    }
+    default:
+      break;
+  }
+  fprintf(f, "\n");
+  *ops = p;
 }
+#endif
 
-V7_PRIVATE char *bcode_end_names(char *ops, size_t names_cnt) {
-  while (names_cnt--) {
-    ops = bcode_next_name(ops, NULL, NULL);
+#ifdef V7_BCODE_DUMP
+V7_PRIVATE void dump_bcode(struct v7 *v7, FILE *f, struct bcode *bcode) {
+  char *p = bcode_end_names(bcode->ops.p, bcode->names_cnt);
+  char *end = bcode->ops.p + bcode->ops.len;
+  for (; p < end; p++) {
+    dump_op(v7, f, bcode, &p);
   }
-  return ops;
 }
+#endif
 
-V7_PRIVATE char *bcode_next_name(char *ops, char **pname, size_t *plen) {
-  size_t len;
-  int llen;
-
-  len = decode_varint((unsigned char *) ops, &llen);
+V7_PRIVATE void bcode_init(struct bcode *bcode, uint8_t strict_mode) {
+  memset(bcode, 0x00, sizeof(*bcode));
+  bcode->refcnt = 0;
+  bcode->args_cnt = 0;
+  bcode->strict_mode = strict_mode;
+}
 
-  ops += llen;
+V7_PRIVATE void bcode_free(struct v7 *v7, struct bcode *bcode) {
+  (void) v7;
+#if V7_ENABLE__Memory__stats
+  if (!bcode->ops_in_rom) {
+    v7->bcode_ops_size -= bcode->ops.len;
+  }
 
-  if (pname != NULL) {
-    *pname = ops;
+  v7->bcode_lit_total_size -= bcode->lit.len;
+  if (bcode->deserialized) {
+    v7->bcode_lit_deser_size -= bcode->lit.len;
   }
+#endif
 
-  if (plen != NULL) {
-    *plen = len;
+  if (!bcode->ops_in_rom) {
+    free(bcode->ops.p);
   }
+  memset(&bcode->ops, 0x00, sizeof(bcode->ops));
 
-  ops += len + 1 /*null-terminator*/;
-  return ops;
-}
+  free(bcode->lit.p);
+  memset(&bcode->lit, 0x00, sizeof(bcode->lit));
 
-V7_PRIVATE char *bcode_next_name_v(struct v7 *v7, struct bcode *bcode,
-                                   char *ops, val_t *res) {
-  char *name;
-  size_t len;
+  free(bcode->ic_map);
+  free(bcode->ics);
+  bcode->ic_map = NULL;
+  bcode->ics = NULL;
+  bcode->ics_cnt = 0;
 
-  ops = bcode_next_name(ops, &name, &len);
+  free(bcode->vals);
+  free(bcode->strs);
+  bcode->vals = NULL;
+  bcode->strs = NULL;
+  bcode->vals_cnt = 0;
+  bcode->strs_mask = 0;
 
-  /*
-   * If `ops` is in RAM, we create owned string, since the string may outlive
-   * bcode. Otherwise (`ops` is in ROM), we create foreign string.
-   */
-  *res = v7_mk_string(v7, name, len, !bcode->ops_in_rom);
+#ifdef V7_ENABLE_JIT
+  jit_free(bcode);
+#endif
 
-  return ops;
+  bcode->refcnt = 0;
 }
 
-V7_PRIVATE bcode_off_t bcode_pos(struct bcode_builder *bbuilder) {
-  return bbuilder->ops.len;
+V7_PRIVATE void retain_bcode(struct v7 *v7, struct bcode *b) {
+  (void) v7;
+  if (!b->frozen) {
+    b->refcnt++;
+  }
 }
 
-/*
- * Appends a branch target and returns its location.
- * This location can be updated with bcode_patch_target.
- * To be issued following a JMP_* bytecode
- */
-V7_PRIVATE bcode_off_t bcode_add_target(struct bcode_builder *bbuilder) {
-  bcode_off_t pos = bcode_pos(bbuilder);
-  bcode_off_t zero = 0;
-  bcode_ops_append(bbuilder, &zero, sizeof(bcode_off_t));
-  return pos;
-}
+V7_PRIVATE void release_bcode(struct v7 *v7, struct bcode *b) {
+  (void) v7;
+  if (b->frozen) return;
 
-/* Appends an op requiring a branch target. See bcode_add_target. */
-V7_PRIVATE bcode_off_t
-bcode_op_target(struct bcode_builder *bbuilder, uint8_t op) {
-  bcode_op(bbuilder, op);
-  return bcode_add_target(bbuilder);
+  assert(b->refcnt > 0);
+  if (b->refcnt != 0) b->refcnt--;
+
+  if (b->refcnt == 0) {
+    bcode_free(v7, b);
+    free(b);
+  }
 }
 
-V7_PRIVATE void bcode_patch_target(struct bcode_builder *bbuilder,
-                                   bcode_off_t label, bcode_off_t target) {
-  memcpy(bbuilder->ops.buf + label, &target, sizeof(target));
+V7_PRIVATE void bcode_op(struct bcode_builder *bbuilder, uint8_t op) {
+  bcode_ops_append(bbuilder, &op, 1);
 }
 
-#ifndef V7_NO_FS
+/*
+ * Appends varint-encoded integer to the `ops` mbuf
+ */
+V7_PRIVATE void bcode_add_varint(struct bcode_builder *bbuilder, size_t value) {
+  int k = calc_llen(value); /* Calculate how many bytes length takes */
+  int offset = bbuilder->ops.len;
 
-static void bcode_serialize_varint(int n, FILE *out) {
-  unsigned char buf[8];
-  int k = calc_llen(n);
-  encode_varint(n, buf);
-  fwrite(buf, k, 1, out);
+  /* Allocate buffer */
+  bcode_ops_append(bbuilder, NULL, k);
+
+  /* Write value */
+  encode_varint(value, (unsigned char *) bbuilder->ops.buf + offset);
 }
 
-static void bcode_serialize_emit_type_tag(enum bcode_ser_lit_tag tag,
-                                          FILE *out) {
-  uint8_t t = (uint8_t) tag;
-  fwrite(&t, 1, 1, out);
+V7_PRIVATE size_t bcode_get_varint(char **ops) {
+  size_t ret = 0;
+  int len = 0;
+  (*ops)++;
+  ret = decode_varint((unsigned char *) *ops, &len);
+  *ops += len - 1;
+  return ret;
 }
 
-static void bcode_serialize_string(struct v7 *v7, val_t v, FILE *out) {
-  size_t len;
-  const char *s = v7_get_string_data(v7, &v, &len);
+static int bcode_is_inline_string(struct v7 *v7, val_t val) {
+  uint64_t tag = val & V7_TAG_MASK;
+  if (v7->is_precompiling && v7_is_string(val)) {
+    return 1;
+  }
+  return tag == V7_TAG_STRING_I || tag == V7_TAG_STRING_5;
+}
 
-  bcode_serialize_varint(len, out);
-  fwrite(s, len + 1 /* NUL char */, 1, out);
+static int bcode_is_inline_func(struct v7 *v7, val_t val) {
+  return (v7->is_precompiling && is_js_function(val));
 }
 
-static void bcode_serialize_lit(struct v7 *v7, val_t v, FILE *out) {
-  int t = val_type(v7, v);
-  switch (t) {
-    case V7_TYPE_NUMBER: {
-      double num = v7_to_number(v);
-      char buf[18];
-      const char *fmt = num > 1e10 ? "%.21g" : "%.10g";
-      size_t len = snprintf(buf, sizeof(buf), fmt, num);
+V7_PRIVATE lit_t bcode_add_lit(struct bcode_builder *bbuilder, val_t val) {
+  lit_t lit;
+  memset(&lit, 0, sizeof(lit));
 
-      bcode_serialize_emit_type_tag(BCODE_SER_NUMBER, out);
-      bcode_serialize_varint(len, out);
-      fwrite(buf, len, 1, out);
-      break;
-    }
-    case V7_TYPE_STRING: {
-      bcode_serialize_emit_type_tag(BCODE_SER_STRING, out);
-      bcode_serialize_string(v7, v, out);
-      break;
+  if (bcode_is_inline_string(bbuilder->v7, val) ||
+      bcode_is_inline_func(bbuilder->v7, val) || v7_is_number(val)) {
+    /* literal should be inlined (it's `bcode_op_lit()` who does this) */
+    lit.mode = LIT_MODE__INLINED;
+    lit.v.inline_val = val;
+  } else {
+    /* literal will now be added to the literal table */
+    lit.mode = LIT_MODE__TABLE;
+    lit.v.lit_idx = bbuilder->lit.len / sizeof(val);
+
+#if V7_ENABLE__Memory__stats
+    bbuilder->v7->bcode_lit_total_size -= bbuilder->lit.len;
+    if (bbuilder->bcode->deserialized) {
+      bbuilder->v7->bcode_lit_deser_size -= bbuilder->lit.len;
     }
-    /* TODO(mkm):
-     * case V7_TYPE_REGEXP_OBJECT:
+#endif
+
+    mbuf_append(&bbuilder->lit, &val, sizeof(val));
+
+    /*
+     * immediately propagate current lit buffer to the bcode, so that GC will
+     * be aware of it
      */
-    case V7_TYPE_FUNCTION_OBJECT: {
-      struct v7_js_function *func;
-      func = to_js_function(v);
-      assert(func->bcode != NULL);
+    bbuilder->bcode->lit.p = bbuilder->lit.buf;
+    bbuilder->bcode->lit.len = bbuilder->lit.len;
 
-      bcode_serialize_emit_type_tag(BCODE_SER_FUNCTION, out);
-      bcode_serialize_func(v7, func->bcode, out);
-      break;
+#if V7_ENABLE__Memory__stats
+    bbuilder->v7->bcode_lit_total_size += bbuilder->lit.len;
+    if (bbuilder->bcode->deserialized) {
+      bbuilder->v7->bcode_lit_deser_size += bbuilder->lit.len;
     }
-    default:
-      fprintf(stderr, "Unhandled type: %d", t);
-      assert(1 == 0);
+#endif
   }
+  return lit;
 }
 
-static void bcode_serialize_func(struct v7 *v7, struct bcode *bcode,
-                                 FILE *out) {
-  val_t *vp;
-  struct v7_vec *vec;
-  (void) v7;
-
-  /*
-   * literals table:
-   * <varint> // number of literals
-   * <bcode_ser_literal>*
-   */
-  vec = &bcode->lit;
-  bcode_serialize_varint(vec->len / sizeof(val_t), out);
-  for (vp = (val_t *) vec->p; (char *) vp < vec->p + vec->len; vp++) {
-    bcode_serialize_lit(v7, *vp, out);
-  }
-
-  /* args_cnt */
-  bcode_serialize_varint(bcode->args_cnt, out);
+#if 0
+V7_PRIVATE v7_val_t bcode_get_lit(struct bcode *bcode, size_t idx) {
+  val_t ret;
+  memcpy(&ret, bcode->lit.p + (size_t) idx * sizeof(ret), sizeof(ret));
+  return ret;
+}
+#endif
 
-  /* names_cnt */
-  bcode_serialize_varint(bcode->names_cnt, out);
+static const char *bcode_deserialize_func(struct v7 *v7, struct bcode *bcode,
+                                          const char *data);
 
-  /*
-   * bcode:
-   * <varint> // opcodes length
-   * <opcode>*
-   */
-  vec = &bcode->ops;
-  bcode_serialize_varint(vec->len, out);
-  fwrite(vec->p, vec->len, 1, out);
-}
+#define BCODE_STRS_MIN 8
 
-V7_PRIVATE void bcode_serialize(struct v7 *v7, struct bcode *bcode, FILE *out) {
-  (void) v7;
-  (void) bcode;
+/*
+ * Makes the values of the names of the bcode, if they aren't made yet (see
+ * `struct bcode`). Returns 0 if the bcode can't keep values, i.e. it's frozen.
+ */
+static int bcode_make_vals(struct v7 *v7, struct bcode *bcode) {
+  char *ops = bcode->ops.p, *name;
+  size_t i, len;
 
-  fwrite(BIN_BCODE_SIGNATURE, sizeof(BIN_BCODE_SIGNATURE), 1, out);
-  bcode_serialize_func(v7, bcode, out);
+  if (bcode->frozen) return 0;
+  if (bcode->vals == NULL) {
+    bcode->vals = (val_t *) malloc((bcode->names_cnt + 1) * sizeof(val_t));
+    for (i = 0; i < bcode->names_cnt; i++) {
+      /*
+       * If `ops` is in RAM, we create owned string, since the string may
+       * outlive bcode. Otherwise (`ops` is in ROM), we create foreign string.
+       */
+      ops = bcode_next_name(ops, &name, &len);
+      bcode->vals[i] = v7_mk_string(v7, name, len, !bcode->ops_in_rom);
+    }
+    bcode->vals_cnt = bcode->names_cnt;
+  }
+  return 1;
 }
 
-static size_t bcode_deserialize_varint(const char **data) {
-  size_t ret = 0;
-  int len = 0;
-  ret = decode_varint((const unsigned char *) (*data), &len);
-  *data += len;
-  return ret;
+static void bcode_strs_put(struct bcode *bcode, uint64_t entry) {
+  uint32_t i = ((uint32_t)(entry >> 32) * 2654435761u) & bcode->strs_mask;
+  while (bcode->strs[i] != 0) i = (i + 1) & bcode->strs_mask;
+  bcode->strs[i] = entry;
 }
 
-static const char *bcode_deserialize_lit(struct bcode_builder *bbuilder,
-                                         const char *data) {
-  enum bcode_ser_lit_tag lit_tag;
+/*
+ * Returns the value of the inline string literal of `len` bytes at `p`, which
+ * points into `ops`.
+ */
+static val_t bcode_str_v(struct v7 *v7, struct bcode *bcode, const char *p,
+                         size_t len) {
+  uint32_t off = (uint32_t)(p - bcode->ops.p), cnt, size, i;
+  uint64_t e;
+  val_t res;
 
-  (void) bbuilder;
+  /* short strings are inlined in `val_t` and cost nothing to make */
+  if (len <= 5 || !bcode_make_vals(v7, bcode)) {
+    return v7_mk_string(v7, p, len, !bcode->ops_in_rom);
+  }
 
-  lit_tag = (enum bcode_ser_lit_tag) * data++;
+  if (bcode->strs != NULL) {
+    for (i = (off * 2654435761u) & bcode->strs_mask; (e = bcode->strs[i]) != 0;
+         i = (i + 1) & bcode->strs_mask) {
+      if ((uint32_t)(e >> 32) == off) return bcode->vals[(uint32_t) e - 1];
+    }
+  }
 
-  switch (lit_tag) {
-    case BCODE_SER_NUMBER:
-    case BCODE_SER_STRING:
-    case BCODE_SER_FUNCTION: {
+  cnt = bcode->vals_cnt - bcode->names_cnt;
+  size = bcode->strs == NULL ? 0 : bcode->strs_mask + 1;
+  if ((cnt + 1) * 4 > size * 3) {
+    /* keep `strs` at most 3/4 full, and `vals` big enough for it */
+    uint64_t *old = bcode->strs;
+    bcode->strs_mask = (size == 0 ? BCODE_STRS_MIN : size * 2) - 1;
+    bcode->strs = (uint64_t *) calloc(bcode->strs_mask + 1, sizeof(*old));
+    for (i = 0; i < size; i++) {
+      if (old[i] != 0) bcode_strs_put(bcode, old[i]);
+    }
+    free(old);
+    bcode->vals = (val_t *) realloc(
+        bcode->vals, (bcode->names_cnt + (bcode->strs_mask + 1) * 3 / 4) *
+                         sizeof(val_t));
+  }
+
+  res = v7_mk_string(v7, p, len, !bcode->ops_in_rom);
+  bcode->vals[bcode->vals_cnt++] = res;
+  bcode_strs_put(bcode, (uint64_t) off << 32 | bcode->vals_cnt);
+  return res;
+}
+
+V7_PRIVATE v7_val_t
+bcode_decode_lit(struct v7 *v7, struct bcode *bcode, char **ops) {
+  struct v7_vec *vec = &bcode->lit;
+  size_t idx = bcode_get_varint(ops);
+  if (idx >= BCODE_MAX_INLINE_TYPE_TAG) {
+    /* a value of the literal table: the most common case */
+    return ((val_t *) vec->p)[idx - BCODE_MAX_INLINE_TYPE_TAG];
+  }
+  switch (idx) {
+    case BCODE_INLINE_STRING_TYPE_TAG: {
+      val_t res;
+      size_t len = bcode_get_varint(ops);
+      res = bcode_str_v(
+          v7, bcode,
+          (const char *) *ops + 1 /*skip BCODE_INLINE_STRING_TYPE_TAG*/, len);
+      *ops += len + 1;
+      return res;
+      break;
+    }
+    case BCODE_INLINE_NUMBER_TYPE_TAG: {
+      val_t res;
+      memcpy(&res, *ops + 1 /*skip BCODE_INLINE_NUMBER_TYPE_TAG*/, sizeof(res));
+      *ops += sizeof(res);
+      return res;
+      break;
+    }
+    case BCODE_INLINE_FUNC_TYPE_TAG: {
       /*
-       * All numbers, strings and functions should be inlined into `ops` during
-       * serialization (see `bcode_add_lit()`, `bcode_is_inline_string()`,
-       * `bcode_is_inline_func()`, `bcode_op_lit()`), so we should never
-       * encounter them here
+       * Create half-done function: without scope but _with_ prototype. Scope
+       * will be set by `bcode_instantiate_function()`.
+       *
+       * The fact that the prototype is already set will make
+       * `bcode_instantiate_function()` just set scope on this function,
+       * instead of creating a new one.
        */
-      assert(0);
+      val_t res = mk_js_function(v7, NULL, v7_mk_object(v7));
+
+      /* Create bcode in this half-done function */
+      struct v7_js_function *func = to_js_function(res);
+
+      func->bcode = (struct bcode *) calloc(1, sizeof(*func->bcode));
+      bcode_init(func->bcode, bcode->strict_mode);
+      retain_bcode(v7, func->bcode);
+
+      /* deserialize the function's bcode from `ops` */
+      *ops = (char *) bcode_deserialize_func(
+          v7, func->bcode, *ops + 1 /*skip BCODE_INLINE_FUNC_TYPE_TAG*/);
+
+      /* decrement *ops, because it will be incremented by `eval_bcode` soon */
+      *ops -= 1;
+
+      return res;
       break;
     }
+    default:
+      return ((val_t *) vec->p)[idx - BCODE_MAX_INLINE_TYPE_TAG];
+  }
+}
 
-    case BCODE_SER_REGEX: {
-      /* TODO */
-      assert(0);
+V7_PRIVATE void bcode_op_lit(struct bcode_builder *bbuilder, enum opcode op,
+                             lit_t lit) {
+  bcode_op(bbuilder, op);
+
+  switch (lit.mode) {
+    case LIT_MODE__TABLE:
+      bcode_add_varint(bbuilder, lit.v.lit_idx + BCODE_MAX_INLINE_TYPE_TAG);
+      break;
+
+    case LIT_MODE__INLINED:
+      if (v7_is_string(lit.v.inline_val)) {
+        size_t len;
+        const char *s =
+            v7_get_string_data(bbuilder->v7, &lit.v.inline_val, &len);
+        bcode_add_varint(bbuilder, BCODE_INLINE_STRING_TYPE_TAG);
+        bcode_add_varint(bbuilder, len);
+        bcode_ops_append(bbuilder, s, len + 1 /* nul term */);
+      } else if (v7_is_number(lit.v.inline_val)) {
+        bcode_add_varint(bbuilder, BCODE_INLINE_NUMBER_TYPE_TAG);
+        /*
+         * TODO(dfrank): we can save some memory by storing string
+         * representation of a number here, instead of wasting 8 bytes for each
+         * number.
+         *
+         * Alternatively, we can add more tags for integers, like
+         * `BCODE_INLINE_S08_TYPE_TAG`, `BCODE_INLINE_S16_TYPE_TAG`, etc, since
+         * integers are the most common numbers for sure.
+         */
+        bcode_ops_append(bbuilder, &lit.v.inline_val, sizeof(lit.v.inline_val));
+      } else if (is_js_function(lit.v.inline_val)) {
+/*
+ * TODO(dfrank): implement `bcode_serialize_*` more generically, so
+ * that they can write to buffer instead of a `FILE`. Then, remove this
+ * workaround with `CS_PLATFORM == CS_P_UNIX`, `tmpfile()`, etc.
+ */
+#if CS_PLATFORM == CS_P_UNIX
+        struct v7_js_function *func;
+        FILE *fp = tmpfile();
+        long len = 0;
+        char *p;
+
+        func = to_js_function(lit.v.inline_val);
+
+        /* we inline functions if only we're precompiling */
+        assert(bbuilder->v7->is_precompiling);
+
+        bcode_add_varint(bbuilder, BCODE_INLINE_FUNC_TYPE_TAG);
+        bcode_serialize_func(bbuilder->v7, func->bcode, fp);
+
+        fflush(fp);
+
+        len = ftell(fp);
+
+        p = (char *) mmap(NULL, len, PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+
+        bcode_ops_append(bbuilder, p, len);
+
+        fclose(fp);
+#endif
+      } else {
+        /* invalid type of inlined value */
+        abort();
+      }
       break;
-    }
 
     default:
-      assert(0);
+      /* invalid literal mode */
+      abort();
       break;
   }
-
-  return data;
 }
 
-static const char *bcode_deserialize_func(struct v7 *v7, struct bcode *bcode,
-                                          const char *data) {
-  size_t size;
-  struct bcode_builder bbuilder;
+V7_PRIVATE void bcode_push_lit(struct bcode_builder *bbuilder, lit_t lit) {
+  bcode_op_lit(bbuilder, OP_PUSH_LIT, lit);
+}
 
-  bcode_builder_init(v7, &bbuilder, bcode);
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err bcode_add_name(struct bcode_builder *bbuilder,
+                                      const char *p, size_t len, size_t *idx) {
+  enum v7_err rcode = V7_OK;
+  int llen;
+  size_t ops_index;
 
   /*
-   * before deserializing, set the corresponding flag, so that metrics will be
-   * updated accordingly
+   * if name length is not provided, assume it's null-terminated and calculate
+   * it
    */
-  bcode->deserialized = 1;
-
-  /* get number of literals */
-  size = bcode_deserialize_varint(&data);
-  /* deserialize all literals */
-  for (; size > 0; --size) {
-    data = bcode_deserialize_lit(&bbuilder, data);
+  if (len == ~((size_t) 0)) {
+    len = strlen(p);
   }
 
-  /* get number of args */
-  bcode->args_cnt = bcode_deserialize_varint(&data);
+  /* if index at which to put name is not provided, we'll append at the end */
+  if (idx != NULL) {
+    ops_index = *idx;
+  } else {
+    ops_index = bbuilder->ops.len;
+  }
 
-  /* get number of names */
-  bcode->names_cnt = bcode_deserialize_varint(&data);
+  /* calculate how much varint len will take */
+  llen = calc_llen(len);
 
-  /* get opcode size */
-  size = bcode_deserialize_varint(&data);
+  /* reserve space in `ops` buffer */
+  mbuf_insert(&bbuilder->ops, ops_index, NULL, llen + len + 1 /*null-term*/);
 
-  bbuilder.ops.buf = (char *) data;
-  bbuilder.ops.size = size;
-  bbuilder.ops.len = size;
+  {
+    char *ops = bbuilder->ops.buf + ops_index;
 
-  bcode->ops_in_rom = 1;
+    /* put varint len */
+    ops += encode_varint(len, (unsigned char *) ops);
 
-  data += size;
+    /* put string */
+    memcpy(ops, p, len);
+    ops += len;
 
-  bcode_builder_finalize(&bbuilder);
-  return data;
-}
+    /* null-terminate */
+    *ops++ = 0x00;
 
-V7_PRIVATE void bcode_deserialize(struct v7 *v7, struct bcode *bcode,
-                                  const char *data) {
-  data = bcode_deserialize_func(v7, bcode, data);
-}
-
-#endif
-#ifdef V7_MODULE_LINES
-#line 1 "./src/eval.c"
-#endif
-/*
- * Copyright (c) 2014 Cesanta Software Limited
- * All rights reserved
- */
-
-/* Amalgamated: #include "common/str_util.h" */
-/* Amalgamated: #include "v7/src/internal.h" */
-/* Amalgamated: #include "v7/src/eval.h" */
-/* Amalgamated: #include "v7/src/string.h" */
-/* Amalgamated: #include "v7/src/array.h" */
-/* Amalgamated: #include "v7/src/object.h" */
-/* Amalgamated: #include "v7/src/gc.h" */
-/* Amalgamated: #include "v7/src/compiler.h" */
-/* Amalgamated: #include "v7/src/cyg_profile.h" */
-/* Amalgamated: #include "v7/src/vm.h" */
-/* Amalgamated: #include "v7/src/types.h" */
-/* Amalgamated: #include "v7/src/exceptions.h" */
-/* Amalgamated: #include "v7/src/conversion.h" */
-
-/*
- * Bcode offsets in "try stack" are stored in JS numbers, i.e.  in `double`s.
- * Apart from the offset itself, we also need some additional data:
- *
- * - type of the block that offset represents (`catch`, `finally`, `switch`,
- *   or some loop)
- * - size of the stack when the block is created (needed when throwing, since
- *   if exception is thrown from the middle of the expression, the stack may
- *   have any arbitrary length)
- *
- * We bake all this data into integer part of the double (53 bits) :
- *
- * - 32 bits: bcode offset
- * - 3 bits: "tag": the type of the block
- * - 16 bits: stack size
- */
-
-/*
- * Widths of data parts
- */
-#define LBLOCK_OFFSET_WIDTH 32
-#define LBLOCK_TAG_WIDTH 3
-#define LBLOCK_STACK_SIZE_WIDTH 16
+    if (idx != NULL) {
+      *idx = ops - bbuilder->ops.buf;
+    }
+  }
 
-/*
- * Shifts of data parts
- */
-#define LBLOCK_OFFSET_SHIFT (0)
-#define LBLOCK_TAG_SHIFT (LBLOCK_OFFSET_SHIFT + LBLOCK_OFFSET_WIDTH)
-#define LBLOCK_STACK_SIZE_SHIFT (LBLOCK_TAG_SHIFT + LBLOCK_TAG_WIDTH)
-#define LBLOCK_TOTAL_WIDTH (LBLOCK_STACK_SIZE_SHIFT + LBLOCK_STACK_SIZE_WIDTH)
+  /* maintain total number of names */
+  if (bbuilder->bcode->names_cnt < V7_NAMES_CNT_MAX) {
+    bbuilder->bcode->names_cnt++;
+  } else {
+    rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "Too many local variables");
+  }
 
-/*
- * Masks of data parts
- */
-#define LBLOCK_OFFSET_MASK \
-  ((int64_t)(((int64_t) 1 << LBLOCK_OFFSET_WIDTH) - 1) << LBLOCK_OFFSET_SHIFT)
-#define LBLOCK_TAG_MASK \
-  ((int64_t)(((int64_t) 1 << LBLOCK_TAG_WIDTH) - 1) << LBLOCK_TAG_SHIFT)
-#define LBLOCK_STACK_SIZE_MASK                             \
-  ((int64_t)(((int64_t) 1 << LBLOCK_STACK_SIZE_WIDTH) - 1) \
-   << LBLOCK_STACK_SIZE_SHIFT)
+  return rcode;
+}
 
-/*
- * Self-check: make sure all the data can fit into double's mantissa
- */
-#if (LBLOCK_TOTAL_WIDTH > 53)
-#error lblock width is too large, it can't fit into double's mantissa
-#endif
+V7_PRIVATE char *bcode_end_names(char *ops, size_t names_cnt) {
+  while (names_cnt--) {
+    ops = bcode_next_name(ops, NULL, NULL);
+  }
+  return ops;
+}
 
-/*
- * Tags that are used for bcode offsets in "try stack"
- */
-#define LBLOCK_TAG_CATCH ((int64_t) 0x01 << LBLOCK_TAG_SHIFT)
-#define LBLOCK_TAG_FINALLY ((int64_t) 0x02 << LBLOCK_TAG_SHIFT)
-#define LBLOCK_TAG_LOOP ((int64_t) 0x03 << LBLOCK_TAG_SHIFT)
-#define LBLOCK_TAG_SWITCH ((int64_t) 0x04 << LBLOCK_TAG_SHIFT)
+V7_PRIVATE char *bcode_next_name(char *ops, char **pname, size_t *plen) {
+  size_t len;
+  int llen;
 
-/*
- * Yields 32-bit bcode offset value
- */
-#define LBLOCK_OFFSET(v) \
-  ((bcode_off_t)(((v) &LBLOCK_OFFSET_MASK) >> LBLOCK_OFFSET_SHIFT))
+  len = decode_varint((unsigned char *) ops, &llen);
 
-/*
- * Yields tag value (unshifted, to be compared with macros like
- * `LBLOCK_TAG_CATCH`, etc)
- */
-#define LBLOCK_TAG(v) ((v) &LBLOCK_TAG_MASK)
+  ops += llen;
 
-/*
- * Yields stack size
- */
-#define LBLOCK_STACK_SIZE(v) \
-  (((v) &LBLOCK_STACK_SIZE_MASK) >> LBLOCK_STACK_SIZE_SHIFT)
+  if (pname != NULL) {
+    *pname = ops;
+  }
 
-/*
- * Yields `int64_t` value to be stored as a JavaScript number
- */
-#define LBLOCK_ITEM_CREATE(offset, tag, stack_size) \
-  ((int64_t)(offset) | (tag) |                      \
-   (((int64_t)(stack_size)) << LBLOCK_STACK_SIZE_SHIFT))
+  if (plen != NULL) {
+    *plen = len;
+  }
 
-/*
- * make sure `bcode_off_t` is just 32-bit, so that it can fit in double
- * with 3-bit tag
- */
-V7_STATIC_ASSERT((sizeof(bcode_off_t) * 8) == LBLOCK_OFFSET_WIDTH,
-                 wrong_size_of_bcode_off_t);
+  ops += len + 1 /*null-terminator*/;
+  return ops;
+}
 
-#define PUSH(v) stack_push(&v7->stack, v)
-#define POP() stack_pop(&v7->stack)
-#define TOS() stack_tos(&v7->stack)
-#define SP() stack_sp(&v7->stack)
+V7_PRIVATE char *bcode_next_name_v(struct v7 *v7, struct bcode *bcode,
+                                   size_t idx, char *ops, val_t *res) {
+  char *name;
+  size_t len;
 
-/*
- * Local-to-function block types that we might want to consider when unwinding
- * stack for whatever reason. see `unwind_local_blocks_stack()`.
- */
-enum local_block {
-  LOCAL_BLOCK_NONE = (0),
-  LOCAL_BLOCK_CATCH = (1 << 0),
-  LOCAL_BLOCK_FINALLY = (1 << 1),
-  LOCAL_BLOCK_LOOP = (1 << 2),
-  LOCAL_BLOCK_SWITCH = (1 << 3),
-};
+  assert(idx < bcode->names_cnt);
+  ops = bcode_next_name(ops, &name, &len);
 
-/*
- * Like `V7_TRY()`, but to be used inside `eval_bcode()` only: you should
- * wrap all calls to cfunctions into `BTRY()` instead of `V7_TRY()`.
- *
- * If the provided function returns something other than `V7_OK`, this macro
- * calls `bcode_perform_throw`, which performs bcode stack unwinding.
- */
-#define BTRY(call)                                                            \
-  do {                                                                        \
-    enum v7_err _e = call;                                                    \
-    (void) _you_should_use_BTRY_in_eval_bcode_only;                           \
-    if (_e != V7_OK) {                                                        \
-      V7_TRY(bcode_perform_throw(v7, &r, 0 /*don't take value from stack*/)); \
-      goto op_done;                                                           \
-    }                                                                         \
-  } while (0)
+  if (bcode_make_vals(v7, bcode)) {
+    *res = bcode->vals[idx];
+  } else {
+    /* see `bcode_make_vals()` */
+    *res = v7_mk_string(v7, name, len, !bcode->ops_in_rom);
+  }
 
-V7_PRIVATE void stack_push(struct mbuf *s, val_t v) {
-  mbuf_append(s, &v, sizeof(v));
+  return ops;
 }
 
-V7_PRIVATE val_t stack_pop(struct mbuf *s) {
-  assert(s->len >= sizeof(val_t));
-  s->len -= sizeof(val_t);
-  return *(val_t *) (s->buf + s->len);
+V7_PRIVATE bcode_off_t bcode_pos(struct bcode_builder *bbuilder) {
+  return bbuilder->ops.len;
 }
 
-V7_PRIVATE val_t stack_tos(struct mbuf *s) {
-  assert(s->len >= sizeof(val_t));
-  return *(val_t *) (s->buf + s->len - sizeof(val_t));
+/*
+ * Appends a branch target and returns its location.
+ * This location can be updated with bcode_patch_target.
+ * To be issued following a JMP_* bytecode
+ */
+V7_PRIVATE bcode_off_t bcode_add_target(struct bcode_builder *bbuilder) {
+  bcode_off_t pos = bcode_pos(bbuilder);
+  bcode_off_t zero = 0;
+  bcode_ops_append(bbuilder, &zero, sizeof(bcode_off_t));
+  return pos;
 }
 
-#ifdef V7_BCODE_TRACE_STACK
-V7_PRIVATE val_t stack_at(struct mbuf *s, size_t idx) {
-  assert(s->len >= sizeof(val_t) * idx);
-  return *(val_t *) (s->buf + s->len - sizeof(val_t) - idx * sizeof(val_t));
+/* Appends an op requiring a branch target. See bcode_add_target. */
+V7_PRIVATE bcode_off_t
+bcode_op_target(struct bcode_builder *bbuilder, uint8_t op) {
+  bcode_op(bbuilder, op);
+  return bcode_add_target(bbuilder);
 }
-#endif
 
-V7_PRIVATE int stack_sp(struct mbuf *s) {
-  return s->len / sizeof(val_t);
+V7_PRIVATE void bcode_patch_target(struct bcode_builder *bbuilder,
+                                   bcode_off_t label, bcode_off_t target) {
+  memcpy(bbuilder->ops.buf + label, &target, sizeof(target));
 }
 
 /*
- * Delete a property with name `name`, `len` from an object `obj`. If the
- * object does not contain own property with the given `name`, moves to `obj`'s
- * prototype, and so on.
- *
- * If the property is eventually found, it is deleted, and `0` is returned.
- * Otherwise, `-1` is returned.
- *
- * If `len` is -1/MAXUINT/~0, then `name` must be 0-terminated.
- *
- * See `v7_del()` as well.
+ * Jump tables are made for this many labels at least: fewer `OP_EQ` are as
+ * fast. `OP_SWITCH_NUM` takes up to `BCODE_SWITCH_SPAN` entries per label.
  */
-static int del_property_deep(struct v7 *v7, val_t obj, const char *name,
-                             size_t len) {
-  if (!v7_is_object(obj)) {
-    return -1;
+#define BCODE_SWITCH_MIN 3
+#define BCODE_SWITCH_SPAN 4
+
+V7_PRIVATE bcode_off_t bcode_op_switch(struct bcode_builder *bbuilder,
+                                       struct bcode_switch_case *cases,
+                                       size_t cnt) {
+  bcode_off_t pos = bcode_pos(bbuilder), dfl, slot, placeholder = 1;
+  double lo, hi;
+  uint32_t size, len, h;
+  int32_t lo32;
+  size_t i;
+  int is_num;
+
+  if (cnt < BCODE_SWITCH_MIN) return 0;
+
+  is_num = cases[0].str == NULL;
+  lo = hi = cases[0].num;
+  for (i = 0; i < cnt; i++) {
+    if ((cases[i].str == NULL) != is_num) return 0;
+    if (!is_num) continue;
+    /* also false for NaN */
+    if (!(cases[i].num >= INT32_MIN && cases[i].num <= INT32_MAX &&
+          cases[i].num == (int32_t) cases[i].num)) {
+      return 0;
+    }
+    if (cases[i].num < lo) lo = cases[i].num;
+    if (cases[i].num > hi) hi = cases[i].num;
   }
-  for (; obj != V7_NULL; obj = obj_prototype_v(v7, obj)) {
-    int del_res;
-    if ((del_res = v7_del(v7, obj, name, len)) != -1) {
-      return del_res;
+
+  if (is_num) {
+    if (hi - lo + 1 > (double) cnt * BCODE_SWITCH_SPAN) return 0;
+    size = (uint32_t)(hi - lo + 1);
+  } else {
+    for (size = 4; size < cnt * 2; size *= 2) {
     }
   }
-  return -1;
-}
 
-/* Visual studio 2012+ has signbit() */
-#if defined(_MSC_VER) && _MSC_VER < 1700
-static int signbit(double x) {
-  double s = _copysign(1, x);
-  return s < 0;
+  bcode_op(bbuilder, is_num ? OP_SWITCH_NUM : OP_SWITCH_STR);
+  dfl = bcode_add_target(bbuilder);
+  len = 0; /* patched below */
+  bcode_ops_append(bbuilder, &len, sizeof(len));
+  if (is_num) {
+    lo32 = (int32_t) lo;
+    bcode_ops_append(bbuilder, &lo32, sizeof(lo32));
+  } else {
+    bcode_ops_append(bbuilder, &size, sizeof(size));
+  }
+  bcode_ops_append(bbuilder, NULL, size * sizeof(uint32_t));
+  memset(bbuilder->ops.buf + pos + BCODE_SWITCH_HDR, 0,
+         size * sizeof(uint32_t));
+
+  /*
+   * The targets are patched by the caller; till then, they're set to
+   * `placeholder` to tell the repeated labels, which keep the first target
+   */
+  for (i = 0; i < cnt; i++) {
+    uint32_t entry;
+    cases[i].label = 0;
+    if (is_num) {
+      slot = pos + BCODE_SWITCH_HDR +
+             (bcode_off_t)(cases[i].num - lo) * sizeof(uint32_t);
+      memcpy(&entry, bbuilder->ops.buf + slot, sizeof(entry));
+      if (entry == 0) {
+        cases[i].label = slot;
+        bcode_patch_target(bbuilder, slot, placeholder);
+      }
+      continue;
+    }
+    h = bcode_switch_hash(cases[i].str, cases[i].len);
+    for (;; h++) {
+      slot = pos + BCODE_SWITCH_HDR + (h & (size - 1)) * sizeof(uint32_t);
+      memcpy(&entry, bbuilder->ops.buf + slot, sizeof(entry));
+      if (entry == 0) {
+        /* a new label: the entry goes at the end */
+        entry = bcode_pos(bbuilder) - pos;
+        memcpy(bbuilder->ops.buf + slot, &entry, sizeof(entry));
+        cases[i].label = bcode_add_target(bbuilder);
+        bcode_patch_target(bbuilder, cases[i].label, placeholder);
+        len = (uint32_t) cases[i].len;
+        bcode_ops_append(bbuilder, &len, sizeof(len));
+        bcode_ops_append(bbuilder, cases[i].str, cases[i].len);
+        break;
+      }
+      memcpy(&len, bbuilder->ops.buf + pos + entry + sizeof(bcode_off_t),
+             sizeof(len));
+      if (len == cases[i].len &&
+          memcmp(bbuilder->ops.buf + pos + entry + sizeof(bcode_off_t) +
+                     sizeof(len),
+                 cases[i].str, len) == 0) {
+        /* repeated label */
+        break;
+      }
+    }
+  }
+
+  len = bcode_pos(bbuilder) - pos;
+  memcpy(bbuilder->ops.buf + pos + 1 + sizeof(bcode_off_t), &len, sizeof(len));
+  return dfl;
 }
-#endif
 
-static double b_int_bin_op(enum opcode op, double a, double b) {
-  int32_t ia = isnan(a) || isinf(a) ? 0 : (int32_t)(int64_t) a;
-  int32_t ib = isnan(b) || isinf(b) ? 0 : (int32_t)(int64_t) b;
+#ifndef V7_NO_FS
 
-  switch (op) {
-    case OP_LSHIFT:
-      return (int32_t)((uint32_t) ia << ((uint32_t) ib & 31));
-    case OP_RSHIFT:
-      return ia >> ((uint32_t) ib & 31);
-    case OP_URSHIFT:
-      return (uint32_t) ia >> ((uint32_t) ib & 31);
-    case OP_OR:
-      return ia | ib;
-    case OP_XOR:
-      return ia ^ ib;
-    case OP_AND:
-      return ia & ib;
-    default:
-      assert(0);
-#if defined(NDEBUG)
-      return 0;
-#endif
-  }
+static void bcode_serialize_varint(int n, FILE *out) {
+  unsigned char buf[8];
+  int k = calc_llen(n);
+  encode_varint(n, buf);
+  fwrite(buf, k, 1, out);
 }
 
-static double b_num_bin_op(enum opcode op, double a, double b) {
-  /*
-   * For certain operations, the result is always NaN if either of arguments
-   * is NaN
-   */
-  switch (op) {
-    case OP_ADD:
-    case OP_SUB:
-    case OP_MUL:
-    case OP_DIV:
-    case OP_REM:
-      if (isnan(a) || isnan(b)) {
-        return NAN;
-      }
-      break;
-    default:
-      break;
-  }
-
-  switch (op) {
-    case OP_ADD: /* simple fixed width nodes with no payload */
-      return a + b;
-    case OP_SUB:
-      return a - b;
-    case OP_REM:
-      if (b == 0 || isnan(b) || isnan(a) || isinf(b) || isinf(a)) {
-        return NAN;
-      }
-      return (int) a % (int) b;
-    case OP_MUL:
-      return a * b;
-    case OP_DIV:
-      if (b == 0) {
-        if (a == 0) return NAN;
-        return (!signbit(a) == !signbit(b)) ? INFINITY : -INFINITY;
-      }
-      return a / b;
-    case OP_LSHIFT:
-    case OP_RSHIFT:
-    case OP_URSHIFT:
-    case OP_OR:
-    case OP_XOR:
-    case OP_AND:
-      return b_int_bin_op(op, a, b);
-    default:
-      assert(0);
-#if defined(NDEBUG)
-      return 0;
-#endif
-  }
+static void bcode_serialize_emit_type_tag(enum bcode_ser_lit_tag tag,
+                                          FILE *out) {
+  uint8_t t = (uint8_t) tag;
+  fwrite(&t, 1, 1, out);
 }
 
-static int b_bool_bin_op(enum opcode op, double a, double b) {
-#ifdef V7_BROKEN_NAN
-  if (isnan(a) || isnan(b)) return op == OP_NE || op == OP_NE_NE;
-#endif
-
-  switch (op) {
-    case OP_EQ:
-    case OP_EQ_EQ:
-      return a == b;
-    case OP_NE:
-    case OP_NE_NE:
-      return a != b;
-    case OP_LT:
-      return a < b;
-    case OP_LE:
-      return a <= b;
-    case OP_GT:
-      return a > b;
-    case OP_GE:
-      return a >= b;
-    default:
-      assert(0);
-#if defined(NDEBUG)
-      return 0;
-#endif
-  }
-}
+static void bcode_serialize_string(struct v7 *v7, val_t v, FILE *out) {
+  size_t len;
+  const char *s = v7_get_string_data(v7, &v, &len);
 
-static bcode_off_t bcode_get_target(char **ops) {
-  bcode_off_t target;
-  (*ops)++;
-  memcpy(&target, *ops, sizeof(target));
-  *ops += sizeof(target) - 1;
-  return target;
+  bcode_serialize_varint(len, out);
+  fwrite(s, len + 1 /* NUL char */, 1, out);
 }
 
-struct bcode_registers {
-  struct bcode *bcode;
-  char *ops;
-  char *end;
-  unsigned int need_inc_ops : 1;
-};
+static void bcode_serialize_lit(struct v7 *v7, val_t v, FILE *out) {
+  int t = val_type(v7, v);
+  switch (t) {
+    case V7_TYPE_NUMBER: {
+      double num = v7_to_number(v);
+      char buf[18];
+      const char *fmt = num > 1e10 ? "%.21g" : "%.10g";
+      size_t len = snprintf(buf, sizeof(buf), fmt, num);
 
-/*
- * If returning from function implicitly, then set return value to `undefined`.
- *
- * And if function was called as a constructor, then make sure returned
- * value is an object.
- */
-static void bcode_adjust_retval(struct v7 *v7, uint8_t is_explicit_return) {
-  if (!is_explicit_return) {
-    /* returning implicitly: set return value to `undefined` */
-    POP();
-    PUSH(v7_mk_undefined());
-  }
+      bcode_serialize_emit_type_tag(BCODE_SER_NUMBER, out);
+      bcode_serialize_varint(len, out);
+      fwrite(buf, len, 1, out);
+      break;
+    }
+    case V7_TYPE_STRING: {
+      bcode_serialize_emit_type_tag(BCODE_SER_STRING, out);
+      bcode_serialize_string(v7, v, out);
+      break;
+    }
+    /* TODO(mkm):
+     * case V7_TYPE_REGEXP_OBJECT:
+     */
+    case V7_TYPE_FUNCTION_OBJECT: {
+      struct v7_js_function *func;
+      func = to_js_function(v);
+      assert(func->bcode != NULL);
 
-  if (v7->is_constructor && !v7_is_object(TOS())) {
-    /* constructor is going to return non-object: replace it with `this` */
-    POP();
-    PUSH(v7_get_this(v7));
+      bcode_serialize_emit_type_tag(BCODE_SER_FUNCTION, out);
+      bcode_serialize_func(v7, func->bcode, out);
+      break;
+    }
+    default:
+      fprintf(stderr, "Unhandled type: %d", t);
+      assert(1 == 0);
   }
 }
 
-static void bcode_restore_registers(struct v7 *v7, struct bcode *bcode,
-                                    struct bcode_registers *r) {
-  r->bcode = bcode;
-  r->ops = bcode->ops.p;
-  r->end = r->ops + bcode->ops.len;
+static void bcode_serialize_func(struct v7 *v7, struct bcode *bcode,
+                                 FILE *out) {
+  val_t *vp;
+  struct v7_vec *vec;
+  (void) v7;
 
   /*
-   * TODO(dfrank) : the field `v7->strict_mode` is needed only for public
-   * functions like `v7_set_prop()` and `v7_array_set()`, but do we actually
-   * need to consider strict mode in these functions, and throw exceptions?
-   *
-   * If not, then we should get rid of `v7->strict_mode` whatsoever.
+   * literals table:
+   * <varint> // number of literals
+   * <bcode_ser_literal>*
    */
-  v7->strict_mode = bcode->strict_mode;
-}
-
-/*
- * Create new call frame object and fill it with the details of the current
- * state
- *
- * For "function" frame, `r` must be non-NULL.
- * For "private" frame, `r` must be NULL.
- *
- * TODO(dfrank): avoid using `val_t` objects for this, use some regular C
- * struct instead.
- */
-static struct v7_call_frame *bcode_create_call_frame(
-    struct v7 *v7, struct bcode_registers *r) {
-  struct v7_call_frame *call_frame =
-      (struct v7_call_frame *) calloc(1, sizeof(*call_frame));
+  vec = &bcode->lit;
+  bcode_serialize_varint(vec->len / sizeof(val_t), out);
+  for (vp = (val_t *) vec->p; (char *) vp < vec->p + vec->len; vp++) {
+    bcode_serialize_lit(v7, *vp, out);
+  }
 
-  /* save previous call stack */
-  call_frame->prev = v7->call_stack;
+  /* args_cnt */
+  bcode_serialize_varint(bcode->args_cnt, out);
 
-  /* current scope */
-  call_frame->vals.scope = v7->vals.scope;
+  /* names_cnt */
+  bcode_serialize_varint(bcode->names_cnt, out);
 
   /*
-   * `try_stack` is left null, and will be lazily created in `eval_try_push()`
+   * bcode:
+   * <varint> // opcodes length
+   * <opcode>*
    */
+  vec = &bcode->ops;
+  bcode_serialize_varint(vec->len, out);
+  fwrite(vec->p, vec->len, 1, out);
+}
 
-  /* stack size */
-  call_frame->stack_size = v7->stack.len;
+V7_PRIVATE void bcode_serialize(struct v7 *v7, struct bcode *bcode, FILE *out) {
+  (void) v7;
+  (void) bcode;
 
-  if (r != NULL) {
-    /* save bcode and the current position in it */
-    call_frame->bcode = r->bcode;
-    call_frame->bcode_ops = r->ops + 1;
+  fwrite(BIN_BCODE_SIGNATURE, sizeof(BIN_BCODE_SIGNATURE), 1, out);
+  bcode_serialize_func(v7, bcode, out);
+}
 
-    /* `this` object */
-    call_frame->vals.this_obj = v7_get_this(v7);
+static size_t bcode_deserialize_varint(const char **data) {
+  size_t ret = 0;
+  int len = 0;
+  ret = decode_varint((const unsigned char *) (*data), &len);
+  *data += len;
+  return ret;
+}
 
-    /* is constructor */
-    call_frame->is_constructor = v7->is_constructor;
-  } else {
-    /*
-     * No bcode registers is provided: assume it's not going to change, and
-     * leave it NULL. This is the way we distinguish between "function" frames
-     * and "private" frames.
-     */
-  }
+static const char *bcode_deserialize_lit(struct bcode_builder *bbuilder,
+                                         const char *data) {
+  enum bcode_ser_lit_tag lit_tag;
 
-  return call_frame;
-}
+  (void) bbuilder;
 
-/*
- * The caller's bcode object is needed because we have to restore literals
- * and `end` registers.
- *
- * TODO(mkm): put this state on a return stack
- *
- * Caller of bcode_perform_call is responsible for owning `call_frame`
- */
-static enum v7_err bcode_perform_call(struct v7 *v7, v7_val_t scope_frame,
-                                      struct v7_js_function *func,
-                                      struct bcode_registers *r,
-                                      val_t this_object, char *ops,
-                                      uint8_t is_constructor) {
-  struct v7_call_frame *call_frame = NULL;
-
-  /* create new `call_frame` which will replace `v7->call_stack` */
-  call_frame = bcode_create_call_frame(v7, r);
-
-  /* after context is saved, we can change current context */
-  v7->vals.this_object = this_object;
-  v7->is_constructor = is_constructor;
+  lit_tag = (enum bcode_ser_lit_tag) * data++;
 
-  /* new scope_frame will inherit from the function's scope */
-  obj_prototype_set(v7, v7_to_object(scope_frame), &func->scope->base);
-  v7->vals.scope = scope_frame;
-  v7->call_stack = call_frame;
-  bcode_restore_registers(v7, func->bcode, r);
+  switch (lit_tag) {
+    case BCODE_SER_NUMBER:
+    case BCODE_SER_STRING:
+    case BCODE_SER_FUNCTION: {
+      /*
+       * All numbers, strings and functions should be inlined into `ops` during
+       * serialization (see `bcode_add_lit()`, `bcode_is_inline_string()`,
+       * `bcode_is_inline_func()`, `bcode_op_lit()`), so we should never
+       * encounter them here
+       */
+      assert(0);
+      break;
+    }
 
-  /* adjust `ops` since names were already read from it */
-  r->ops = ops;
+    case BCODE_SER_REGEX: {
+      /* TODO */
+      assert(0);
+      break;
+    }
 
-  /* `ops` already points to the needed instruction, no need to increment it */
-  r->need_inc_ops = 0;
+    default:
+      assert(0);
+      break;
+  }
 
-  return V7_OK;
+  return data;
 }
 
-/*
- * Unwinds `call_stack` by 1 frame.
- *
- * Returns `1` if the unwound frame is a "function" frame, or `0` if it's
- * a "private" frame.
- */
-static uint8_t unwind_stack_1level(struct v7 *v7, struct bcode_registers *r) {
-  /*
-   * We have two types of frames: "function" frames and "private" frames.
-   * The "private" frames don't contain some fields, so, we need to
-   * distinguish between them.
-   */
-  uint8_t is_func_frame = 0;
-#ifdef V7_BCODE_TRACE
-  fprintf(stderr, "unwinding stack by 1 level\n");
-#endif
+static const char *bcode_deserialize_func(struct v7 *v7, struct bcode *bcode,
+                                          const char *data) {
+  size_t size;
+  struct bcode_builder bbuilder;
+
+  bcode_builder_init(v7, &bbuilder, bcode);
 
   /*
-   * Whatever the frame type is, we try to retrieve `bcode` pointer and see
-   * if it's non-NULL. If it is, we have "function" frame.
+   * before deserializing, set the corresponding flag, so that metrics will be
+   * updated accordingly
    */
-  assert(v7->call_stack != NULL);
-  is_func_frame = (v7->call_stack->bcode != NULL);
+  bcode->deserialized = 1;
 
-  if (is_func_frame) {
-    bcode_restore_registers(v7, v7->call_stack->bcode, r);
+  /* get number of literals */
+  size = bcode_deserialize_varint(&data);
+  /* deserialize all literals */
+  for (; size > 0; --size) {
+    data = bcode_deserialize_lit(&bbuilder, data);
+  }
 
-    r->ops = v7->call_stack->bcode_ops;
+  /* get number of args */
+  bcode->args_cnt = bcode_deserialize_varint(&data);
 
-    /* restore `this` object */
-    v7->vals.this_object = v7->call_stack->vals.this_obj;
+  /* get number of names */
+  bcode->names_cnt = bcode_deserialize_varint(&data);
 
-    /* restore `is_constructor` */
-    v7->is_constructor = v7->call_stack->is_constructor;
-  }
+  /* get opcode size */
+  size = bcode_deserialize_varint(&data);
 
-  /* adjust data stack length (restore saved) */
-  assert(v7->call_stack->stack_size <= v7->stack.len);
-  v7->stack.len = v7->call_stack->stack_size;
+  bbuilder.ops.buf = (char *) data;
+  bbuilder.ops.size = size;
+  bbuilder.ops.len = size;
 
-  /* restore scope */
-  v7->vals.scope = v7->call_stack->vals.scope;
+  bcode->ops_in_rom = 1;
 
-  /* finally, drop the frame which we've just unwound */
-  {
-    struct v7_call_frame *tmp = v7->call_stack;
-    v7->call_stack = v7->call_stack->prev;
-    free(tmp);
-  }
+  data += size;
 
-  return is_func_frame;
+  bcode_builder_finalize(&bbuilder);
+  return data;
 }
 
-static enum v7_err bcode_private_frame_push(struct v7 *v7,
-                                            v7_val_t scope_frame) {
-  struct v7_call_frame *call_frame = NULL;
-
-  /*
-   * Create new `call_frame` which will replace `v7->call_stack`. We pass
-   * `NULL` for `bcode_registers` because we're creating "private" call_frame.
-   */
-  call_frame = bcode_create_call_frame(v7, NULL);
+V7_PRIVATE void bcode_deserialize(struct v7 *v7, struct bcode *bcode,
+                                  const char *data) {
+  data = bcode_deserialize_func(v7, bcode, data);
+}
 
-  /* new scope_frame will inherit from the current scope */
-  obj_prototype_set(v7, v7_to_object(scope_frame),
-                    v7_to_object(v7->vals.scope));
-  v7->vals.scope = scope_frame;
-  v7->call_stack = call_frame;
+#endif
+#ifdef V7_MODULE_LINES
+#line 1 "./src/eval.c"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
 
-  return V7_OK;
-}
+/* Amalgamated: #include "common/str_util.h" */
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/eval.h" */
+/* Amalgamated: #include "v7/src/string.h" */
+/* Amalgamated: #include "v7/src/array.h" */
+/* Amalgamated: #include "v7/src/object.h" */
+/* Amalgamated: #include "v7/src/gc.h" */
+/* Amalgamated: #include "v7/src/compiler.h" */
+/* Amalgamated: #include "v7/src/cyg_profile.h" */
+/* Amalgamated: #include "v7/src/vm.h" */
+/* Amalgamated: #include "v7/src/types.h" */
+/* Amalgamated: #include "v7/src/exceptions.h" */
+/* Amalgamated: #include "v7/src/conversion.h" */
 
 /*
- * Unwinds local "try stack" (i.e. local-to-current-function stack of nested
- * `try` blocks), looking for local-to-function blocks.
- *
- * Block types of interest are specified with `wanted_blocks_mask`: it's a
- * bitmask of `enum local_block` values.
+ * Bcode offsets in "try stack" are stored in `int64_t`s (see
+ * `struct v7_call_frame`). Apart from the offset itself, we also need some
+ * additional data:
  *
- * Only blocks of specified types will be considered, others will be dropped.
+ * - type of the block that offset represents (`catch`, `finally`, `switch`,
+ *   or some loop)
+ * - size of the stack when the block is created (needed when throwing, since
+ *   if exception is thrown from the middle of the expression, the stack may
+ *   have any arbitrary length)
  *
- * If `restore_stack_size` is non-zero, the `v7->stack.len` will be restored
- * to the value saved when the block was created. This is useful when throwing,
- * since if we throw from the middle of the expression, the stack could have
- * any size. But you probably shouldn't set this flag when breaking and
- * returning, since it may hide real bugs in the opcode.
+ * We bake all this data into 63 bits, so that items are never negative:
  *
- * Returns id of the block type that control was transferred into, or
- * `LOCAL_BLOCK_NONE` if no appropriate block was found. Note: returned value
- * contains at most 1 block bit; it can't contain multiple bits.
+ * - 32 bits: bcode offset
+ * - 3 bits: "tag": the type of the block
+ * - 28 bits: stack size
  */
-static enum local_block unwind_local_blocks_stack(
-    struct v7 *v7, struct bcode_registers *r, unsigned int wanted_blocks_mask,
-    uint8_t restore_stack_size) {
-  val_t arr = v7_mk_undefined();
-  struct gc_tmp_frame tf = new_tmp_frame(v7);
-  enum local_block found_block = LOCAL_BLOCK_NONE;
-  unsigned long length;
-
-  tmp_stack_push(&tf, &arr);
-
-  arr = v7->call_stack->vals.try_stack;
-  if (v7_is_array(v7, arr)) {
-    /*
-     * pop latest element from "try stack", loop until we need to transfer
-     * control there
-     */
-    while ((length = v7_array_length(v7, arr)) > 0) {
-      /* get latest offset from the "try stack" */
-      int64_t offset = v7_to_number(v7_array_get(v7, arr, length - 1));
-      enum local_block cur_block = LOCAL_BLOCK_NONE;
-
-      /* get id of the current block type */
-      switch (LBLOCK_TAG(offset)) {
-        case LBLOCK_TAG_CATCH:
-          cur_block = LOCAL_BLOCK_CATCH;
-          break;
-        case LBLOCK_TAG_FINALLY:
-          cur_block = LOCAL_BLOCK_FINALLY;
-          break;
-        case LBLOCK_TAG_LOOP:
-          cur_block = LOCAL_BLOCK_LOOP;
-          break;
-        case LBLOCK_TAG_SWITCH:
-          cur_block = LOCAL_BLOCK_SWITCH;
-          break;
-        default:
-          assert(0);
-          break;
-      }
 
-      if (cur_block & wanted_blocks_mask) {
-        /* need to transfer control to this offset */
-        r->ops = r->bcode->ops.p + LBLOCK_OFFSET(offset);
-#ifdef V7_BCODE_TRACE
-        fprintf(stderr, "transferring to block #%d: %u\n", (int) cur_block,
-                (unsigned int) LBLOCK_OFFSET(offset));
-#endif
-        found_block = cur_block;
-        /* if needed, restore stack size to the saved value */
-        if (restore_stack_size) {
-          v7->stack.len = LBLOCK_STACK_SIZE(offset);
-        }
-        break;
-      } else {
-#ifdef V7_BCODE_TRACE
-        fprintf(stderr, "skipped block #%d: %u\n", (int) cur_block,
-                (unsigned int) LBLOCK_OFFSET(offset));
-#endif
-        /*
-         * since we don't need to control transfer there, just pop
-         * it from the "try stack"
-         */
-        v7_array_del(v7, arr, length - 1);
-      }
-    }
-  }
+/*
+ * Widths of data parts
+ */
+#define LBLOCK_OFFSET_WIDTH 32
+#define LBLOCK_TAG_WIDTH 3
+#define LBLOCK_STACK_SIZE_WIDTH 28
 
-  tmp_frame_cleanup(&tf);
-  return found_block;
-}
+/*
+ * Shifts of data parts
+ */
+#define LBLOCK_OFFSET_SHIFT (0)
+#define LBLOCK_TAG_SHIFT (LBLOCK_OFFSET_SHIFT + LBLOCK_OFFSET_WIDTH)
+#define LBLOCK_STACK_SIZE_SHIFT (LBLOCK_TAG_SHIFT + LBLOCK_TAG_WIDTH)
+#define LBLOCK_TOTAL_WIDTH (LBLOCK_STACK_SIZE_SHIFT + LBLOCK_STACK_SIZE_WIDTH)
 
 /*
- * Perform break, if there is a `finally` block in effect, transfer
- * control there.
+ * Masks of data parts
  */
-static void bcode_perform_break(struct v7 *v7, struct bcode_registers *r) {
-  enum local_block found;
-  unsigned int mask;
-  v7->is_breaking = 0;
-  if (v7->is_continuing) {
-    mask = LOCAL_BLOCK_LOOP;
-  } else {
-    mask = LOCAL_BLOCK_LOOP | LOCAL_BLOCK_SWITCH;
-  }
+#define LBLOCK_OFFSET_MASK \
+  ((int64_t)(((int64_t) 1 << LBLOCK_OFFSET_WIDTH) - 1) << LBLOCK_OFFSET_SHIFT)
+#define LBLOCK_TAG_MASK \
+  ((int64_t)(((int64_t) 1 << LBLOCK_TAG_WIDTH) - 1) << LBLOCK_TAG_SHIFT)
+#define LBLOCK_STACK_SIZE_MASK                             \
+  ((int64_t)(((int64_t) 1 << LBLOCK_STACK_SIZE_WIDTH) - 1) \
+   << LBLOCK_STACK_SIZE_SHIFT)
 
-  /*
-   * Keep unwinding until we find local block of interest. We should not
-   * encounter any "function" frames; only "private" frames are allowed.
-   */
-  for (;;) {
-    /*
-     * Try to unwind local "try stack", considering only `finally` and `break`.
-     */
-    found = unwind_local_blocks_stack(v7, r, mask | LOCAL_BLOCK_FINALLY, 0);
-    if (found == LOCAL_BLOCK_NONE) {
 /*
- * no blocks found: this may happen if only the `break` or `continue` has
- * occurred inside "private" frame. So, unwind this frame, make sure it
- * is indeed "private" (not "function"), and keep unwinding local blocks.
+ * Self-check: make sure all the data can fit into `int64_t`
  */
-#if !defined(NDEBUG)
-      uint8_t is_func_frame = unwind_stack_1level(v7, r);
-      assert(!is_func_frame);
+#if (LBLOCK_TOTAL_WIDTH > 63)
+#error lblock width is too large to fit into int64_t
 #endif
-    } else {
-      /* found some block to transfer control into, stop unwinding */
-      break;
-    }
-  }
-
-  /*
-   * upon exit of a finally block we'll reenter here if is_breaking is true.
-   * See OP_AFTER_FINALLY.
-   */
-  if (found == LOCAL_BLOCK_FINALLY) {
-    v7->is_breaking = 1;
-  }
 
-  /* `ops` already points to the needed instruction, no need to increment it */
-  r->need_inc_ops = 0;
-}
+/*
+ * Tags that are used for bcode offsets in "try stack"
+ */
+#define LBLOCK_TAG_CATCH ((int64_t) 0x01 << LBLOCK_TAG_SHIFT)
+#define LBLOCK_TAG_FINALLY ((int64_t) 0x02 << LBLOCK_TAG_SHIFT)
+#define LBLOCK_TAG_LOOP ((int64_t) 0x03 << LBLOCK_TAG_SHIFT)
+#define LBLOCK_TAG_SWITCH ((int64_t) 0x04 << LBLOCK_TAG_SHIFT)
 
 /*
- * Perform return, but if there is a `finally` block in effect, transfer
- * control there.
- *
- * If `take_retval` is non-zero, value to return will be popped from stack
- * (and saved into `v7->vals.returned_value`), otherwise, it won't be affected.
+ * Yields 32-bit bcode offset value
  */
-static enum v7_err bcode_perform_return(struct v7 *v7,
-                                        struct bcode_registers *r,
-                                        int take_retval) {
-  /*
-   * We should either take retval from the stack, or some value should already
-   * be pending to return
-   */
-  assert(take_retval || v7->is_returned);
+#define LBLOCK_OFFSET(v) \
+  ((bcode_off_t)(((v) &LBLOCK_OFFSET_MASK) >> LBLOCK_OFFSET_SHIFT))
 
-  if (take_retval) {
-    /* taking return value from stack */
-    v7->vals.returned_value = POP();
-    v7->is_returned = 1;
+/*
+ * Yields tag value (unshifted, to be compared with macros like
+ * `LBLOCK_TAG_CATCH`, etc)
+ */
+#define LBLOCK_TAG(v) ((v) &LBLOCK_TAG_MASK)
 
-    /*
-     * returning (say, from `finally`) dismisses any errors that are being
-     * thrown at the moment as well
-     */
-    v7->is_thrown = 0;
-    v7->vals.thrown_error = v7_mk_undefined();
-  }
+/*
+ * Yields stack size
+ */
+#define LBLOCK_STACK_SIZE(v) \
+  (((v) &LBLOCK_STACK_SIZE_MASK) >> LBLOCK_STACK_SIZE_SHIFT)
 
-  /*
-   * Keep unwinding until we unwound "function" frame, or found some `finally`
-   * block.
-   */
-  for (;;) {
-    /* Try to unwind local "try stack", considering only `finally` blocks */
-    if (unwind_local_blocks_stack(v7, r, (LOCAL_BLOCK_FINALLY), 0) ==
-        LOCAL_BLOCK_NONE) {
-      /*
-       * no `finally` blocks were found, so, unwind stack by 1 level, and see
-       * if it's a "function" frame. If not, will keep unwinding.
-       */
-      if (unwind_stack_1level(v7, r)) {
-        /*
-         * unwound frame is a "function" frame, so, push returned value to
-         * stack, and stop unwinding
-         */
-        PUSH(v7->vals.returned_value);
-        v7->is_returned = 0;
-        v7->vals.returned_value = v7_mk_undefined();
+/*
+ * Yields `int64_t` value to be stored in the "try stack"
+ */
+#define LBLOCK_ITEM_CREATE(offset, tag, stack_size) \
+  ((int64_t)(offset) | (tag) |                      \
+   (((int64_t)(stack_size)) << LBLOCK_STACK_SIZE_SHIFT))
 
-        break;
-      }
-    } else {
-      /* found `finally` block, so, stop unwinding */
-      break;
-    }
-  }
+/*
+ * make sure `bcode_off_t` is just 32-bit, so that it can fit in `int64_t`
+ * with 3-bit tag and stack size
+ */
+V7_STATIC_ASSERT((sizeof(bcode_off_t) * 8) == LBLOCK_OFFSET_WIDTH,
+                 wrong_size_of_bcode_off_t);
 
-  /* `ops` already points to the needed instruction, no need to increment it */
-  r->need_inc_ops = 0;
+/*
+ * The room for the values is reserved when entering the bcode (see
+ * `bcode_reserve_stack()`), so pushing is just a store
+ */
+#define PUSH(v)                                                       \
+  do {                                                                \
+    val_t _push_v = (v);                                              \
+    assert(v7->stack.len + sizeof(val_t) <= v7->stack.size);          \
+    *(val_t *) (v7->stack.buf + v7->stack.len) = _push_v;             \
+    v7->stack.len += sizeof(val_t);                                   \
+  } while (0)
+#define POP() stack_pop(&v7->stack)
+#define TOS() stack_tos(&v7->stack)
+#define SP() stack_sp(&v7->stack)
+/* Frame slot `i` of the current function, see `OP_GET_LOCAL` */
+#define SLOT(i) (((val_t *) (v7->stack.buf + r.slots_base))[i])
 
-  return V7_OK;
-}
+/*
+ * Local-to-function block types that we might want to consider when unwinding
+ * stack for whatever reason. see `unwind_local_blocks_stack()`.
+ */
+enum local_block {
+  LOCAL_BLOCK_NONE = (0),
+  LOCAL_BLOCK_CATCH = (1 << 0),
+  LOCAL_BLOCK_FINALLY = (1 << 1),
+  LOCAL_BLOCK_LOOP = (1 << 2),
+  LOCAL_BLOCK_SWITCH = (1 << 3),
+};
 
 /*
- * Perform throw inside `eval_bcode()`.
- *
- * If `take_thrown_value` is non-zero, value to return will be popped from
- * stack (and saved into `v7->vals.thrown_error`), otherwise, it won't be
- *affected.
- *
- * Returns `V7_OK` if thrown exception was caught, `V7_EXEC_EXCEPTION`
- * otherwise (in this case, evaluation of current script must be stopped)
+ * Like `V7_TRY()`, but to be used inside `eval_bcode()` only: you should
+ * wrap all calls to cfunctions into `BTRY()` instead of `V7_TRY()`.
  *
- * When calling this function from `eval_bcode()`, you should wrap this call
- * into the `V7_TRY()` macro.
+ * If the provided function returns something other than `V7_OK`, this macro
+ * calls `bcode_perform_throw`, which performs bcode stack unwinding.
  */
-static enum v7_err bcode_perform_throw(struct v7 *v7, struct bcode_registers *r,
-                                       int take_thrown_value) {
-  enum v7_err rcode = V7_OK;
-  enum local_block found;
-
-  assert(take_thrown_value || v7->is_thrown);
+#define BTRY(call)                                                            \
+  do {                                                                        \
+    enum v7_err _e = call;                                                    \
+    (void) _you_should_use_BTRY_in_eval_bcode_only;                           \
+    if (_e != V7_OK) {                                                        \
+      V7_TRY(bcode_perform_throw(v7, &r, 0 /*don't take value from stack*/)); \
+      goto op_done;                                                           \
+    }                                                                         \
+  } while (0)
 
-  if (take_thrown_value) {
-    v7->vals.thrown_error = POP();
-    v7->is_thrown = 1;
+/*
+ * Dispatch of `eval_bcode()`. With labels-as-values (GCC, Clang) the handlers
+ * of frequent opcodes jump straight to the handler of the next one, others go
+ * through the `switch`, which is also the portable fallback. Tracing needs the
+ * common epilogue, so it always uses the `switch`.
+ */
+#if defined(__GNUC__) && !defined(V7_DISABLE_THREADED_DISPATCH) && \
+    !defined(V7_BCODE_TRACE)
+#define V7_THREADED_DISPATCH
+#endif
 
-    /* Throwing dismisses any pending return values */
-    v7->is_returned = 0;
-    v7->vals.returned_value = v7_mk_undefined();
+#ifdef V7_THREADED_DISPATCH
+#define BCASE(op) \
+  case op:        \
+  lbl_##op
+/*
+ * Finish an opcode which doesn't change `r.need_inc_ops` and didn't fail. Use
+ * it as a statement at the top level of a handler only.
+ */
+#define BNEXT()                                                  \
+  {                                                              \
+    r.ops++;                                                     \
+    if (r.ops < r.end && (uint8_t) *r.ops < OP_MAX &&            \
+        !BJIT_ENTRY()) {                                         \
+      op = (enum opcode) * r.ops;                                \
+      goto *dispatch_table[op];                                  \
+    }                                                            \
+    continue;                                                    \
   }
-
-  while ((found = unwind_local_blocks_stack(
-              v7, r, (LOCAL_BLOCK_CATCH | LOCAL_BLOCK_FINALLY), 1)) ==
-         LOCAL_BLOCK_NONE) {
-    if (v7->call_stack != v7->bottom_call_stack) {
-#ifdef V7_BCODE_TRACE
-      fprintf(stderr, "not at the bottom of the stack, going to unwind..\n");
-#endif
-      /* not reached bottom of the stack yet, keep unwinding */
-      unwind_stack_1level(v7, r);
-    } else {
-/* reached stack bottom: uncaught exception */
-#ifdef V7_BCODE_TRACE
-      fprintf(stderr, "reached stack bottom: uncaught exception\n");
+#else
+#define BCASE(op) case op
+#define BNEXT() goto op_done
 #endif
-      rcode = V7_EXEC_EXCEPTION;
-      break;
-    }
-  }
 
-  if (found == LOCAL_BLOCK_CATCH) {
-    /*
-     * we're going to enter `catch` block, so, populate TOS with the thrown
-     * value, and clear it in v7 context.
-     */
-    PUSH(v7->vals.thrown_error);
-    v7->is_thrown = 0;
-    v7->vals.thrown_error = v7_mk_undefined();
-  }
+/*
+ * GC safepoint: allocations only set `v7->need_gc`, the collection itself is
+ * done on backward jumps, calls and returns, so that straight-line code
+ * doesn't test the flag on every opcode.
+ */
+#define BSAFEPOINT()   \
+  do {                 \
+    if (v7->need_gc) { \
+      maybe_gc(v7);    \
+      v7->need_gc = 0; \
+    }                  \
+  } while (0)
 
-  /* `ops` already points to the needed instruction, no need to increment it */
-  r->need_inc_ops = 0;
+#define BSAFEPOINT_IF_BACKWARD(target)                  \
+  do {                                                  \
+    if (r.bcode->ops.p + (target) <= r.ops) {           \
+      BSAFEPOINT();                                     \
+      BJIT_HOT(r.bcode);                                \
+    }                                                   \
+  } while (0)
 
-  return rcode;
-}
+#ifdef V7_ENABLE_JIT
+/* Counts an entry or a backward jump of the bcode, see `jit_compile()` */
+#define BJIT_HOT(b)                                   \
+  do {                                                \
+    if ((b)->jit_hot < V7_JIT_THRESHOLD &&            \
+        ++(b)->jit_hot == V7_JIT_THRESHOLD) {         \
+      jit_compile(v7, (b));                           \
+    }                                                 \
+  } while (0)
 
 /*
- * Throws reference error from `eval_bcode()`. Always wrap a call to this
- * function into `V7_TRY()`.
+ * Whether to run the instruction at `r.ops` natively: not if the native code
+ * has just left there, so that the interpreter makes progress.
  */
-static enum v7_err bcode_throw_reference_error(struct v7 *v7,
-                                               struct bcode_registers *r,
-                                               val_t var_name) {
-  enum v7_err rcode = V7_OK;
-  const char *s;
-  size_t name_len;
+#define BJIT_ENTRY()                                  \
+  (r.bcode->jit != NULL && r.ops != r.jit_skip &&     \
+   r.bcode->jit->entry[r.ops - r.bcode->ops.p] != 0)
+#else
+#define BJIT_HOT(b) \
+  do {              \
+  } while (0)
+#define BJIT_ENTRY() 0
+#endif
 
-  assert(v7_is_string(var_name));
-  s = v7_get_string_data(v7, &var_name, &name_len);
+/*
+ * Handler of the compare-and-branch instruction `jop`, which compares like
+ * `cop` does. `cop` is a constant, so the comparison of two numbers boils down
+ * to the C operator.
+ */
+#define BCMP_JMP(jop, cop)                                            \
+  BCASE(jop): {                                                       \
+    bcode_off_t target = bcode_get_target(&r.ops);                    \
+    int taken;                                                        \
+    BSAFEPOINT_IF_BACKWARD(target);                                   \
+    v2 = POP();                                                       \
+    v1 = POP();                                                       \
+    if (v7_is_number(v1) && v7_is_number(v2)) {                       \
+      taken = b_bool_bin_op(cop, v7_to_number(v1), v7_to_number(v2)); \
+    } else {                                                          \
+      BTRY(b_relational_op(v7, cop, v1, v2, &taken));                 \
+    }                                                                 \
+    if (taken) {                                                      \
+      r.ops = r.bcode->ops.p + target - 1;                            \
+    }                                                                 \
+    BNEXT();                                                          \
+  }
 
-  rcode = v7_throwf(v7, REFERENCE_ERROR, "[%.*s] is not defined",
-                    (int) name_len, s);
-  (void) rcode;
-  return bcode_perform_throw(v7, r, 0);
-}
+/*
+ * Values pushed on top of `struct bcode::max_stack`: the return value when
+ * returning from a `finally` block (see `OP_AFTER_FINALLY`), and the like
+ */
+#define BCODE_STACK_SLACK 4
 
 /*
- * Takes a half-done function (either from literal table or deserialized from
- * `ops` inlined data), and returns a ready-to-use function.
- *
- * The actual behaviour depends on whether the half-done function has
- * `prototype` defined. If there's no prototype (i.e. it's `undefined`), then
- * the new function is created, with bcode from a given one. If, however,
- * the prototype is defined, it means that the function was just deserialized
- * from `ops`, so we only need to set `scope` on it.
- *
- * Assumes `func` is owned by the caller.
+ * Makes room on the data stack for the bcode being entered, so that its
+ * instructions can push values without checking
  */
-static val_t bcode_instantiate_function(struct v7 *v7, val_t func) {
-  val_t res;
-  struct v7_js_function *f;
-  assert(is_js_function(func));
-  f = to_js_function(func);
+static void bcode_reserve_stack(struct v7 *v7, struct bcode *bcode) {
+  size_t need = v7->stack.len +
+                (bcode->max_stack + BCODE_STACK_SLACK) * sizeof(val_t);
+  if (need > v7->stack.size) {
+    mbuf_resize(&v7->stack, need * 2);
+  }
+}
 
-  if (v7_is_undefined(v7_get(v7, func, "prototype", 9))) {
-    /*
-     * Function's `prototype` is `undefined`: it means that the function is
-     * created by the compiler and is stored in the literal table. We have to
-     * create completely new function
-     */
-    struct v7_js_function *rf;
+V7_PRIVATE val_t stack_pop(struct mbuf *s) {
+  assert(s->len >= sizeof(val_t));
+  s->len -= sizeof(val_t);
+  return *(val_t *) (s->buf + s->len);
+}
 
-    res = mk_js_function(v7, v7_to_generic_object(v7->vals.scope),
-                         v7_mk_object(v7));
+V7_PRIVATE val_t stack_tos(struct mbuf *s) {
+  assert(s->len >= sizeof(val_t));
+  return *(val_t *) (s->buf + s->len - sizeof(val_t));
+}
 
-    /* Copy and retain bcode */
-    rf = to_js_function(res);
-    rf->bcode = f->bcode;
-    retain_bcode(v7, rf->bcode);
-  } else {
-    /*
-     * Function's `prototype` is NOT `undefined`: it means that the function is
-     * deserialized from inline `ops` data, and we just need to set scope on
-     * it.
-     */
-    res = func;
-    f->scope = v7_to_generic_object(v7->vals.scope);
-  }
+#ifdef V7_BCODE_TRACE_STACK
+V7_PRIVATE val_t stack_at(struct mbuf *s, size_t idx) {
+  assert(s->len >= sizeof(val_t) * idx);
+  return *(val_t *) (s->buf + s->len - sizeof(val_t) - idx * sizeof(val_t));
+}
+#endif
 
-  return res;
+V7_PRIVATE int stack_sp(struct mbuf *s) {
+  return s->len / sizeof(val_t);
 }
 
-/**
- * Call C function `func` with given `this_object` and array of arguments
- * `args`. `func` should be a C function pointer, not C function object.
+/*
+ * Delete a property with name `name`, `len` from an object `obj`. If the
+ * object does not contain own property with the given `name`, moves to `obj`'s
+ * prototype, and so on.
+ *
+ * If the property is eventually found, it is deleted, and `0` is returned.
+ * Otherwise, `-1` is returned.
+ *
+ * If `len` is -1/MAXUINT/~0, then `name` must be 0-terminated.
+ *
+ * See `v7_del()` as well.
  */
-static enum v7_err call_cfunction(struct v7 *v7, val_t func, val_t this_object,
-                                  val_t args, uint8_t is_constructor,
-                                  val_t *res) {
-  enum v7_err rcode = V7_OK;
-  uint8_t saved_inhibit_gc = v7->inhibit_gc;
-  val_t saved_this = v7->vals.this_object;
-  val_t saved_arguments = v7->vals.arguments;
-  struct gc_tmp_frame tf = new_tmp_frame(v7);
-
-  *res = v7_mk_undefined();
-
-  tmp_stack_push(&tf, &saved_this);
-  tmp_stack_push(&tf, &saved_arguments);
-
-  /*
-   * prepare cfunction environment: `this`, `arguments`.
-   */
-  v7->vals.this_object = this_object;
-  v7->inhibit_gc = 1;
-  v7->vals.arguments = args;
-
-  /* call C function */
-  rcode = to_cfunction(v7, func)(v7, res);
-  if (rcode != V7_OK) {
-    goto clean;
+static int del_property_deep(struct v7 *v7, val_t obj, const char *name,
+                             size_t len) {
+  if (!v7_is_object(obj)) {
+    return -1;
   }
-
-  if (is_constructor && !v7_is_object(*res)) {
-    /* constructor returned non-object: replace it with `this` */
-    *res = v7_get_this(v7);
+  for (; obj != V7_NULL; obj = obj_prototype_v(v7, obj)) {
+    int del_res;
+    if ((del_res = v7_del(v7, obj, name, len)) != -1) {
+      return del_res;
+    }
   }
-
-clean:
-  v7->vals.this_object = saved_this;
-  v7->vals.arguments = saved_arguments;
-  v7->inhibit_gc = saved_inhibit_gc;
-
-  tmp_frame_cleanup(&tf);
-  return rcode;
+  return -1;
 }
 
-/*
- * Evaluate `OP_TRY_PUSH_CATCH` or `OP_TRY_PUSH_FINALLY`: Take an offset (from
- * the parameter of opcode) and push it onto "try stack"
- */
-static void eval_try_push(struct v7 *v7, enum opcode op,
-                          struct bcode_registers *r) {
-  val_t arr = v7_mk_undefined();
-  struct gc_tmp_frame tf = new_tmp_frame(v7);
-  bcode_off_t target;
-  int64_t offset_tag = 0;
+/* Visual studio 2012+ has signbit() */
+#if defined(_MSC_VER) && _MSC_VER < 1700
+static int signbit(double x) {
+  double s = _copysign(1, x);
+  return s < 0;
+}
+#endif
 
-  tmp_stack_push(&tf, &arr);
+static double b_int_bin_op(enum opcode op, double a, double b) {
+  int32_t ia = isnan(a) || isinf(a) ? 0 : (int32_t)(int64_t) a;
+  int32_t ib = isnan(b) || isinf(b) ? 0 : (int32_t)(int64_t) b;
 
-  /* make sure "try stack" array exists */
-  arr = v7->call_stack->vals.try_stack;
-  if (!v7_is_array(v7, arr)) {
-    arr = v7_mk_dense_array(v7);
-    v7->call_stack->vals.try_stack = arr;
+  switch (op) {
+    case OP_LSHIFT:
+      return (int32_t)((uint32_t) ia << ((uint32_t) ib & 31));
+    case OP_RSHIFT:
+      return ia >> ((uint32_t) ib & 31);
+    case OP_URSHIFT:
+      return (uint32_t) ia >> ((uint32_t) ib & 31);
+    case OP_OR:
+      return ia | ib;
+    case OP_XOR:
+      return ia ^ ib;
+    case OP_AND:
+      return ia & ib;
+    default:
+      assert(0);
+#if defined(NDEBUG)
+      return 0;
+#endif
   }
+}
 
+V7_PRIVATE double b_num_bin_op(enum opcode op, double a, double b) {
   /*
-   * push the target address at the end of the "try stack" array
+   * For certain operations, the result is always NaN if either of arguments
+   * is NaN
    */
   switch (op) {
-    case OP_TRY_PUSH_CATCH:
-      offset_tag = LBLOCK_TAG_CATCH;
-      break;
-    case OP_TRY_PUSH_FINALLY:
-      offset_tag = LBLOCK_TAG_FINALLY;
-      break;
-    case OP_TRY_PUSH_LOOP:
-      offset_tag = LBLOCK_TAG_LOOP;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_REM:
+      if (isnan(a) || isnan(b)) {
+        return NAN;
+      }
       break;
-    case OP_TRY_PUSH_SWITCH:
-      offset_tag = LBLOCK_TAG_SWITCH;
+    default:
       break;
+  }
+
+  switch (op) {
+    case OP_ADD: /* simple fixed width nodes with no payload */
+      return a + b;
+    case OP_SUB:
+      return a - b;
+    case OP_REM:
+      if (b == 0 || isnan(b) || isnan(a) || isinf(b) || isinf(a)) {
+        return NAN;
+      }
+      return (int) a % (int) b;
+    case OP_MUL:
+      return a * b;
+    case OP_DIV:
+      if (b == 0) {
+        if (a == 0) return NAN;
+        return (!signbit(a) == !signbit(b)) ? INFINITY : -INFINITY;
+      }
+      return a / b;
+    case OP_LSHIFT:
+    case OP_RSHIFT:
+    case OP_URSHIFT:
+    case OP_OR:
+    case OP_XOR:
+    case OP_AND:
+      return b_int_bin_op(op, a, b);
     default:
       assert(0);
-      break;
+#if defined(NDEBUG)
+      return 0;
+#endif
   }
-  target = bcode_get_target(&r->ops);
-  v7_array_push(v7, arr, v7_mk_number(LBLOCK_ITEM_CREATE(target, offset_tag,
-                                                         v7->stack.len)));
+}
 
-  tmp_frame_cleanup(&tf);
+V7_PRIVATE int b_bool_bin_op(enum opcode op, double a, double b) {
+#ifdef V7_BROKEN_NAN
+  if (isnan(a) || isnan(b)) return op == OP_NE || op == OP_NE_NE;
+#endif
+
+  switch (op) {
+    case OP_EQ:
+    case OP_EQ_EQ:
+      return a == b;
+    case OP_NE:
+    case OP_NE_NE:
+      return a != b;
+    case OP_LT:
+      return a < b;
+    case OP_LE:
+      return a <= b;
+    case OP_GT:
+      return a > b;
+    case OP_GE:
+      return a >= b;
+    default:
+      assert(0);
+#if defined(NDEBUG)
+      return 0;
+#endif
+  }
 }
 
 /*
- * Evaluate `OP_TRY_POP`: just pop latest item from "try stack", ignoring it
+ * Relational comparison of any two values: `op` is one of `OP_LT`, `OP_LE`,
+ * `OP_GT` and `OP_GE`. Numbers are better compared with `b_bool_bin_op()`.
  */
-static enum v7_err eval_try_pop(struct v7 *v7) {
+static enum v7_err b_relational_op(struct v7 *v7, enum opcode op, val_t v1,
+                                   val_t v2, int *res) {
   enum v7_err rcode = V7_OK;
-  val_t arr = v7_mk_undefined();
-  unsigned long length;
-  struct gc_tmp_frame tf = new_tmp_frame(v7);
 
-  tmp_stack_push(&tf, &arr);
+  V7_TRY(to_primitive(v7, v1, V7_TO_PRIMITIVE_HINT_NUMBER, &v1));
+  V7_TRY(to_primitive(v7, v2, V7_TO_PRIMITIVE_HINT_NUMBER, &v2));
 
-  /* get "try stack" array, which must be defined and must not be emtpy */
-  arr = v7->call_stack->vals.try_stack;
-  if (!v7_is_array(v7, arr)) {
-    rcode = v7_throwf(v7, "Error", "TRY_POP when try_stack is not an array");
-    V7_TRY(V7_INTERNAL_ERROR);
-  }
+  if (v7_is_string(v1) && v7_is_string(v2)) {
+    int cmp = s_cmp(v7, v1, v2);
+    switch (op) {
+      case OP_LT:
+        *res = cmp < 0;
+        break;
+      case OP_LE:
+        *res = cmp <= 0;
+        break;
+      case OP_GT:
+        *res = cmp > 0;
+        break;
+      case OP_GE:
+        *res = cmp >= 0;
+        break;
+      default:
+        /* should never be here */
+        assert(0);
+    }
+  } else {
+    /* Convert both operands to numbers */
 
-  length = v7_array_length(v7, arr);
-  if (length == 0) {
-    rcode = v7_throwf(v7, "Error", "TRY_POP when try_stack is empty");
-    V7_TRY(V7_INTERNAL_ERROR);
-  }
+    V7_TRY(to_number_v(v7, v1, &v1));
+    V7_TRY(to_number_v(v7, v2, &v2));
 
-  /* delete the latest element of this array */
-  v7_array_del(v7, arr, length - 1);
+    *res = b_bool_bin_op(op, v7_to_number(v1), v7_to_number(v2));
+  }
 
 clean:
-  tmp_frame_cleanup(&tf);
   return rcode;
 }
 
-static void own_bcode(struct v7 *v7, struct bcode *p) {
-  mbuf_append(&v7->act_bcodes, &p, sizeof(p));
+static bcode_off_t bcode_get_target(char **ops) {
+  bcode_off_t target;
+  (*ops)++;
+  memcpy(&target, *ops, sizeof(target));
+  *ops += sizeof(target) - 1;
+  return target;
 }
 
-static void disown_bcode(struct v7 *v7, struct bcode *p) {
-#ifndef NDEBUG
-  struct bcode **vp =
-      (struct bcode **) (v7->act_bcodes.buf + v7->act_bcodes.len - sizeof(p));
+/*
+ * Looks `v` up in the jump table of the `OP_SWITCH_NUM` or `OP_SWITCH_STR`
+ * instruction at `p`. Returns the target to jump to, or 0 if `v` isn't of the
+ * type of the labels.
+ */
+static bcode_off_t bcode_switch_target(struct v7 *v7, const char *p,
+                                       val_t v) {
+  const char *table = p + BCODE_SWITCH_HDR, *s, *e;
+  bcode_off_t target = 0;
+  uint32_t size, len, entry, h;
+  int32_t lo;
+  size_t n;
+  double d;
 
-  /* given `p` should be the last item */
-  assert(*vp == p);
-#endif
-  v7->act_bcodes.len -= sizeof(p);
+  if (*p == OP_SWITCH_NUM) {
+    if (!v7_is_number(v)) return 0;
+    memcpy(&lo, table - sizeof(lo), sizeof(lo));
+    memcpy(&len, p + 1 + sizeof(target), sizeof(len));
+    /* also false for NaN, and -0 is 0 */
+    d = v7_to_number(v) - lo;
+    if (d >= 0 && d < (len - BCODE_SWITCH_HDR) / sizeof(target) &&
+        d == (size_t) d) {
+      memcpy(&target, table + (size_t) d * sizeof(target), sizeof(target));
+    }
+  } else {
+    if (!v7_is_string(v)) return 0;
+    s = v7_get_string_data(v7, &v, &n);
+    memcpy(&size, table - sizeof(size), sizeof(size));
+    for (h = bcode_switch_hash(s, n);; h++) {
+      memcpy(&entry, table + (h & (size - 1)) * sizeof(entry), sizeof(entry));
+      if (entry == 0) break;
+      e = p + entry;
+      memcpy(&len, e + sizeof(target), sizeof(len));
+      if (len == n && memcmp(e + sizeof(target) + sizeof(len), s, n) == 0) {
+        memcpy(&target, e, sizeof(target));
+        break;
+      }
+    }
+  }
+  if (target == 0) {
+    /* the default case */
+    memcpy(&target, p + 1, sizeof(target));
+  }
+  return target;
 }
 
-WARN_UNUSED_RESULT
-V7_PRIVATE enum v7_err eval_bcode(struct v7 *v7, struct bcode *bcode) {
-  struct bcode_registers r;
-  enum v7_err rcode = V7_OK;
-
-  /*
-   * Dummy variable just to enforce that `BTRY()` macro is used only inside the
-   * `eval_bcode()` function
-   */
-  uint8_t _you_should_use_BTRY_in_eval_bcode_only = 0;
-
-  char buf[512];
+struct bcode_registers {
+  struct bcode *bcode;
+  char *ops;
+  char *end;
+  /* offset of the frame slots of the current function in `v7->stack` */
+  size_t slots_base;
+#ifdef V7_ENABLE_JIT
+  /* instruction where the native code has just left, see `BJIT_ENTRY()` */
+  const char *jit_skip;
+#endif
+  unsigned int need_inc_ops : 1;
+};
 
-  val_t res = v7_mk_undefined(), v1 = v7_mk_undefined(), v2 = v7_mk_undefined(),
-        v3 = v7_mk_undefined(), v4 = v7_mk_undefined(),
-        scope_frame = v7_mk_undefined();
-  struct gc_tmp_frame tf = new_tmp_frame(v7);
+/*
+ * If returning from function implicitly, then set return value to `undefined`.
+ *
+ * And if function was called as a constructor, then make sure returned
+ * value is an object.
+ */
+static void bcode_adjust_retval(struct v7 *v7, uint8_t is_explicit_return) {
+  if (!is_explicit_return) {
+    /* returning implicitly: set return value to `undefined` */
+    POP();
+    PUSH(v7_mk_undefined());
+  }
 
-  bcode_restore_registers(v7, bcode, &r);
+  if (v7->is_constructor && !v7_is_object(TOS())) {
+    /* constructor is going to return non-object: replace it with `this` */
+    POP();
+    PUSH(v7_get_this(v7));
+  }
+}
 
-  tmp_stack_push(&tf, &res);
-  tmp_stack_push(&tf, &v1);
-  tmp_stack_push(&tf, &v2);
-  tmp_stack_push(&tf, &v3);
-  tmp_stack_push(&tf, &v4);
-  tmp_stack_push(&tf, &scope_frame);
+static void bcode_restore_registers(struct v7 *v7, struct bcode *bcode,
+                                    struct bcode_registers *r) {
+  r->bcode = bcode;
+  r->ops = bcode->ops.p;
+  r->end = r->ops + bcode->ops.len;
+#ifdef V7_ENABLE_JIT
+  r->jit_skip = NULL;
+#endif
 
   /*
-   * populate local variables on current scope, making them undeletable
-   * (since they're defined with `var`)
+   * TODO(dfrank) : the field `v7->strict_mode` is needed only for public
+   * functions like `v7_set_prop()` and `v7_array_set()`, but do we actually
+   * need to consider strict mode in these functions, and throw exceptions?
+   *
+   * If not, then we should get rid of `v7->strict_mode` whatsoever.
    */
-  {
-    size_t i;
-    for (i = 0; i < bcode->names_cnt; ++i) {
-      r.ops = bcode_next_name_v(v7, bcode, r.ops, &v1);
+  v7->strict_mode = bcode->strict_mode;
+}
 
-      /* set undeletable property on current scope */
-      V7_TRY(def_property_v(v7, v7->vals.scope, v1, V7_DESC_CONFIGURABLE(0),
-                            v7_mk_undefined(), 1 /*as_assign*/, NULL));
-    }
+/*
+ * If the function keeps some of its names in frame slots, returns the slot map
+ * of its `OP_FRAME_SLOTS` prologue and sets `slots_cnt`; otherwise returns
+ * NULL. `ops` should point at the name following the function name.
+ */
+static char *bcode_slot_map(struct bcode *bcode, char *ops,
+                            size_t *slots_cnt) {
+  int llen;
+  char *end = bcode->ops.p + bcode->ops.len;
+
+  ops = bcode_end_names(ops, bcode->names_cnt - 1);
+  if (ops >= end || (uint8_t) *ops != OP_FRAME_SLOTS) {
+    return NULL;
   }
+  ops++;
+  *slots_cnt = decode_varint((unsigned char *) ops, &llen);
+  return ops + llen;
+}
 
-restart:
-  while (r.ops < r.end && rcode == V7_OK) {
-    enum opcode op = (enum opcode) * r.ops;
+/* Returns the next entry of a slot map, see `OP_FRAME_SLOTS` */
+static size_t bcode_next_slot(char **map) {
+  int llen;
+  size_t ret = decode_varint((unsigned char *) *map, &llen);
+  *map += llen;
+  return ret;
+}
 
-    if (v7->need_gc) {
-      maybe_gc(v7);
-      v7->need_gc = 0;
-    }
+/* Makes room for more local blocks in the frame's "try stack" */
+static void call_frame_grow_blocks(struct v7_call_frame *frame) {
+  int64_t *blocks;
 
-    r.need_inc_ops = 1;
-#ifdef V7_BCODE_TRACE
-    {
-      char *dops = r.ops;
-      fprintf(stderr, "eval ");
-      dump_op(v7, stderr, r.bcode, &dops);
-    }
-#endif
+  if (frame->blocks == NULL) {
+    frame->blocks = frame->blocks_buf;
+    frame->blocks_size = ARRAY_SIZE(frame->blocks_buf);
+    return;
+  }
 
-    switch (op) {
-      case OP_DROP:
-        POP();
-        break;
-      case OP_DUP:
-        v1 = POP();
-        PUSH(v1);
-        PUSH(v1);
-        break;
-      case OP_2DUP:
-        v2 = POP();
-        v1 = POP();
-        PUSH(v1);
-        PUSH(v2);
-        PUSH(v1);
-        PUSH(v2);
-        break;
-      case OP_SWAP:
-        v1 = POP();
-        v2 = POP();
-        PUSH(v1);
-        PUSH(v2);
-        break;
-      case OP_STASH:
-        assert(!v7->is_stashed);
-        v7->vals.stash = TOS();
-        v7->is_stashed = 1;
-        break;
-      case OP_UNSTASH:
-        assert(v7->is_stashed);
-        POP();
-        PUSH(v7->vals.stash);
-        v7->vals.stash = v7_mk_undefined();
-        v7->is_stashed = 0;
-        break;
+  blocks = (int64_t *) malloc(frame->blocks_size * 2 * sizeof(*blocks));
+  memcpy(blocks, frame->blocks, frame->blocks_cnt * sizeof(*blocks));
+  if (frame->blocks != frame->blocks_buf) {
+    free(frame->blocks);
+  }
+  frame->blocks = blocks;
+  frame->blocks_size *= 2;
+}
 
-      case OP_SWAP_DROP:
-        v1 = POP();
-        POP();
-        PUSH(v1);
-        break;
+/* Returns the frame to the pool of `v7`, or frees it if the pool is full */
+static void call_frame_free(struct v7 *v7, struct v7_call_frame *frame) {
+  if (frame->blocks != frame->blocks_buf) {
+    free(frame->blocks);
+  }
+  if (v7->free_frames_cnt < V7_FRAME_POOL_SIZE) {
+    frame->prev = v7->free_frames;
+    v7->free_frames = frame;
+    v7->free_frames_cnt++;
+  } else {
+    free(frame);
+  }
+}
 
-      case OP_PUSH_UNDEFINED:
-        PUSH(v7_mk_undefined());
-        break;
-      case OP_PUSH_NULL:
-        PUSH(v7_mk_null());
-        break;
-      case OP_PUSH_THIS:
-        PUSH(v7_get_this(v7));
-        break;
-      case OP_PUSH_TRUE:
-        PUSH(v7_mk_boolean(1));
-        break;
-      case OP_PUSH_FALSE:
-        PUSH(v7_mk_boolean(0));
-        break;
-      case OP_PUSH_ZERO:
-        PUSH(v7_mk_number(0));
-        break;
-      case OP_PUSH_ONE:
-        PUSH(v7_mk_number(1));
-        break;
-      case OP_PUSH_LIT: {
-        PUSH(bcode_decode_lit(v7, r.bcode, &r.ops));
-        break;
-      }
-      case OP_LOGICAL_NOT:
-        v1 = POP();
-        PUSH(v7_mk_boolean(!v7_is_truthy(v7, v1)));
-        break;
-      case OP_NOT: {
-        v1 = POP();
-        BTRY(to_number_v(v7, v1, &v1));
-        PUSH(v7_mk_number(~(int32_t) v7_to_number(v1)));
-        break;
-      }
-      case OP_NEG: {
-        v1 = POP();
-        BTRY(to_number_v(v7, v1, &v1));
-        PUSH(v7_mk_number(-v7_to_number(v1)));
-        break;
-      }
-      case OP_POS: {
-        v1 = POP();
-        BTRY(to_number_v(v7, v1, &v1));
-        PUSH(v1);
-        break;
-      }
-      case OP_ADD: {
-        v2 = POP();
-        v1 = POP();
+/*
+ * Create new call frame object and fill it with the details of the current
+ * state
+ *
+ * For "function" frame, `r` must be non-NULL.
+ * For "private" frame, `r` must be NULL.
+ *
+ * TODO(dfrank): avoid using `val_t` objects for this, use some regular C
+ * struct instead.
+ */
+static struct v7_call_frame *bcode_create_call_frame(
+    struct v7 *v7, struct bcode_registers *r) {
+  struct v7_call_frame *call_frame = v7->free_frames;
 
-        /*
-         * If either operand is an object, convert both of them to primitives
-         */
-        if (v7_is_object(v1) || v7_is_object(v2)) {
-          BTRY(to_primitive(v7, v1, V7_TO_PRIMITIVE_HINT_AUTO, &v1));
-          BTRY(to_primitive(v7, v2, V7_TO_PRIMITIVE_HINT_AUTO, &v2));
-        }
+  if (call_frame != NULL) {
+    v7->free_frames = call_frame->prev;
+    v7->free_frames_cnt--;
+    /* `blocks_buf` is only read after it's written */
+    memset(call_frame, 0, offsetof(struct v7_call_frame, blocks_buf));
+  } else {
+    call_frame = (struct v7_call_frame *) calloc(1, sizeof(*call_frame));
+  }
 
-        if (v7_is_string(v1) || v7_is_string(v2)) {
-          /* Convert both operands to strings, and concatenate */
+  /* save previous call stack */
+  call_frame->prev = v7->call_stack;
 
-          BTRY(primitive_to_str(v7, v1, &v1, NULL, 0, NULL));
-          BTRY(primitive_to_str(v7, v2, &v2, NULL, 0, NULL));
+  /* current scope */
+  call_frame->vals.scope = v7->vals.scope;
+  call_frame->vals.gen = v7_mk_undefined();
 
-          PUSH(s_concat(v7, v1, v2));
-        } else {
-          /* Convert both operands to numbers, and sum */
+  /*
+   * `blocks` are left null, and will be lazily set in `eval_try_push()`
+   */
 
-          BTRY(primitive_to_number(v7, v1, &v1));
-          BTRY(primitive_to_number(v7, v2, &v2));
+  /* stack size */
+  call_frame->stack_size = v7->stack.len;
 
-          PUSH(v7_mk_number(
-              b_num_bin_op(op, v7_to_number(v1), v7_to_number(v2))));
-        }
-        break;
-      }
-      case OP_SUB:
-      case OP_REM:
-      case OP_MUL:
-      case OP_DIV:
-      case OP_LSHIFT:
-      case OP_RSHIFT:
-      case OP_URSHIFT:
-      case OP_OR:
-      case OP_XOR:
-      case OP_AND: {
-        v2 = POP();
-        v1 = POP();
+  if (r != NULL) {
+    /* save bcode and the current position in it */
+    call_frame->bcode = r->bcode;
+    call_frame->bcode_ops = r->ops + 1;
+    call_frame->slots_base = r->slots_base;
 
-        BTRY(to_number_v(v7, v1, &v1));
-        BTRY(to_number_v(v7, v2, &v2));
+    /* `this` object */
+    call_frame->vals.this_obj = v7_get_this(v7);
 
-        PUSH(
-            v7_mk_number(b_num_bin_op(op, v7_to_number(v1), v7_to_number(v2))));
-        break;
-      }
-      case OP_EQ_EQ: {
-        v2 = POP();
-        v1 = POP();
-        if (v7_is_string(v1) && v7_is_string(v2)) {
-          res = v7_mk_boolean(s_cmp(v7, v1, v2) == 0);
-        } else if (v1 == v2 && v1 == V7_TAG_NAN) {
-          res = v7_mk_boolean(0);
-        } else {
-          res = v7_mk_boolean(v1 == v2);
-        }
-        PUSH(res);
-        break;
-      }
-      case OP_NE_NE: {
-        v2 = POP();
-        v1 = POP();
-        if (v7_is_string(v1) && v7_is_string(v2)) {
-          res = v7_mk_boolean(s_cmp(v7, v1, v2) != 0);
-        } else if (v1 == v2 && v1 == V7_TAG_NAN) {
-          res = v7_mk_boolean(1);
-        } else {
-          res = v7_mk_boolean(v1 != v2);
-        }
-        PUSH(res);
-        break;
-      }
-      case OP_EQ:
-      case OP_NE: {
-        v2 = POP();
-        v1 = POP();
-        /*
-         * TODO(dfrank) : it's not really correct. Fix it accordingly to
-         * the p. 4.9 of The Definitive Guide (page 71)
-         */
-        if (((v7_is_object(v1) || v7_is_object(v2)) && v1 == v2)) {
-          res = v7_mk_boolean(op == OP_EQ);
-          PUSH(res);
+    /* is constructor */
+    call_frame->is_constructor = v7->is_constructor;
+  } else {
+    /*
+     * No bcode registers is provided: assume it's not going to change, and
+     * leave it NULL. This is the way we distinguish between "function" frames
+     * and "private" frames.
+     */
+  }
+
+  return call_frame;
+}
+
+/*
+ * Returns argument `i` of `argc` ones at byte offset `off` of the data stack,
+ * or `undefined` if there are not so many.
+ */
+static val_t stack_arg(struct v7 *v7, size_t off, int argc, int i) {
+  return i < argc ? ((val_t *) (v7->stack.buf + off))[i] : v7_mk_undefined();
+}
+
+/*
+ * The caller's bcode object is needed because we have to restore literals
+ * and `end` registers.
+ *
+ * TODO(mkm): put this state on a return stack
+ *
+ * Caller of bcode_perform_call is responsible for owning `call_frame`
+ *
+ * `stack_len` is the length of the data stack to restore on return: the
+ * caller may leave the arguments above it.
+ */
+static enum v7_err bcode_perform_call(struct v7 *v7, v7_val_t scope_frame,
+                                      struct v7_js_function *func,
+                                      struct bcode_registers *r,
+                                      val_t this_object, char *ops,
+                                      uint8_t is_constructor,
+                                      size_t stack_len) {
+  struct v7_call_frame *call_frame = NULL;
+
+  /* create new `call_frame` which will replace `v7->call_stack` */
+  call_frame = bcode_create_call_frame(v7, r);
+  call_frame->stack_size = stack_len;
+
+  /* after context is saved, we can change current context */
+  v7->vals.this_object = this_object;
+  v7->is_constructor = is_constructor;
+
+  /* new scope_frame will inherit from the function's scope */
+  obj_prototype_set(v7, v7_to_object(scope_frame), &func->scope->base);
+  v7->vals.scope = scope_frame;
+  v7->call_stack = call_frame;
+  bcode_restore_registers(v7, func->bcode, r);
+
+  /* adjust `ops` since names were already read from it */
+  r->ops = ops;
+
+  /* `ops` already points to the needed instruction, no need to increment it */
+  r->need_inc_ops = 0;
+
+  return V7_OK;
+}
+
+/*
+ * Unwinds `call_stack` by 1 frame.
+ *
+ * Returns `1` if the unwound frame is a "function" frame, or `0` if it's
+ * a "private" frame.
+ */
+static uint8_t unwind_stack_1level(struct v7 *v7, struct bcode_registers *r) {
+  /*
+   * We have two types of frames: "function" frames and "private" frames.
+   * The "private" frames don't contain some fields, so, we need to
+   * distinguish between them.
+   */
+  uint8_t is_func_frame = 0;
+#ifdef V7_BCODE_TRACE
+  fprintf(stderr, "unwinding stack by 1 level\n");
+#endif
+
+  /*
+   * Whatever the frame type is, we try to retrieve `bcode` pointer and see
+   * if it's non-NULL. If it is, we have "function" frame.
+   */
+  assert(v7->call_stack != NULL);
+  is_func_frame = (v7->call_stack->bcode != NULL);
+
+  if (is_func_frame) {
+    bcode_restore_registers(v7, v7->call_stack->bcode, r);
+
+    r->ops = v7->call_stack->bcode_ops;
+    r->slots_base = v7->call_stack->slots_base;
+
+    /* restore `this` object */
+    v7->vals.this_object = v7->call_stack->vals.this_obj;
+
+    /* restore `is_constructor` */
+    v7->is_constructor = v7->call_stack->is_constructor;
+  }
+
+  /* adjust data stack length (restore saved) */
+  assert(v7->call_stack->stack_size <= v7->stack.len);
+  v7->stack.len = v7->call_stack->stack_size;
+
+  /* restore scope */
+  v7->vals.scope = v7->call_stack->vals.scope;
+
+  /* finally, drop the frame which we've just unwound */
+  {
+    struct v7_call_frame *tmp = v7->call_stack;
+    v7->call_stack = v7->call_stack->prev;
+    call_frame_free(v7, tmp);
+  }
+
+  return is_func_frame;
+}
+
+static enum v7_err bcode_private_frame_push(struct v7 *v7,
+                                            v7_val_t scope_frame) {
+  struct v7_call_frame *call_frame = NULL;
+
+  /*
+   * Create new `call_frame` which will replace `v7->call_stack`. We pass
+   * `NULL` for `bcode_registers` because we're creating "private" call_frame.
+   */
+  call_frame = bcode_create_call_frame(v7, NULL);
+
+  /* new scope_frame will inherit from the current scope */
+  obj_prototype_set(v7, v7_to_object(scope_frame),
+                    v7_to_object(v7->vals.scope));
+  v7->vals.scope = scope_frame;
+  v7->call_stack = call_frame;
+
+  return V7_OK;
+}
+
+/*
+ * Unwinds local "try stack" (i.e. local-to-current-function stack of nested
+ * `try` blocks), looking for local-to-function blocks.
+ *
+ * Block types of interest are specified with `wanted_blocks_mask`: it's a
+ * bitmask of `enum local_block` values.
+ *
+ * Only blocks of specified types will be considered, others will be dropped.
+ *
+ * If `restore_stack_size` is non-zero, the `v7->stack.len` will be restored
+ * to the value saved when the block was created. This is useful when throwing,
+ * since if we throw from the middle of the expression, the stack could have
+ * any size. But you probably shouldn't set this flag when breaking and
+ * returning, since it may hide real bugs in the opcode.
+ *
+ * Returns id of the block type that control was transferred into, or
+ * `LOCAL_BLOCK_NONE` if no appropriate block was found. Note: returned value
+ * contains at most 1 block bit; it can't contain multiple bits.
+ */
+static enum local_block unwind_local_blocks_stack(
+    struct v7 *v7, struct bcode_registers *r, unsigned int wanted_blocks_mask,
+    uint8_t restore_stack_size) {
+  struct v7_call_frame *frame = v7->call_stack;
+  enum local_block found_block = LOCAL_BLOCK_NONE;
+
+  /*
+   * pop latest element from "try stack", loop until we need to transfer
+   * control there
+   */
+  while (frame->blocks_cnt > frame->blocks_base) {
+    /* get latest offset from the "try stack" */
+    int64_t offset = frame->blocks[frame->blocks_cnt - 1];
+    enum local_block cur_block = LOCAL_BLOCK_NONE;
+
+    /* get id of the current block type */
+    switch (LBLOCK_TAG(offset)) {
+      case LBLOCK_TAG_CATCH:
+        cur_block = LOCAL_BLOCK_CATCH;
+        break;
+      case LBLOCK_TAG_FINALLY:
+        cur_block = LOCAL_BLOCK_FINALLY;
+        break;
+      case LBLOCK_TAG_LOOP:
+        cur_block = LOCAL_BLOCK_LOOP;
+        break;
+      case LBLOCK_TAG_SWITCH:
+        cur_block = LOCAL_BLOCK_SWITCH;
+        break;
+      default:
+        assert(0);
+        break;
+    }
+
+    if (cur_block & wanted_blocks_mask) {
+      /* need to transfer control to this offset */
+      r->ops = r->bcode->ops.p + LBLOCK_OFFSET(offset);
+#ifdef V7_BCODE_TRACE
+      fprintf(stderr, "transferring to block #%d: %u\n", (int) cur_block,
+              (unsigned int) LBLOCK_OFFSET(offset));
+#endif
+      found_block = cur_block;
+      /* if needed, restore stack size to the saved value */
+      if (restore_stack_size) {
+        v7->stack.len = LBLOCK_STACK_SIZE(offset);
+      }
+      break;
+    } else {
+#ifdef V7_BCODE_TRACE
+      fprintf(stderr, "skipped block #%d: %u\n", (int) cur_block,
+              (unsigned int) LBLOCK_OFFSET(offset));
+#endif
+      /*
+       * since we don't need to control transfer there, just pop
+       * it from the "try stack"
+       */
+      frame->blocks_cnt--;
+    }
+  }
+
+  return found_block;
+}
+
+/*
+ * Perform break, if there is a `finally` block in effect, transfer
+ * control there.
+ */
+static void bcode_perform_break(struct v7 *v7, struct bcode_registers *r) {
+  enum local_block found;
+  unsigned int mask;
+  v7->is_breaking = 0;
+  if (v7->is_continuing) {
+    mask = LOCAL_BLOCK_LOOP;
+  } else {
+    mask = LOCAL_BLOCK_LOOP | LOCAL_BLOCK_SWITCH;
+  }
+
+  /*
+   * Keep unwinding until we find local block of interest. We should not
+   * encounter any "function" frames; only "private" frames are allowed.
+   */
+  for (;;) {
+    /*
+     * Try to unwind local "try stack", considering only `finally` and `break`.
+     */
+    found = unwind_local_blocks_stack(v7, r, mask | LOCAL_BLOCK_FINALLY, 0);
+    if (found == LOCAL_BLOCK_NONE) {
+/*
+ * no blocks found: this may happen if only the `break` or `continue` has
+ * occurred inside "private" frame. So, unwind this frame, make sure it
+ * is indeed "private" (not "function"), and keep unwinding local blocks.
+ */
+#if !defined(NDEBUG)
+      uint8_t is_func_frame = unwind_stack_1level(v7, r);
+      assert(!is_func_frame);
+#endif
+    } else {
+      /* found some block to transfer control into, stop unwinding */
+      break;
+    }
+  }
+
+  /*
+   * upon exit of a finally block we'll reenter here if is_breaking is true.
+   * See OP_AFTER_FINALLY.
+   */
+  if (found == LOCAL_BLOCK_FINALLY) {
+    v7->is_breaking = 1;
+  }
+
+  /* `ops` already points to the needed instruction, no need to increment it */
+  r->need_inc_ops = 0;
+}
+
+/*
+ * Perform return, but if there is a `finally` block in effect, transfer
+ * control there.
+ *
+ * If `take_retval` is non-zero, value to return will be popped from stack
+ * (and saved into `v7->vals.returned_value`), otherwise, it won't be affected.
+ */
+static enum v7_err bcode_perform_return(struct v7 *v7,
+                                        struct bcode_registers *r,
+                                        int take_retval) {
+  /*
+   * We should either take retval from the stack, or some value should already
+   * be pending to return
+   */
+  assert(take_retval || v7->is_returned);
+
+  if (take_retval) {
+    /* taking return value from stack */
+    v7->vals.returned_value = POP();
+    v7->is_returned = 1;
+
+    /*
+     * returning (say, from `finally`) dismisses any errors that are being
+     * thrown at the moment as well
+     */
+    v7->is_thrown = 0;
+    v7->vals.thrown_error = v7_mk_undefined();
+  }
+
+  /*
+   * Keep unwinding until we unwound "function" frame, or found some `finally`
+   * block.
+   */
+  for (;;) {
+    /* Try to unwind local "try stack", considering only `finally` blocks */
+    if (unwind_local_blocks_stack(v7, r, (LOCAL_BLOCK_FINALLY), 0) ==
+        LOCAL_BLOCK_NONE) {
+      /*
+       * no `finally` blocks were found, so, unwind stack by 1 level, and see
+       * if it's a "function" frame. If not, will keep unwinding.
+       */
+      if (unwind_stack_1level(v7, r)) {
+        /*
+         * unwound frame is a "function" frame, so, push returned value to
+         * stack, and stop unwinding
+         */
+        PUSH(v7->vals.returned_value);
+        v7->is_returned = 0;
+        v7->vals.returned_value = v7_mk_undefined();
+
+        break;
+      }
+    } else {
+      /* found `finally` block, so, stop unwinding */
+      break;
+    }
+  }
+
+  /* `ops` already points to the needed instruction, no need to increment it */
+  r->need_inc_ops = 0;
+
+  return V7_OK;
+}
+
+/*
+ * Perform throw inside `eval_bcode()`.
+ *
+ * If `take_thrown_value` is non-zero, value to return will be popped from
+ * stack (and saved into `v7->vals.thrown_error`), otherwise, it won't be
+ *affected.
+ *
+ * Returns `V7_OK` if thrown exception was caught, `V7_EXEC_EXCEPTION`
+ * otherwise (in this case, evaluation of current script must be stopped)
+ *
+ * When calling this function from `eval_bcode()`, you should wrap this call
+ * into the `V7_TRY()` macro.
+ */
+static enum v7_err bcode_perform_throw(struct v7 *v7, struct bcode_registers *r,
+                                       int take_thrown_value) {
+  enum v7_err rcode = V7_OK;
+  enum local_block found;
+
+  assert(take_thrown_value || v7->is_thrown);
+
+  if (take_thrown_value) {
+    v7->vals.thrown_error = POP();
+    v7->is_thrown = 1;
+
+    /* Throwing dismisses any pending return values */
+    v7->is_returned = 0;
+    v7->vals.returned_value = v7_mk_undefined();
+  }
+
+  while ((found = unwind_local_blocks_stack(
+              v7, r, (LOCAL_BLOCK_CATCH | LOCAL_BLOCK_FINALLY), 1)) ==
+         LOCAL_BLOCK_NONE) {
+    if (v7->call_stack != v7->bottom_call_stack) {
+#ifdef V7_BCODE_TRACE
+      fprintf(stderr, "not at the bottom of the stack, going to unwind..\n");
+#endif
+      /* not reached bottom of the stack yet, keep unwinding */
+      unwind_stack_1level(v7, r);
+    } else {
+/* reached stack bottom: uncaught exception */
+#ifdef V7_BCODE_TRACE
+      fprintf(stderr, "reached stack bottom: uncaught exception\n");
+#endif
+      rcode = V7_EXEC_EXCEPTION;
+      break;
+    }
+  }
+
+  if (found == LOCAL_BLOCK_CATCH) {
+    /*
+     * we're going to enter `catch` block, so, populate TOS with the thrown
+     * value, and clear it in v7 context.
+     */
+    PUSH(v7->vals.thrown_error);
+    v7->is_thrown = 0;
+    v7->vals.thrown_error = v7_mk_undefined();
+  }
+
+  /* `ops` already points to the needed instruction, no need to increment it */
+  r->need_inc_ops = 0;
+
+  return rcode;
+}
+
+/*
+ * Throws reference error from `eval_bcode()`. Always wrap a call to this
+ * function into `V7_TRY()`.
+ */
+static enum v7_err bcode_throw_reference_error(struct v7 *v7,
+                                               struct bcode_registers *r,
+                                               val_t var_name) {
+  enum v7_err rcode = V7_OK;
+  const char *s;
+  size_t name_len;
+
+  assert(v7_is_string(var_name));
+  s = v7_get_string_data(v7, &var_name, &name_len);
+
+  rcode = v7_throwf(v7, REFERENCE_ERROR, "[%.*s] is not defined",
+                    (int) name_len, s);
+  (void) rcode;
+  return bcode_perform_throw(v7, r, 0);
+}
+
+/*
+ * Assigns `v` to the variable `name`, see `OP_SET_VAR`. Sets `found` to 0 if
+ * there's no such variable and it can't be made either (in strict mode), the
+ * caller throws a reference error then.
+ */
+static enum v7_err bcode_set_var(struct v7 *v7, struct bcode *bcode,
+                                 val_t name, val_t v, int *found) {
+  enum v7_err rcode = V7_OK;
+  struct v7_property *prop;
+  char buf[512];
+
+  *found = 1;
+  V7_TRY(to_string(v7, name, NULL, buf, sizeof(buf), NULL));
+  prop = v7_get_property(v7, v7->vals.scope, buf, strlen(buf));
+  if (prop != NULL) {
+    /* Property already exists: update its value */
+    /*
+     * TODO(dfrank): currently we can't use `def_property_v()` here,
+     * because if the property was already found somewhere in the
+     * prototype chain, then it should be updated, instead of creating a
+     * new one on the top of the scope.
+     *
+     * Probably we need to make `def_property_v()` more generic and
+     * use it here; or split `def_property_v()` into smaller pieces and
+     * use one of them here.
+     */
+    if (!(prop->attributes & V7_PROPERTY_NON_WRITABLE)) {
+      prop->value = v;
+    }
+  } else if (!bcode->strict_mode) {
+    /*
+     * Property does not exist: since we're not in strict mode, let's
+     * create new property at Global Object
+     */
+    V7_TRY(set_property_v(v7, v7_get_global(v7), name, v, NULL));
+  } else {
+    /*
+     * In strict mode, throw reference error instead of polluting Global
+     * Object
+     */
+    *found = 0;
+  }
+
+clean:
+  return rcode;
+}
+
+/*
+ * Returns the inline cache of the instruction at `ops`, or NULL if the bcode
+ * can't have one.
+ */
+static struct bcode_ic *bcode_get_ic(struct bcode *bcode, const char *ops) {
+  size_t off = ops - bcode->ops.p;
+  uint16_t idx;
+
+  if (bcode->frozen) return NULL;
+  if (bcode->ic_map == NULL) {
+    bcode->ic_map = (uint16_t *) calloc(bcode->ops.len, sizeof(uint16_t));
+  }
+
+  idx = bcode->ic_map[off];
+  if (idx == 0) {
+    uint16_t cnt = bcode->ics_cnt;
+    if (cnt == BCODE_IC_MAX) return NULL;
+    if (cnt == 0 || (cnt >= 4 && (cnt & (cnt - 1)) == 0)) {
+      bcode->ics = (struct bcode_ic *) realloc(
+          bcode->ics, (cnt == 0 ? 4 : cnt * 2) * sizeof(*bcode->ics));
+    }
+    memset(&bcode->ics[cnt], 0, sizeof(*bcode->ics));
+    idx = bcode->ic_map[off] = ++bcode->ics_cnt;
+  }
+  return &bcode->ics[idx - 1];
+}
+
+/*
+ * Returns the object where the lookup of a property of `v` starts (see
+ * `v7_get_throwing()`), or `undefined` if there's no such.
+ */
+static val_t bcode_ic_obj(struct v7 *v7, val_t v) {
+  if (v7_is_object(v)) {
+    return v;
+  } else if (v7_is_string(v)) {
+    return v7->vals.string_prototype;
+  } else if (v7_is_number(v)) {
+    return v7->vals.number_prototype;
+  } else if (v7_is_boolean(v)) {
+    return v7->vals.boolean_prototype;
+  } else if (is_cfunction_lite(v)) {
+    return v7->vals.function_prototype;
+  }
+  return V7_UNDEFINED;
+}
+
+static uintptr_t bcode_ic_key(struct v7_object *o) {
+  /* frozen objects have properties but no shape */
+  if (o->shape != V7_SHAPE_DICT && (o->shape != 0 || o->properties == NULL)) {
+    return (uintptr_t) o->shape << 1 | 1;
+  }
+  return (uintptr_t) o;
+}
+
+/*
+ * Only names of identifiers are cached: they can't be array indices, nor
+ * subscript strings.
+ */
+static int bcode_ic_name_ok(const char *s, size_t len) {
+  return len > 0 && (isalpha((unsigned char) s[0]) || s[0] == '_' ||
+                     s[0] == '$' || (unsigned char) s[0] >= 0x80);
+}
+
+/* Sets `*res` to the cached property and returns 1, or returns 0 */
+static int bcode_ic_hit(struct v7 *v7, struct bcode_ic *ic, val_t obj,
+                        val_t name, struct v7_property **res) {
+  struct v7_object *o = v7_to_object(obj);
+
+  if (ic->epoch != v7->prop_epoch || ic->name != name ||
+      ic->key != bcode_ic_key(o) || ic->proto != obj_prototype(v7, o)) {
+    return 0;
+  }
+  *res = ic->index != 0 ? obj_shape_slot(v7, o, ic->index - 1, ic->name)
+                        : ic->prop;
+  return 1;
+}
+
+/*
+ * Caches the property `p` found by `name` at `obj`. `epoch` is the
+ * `v7->prop_epoch` before the lookup: if it's changed, the lookup might have
+ * run GC and `name` is stale, so nothing is cached.
+ */
+static void bcode_ic_fill(struct v7 *v7, struct bcode_ic *ic, uint32_t epoch,
+                          val_t obj, val_t name, struct v7_property *p) {
+  struct v7_object *o = v7_to_object(obj), *q;
+  const char *s;
+  size_t len;
+  int idx = -1;
+
+  if (epoch != v7->prop_epoch || p == NULL || p == v7->cur_dense_prop ||
+      !v7_is_string(name)) {
+    return;
+  }
+  s = v7_get_string_data(v7, &name, &len);
+  if (!bcode_ic_name_ok(s, len)) return;
+
+  ic->key = bcode_ic_key(o);
+  if (ic->key & 1) {
+    idx = shape_find(v7, o->shape, s, len);
+  } else if (!(o->attributes & V7_OBJ_OFF_HEAP)) {
+    /* without a shape, new properties of the receiver must bump the epoch */
+    o->attributes |= _V7_OBJ_WATCHED;
+  }
+  ic->proto = obj_prototype(v7, o);
+  for (q = ic->proto; q != NULL; q = obj_prototype(v7, q)) {
+    if (!(q->attributes & V7_OBJ_OFF_HEAP)) {
+      q->attributes |= _V7_OBJ_WATCHED;
+    }
+  }
+
+  ic->name = name;
+  ic->prop = p;
+  ic->index = idx + 1;
+  ic->epoch = epoch;
+}
+
+/*
+ * Looks up the property `name` of `obj` through the inline cache. Returns 0
+ * if the lookup can't be cached and should go the generic way.
+ */
+static int bcode_ic_lookup(struct v7 *v7, struct bcode_ic *ic, val_t obj,
+                           val_t name, struct v7_property **res) {
+  const char *s;
+  size_t len;
+
+  if (bcode_ic_hit(v7, ic, obj, name, res)) return 1;
+
+  if (!v7_is_string(name)) return 0;
+  s = v7_get_string_data(v7, &name, &len);
+  if (!bcode_ic_name_ok(s, len)) return 0;
+
+  *res = v7_get_property(v7, obj, s, len);
+  bcode_ic_fill(v7, ic, v7->prop_epoch, obj, name, *res);
+  return 1;
+}
+
+/*
+ * Takes a half-done function (either from literal table or deserialized from
+ * `ops` inlined data), and returns a ready-to-use function.
+ *
+ * The actual behaviour depends on whether the half-done function has
+ * `prototype` defined. If there's no prototype (i.e. it's `undefined`), then
+ * the new function is created, with bcode from a given one. If, however,
+ * the prototype is defined, it means that the function was just deserialized
+ * from `ops`, so we only need to set `scope` on it.
+ *
+ * Assumes `func` is owned by the caller.
+ */
+static val_t bcode_instantiate_function(struct v7 *v7, val_t func) {
+  val_t res;
+  struct v7_js_function *f;
+  assert(is_js_function(func));
+  f = to_js_function(func);
+
+  if (v7_is_undefined(v7_get(v7, func, "prototype", 9))) {
+    /*
+     * Function's `prototype` is `undefined`: it means that the function is
+     * created by the compiler and is stored in the literal table. We have to
+     * create completely new function
+     */
+    struct v7_js_function *rf;
+
+    res = mk_js_function(v7, v7_to_generic_object(v7->vals.scope),
+                         v7_mk_object(v7));
+
+    /* Copy and retain bcode */
+    rf = to_js_function(res);
+    rf->bcode = f->bcode;
+    retain_bcode(v7, rf->bcode);
+  } else {
+    /*
+     * Function's `prototype` is NOT `undefined`: it means that the function is
+     * deserialized from inline `ops` data, and we just need to set scope on
+     * it.
+     */
+    res = func;
+    f->scope = v7_to_generic_object(v7->vals.scope);
+  }
+
+  return res;
+}
+
+/**
+ * Call C function `func` with given `this_object` and array of arguments
+ * `args`. `func` should be a C function pointer, not C function object.
+ *
+ * If `args` is `V7_TAG_NOVALUE`, the arguments are the `argc` values on top
+ * of the stack instead: they stay there during the call, and the array is
+ * only made if the function asks for it (see `v7_get_arguments()`).
+ */
+static enum v7_err call_cfunction(struct v7 *v7, val_t func, val_t this_object,
+                                  val_t args, unsigned long argc,
+                                  uint8_t is_constructor, val_t *res) {
+  enum v7_err rcode = V7_OK;
+  uint8_t saved_inhibit_gc = v7->inhibit_gc;
+  val_t saved_this = v7->vals.this_object;
+  val_t saved_arguments = v7->vals.arguments;
+  size_t saved_args_base = v7->args_base;
+  unsigned long saved_args_cnt = v7->args_cnt;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+
+  *res = v7_mk_undefined();
+
+  tmp_stack_push(&tf, &saved_this);
+  tmp_stack_push(&tf, &saved_arguments);
+
+  /*
+   * prepare cfunction environment: `this`, `arguments`.
+   */
+  v7->vals.this_object = this_object;
+  v7->inhibit_gc = 1;
+  v7->vals.arguments = args;
+  if (args == V7_TAG_NOVALUE) {
+    v7->args_cnt = argc;
+    v7->args_base = v7->stack.len - argc * sizeof(val_t);
+  }
+
+  /* call C function */
+  rcode = to_cfunction(v7, func)(v7, res);
+  if (rcode != V7_OK) {
+    goto clean;
+  }
+
+  if (is_constructor && !v7_is_object(*res)) {
+    /* constructor returned non-object: replace it with `this` */
+    *res = v7_get_this(v7);
+  }
+
+clean:
+  v7->vals.this_object = saved_this;
+  v7->vals.arguments = saved_arguments;
+  v7->args_base = saved_args_base;
+  v7->args_cnt = saved_args_cnt;
+  v7->inhibit_gc = saved_inhibit_gc;
+
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+
+/*
+ * Evaluate `OP_TRY_PUSH_CATCH` or `OP_TRY_PUSH_FINALLY`: Take an offset (from
+ * the parameter of opcode) and push it onto "try stack"
+ */
+static void eval_try_push(struct v7 *v7, enum opcode op,
+                          struct bcode_registers *r) {
+  struct v7_call_frame *frame = v7->call_stack;
+  bcode_off_t target;
+  int64_t offset_tag = 0;
+
+  /* make sure "try stack" has room for one more item */
+  if (frame->blocks_cnt == frame->blocks_size) {
+    call_frame_grow_blocks(frame);
+  }
+
+  /*
+   * push the target address at the end of the "try stack"
+   */
+  switch (op) {
+    case OP_TRY_PUSH_CATCH:
+      offset_tag = LBLOCK_TAG_CATCH;
+      break;
+    case OP_TRY_PUSH_FINALLY:
+      offset_tag = LBLOCK_TAG_FINALLY;
+      break;
+    case OP_TRY_PUSH_LOOP:
+      offset_tag = LBLOCK_TAG_LOOP;
+      break;
+    case OP_TRY_PUSH_SWITCH:
+      offset_tag = LBLOCK_TAG_SWITCH;
+      break;
+    default:
+      assert(0);
+      break;
+  }
+  target = bcode_get_target(&r->ops);
+  frame->blocks[frame->blocks_cnt++] =
+      LBLOCK_ITEM_CREATE(target, offset_tag, v7->stack.len);
+}
+
+/*
+ * Evaluate `OP_TRY_POP`: just pop latest item from "try stack", ignoring it
+ */
+static enum v7_err eval_try_pop(struct v7 *v7) {
+  enum v7_err rcode = V7_OK;
+  struct v7_call_frame *frame = v7->call_stack;
+
+  /* "try stack" must not be emtpy */
+  if (frame->blocks_cnt == frame->blocks_base) {
+    rcode = v7_throwf(v7, "Error", "TRY_POP when try_stack is empty");
+    V7_TRY(V7_INTERNAL_ERROR);
+  }
+
+  /* delete the latest item */
+  frame->blocks_cnt--;
+
+clean:
+  return rcode;
+}
+
+/*
+ * Generators.
+ *
+ * A generator runs in a call frame of its own, like any function. When it
+ * yields, its frames and data stack are saved into the generator record and
+ * unwound, see `bcode_gen_suspend()`; resuming makes them again on top of the
+ * resumer's ones, see `bcode_gen_resume()`. So nothing of a suspended
+ * generator stays on the native stack or on the call stack. The record is an
+ * array, so that the GC sees the values in there; the generator object keeps
+ * it in its hidden property.
+ */
+enum gen_field {
+  GEN_STATE,  /* `enum gen_state` */
+  GEN_FUNC,   /* the generator function, which keeps the bcode */
+  GEN_THIS,   /* `this` of the call */
+  GEN_SCOPE,  /* scope at the resume point */
+  GEN_OPS,    /* offset of the resume point in the bcode */
+  GEN_SLOTS,  /* offset of the frame slots in the saved data stack */
+  GEN_FRAMES, /* per frame, bottom up: scope, stack size, blocks and blocks */
+  GEN_STACK   /* the saved data stack */
+};
+
+enum gen_state {
+  GEN_STATE_START,     /* not started yet */
+  GEN_STATE_SUSPENDED, /* suspended in `yield` */
+  GEN_STATE_RUNNING,
+  GEN_STATE_DONE
+};
+
+static enum gen_state gen_get_state(struct v7 *v7, val_t gen) {
+  return (enum gen_state) v7_to_number(v7_array_get(v7, gen, GEN_STATE));
+}
+
+static void gen_set_state(struct v7 *v7, val_t gen, enum gen_state state) {
+  v7_array_set(v7, gen, GEN_STATE, v7_mk_number(state));
+}
+
+/*
+ * Saves the generator which runs in the innermost function frame into its
+ * record `gen` and unwinds its frames: the function one, and the private ones
+ * of the `catch` blocks above it. Stack sizes are saved relative to the
+ * bottom of the function frame, so that the generator can be resumed at any
+ * stack depth. `ops` is where to resume.
+ *
+ * Leaves the registers of the resumer in `r`, just like a return.
+ */
+static void bcode_gen_suspend(struct v7 *v7, struct bcode_registers *r,
+                              val_t gen, const char *ops,
+                              enum gen_state state) {
+  struct v7_call_frame *frame, *func_frame = v7->call_stack;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+  val_t frames = v7_mk_undefined(), stack = v7_mk_undefined();
+  size_t base, i, n, cnt = 1;
+  unsigned int b;
+
+  tmp_stack_push(&tf, &gen);
+  tmp_stack_push(&tf, &frames);
+  tmp_stack_push(&tf, &stack);
+  frames = v7_mk_dense_array(v7);
+  stack = v7_mk_dense_array(v7);
+
+  while (func_frame->bcode == NULL) {
+    func_frame = func_frame->prev;
+    cnt++;
+  }
+  base = func_frame->stack_size;
+
+  for (n = cnt; n > 0; n--) {
+    for (frame = v7->call_stack, i = 1; i < n; i++) {
+      frame = frame->prev;
+    }
+    v7_array_push(v7, frames, frame == func_frame ? v7_mk_undefined()
+                                                  : frame->vals.scope);
+    v7_array_push(v7, frames, v7_mk_number(frame->stack_size - base));
+    v7_array_push(v7, frames, v7_mk_number(frame->blocks_cnt));
+    for (b = 0; b < frame->blocks_cnt; b++) {
+      int64_t item = frame->blocks[b];
+      v7_array_push(v7, frames,
+                    v7_mk_number((double) (item & ~LBLOCK_STACK_SIZE_MASK)));
+      v7_array_push(v7, frames,
+                    v7_mk_number((double) (LBLOCK_STACK_SIZE(item) - base)));
+    }
+  }
+  for (i = base; i < v7->stack.len; i += sizeof(val_t)) {
+    v7_array_push(v7, stack, *(val_t *) (v7->stack.buf + i));
+  }
+
+  gen_set_state(v7, gen, state);
+  v7_array_set(v7, gen, GEN_THIS, v7_get_this(v7));
+  v7_array_set(v7, gen, GEN_SCOPE, v7->vals.scope);
+  v7_array_set(v7, gen, GEN_OPS, v7_mk_number(ops - r->bcode->ops.p));
+  v7_array_set(v7, gen, GEN_SLOTS,
+               v7_mk_number(r->slots_base > base ? r->slots_base - base : 0));
+  v7_array_set(v7, gen, GEN_FRAMES, frames);
+  v7_array_set(v7, gen, GEN_STACK, stack);
+
+  /* the private frames, then the function one */
+  while (!unwind_stack_1level(v7, r)) {
+  }
+  r->need_inc_ops = 0;
+
+  tmp_frame_cleanup(&tf);
+}
+
+/*
+ * Makes the frames and the data stack of the generator `gen` again, see
+ * `bcode_gen_suspend()`, and transfers control to it. The function frame
+ * keeps the registers of the resumer, like `OP_CALL` does. Returns the state
+ * the generator was in.
+ */
+static enum gen_state bcode_gen_resume(struct v7 *v7,
+                                       struct bcode_registers *r, val_t gen) {
+  enum gen_state state = gen_get_state(v7, gen);
+  struct v7_js_function *func = to_js_function(v7_array_get(v7, gen, GEN_FUNC));
+  val_t frames = v7_array_get(v7, gen, GEN_FRAMES);
+  val_t stack = v7_array_get(v7, gen, GEN_STACK);
+  size_t base = v7->stack.len, n = v7_array_length(v7, frames), i, k, cnt;
+  struct v7_call_frame *frame;
+
+  frame = bcode_create_call_frame(v7, r);
+  frame->vals.gen = gen;
+  v7->call_stack = frame;
+  v7->vals.this_object = v7_array_get(v7, gen, GEN_THIS);
+  v7->is_constructor = 0;
+  bcode_restore_registers(v7, func->bcode, r);
+
+  for (i = 0; i < n;) {
+    if (i > 0) {
+      frame = bcode_create_call_frame(v7, NULL);
+      frame->vals.scope = v7_array_get(v7, frames, i);
+      v7->call_stack = frame;
+    }
+    frame->stack_size =
+        base + (size_t) v7_to_number(v7_array_get(v7, frames, i + 1));
+    cnt = (size_t) v7_to_number(v7_array_get(v7, frames, i + 2));
+    for (i += 3, k = 0; k < cnt; k++, i += 2) {
+      int64_t item = (int64_t) v7_to_number(v7_array_get(v7, frames, i));
+      size_t len =
+          base + (size_t) v7_to_number(v7_array_get(v7, frames, i + 1));
+      if (frame->blocks_cnt == frame->blocks_size) {
+        call_frame_grow_blocks(frame);
+      }
+      frame->blocks[frame->blocks_cnt++] = LBLOCK_ITEM_CREATE(0, item, len);
+    }
+  }
+  v7->vals.scope = v7_array_get(v7, gen, GEN_SCOPE);
+
+  n = v7_array_length(v7, stack);
+  mbuf_append(&v7->stack, NULL, n * sizeof(val_t));
+  for (i = 0; i < n; i++) {
+    ((val_t *) (v7->stack.buf + base))[i] = v7_array_get(v7, stack, i);
+  }
+  bcode_reserve_stack(v7, r->bcode);
+
+  r->slots_base =
+      base + (size_t) v7_to_number(v7_array_get(v7, gen, GEN_SLOTS));
+  r->ops = r->bcode->ops.p + (size_t) v7_to_number(
+                                 v7_array_get(v7, gen, GEN_OPS));
+  r->need_inc_ops = 0;
+
+  gen_set_state(v7, gen, GEN_STATE_RUNNING);
+  return state;
+}
+
+static void own_bcode(struct v7 *v7, struct bcode *p) {
+  mbuf_append(&v7->act_bcodes, &p, sizeof(p));
+}
+
+static void disown_bcode(struct v7 *v7, struct bcode *p) {
+#ifndef NDEBUG
+  struct bcode **vp =
+      (struct bcode **) (v7->act_bcodes.buf + v7->act_bcodes.len - sizeof(p));
+
+  /* given `p` should be the last item */
+  assert(*vp == p);
+#endif
+  v7->act_bcodes.len -= sizeof(p);
+}
+
+#ifdef V7_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err eval_bcode(struct v7 *v7, struct bcode *bcode) {
+  struct bcode_registers r;
+  enum v7_err rcode = V7_OK;
+  enum opcode op;
+
+#ifdef V7_THREADED_DISPATCH
+  /* Opcodes without a label of their own go through the `switch` */
+  static const void *const dispatch_table[OP_MAX] = {
+      [OP_DROP] = &&lbl_OP_DROP,
+      [OP_DUP] = &&lbl_OP_DUP,
+      [OP_2DUP] = &&lbl_OP_2DUP,
+      [OP_SWAP] = &&lbl_OP_SWAP,
+      [OP_STASH] = &&lbl_OP_STASH,
+      [OP_UNSTASH] = &&lbl_OP_UNSTASH,
+      [OP_SWAP_DROP] = &&lbl_OP_SWAP_DROP,
+      [OP_PUSH_UNDEFINED] = &&lbl_OP_PUSH_UNDEFINED,
+      [OP_PUSH_NULL] = &&lbl_OP_PUSH_NULL,
+      [OP_PUSH_THIS] = &&lbl_OP_PUSH_THIS,
+      [OP_PUSH_TRUE] = &&lbl_OP_PUSH_TRUE,
+      [OP_PUSH_FALSE] = &&lbl_OP_PUSH_FALSE,
+      [OP_PUSH_ZERO] = &&lbl_OP_PUSH_ZERO,
+      [OP_PUSH_ONE] = &&lbl_OP_PUSH_ONE,
+      [OP_PUSH_LIT] = &&lbl_OP_PUSH_LIT,
+      [OP_NOT] = &&lbl_OP_NOT,
+      [OP_LOGICAL_NOT] = &&lbl_OP_LOGICAL_NOT,
+      [OP_NEG] = &&lbl_OP_NEG,
+      [OP_POS] = &&lbl_OP_POS,
+      [OP_ADD] = &&lbl_OP_ADD,
+      [OP_SUB] = &&lbl_OP_SUB,
+      [OP_REM] = &&lbl_OP_REM,
+      [OP_MUL] = &&lbl_OP_MUL,
+      [OP_DIV] = &&lbl_OP_DIV,
+      [OP_LSHIFT] = &&lbl_OP_LSHIFT,
+      [OP_RSHIFT] = &&lbl_OP_RSHIFT,
+      [OP_URSHIFT] = &&lbl_OP_URSHIFT,
+      [OP_OR] = &&lbl_OP_OR,
+      [OP_XOR] = &&lbl_OP_XOR,
+      [OP_AND] = &&lbl_OP_AND,
+      [OP_EQ_EQ] = &&lbl_OP_EQ_EQ,
+      [OP_EQ] = &&lbl_OP_EQ,
+      [OP_NE] = &&lbl_OP_NE,
+      [OP_NE_NE] = &&lbl_OP_NE_NE,
+      [OP_LT] = &&lbl_OP_LT,
+      [OP_LE] = &&lbl_OP_LE,
+      [OP_GT] = &&lbl_OP_GT,
+      [OP_GE] = &&lbl_OP_GE,
+      [OP_INSTANCEOF] = &&op_switch,
+      [OP_TYPEOF] = &&op_switch,
+      [OP_IN] = &&op_switch,
+      [OP_GET] = &&lbl_OP_GET,
+      [OP_SET] = &&lbl_OP_SET,
+      [OP_SET_VAR] = &&lbl_OP_SET_VAR,
+      [OP_GET_VAR] = &&lbl_OP_GET_VAR,
+      [OP_SAFE_GET_VAR] = &&lbl_OP_SAFE_GET_VAR,
+      [OP_JMP] = &&lbl_OP_JMP,
+      [OP_JMP_TRUE] = &&lbl_OP_JMP_TRUE,
+      [OP_JMP_FALSE] = &&lbl_OP_JMP_FALSE,
+      [OP_JMP_TRUE_DROP] = &&lbl_OP_JMP_TRUE_DROP,
+      [OP_JMP_IF_CONTINUE] = &&lbl_OP_JMP_IF_CONTINUE,
+      [OP_CREATE_OBJ] = &&lbl_OP_CREATE_OBJ,
+      [OP_CREATE_ARR] = &&lbl_OP_CREATE_ARR,
+      [OP_NEXT_PROP] = &&op_switch,
+      [OP_FUNC_LIT] = &&op_switch,
+      [OP_CALL] = &&op_switch,
+      [OP_NEW] = &&op_switch,
+      [OP_RET] = &&op_switch,
+      [OP_DELETE] = &&op_switch,
+      [OP_DELETE_VAR] = &&op_switch,
+      [OP_TRY_PUSH_CATCH] = &&op_switch,
+      [OP_TRY_PUSH_FINALLY] = &&op_switch,
+      [OP_TRY_PUSH_LOOP] = &&op_switch,
+      [OP_TRY_PUSH_SWITCH] = &&op_switch,
+      [OP_TRY_POP] = &&op_switch,
+      [OP_AFTER_FINALLY] = &&op_switch,
+      [OP_THROW] = &&op_switch,
+      [OP_BREAK] = &&op_switch,
+      [OP_CONTINUE] = &&op_switch,
+      [OP_ENTER_CATCH] = &&op_switch,
+      [OP_EXIT_CATCH] = &&op_switch,
+      [OP_FRAME_SLOTS] = &&op_switch,
+      [OP_GET_LOCAL] = &&lbl_OP_GET_LOCAL,
+      [OP_SET_LOCAL] = &&lbl_OP_SET_LOCAL,
+      [OP_GET_PROP] = &&lbl_OP_GET_PROP,
+      [OP_SET_LOCAL_DROP] = &&lbl_OP_SET_LOCAL_DROP,
+      [OP_INC_VAR] = &&lbl_OP_INC_VAR,
+      [OP_DEC_VAR] = &&lbl_OP_DEC_VAR,
+      [OP_INC_LOCAL] = &&lbl_OP_INC_LOCAL,
+      [OP_DEC_LOCAL] = &&lbl_OP_DEC_LOCAL,
+      [OP_JMP_LT] = &&lbl_OP_JMP_LT,
+      [OP_JMP_LE] = &&lbl_OP_JMP_LE,
+      [OP_JMP_GT] = &&lbl_OP_JMP_GT,
+      [OP_JMP_GE] = &&lbl_OP_JMP_GE,
+      [OP_SWITCH_NUM] = &&lbl_OP_SWITCH_NUM,
+      [OP_SWITCH_STR] = &&lbl_OP_SWITCH_STR,
+      [OP_GEN_START] = &&op_switch,
+      [OP_YIELD] = &&op_switch,
+      [OP_RESUME] = &&op_switch,
+  };
+#endif
+
+  /*
+   * Dummy variable just to enforce that `BTRY()` macro is used only inside the
+   * `eval_bcode()` function
+   */
+  uint8_t _you_should_use_BTRY_in_eval_bcode_only = 0;
+
+  char buf[512];
+
+  val_t res = v7_mk_undefined(), v1 = v7_mk_undefined(), v2 = v7_mk_undefined(),
+        v3 = v7_mk_undefined(), v4 = v7_mk_undefined(),
+        scope_frame = v7_mk_undefined();
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+
+  bcode_restore_registers(v7, bcode, &r);
+  r.slots_base = 0;
+  bcode_reserve_stack(v7, bcode);
+  BJIT_HOT(bcode);
+
+  tmp_stack_push(&tf, &res);
+  tmp_stack_push(&tf, &v1);
+  tmp_stack_push(&tf, &v2);
+  tmp_stack_push(&tf, &v3);
+  tmp_stack_push(&tf, &v4);
+  tmp_stack_push(&tf, &scope_frame);
+
+  /*
+   * populate local variables on current scope, making them undeletable
+   * (since they're defined with `var`)
+   */
+  {
+    size_t i;
+    for (i = 0; i < bcode->names_cnt; ++i) {
+      r.ops = bcode_next_name_v(v7, bcode, i, r.ops, &v1);
+
+      /* set undeletable property on current scope */
+      V7_TRY(def_property_v(v7, v7->vals.scope, v1, V7_DESC_CONFIGURABLE(0),
+                            v7_mk_undefined(), 1 /*as_assign*/, NULL));
+    }
+  }
+
+restart:
+  BSAFEPOINT();
+  while (r.ops < r.end && rcode == V7_OK) {
+#ifdef V7_ENABLE_JIT
+    if (BJIT_ENTRY()) {
+      r.ops = r.bcode->ops.p + jit_run(v7, r.bcode, r.ops - r.bcode->ops.p,
+                                       r.slots_base);
+      r.jit_skip = r.ops;
+      continue;
+    }
+#endif
+    op = (enum opcode) * r.ops;
+
+    r.need_inc_ops = 1;
+#ifdef V7_BCODE_TRACE
+    {
+      char *dops = r.ops;
+      fprintf(stderr, "eval ");
+      dump_op(v7, stderr, r.bcode, &dops);
+    }
+#endif
+
+#ifdef V7_THREADED_DISPATCH
+  op_switch:
+#endif
+    switch (op) {
+      BCASE(OP_DROP):
+        POP();
+        BNEXT();
+      BCASE(OP_DUP):
+        v1 = POP();
+        PUSH(v1);
+        PUSH(v1);
+        BNEXT();
+      BCASE(OP_2DUP):
+        v2 = POP();
+        v1 = POP();
+        PUSH(v1);
+        PUSH(v2);
+        PUSH(v1);
+        PUSH(v2);
+        BNEXT();
+      BCASE(OP_SWAP):
+        v1 = POP();
+        v2 = POP();
+        PUSH(v1);
+        PUSH(v2);
+        BNEXT();
+      BCASE(OP_STASH):
+        assert(!v7->is_stashed);
+        v7->vals.stash = TOS();
+        v7->is_stashed = 1;
+        BNEXT();
+      BCASE(OP_UNSTASH):
+        assert(v7->is_stashed);
+        POP();
+        PUSH(v7->vals.stash);
+        v7->vals.stash = v7_mk_undefined();
+        v7->is_stashed = 0;
+        BNEXT();
+
+      BCASE(OP_SWAP_DROP):
+        v1 = POP();
+        POP();
+        PUSH(v1);
+        BNEXT();
+
+      BCASE(OP_PUSH_UNDEFINED):
+        PUSH(v7_mk_undefined());
+        BNEXT();
+      BCASE(OP_PUSH_NULL):
+        PUSH(v7_mk_null());
+        BNEXT();
+      BCASE(OP_PUSH_THIS):
+        PUSH(v7_get_this(v7));
+        BNEXT();
+      BCASE(OP_PUSH_TRUE):
+        PUSH(v7_mk_boolean(1));
+        BNEXT();
+      BCASE(OP_PUSH_FALSE):
+        PUSH(v7_mk_boolean(0));
+        BNEXT();
+      BCASE(OP_PUSH_ZERO):
+        PUSH(v7_mk_number(0));
+        BNEXT();
+      BCASE(OP_PUSH_ONE):
+        PUSH(v7_mk_number(1));
+        BNEXT();
+      BCASE(OP_PUSH_LIT): {
+        PUSH(bcode_decode_lit(v7, r.bcode, &r.ops));
+        BNEXT();
+      }
+      BCASE(OP_LOGICAL_NOT):
+        v1 = POP();
+        PUSH(v7_mk_boolean(!v7_is_truthy(v7, v1)));
+        BNEXT();
+      BCASE(OP_NOT): {
+        v1 = POP();
+        BTRY(to_number_v(v7, v1, &v1));
+        PUSH(v7_mk_number(~(int32_t) v7_to_number(v1)));
+        BNEXT();
+      }
+      BCASE(OP_NEG): {
+        v1 = POP();
+        BTRY(to_number_v(v7, v1, &v1));
+        PUSH(v7_mk_number(-v7_to_number(v1)));
+        BNEXT();
+      }
+      BCASE(OP_POS): {
+        v1 = POP();
+        BTRY(to_number_v(v7, v1, &v1));
+        PUSH(v1);
+        BNEXT();
+      }
+      BCASE(OP_ADD): {
+        v2 = POP();
+        v1 = POP();
+
+        if (v7_is_number(v1) && v7_is_number(v2)) {
+          PUSH(v7_mk_number(v7_to_number(v1) + v7_to_number(v2)));
+          BNEXT();
+        }
+
+        /*
+         * If either operand is an object, convert both of them to primitives
+         */
+        if (v7_is_object(v1) || v7_is_object(v2)) {
+          BTRY(to_primitive(v7, v1, V7_TO_PRIMITIVE_HINT_AUTO, &v1));
+          BTRY(to_primitive(v7, v2, V7_TO_PRIMITIVE_HINT_AUTO, &v2));
+        }
+
+        if (v7_is_string(v1) || v7_is_string(v2)) {
+          /* Convert both operands to strings, and concatenate */
+
+          BTRY(primitive_to_str(v7, v1, &v1, NULL, 0, NULL));
+          BTRY(primitive_to_str(v7, v2, &v2, NULL, 0, NULL));
+
+          PUSH(s_concat(v7, v1, v2));
+        } else {
+          /* Convert both operands to numbers, and sum */
+
+          BTRY(primitive_to_number(v7, v1, &v1));
+          BTRY(primitive_to_number(v7, v2, &v2));
+
+          PUSH(v7_mk_number(
+              b_num_bin_op(op, v7_to_number(v1), v7_to_number(v2))));
+        }
+        BNEXT();
+      }
+      BCASE(OP_SUB): {
+        v2 = POP();
+        v1 = POP();
+        if (v7_is_number(v1) && v7_is_number(v2)) {
+          PUSH(v7_mk_number(v7_to_number(v1) - v7_to_number(v2)));
+          BNEXT();
+        }
+        goto num_bin_op;
+      }
+      BCASE(OP_MUL): {
+        v2 = POP();
+        v1 = POP();
+        if (v7_is_number(v1) && v7_is_number(v2)) {
+          PUSH(v7_mk_number(v7_to_number(v1) * v7_to_number(v2)));
+          BNEXT();
+        }
+        goto num_bin_op;
+      }
+      BCASE(OP_REM):
+      BCASE(OP_DIV):
+      BCASE(OP_LSHIFT):
+      BCASE(OP_RSHIFT):
+      BCASE(OP_URSHIFT):
+      BCASE(OP_OR):
+      BCASE(OP_XOR):
+      BCASE(OP_AND): {
+        v2 = POP();
+        v1 = POP();
+
+      num_bin_op:
+        if (!v7_is_number(v1) || !v7_is_number(v2)) {
+          BTRY(to_number_v(v7, v1, &v1));
+          BTRY(to_number_v(v7, v2, &v2));
+        }
+
+        PUSH(
+            v7_mk_number(b_num_bin_op(op, v7_to_number(v1), v7_to_number(v2))));
+        BNEXT();
+      }
+      BCASE(OP_EQ_EQ): {
+        v2 = POP();
+        v1 = POP();
+        if (v7_is_string(v1) && v7_is_string(v2)) {
+          res = v7_mk_boolean(s_cmp(v7, v1, v2) == 0);
+        } else if (v1 == v2 && v1 == V7_TAG_NAN) {
+          res = v7_mk_boolean(0);
+        } else {
+          res = v7_mk_boolean(v1 == v2);
+        }
+        PUSH(res);
+        BNEXT();
+      }
+      BCASE(OP_NE_NE): {
+        v2 = POP();
+        v1 = POP();
+        if (v7_is_string(v1) && v7_is_string(v2)) {
+          res = v7_mk_boolean(s_cmp(v7, v1, v2) != 0);
+        } else if (v1 == v2 && v1 == V7_TAG_NAN) {
+          res = v7_mk_boolean(1);
+        } else {
+          res = v7_mk_boolean(v1 != v2);
+        }
+        PUSH(res);
+        BNEXT();
+      }
+      BCASE(OP_EQ):
+      BCASE(OP_NE): {
+        v2 = POP();
+        v1 = POP();
+        /*
+         * TODO(dfrank) : it's not really correct. Fix it accordingly to
+         * the p. 4.9 of The Definitive Guide (page 71)
+         */
+        if (((v7_is_object(v1) || v7_is_object(v2)) && v1 == v2)) {
+          res = v7_mk_boolean(op == OP_EQ);
+          PUSH(res);
           break;
         } else if (v7_is_undefined(v1) || v7_is_null(v1)) {
           res = v7_mk_boolean((op != OP_EQ) ^
@@ -12678,962 +15174,2180 @@ restart:
           res = v7_mk_boolean(
               b_bool_bin_op(op, v7_to_number(v1), v7_to_number(v2)));
         }
-        PUSH(res);
-        break;
+        PUSH(res);
+        BNEXT();
+      }
+      BCASE(OP_LT):
+      BCASE(OP_LE):
+      BCASE(OP_GT):
+      BCASE(OP_GE): {
+        int cmp;
+        v2 = POP();
+        v1 = POP();
+        if (v7_is_number(v1) && v7_is_number(v2)) {
+          cmp = b_bool_bin_op(op, v7_to_number(v1), v7_to_number(v2));
+        } else {
+          BTRY(b_relational_op(v7, op, v1, v2, &cmp));
+        }
+        PUSH(v7_mk_boolean(cmp));
+        BNEXT();
+      }
+      case OP_INSTANCEOF: {
+        v2 = POP();
+        v1 = POP();
+        if (!v7_is_callable(v7, v2)) {
+          BTRY(v7_throwf(v7, TYPE_ERROR,
+                         "Expecting a function in instanceof check"));
+          goto op_done;
+        } else {
+          PUSH(v7_mk_boolean(
+              is_prototype_of(v7, v1, v7_get(v7, v2, "prototype", 9))));
+        }
+        break;
+      }
+      case OP_TYPEOF:
+        v1 = POP();
+        switch (val_type(v7, v1)) {
+          case V7_TYPE_NUMBER:
+            res = v7_mk_string(v7, "number", 6, 1);
+            break;
+          case V7_TYPE_STRING:
+            res = v7_mk_string(v7, "string", 6, 1);
+            break;
+          case V7_TYPE_BOOLEAN:
+            res = v7_mk_string(v7, "boolean", 7, 1);
+            break;
+          case V7_TYPE_FUNCTION_OBJECT:
+          case V7_TYPE_CFUNCTION_OBJECT:
+          case V7_TYPE_CFUNCTION:
+            res = v7_mk_string(v7, "function", 8, 1);
+            break;
+          case V7_TYPE_UNDEFINED:
+            res = v7_mk_string(v7, "undefined", 9, 1);
+            break;
+          default:
+            res = v7_mk_string(v7, "object", 6, 1);
+            break;
+        }
+        PUSH(res);
+        break;
+      case OP_IN: {
+        struct v7_property *prop = NULL;
+        v2 = POP();
+        v1 = POP();
+        BTRY(to_string(v7, v1, NULL, buf, sizeof(buf), NULL));
+        prop = v7_get_property(v7, v2, buf, -1);
+        PUSH(v7_mk_boolean(prop != NULL));
+      } break;
+      BCASE(OP_GET): {
+        struct bcode_ic *ic;
+        struct v7_property *p;
+        v2 = POP();
+        v1 = POP();
+        if (dense_array_get_v(v7, v1, v2, &v3)) {
+          /* an element of a dense array */
+          PUSH(v3);
+          BNEXT();
+        }
+        v3 = bcode_ic_obj(v7, v1);
+        if (!v7_is_undefined(v3) &&
+            (ic = bcode_get_ic(r.bcode, r.ops)) != NULL &&
+            bcode_ic_lookup(v7, ic, v3, v2, &p)) {
+          BTRY(v7_property_value(v7, v1, p, &v3));
+        } else {
+          BTRY(v7_get_throwing_v(v7, v1, v2, &v3));
+        }
+        PUSH(v3);
+        BNEXT();
+      }
+      BCASE(OP_GET_PROP): {
+        /* see `OP_GET` */
+        const char *insn = r.ops;
+        struct bcode_ic *ic;
+        struct v7_property *p;
+        v2 = bcode_decode_lit(v7, r.bcode, &r.ops);
+        v1 = POP();
+        v3 = bcode_ic_obj(v7, v1);
+        if (!v7_is_undefined(v3) &&
+            (ic = bcode_get_ic(r.bcode, insn)) != NULL &&
+            bcode_ic_lookup(v7, ic, v3, v2, &p)) {
+          BTRY(v7_property_value(v7, v1, p, &v3));
+        } else {
+          BTRY(v7_get_throwing_v(v7, v1, v2, &v3));
+        }
+        PUSH(v3);
+        BNEXT();
+      }
+      BCASE(OP_SET): {
+        struct bcode_ic *ic = NULL;
+        struct v7_property *p = NULL;
+        uint32_t epoch = v7->prop_epoch;
+        v3 = POP();
+        v2 = POP();
+        v1 = POP();
+
+        if (dense_array_set_v(v7, v1, v2, v3)) {
+          /* an element of a dense array, see `dense_array_put()` */
+        } else if (v7_is_object(v1) &&
+                   (ic = bcode_get_ic(r.bcode, r.ops)) != NULL &&
+                   bcode_ic_hit(v7, ic, v1, v2, &p) &&
+                   !(p->attributes & (V7_PROPERTY_NON_WRITABLE |
+                                      V7_PROPERTY_GETTER |
+                                      V7_PROPERTY_SETTER))) {
+          /* own data property, see `def_property_v()` */
+          p->value = v3;
+        } else {
+          /* convert name to string, if it's not already */
+          BTRY(to_string(v7, v2, &v2, NULL, 0, NULL));
+
+          /* set value */
+          BTRY(set_property_v(v7, v1, v2, v3, &p));
+
+          if (ic != NULL) {
+            bcode_ic_fill(v7, ic, epoch, v1, v2, p);
+          }
+        }
+
+        PUSH(v3);
+        BNEXT();
+      }
+      BCASE(OP_GET_VAR):
+      BCASE(OP_SAFE_GET_VAR): {
+        struct bcode_ic *ic = bcode_get_ic(r.bcode, r.ops);
+        struct v7_property *p = NULL;
+        assert(r.ops < r.end - 1);
+        v1 = bcode_decode_lit(v7, r.bcode, &r.ops);
+        if (ic == NULL ||
+            !bcode_ic_lookup(v7, ic, v7->vals.scope, v1, &p)) {
+          BTRY(v7_get_property_v(v7, v7->vals.scope, v1, &p));
+        }
+        if (p == NULL) {
+          if (op == OP_SAFE_GET_VAR) {
+            PUSH(v7_mk_undefined());
+          } else {
+            /* variable does not exist: Reference Error */
+            V7_TRY(bcode_throw_reference_error(v7, &r, v1));
+            goto op_done;
+          }
+          break;
+        } else {
+          BTRY(v7_property_value(v7, v7->vals.scope, p, &v2));
+          PUSH(v2);
+        }
+        BNEXT();
+      }
+      BCASE(OP_SET_VAR): {
+        int found;
+        v3 = POP();
+        v2 = bcode_decode_lit(v7, r.bcode, &r.ops);
+
+        BTRY(bcode_set_var(v7, r.bcode, v2, v3, &found));
+        if (!found) {
+          V7_TRY(bcode_throw_reference_error(v7, &r, v2));
+          goto op_done;
+        }
+        PUSH(v3);
+        BNEXT();
+      }
+      BCASE(OP_INC_VAR):
+      BCASE(OP_DEC_VAR): {
+        struct bcode_ic *ic = bcode_get_ic(r.bcode, r.ops);
+        struct v7_property *p = NULL;
+        int found;
+        v1 = bcode_decode_lit(v7, r.bcode, &r.ops);
+        if (ic == NULL ||
+            !bcode_ic_lookup(v7, ic, v7->vals.scope, v1, &p)) {
+          BTRY(v7_get_property_v(v7, v7->vals.scope, v1, &p));
+        }
+        if (p == NULL) {
+          V7_TRY(bcode_throw_reference_error(v7, &r, v1));
+          goto op_done;
+        }
+        BTRY(v7_property_value(v7, v7->vals.scope, p, &v2));
+        if (v7_is_number(v2)) {
+          v3 = v7_mk_number(v7_to_number(v2) + (op == OP_INC_VAR ? 1 : -1));
+          if (!(p->attributes & V7_PROPERTY_NON_WRITABLE)) {
+            p->value = v3;
+          }
+        } else {
+          /* the conversion may run JS code, which may drop the variable */
+          BTRY(to_number_v(v7, v2, &v2));
+          v3 = v7_mk_number(v7_to_number(v2) + (op == OP_INC_VAR ? 1 : -1));
+          BTRY(bcode_set_var(v7, r.bcode, v1, v3, &found));
+          if (!found) {
+            V7_TRY(bcode_throw_reference_error(v7, &r, v1));
+            goto op_done;
+          }
+        }
+        PUSH(v2);
+        BNEXT();
+      }
+      BCASE(OP_GET_LOCAL): {
+        size_t slot = bcode_get_varint(&r.ops);
+        v1 = SLOT(slot);
+        PUSH(v1);
+        BNEXT();
+      }
+      BCASE(OP_SET_LOCAL): {
+        size_t slot = bcode_get_varint(&r.ops);
+        SLOT(slot) = TOS();
+        BNEXT();
+      }
+      BCASE(OP_SET_LOCAL_DROP): {
+        size_t slot = bcode_get_varint(&r.ops);
+        SLOT(slot) = POP();
+        BNEXT();
+      }
+      BCASE(OP_INC_LOCAL):
+      BCASE(OP_DEC_LOCAL): {
+        size_t slot = bcode_get_varint(&r.ops);
+        v1 = SLOT(slot);
+        if (!v7_is_number(v1)) {
+          BTRY(to_number_v(v7, v1, &v1));
+        }
+        SLOT(slot) =
+            v7_mk_number(v7_to_number(v1) + (op == OP_INC_LOCAL ? 1 : -1));
+        PUSH(v1);
+        BNEXT();
+      }
+      case OP_FRAME_SLOTS: {
+        size_t i;
+        bcode_get_varint(&r.ops);
+        for (i = 1; i < r.bcode->names_cnt; i++) {
+          bcode_get_varint(&r.ops);
+        }
+        break;
+      }
+      BCASE(OP_JMP): {
+        bcode_off_t target = bcode_get_target(&r.ops);
+        BSAFEPOINT_IF_BACKWARD(target);
+        r.ops = r.bcode->ops.p + target - 1;
+        BNEXT();
+      }
+      BCASE(OP_JMP_FALSE): {
+        bcode_off_t target = bcode_get_target(&r.ops);
+        BSAFEPOINT_IF_BACKWARD(target);
+        v1 = POP();
+        if (!v7_is_truthy(v7, v1)) {
+          r.ops = r.bcode->ops.p + target - 1;
+        }
+        BNEXT();
+      }
+      BCASE(OP_JMP_TRUE): {
+        bcode_off_t target = bcode_get_target(&r.ops);
+        BSAFEPOINT_IF_BACKWARD(target);
+        v1 = POP();
+        if (v7_is_truthy(v7, v1)) {
+          r.ops = r.bcode->ops.p + target - 1;
+        }
+        BNEXT();
+      }
+      BCASE(OP_JMP_TRUE_DROP): {
+        bcode_off_t target = bcode_get_target(&r.ops);
+        BSAFEPOINT_IF_BACKWARD(target);
+        v1 = POP();
+        if (v7_is_truthy(v7, v1)) {
+          r.ops = r.bcode->ops.p + target - 1;
+          v1 = POP();
+          POP();
+          PUSH(v1);
+        }
+        BNEXT();
+      }
+      BCMP_JMP(OP_JMP_LT, OP_LT)
+      BCMP_JMP(OP_JMP_LE, OP_LE)
+      BCMP_JMP(OP_JMP_GT, OP_GT)
+      BCMP_JMP(OP_JMP_GE, OP_GE)
+      BCASE(OP_JMP_IF_CONTINUE): {
+        bcode_off_t target = bcode_get_target(&r.ops);
+        BSAFEPOINT_IF_BACKWARD(target);
+        if (v7->is_continuing) {
+          r.ops = r.bcode->ops.p + target - 1;
+        }
+        v7->is_continuing = 0;
+        BNEXT();
+      }
+      BCASE(OP_SWITCH_NUM):
+      BCASE(OP_SWITCH_STR): {
+        /* the targets are forward: no safepoint */
+        bcode_off_t target = bcode_switch_target(v7, r.ops, TOS());
+        if (target != 0) {
+          POP();
+          r.ops = r.bcode->ops.p + target - 1;
+        } else {
+          r.ops = (char *) bcode_next_op(r.bcode, r.ops) - 1;
+        }
+        BNEXT();
       }
-      case OP_LT:
-      case OP_LE:
-      case OP_GT:
-      case OP_GE: {
-        v2 = POP();
-        v1 = POP();
-        BTRY(to_primitive(v7, v1, V7_TO_PRIMITIVE_HINT_NUMBER, &v1));
-        BTRY(to_primitive(v7, v2, V7_TO_PRIMITIVE_HINT_NUMBER, &v2));
+      BCASE(OP_CREATE_OBJ):
+        PUSH(v7_mk_object(v7));
+        BNEXT();
+      BCASE(OP_CREATE_ARR):
+        PUSH(v7_mk_array(v7));
+        BNEXT();
+      case OP_NEXT_PROP: {
+        void *h = NULL;
+        v1 = POP(); /* handle */
+        v2 = POP(); /* object */
 
-        if (v7_is_string(v1) && v7_is_string(v2)) {
-          int cmp = s_cmp(v7, v1, v2);
-          switch (op) {
-            case OP_LT:
-              res = v7_mk_boolean(cmp < 0);
-              break;
-            case OP_LE:
-              res = v7_mk_boolean(cmp <= 0);
-              break;
-            case OP_GT:
-              res = v7_mk_boolean(cmp > 0);
-              break;
-            case OP_GE:
-              res = v7_mk_boolean(cmp >= 0);
-              break;
-            default:
-              /* should never be here */
-              assert(0);
-          }
-        } else {
-          /* Convert both operands to numbers */
+        if (!v7_is_null(v1)) {
+          h = v7_to_foreign(v1);
+        }
 
-          BTRY(to_number_v(v7, v1, &v1));
-          BTRY(to_number_v(v7, v2, &v2));
+        if (v7_is_object(v2)) {
+          v7_prop_attr_t attrs;
+          do {
+            /* iterate properties until we find a non-hidden enumerable one */
+            do {
+              h = obj_next_prop(v7, h, v2, &res, NULL, &attrs);
+            } while (h != NULL && (attrs & (_V7_PROPERTY_HIDDEN |
+                                            V7_PROPERTY_NON_ENUMERABLE)));
 
-          res = v7_mk_boolean(
-              b_bool_bin_op(op, v7_to_number(v1), v7_to_number(v2)));
+            if (h == NULL) {
+              /* no more properties in this object: proceed to the prototype */
+              v2 = obj_prototype_v(v7, v2);
+            }
+          } while (h == NULL && v7_to_generic_object(v2) != NULL);
         }
-        PUSH(res);
-        break;
-      }
-      case OP_INSTANCEOF: {
-        v2 = POP();
-        v1 = POP();
-        if (!v7_is_callable(v7, v2)) {
-          BTRY(v7_throwf(v7, TYPE_ERROR,
-                         "Expecting a function in instanceof check"));
-          goto op_done;
+
+        if (h == NULL) {
+          PUSH(v7_mk_boolean(0));
         } else {
-          PUSH(v7_mk_boolean(
-              is_prototype_of(v7, v1, v7_get(v7, v2, "prototype", 9))));
+          PUSH(v2);
+          PUSH(v7_mk_foreign(h));
+          PUSH(res);
+          PUSH(v7_mk_boolean(1));
         }
         break;
       }
-      case OP_TYPEOF:
-        v1 = POP();
-        switch (val_type(v7, v1)) {
-          case V7_TYPE_NUMBER:
-            res = v7_mk_string(v7, "number", 6, 1);
-            break;
-          case V7_TYPE_STRING:
-            res = v7_mk_string(v7, "string", 6, 1);
-            break;
-          case V7_TYPE_BOOLEAN:
-            res = v7_mk_string(v7, "boolean", 7, 1);
-            break;
-          case V7_TYPE_FUNCTION_OBJECT:
-          case V7_TYPE_CFUNCTION_OBJECT:
-          case V7_TYPE_CFUNCTION:
-            res = v7_mk_string(v7, "function", 8, 1);
-            break;
-          case V7_TYPE_UNDEFINED:
-            res = v7_mk_string(v7, "undefined", 9, 1);
-            break;
-          default:
-            res = v7_mk_string(v7, "object", 6, 1);
-            break;
-        }
-        PUSH(res);
-        break;
-      case OP_IN: {
-        struct v7_property *prop = NULL;
-        v2 = POP();
-        v1 = POP();
-        BTRY(to_string(v7, v1, NULL, buf, sizeof(buf), NULL));
-        prop = v7_get_property(v7, v2, buf, -1);
-        PUSH(v7_mk_boolean(prop != NULL));
-      } break;
-      case OP_GET:
-        v2 = POP();
+      case OP_FUNC_LIT: {
         v1 = POP();
-        BTRY(v7_get_throwing_v(v7, v1, v2, &v3));
-        PUSH(v3);
+        v2 = bcode_instantiate_function(v7, v1);
+        PUSH(v2);
         break;
-      case OP_SET: {
-        v3 = POP();
-        v2 = POP();
-        v1 = POP();
+      }
+      case OP_CALL:
+      case OP_NEW: {
+        /* Naive implementation pending stack frame redesign */
+        int args;
+        uint8_t is_constructor = (op == OP_NEW);
+
+        BSAFEPOINT();
+        args = (int) *(++r.ops);
+
+        if (SP() < (args + 1 /*func*/ + 1 /*this*/)) {
+          BTRY(v7_throwf(v7, INTERNAL_ERROR, "stack underflow"));
+          goto op_done;
+          break;
+        } else {
+          /*
+           * The function and `this` are below the arguments. They all stay on
+           * the stack until we know what to call: C functions take the
+           * arguments right from there.
+           */
+          v1 = ((val_t *) (v7->stack.buf + v7->stack.len))[-args - 1];
+          v3 = ((val_t *) (v7->stack.buf + v7->stack.len))[-args - 2];
+
+          /*
+           * adjust `this` if the function is called with the constructor
+           * invocation pattern
+           */
+          if (is_constructor) {
+            /*
+             * The function is invoked as a constructor: we ignore `this`
+             * value popped from stack, create new object and set prototype.
+             */
+
+            /*
+             * get "prototype" property from the constructor function,
+             * and make sure it's an object
+             */
+            v4 = v7_get(v7, v1 /*func*/, "prototype", 9);
+            if (!v7_is_object(v4)) {
+              /* TODO(dfrank): box primitive value */
+              BTRY(v7_throwf(
+                  v7, TYPE_ERROR,
+                  "Cannot set a primitive value as object prototype"));
+              goto op_done;
+            } else if (is_cfunction_lite(v4)) {
+              /*
+               * TODO(dfrank): maybe add support for a cfunction pointer to be
+               * a prototype
+               */
+              BTRY(v7_throwf(v7, TYPE_ERROR,
+                             "Not implemented: cfunction as a prototype"));
+              goto op_done;
+            }
+
+            /* create an object with given prototype */
+            v3 = mk_object(v7, v4 /*prototype*/);
+            v4 = v7_mk_undefined();
+          }
+
+          if (!v7_is_callable(v7, v1)) {
+            /* tried to call non-function object: throw a TypeError */
+
+            /*
+             * TODO(dfrank): include reasonable name of an object to the error
+             * message. Currently, we have just a value on stack, not the name
+             * of it, so, if we have the code like:
+             *
+             *      var foo = 1;
+             *      foo();
+             *
+             * We have `1` here, but not `"foo"`.
+             */
+            BTRY(v7_throwf(v7, TYPE_ERROR, "value is not a function"));
+            goto op_done;
+          } else if (is_cfunction_lite(v1) || is_cfunction_obj(v7, v1)) {
+            /* call cfunction */
+
+            /*
+             * In "function invocation pattern", the `this` value popped from
+             * stack is an `undefined`. And in non-strict mode, we should change
+             * it to global object.
+             */
+            if (!is_constructor && !r.bcode->strict_mode &&
+                v7_is_undefined(v3)) {
+              v3 = v7->vals.global_object;
+            }
+
+            BTRY(call_cfunction(v7, v1 /*func*/, v3 /*this*/,
+                                V7_TAG_NOVALUE /*args on stack*/, args,
+                                is_constructor, &v4));
+
+            /* drop the arguments, the function and `this` */
+            v7->stack.len -= (args + 2) * sizeof(val_t);
+
+            /* push value returned from C function to bcode stack */
+            PUSH(v4);
+
+          } else {
+            char *ops, *slot_map, *slot_p;
+            size_t slots_cnt = 0, frame_stack_len, argv_off;
+            struct v7_js_function *func = to_js_function(v1);
+
+            /*
+             * In "function invocation pattern", the `this` value popped from
+             * stack is an `undefined`. And in non-strict mode, we should change
+             * it to global object.
+             */
+            if (!is_constructor && !func->bcode->strict_mode &&
+                v7_is_undefined(v3)) {
+              v3 = v7->vals.global_object;
+            }
+
+            /*
+             * The arguments, the function and `this` stay on the stack, out
+             * of the GC's way, until the call is set up: then the new frame
+             * drops them along with the rest of its data stack.
+             */
+            frame_stack_len = v7->stack.len - (args + 2) * sizeof(val_t);
+            argv_off = v7->stack.len - args * sizeof(val_t);
+
+            v2 = v7_mk_undefined();
+            if (!func->bcode->no_arguments) {
+              int i;
+              v2 = v7_mk_dense_array(v7);
+              for (i = 0; i < args; i++) {
+                BTRY(v7_array_set_throwing(
+                    v7, v2, i, stack_arg(v7, argv_off, args, i), NULL));
+              }
+            }
+
+            scope_frame = v7_mk_object(v7);
+
+            /*
+             * Before actual opcodes, `ops` contains one or more
+             * null-terminated strings: first of all, the function name (if the
+             * function is anonymous, it's an empty string).
+             *
+             * Then, argument names follow. We know number of arguments, so, we
+             * know how many names to take.
+             *
+             * And then, local variable names follow. We know total number of
+             * strings (`names_cnt`), so, again, we know how many names to
+             * take.
+             */
+
+            ops = func->bcode->ops.p;
+
+            /* populate function itself */
+            ops = bcode_next_name_v(v7, func->bcode, 0, ops, &v4);
+            BTRY(def_property_v(v7, scope_frame, v4, V7_DESC_CONFIGURABLE(0),
+                                v1, 0 /*not assign*/, NULL));
+
+            /*
+             * Names which the function keeps in frame slots are skipped here,
+             * the slots are set up after the call frame is created
+             */
+            slot_map = slot_p = bcode_slot_map(func->bcode, ops, &slots_cnt);
+
+            /* populate arguments */
+            {
+              int arg_num;
+              for (arg_num = 0; arg_num < func->bcode->args_cnt; ++arg_num) {
+                if (slot_p != NULL && bcode_next_slot(&slot_p) != 0) {
+                  ops = bcode_next_name(ops, NULL, NULL);
+                  continue;
+                }
+                ops = bcode_next_name_v(v7, func->bcode, 1 + arg_num, ops, &v4);
+                BTRY(def_property_v(
+                    v7, scope_frame, v4, V7_DESC_CONFIGURABLE(0),
+                    stack_arg(v7, argv_off, args, arg_num), 0 /*not assign*/,
+                    NULL));
+              }
+            }
+
+            /* populate `arguments` object */
+
+            /*
+             * TODO(dfrank): it's actually much more complicated than that:
+             * it's not an array, it's an array-like object. More, in
+             * non-strict mode, elements of `arguments` object are just aliases
+             * for actual arguments, so this one:
+             *
+             *   `(function(a){arguments[0]=2; return a;})(1);`
+             *
+             * should yield 2. Currently, it yields 1.
+             */
+            if (!func->bcode->no_arguments) {
+              v7_def(v7, scope_frame, "arguments", 9, V7_DESC_CONFIGURABLE(0),
+                     v2);
+            }
 
-        /* convert name to string, if it's not already */
-        BTRY(to_string(v7, v2, &v2, NULL, 0, NULL));
+            /* populate local variables */
+            {
+              uint8_t loc_num;
+              uint8_t loc_cnt = func->bcode->names_cnt - func->bcode->args_cnt -
+                                1 /*func name*/;
+              for (loc_num = 0; loc_num < loc_cnt; ++loc_num) {
+                if (slot_p != NULL && bcode_next_slot(&slot_p) != 0) {
+                  ops = bcode_next_name(ops, NULL, NULL);
+                  continue;
+                }
+                ops = bcode_next_name_v(v7, func->bcode,
+                                        1 + func->bcode->args_cnt + loc_num,
+                                        ops, &v4);
+                BTRY(def_property_v(v7, scope_frame, v4,
+                                    V7_DESC_CONFIGURABLE(0), v7_mk_undefined(),
+                                    0 /*not assign*/, NULL));
+              }
+            }
 
-        /* set value */
-        BTRY(set_property_v(v7, v1, v2, v3, NULL));
+            if (slot_p != NULL) {
+              /* the slot map is over: skip `OP_FRAME_SLOTS` altogether */
+              ops = slot_p;
+            }
 
-        PUSH(v3);
-        break;
-      }
-      case OP_GET_VAR:
-      case OP_SAFE_GET_VAR: {
-        struct v7_property *p = NULL;
-        assert(r.ops < r.end - 1);
-        v1 = bcode_decode_lit(v7, r.bcode, &r.ops);
-        BTRY(v7_get_property_v(v7, v7->vals.scope, v1, &p));
-        if (p == NULL) {
-          if (op == OP_SAFE_GET_VAR) {
-            PUSH(v7_mk_undefined());
-          } else {
-            /* variable does not exist: Reference Error */
-            V7_TRY(bcode_throw_reference_error(v7, &r, v1));
-            goto op_done;
+            /* transfer control to the function */
+            V7_TRY(bcode_perform_call(v7, scope_frame, func, &r, v3 /*this*/,
+                                      ops, is_constructor, frame_stack_len));
+
+            if (slots_cnt > 0) {
+              /*
+               * Frame slots go on the data stack above the saved stack size,
+               * so that unwinding the frame drops them. Arguments and locals
+               * are assigned in the same order as the scope ones above.
+               */
+              size_t i, slot;
+              r.slots_base = v7->stack.len;
+              mbuf_append(&v7->stack, NULL, slots_cnt * sizeof(val_t));
+              for (i = 0; i < slots_cnt; i++) {
+                SLOT(i) = v7_mk_undefined();
+              }
+              for (i = 0; i + 1 < r.bcode->names_cnt; i++) {
+                slot = bcode_next_slot(&slot_map);
+                if (slot != 0) {
+                  SLOT(slot - 1) = i < r.bcode->args_cnt
+                                       ? stack_arg(v7, argv_off, args, i)
+                                       : v7_mk_undefined();
+                }
+              }
+            }
+            bcode_reserve_stack(v7, r.bcode);
+            BJIT_HOT(r.bcode);
+
+            scope_frame = v7_mk_undefined();
           }
-          break;
-        } else {
-          BTRY(v7_property_value(v7, v7->vals.scope, p, &v2));
-          PUSH(v2);
         }
         break;
       }
-      case OP_SET_VAR: {
+      case OP_RET:
+        BSAFEPOINT();
+        bcode_adjust_retval(v7, 1 /*explicit return*/);
+        V7_TRY(bcode_perform_return(v7, &r, 1 /*take value from stack*/));
+        break;
+      case OP_DELETE:
+      case OP_DELETE_VAR: {
+        size_t name_len;
         struct v7_property *prop;
-        v3 = POP();
-        v2 = bcode_decode_lit(v7, r.bcode, &r.ops);
-        v1 = v7->vals.scope;
 
-        BTRY(to_string(v7, v2, NULL, buf, sizeof(buf), NULL));
-        prop = v7_get_property(v7, v1, buf, strlen(buf));
-        if (prop != NULL) {
-          /* Property already exists: update its value */
+        res = v7_mk_boolean(1);
+
+        /* pop property name to delete */
+        v2 = POP();
+
+        if (op == OP_DELETE) {
+          /* pop object to delete the property from */
+          v1 = POP();
+        } else {
+          /* use scope as an object to delete the property from */
+          v1 = v7->vals.scope;
+        }
+
+        if (!v7_is_object(v1)) {
           /*
-           * TODO(dfrank): currently we can't use `def_property_v()` here,
-           * because if the property was already found somewhere in the
-           * prototype chain, then it should be updated, instead of creating a
-           * new one on the top of the scope.
-           *
-           * Probably we need to make `def_property_v()` more generic and
-           * use it here; or split `def_property_v()` into smaller pieces and
-           * use one of them here.
+           * the "object" to delete a property from is not actually an object
+           * (at least this can happen with cfunction pointers), will just
+           * return `true`
            */
-          if (!(prop->attributes & V7_PROPERTY_NON_WRITABLE)) {
-            prop->value = v3;
-          }
-        } else if (!r.bcode->strict_mode) {
+          goto delete_clean;
+        }
+
+        BTRY(to_string(v7, v2, NULL, buf, sizeof(buf), &name_len));
+
+        prop = v7_get_property(v7, v1, buf, name_len);
+        if (prop == NULL) {
+          /* not found a property; will just return `true` */
+          goto delete_clean;
+        }
+
+        /* found needed property */
+
+        if (prop->attributes & V7_PROPERTY_NON_CONFIGURABLE) {
           /*
-           * Property does not exist: since we're not in strict mode, let's
-           * create new property at Global Object
+           * this property is undeletable. In non-strict mode, we just
+           * return `false`; otherwise, we throw.
            */
-          BTRY(set_property_v(v7, v7_get_global(v7), v2, v3, NULL));
+          if (!r.bcode->strict_mode) {
+            res = v7_mk_boolean(0);
+          } else {
+            BTRY(v7_throwf(v7, TYPE_ERROR, "Cannot delete property '%s'", buf));
+            goto op_done;
+          }
         } else {
           /*
-           * In strict mode, throw reference error instead of polluting Global
-           * Object
+           * delete property: when we operate on the current scope, we should
+           * walk the prototype chain when deleting property.
+           *
+           * But when we operate on a "real" object, we should delete own
+           * properties only.
            */
-          V7_TRY(bcode_throw_reference_error(v7, &r, v2));
+          if (op == OP_DELETE) {
+            v7_del(v7, v1, buf, name_len);
+          } else {
+            del_property_deep(v7, v1, buf, name_len);
+          }
+        }
+
+      delete_clean:
+        PUSH(res);
+        break;
+      }
+      case OP_TRY_PUSH_CATCH:
+      case OP_TRY_PUSH_FINALLY:
+      case OP_TRY_PUSH_LOOP:
+      case OP_TRY_PUSH_SWITCH:
+        eval_try_push(v7, op, &r);
+        break;
+      case OP_TRY_POP:
+        V7_TRY(eval_try_pop(v7));
+        break;
+      case OP_AFTER_FINALLY:
+        /*
+         * exited from `finally` block: if some value is currently being
+         * returned, continue returning it.
+         *
+         * Likewise, if some value is currently being thrown, continue
+         * unwinding stack.
+         */
+        if (v7->is_thrown) {
+          V7_TRY(
+              bcode_perform_throw(v7, &r, 0 /*don't take value from stack*/));
           goto op_done;
           break;
+        } else if (v7->is_returned) {
+          V7_TRY(
+              bcode_perform_return(v7, &r, 0 /*don't take value from stack*/));
+          break;
+        } else if (v7->is_breaking) {
+          bcode_perform_break(v7, &r);
         }
-        PUSH(v3);
+        break;
+      case OP_THROW:
+        V7_TRY(bcode_perform_throw(v7, &r, 1 /*take thrown value*/));
+        goto op_done;
+        break;
+      case OP_BREAK:
+        bcode_perform_break(v7, &r);
+        break;
+      case OP_CONTINUE:
+        v7->is_continuing = 1;
+        bcode_perform_break(v7, &r);
+        break;
+      case OP_ENTER_CATCH: {
+        /* pop thrown value from stack */
+        v1 = POP();
+        /* get the name of the thrown value */
+        v2 = bcode_decode_lit(v7, r.bcode, &r.ops);
+
+        /*
+         * create a new stack frame (a "private" one), and set exception
+         * property on it
+         */
+        scope_frame = v7_mk_object(v7);
+        BTRY(set_property_v(v7, scope_frame, v2, v1, NULL));
+
+        /* Push this "private" frame on the call stack */
+        bcode_private_frame_push(v7, scope_frame);
         break;
       }
-      case OP_JMP: {
-        bcode_off_t target = bcode_get_target(&r.ops);
-        r.ops = r.bcode->ops.p + target - 1;
+      case OP_EXIT_CATCH: {
+        uint8_t is_func_frame = 0;
+        /* unwind 1 frame */
+        is_func_frame = unwind_stack_1level(v7, &r);
+        /* make sure the unwound frame is the "private" frame */
+        assert(is_func_frame == 0);
+#if defined(NDEBUG)
+        (void) is_func_frame;
+#endif
         break;
       }
-      case OP_JMP_FALSE: {
-        bcode_off_t target = bcode_get_target(&r.ops);
-        v1 = POP();
-        if (!v7_is_truthy(v7, v1)) {
-          r.ops = r.bcode->ops.p + target - 1;
+      case OP_GEN_START: {
+        uint8_t is_async = *(++r.ops);
+
+        /* the call has just made the frame: `this` and the function on top */
+        v1 = v7_mk_dense_array(v7);
+        v7_array_set(
+            v7, v1, GEN_FUNC,
+            ((val_t *) (v7->stack.buf + v7->call_stack->stack_size))[1]);
+        v2 = mk_object(v7, v7->vals.generator_prototype);
+        v7_def(v7, v2, "", 0, _V7_DESC_HIDDEN(1), v1);
+        bcode_gen_suspend(v7, &r, v1, r.ops + 1, GEN_STATE_START);
+
+        if (is_async) {
+          /* the driver of `js_stdlib.c` runs it and returns a promise */
+          if (!v7_is_callable(v7, v7->vals.async_run)) {
+            BTRY(v7_throwf(v7, TYPE_ERROR, "async functions are disabled"));
+          }
+          v3 = v7_mk_dense_array(v7);
+          v7_array_push(v7, v3, v2);
+          BTRY(b_apply(v7, v7->vals.async_run, v7_mk_undefined(), v3, 0, &v2));
         }
+        PUSH(v2);
         break;
       }
-      case OP_JMP_TRUE: {
-        bcode_off_t target = bcode_get_target(&r.ops);
-        v1 = POP();
-        if (v7_is_truthy(v7, v1)) {
-          r.ops = r.bcode->ops.p + target - 1;
+      case OP_YIELD: {
+        struct v7_call_frame *frame = v7->call_stack;
+        while (frame->bcode == NULL) {
+          frame = frame->prev;
         }
+        v1 = POP();
+        bcode_gen_suspend(v7, &r, frame->vals.gen, r.ops + 1,
+                          GEN_STATE_SUSPENDED);
+        PUSH(v1);
         break;
       }
-      case OP_JMP_TRUE_DROP: {
-        bcode_off_t target = bcode_get_target(&r.ops);
+      case OP_RESUME: {
+        enum gen_resume how = (enum gen_resume) * (++r.ops);
+        v2 = POP();
         v1 = POP();
-        if (v7_is_truthy(v7, v1)) {
-          r.ops = r.bcode->ops.p + target - 1;
-          v1 = POP();
-          POP();
-          PUSH(v1);
+
+        /* a generator which has not started yet takes nothing */
+        if (bcode_gen_resume(v7, &r, v1) == GEN_STATE_SUSPENDED) {
+          PUSH(v2);
         }
-        break;
-      }
-      case OP_JMP_IF_CONTINUE: {
-        bcode_off_t target = bcode_get_target(&r.ops);
-        if (v7->is_continuing) {
-          r.ops = r.bcode->ops.p + target - 1;
+        if (how == GEN_RESUME_THROW) {
+          V7_TRY(bcode_perform_throw(v7, &r, 1 /*take thrown value*/));
+          goto op_done;
+        } else if (how == GEN_RESUME_RETURN) {
+          V7_TRY(bcode_perform_return(v7, &r, 1 /*take value from stack*/));
         }
-        v7->is_continuing = 0;
         break;
       }
-      case OP_CREATE_OBJ:
-        PUSH(v7_mk_object(v7));
-        break;
-      case OP_CREATE_ARR:
-        PUSH(v7_mk_array(v7));
+      default:
+        BTRY(v7_throwf(v7, INTERNAL_ERROR, "Unknown opcode: %d", (int) op));
+        goto op_done;
         break;
-      case OP_NEXT_PROP: {
-        void *h = NULL;
-        v1 = POP(); /* handle */
-        v2 = POP(); /* object */
+    }
+
+  op_done:
+#ifdef V7_BCODE_TRACE
+    /* print current stack state */
+    {
+      char buf[40];
+      char *str = v7_stringify(v7, TOS(), buf, sizeof(buf), V7_STRINGIFY_DEBUG);
+      fprintf(stderr, "        stack size: %u, TOS: '%s'\n",
+              (unsigned int) (v7->stack.len / sizeof(val_t)), str);
+      if (str != buf) {
+        free(str);
+      }
+
+#ifdef V7_BCODE_TRACE_STACK
+      {
+        size_t i;
+        for (i = 0; i < (v7->stack.len / sizeof(val_t)); i++) {
+          char *str = v7_stringify(v7, stack_at(&v7->stack, i), buf,
+                                   sizeof(buf), V7_STRINGIFY_DEBUG);
+
+          fprintf(stderr, "        #: '%s'\n", str);
+
+          if (str != buf) {
+            free(str);
+          }
+        }
+      }
+#endif
+    }
+#endif
+    if (r.need_inc_ops) {
+      r.ops++;
+    }
+  }
+
+  /* implicit return */
+  if (v7->call_stack != v7->bottom_call_stack) {
+#ifdef V7_BCODE_TRACE
+    fprintf(stderr, "return implicitly\n");
+#endif
+    bcode_adjust_retval(v7, 0 /*implicit return*/);
+    V7_TRY(bcode_perform_return(v7, &r, 1));
+    goto restart;
+  } else {
+#ifdef V7_BCODE_TRACE
+    const char *s = (v7->vals.scope != v7->vals.global_object)
+                        ? "not global object"
+                        : "global object";
+    fprintf(stderr, "reached bottom_call_stack (%s)\n", s);
+#endif
+  }
 
-        if (!v7_is_null(v1)) {
-          h = v7_to_foreign(v1);
-        }
+clean:
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+#ifdef V7_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
 
-        if (v7_is_object(v2)) {
-          v7_prop_attr_t attrs;
-          do {
-            /* iterate properties until we find a non-hidden enumerable one */
-            do {
-              h = v7_next_prop(h, v2, &res, NULL, &attrs);
-            } while (h != NULL && (attrs & (_V7_PROPERTY_HIDDEN |
-                                            V7_PROPERTY_NON_ENUMERABLE)));
+/*
+ * Runs the jobs of settled promises, see `js_stdlib.c`, when the outermost
+ * script or call from C is over: the jobs queued while it ran, and those which
+ * they queue in turn. `res` is kept from the GC meanwhile.
+ */
+static void bcode_run_jobs(struct v7 *v7, val_t *res) {
+  struct v7_call_handle h;
+  struct gc_tmp_frame tf;
+  enum v7_err rcode;
 
-            if (h == NULL) {
-              /* no more properties in this object: proceed to the prototype */
-              v2 = obj_prototype_v(v7, v2);
-            }
-          } while (h == NULL && v7_to_generic_object(v2) != NULL);
-        }
+  if (v7->act_bcodes.len > 0 || v7->is_running_jobs ||
+      !v7_is_object(v7->vals.jobs) ||
+      v7_array_length(v7, v7->vals.jobs) == 0) {
+    return;
+  }
 
-        if (h == NULL) {
-          PUSH(v7_mk_boolean(0));
-        } else {
-          PUSH(v2);
-          PUSH(v7_mk_foreign(h));
-          PUSH(res);
-          PUSH(v7_mk_boolean(1));
-        }
-        break;
-      }
-      case OP_FUNC_LIT: {
-        v1 = POP();
-        v2 = bcode_instantiate_function(v7, v1);
-        PUSH(v2);
-        break;
-      }
-      case OP_CALL:
-      case OP_NEW: {
-        /* Naive implementation pending stack frame redesign */
-        int args = (int) *(++r.ops);
-        uint8_t is_constructor = (op == OP_NEW);
+  tf = new_tmp_frame(v7);
+  tmp_stack_push(&tf, res);
+  v7->is_running_jobs = 1;
+  call_handle_init(&h, v7->vals.run_jobs, v7_mk_undefined());
+  /* the jobs catch what they throw: they reject promises with it */
+  rcode = b_call(v7, &h, NULL, 0, NULL);
+  (void) rcode;
+  v7->is_running_jobs = 0;
+  tmp_frame_cleanup(&tf);
+}
 
-        if (SP() < (args + 1 /*func*/ + 1 /*this*/)) {
-          BTRY(v7_throwf(v7, INTERNAL_ERROR, "stack underflow"));
-          goto op_done;
-          break;
-        } else {
-          v2 = v7_mk_dense_array(v7);
-          while (args > 0) {
-            BTRY(v7_array_set_throwing(v7, v2, --args, POP(), NULL));
-          }
-          /* pop function to call */
-          v1 = POP();
+/*
+ * TODO(dfrank) this function is probably too overloaded: it handles both
+ * `v7_exec` and `v7_apply`. Read below why it's written this way, but it's
+ * probably a good idea to factor out common functionality in some other
+ * function.
+ *
+ * If `src` is not `NULL`, then we behave in favour of `v7_exec`: parse,
+ * compile, and evaluate the script. The `func` and `args` are ignored.
+ *
+ * If, however, `src` is `NULL`, then we behave in favour of `v7_apply`: we
+ * call the provided `func` with `args`. But unlike interpreter, we can't just
+ * call the provided function: we need to setup environment for this call.
+ *
+ * Currently, we just quickly generate the "wrapper" bcode for the function.
+ * This wrapper bcode looks like this:
+ *
+ *    OP_PUSH_UNDEFINED
+ *    OP_PUSH_LIT       # push this
+ *    OP_PUSH_LIT       # push function
+ *    OP_PUSH_LIT       # push arg1
+ *    OP_PUSH_LIT       # push arg2
+ *    ...
+ *    OP_PUSH_LIT       # push argN
+ *    OP_CALL(N)        # call function with N arguments
+ *    OP_SWAP_DROP
+ *
+ * and then, bcode evaluator proceeds with this code.
+ *
+ * In fact, both cases (eval or apply) are quite similar: we should prepare
+ * environment for the bcode evaluation in exactly the same way, and the only
+ * different part is where we get the bcode from. This is why that
+ * functionality is baked in the single function, but it would be good to make
+ * it suck less.
+ */
+V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
+                              val_t func, val_t args, val_t this_object,
+                              int is_json, int fr, uint8_t is_constructor,
+                              val_t *res) {
+#if defined(V7_BCODE_TRACE_SRC)
+  fprintf(stderr, "src:'%s'\n", src);
+#endif
 
-          /* pop `this` */
-          v3 = POP();
+  /* TODO(mkm): use GC pool */
+  struct ast *a = (struct ast *) malloc(sizeof(struct ast));
+  val_t saved_this = v7->vals.this_object;
+  struct v7_call_frame *saved_bottom_call_stack = v7->bottom_call_stack;
+  unsigned int saved_blocks_base = v7->call_stack->blocks_base;
+  size_t saved_stack_len = v7->stack.len;
+  enum v7_err rcode = V7_OK;
+  val_t r = v7_mk_undefined();
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+  uint8_t noopt = 0;
+  struct bcode *bcode = NULL;
+#if defined(V7_ENABLE_STACK_TRACKING)
+  struct stack_track_ctx stack_track_ctx;
+#endif
 
-          /*
-           * adjust `this` if the function is called with the constructor
-           * invocation pattern
-           */
-          if (is_constructor) {
-            /*
-             * The function is invoked as a constructor: we ignore `this`
-             * value popped from stack, create new object and set prototype.
-             */
+#if defined(V7_ENABLE_STACK_TRACKING)
+  v7_stack_track_start(v7, &stack_track_ctx);
+#endif
 
-            /*
-             * get "prototype" property from the constructor function,
-             * and make sure it's an object
-             */
-            v4 = v7_get(v7, v1 /*func*/, "prototype", 9);
-            if (!v7_is_object(v4)) {
-              /* TODO(dfrank): box primitive value */
-              BTRY(v7_throwf(
-                  v7, TYPE_ERROR,
-                  "Cannot set a primitive value as object prototype"));
-              goto op_done;
-            } else if (is_cfunction_lite(v4)) {
-              /*
-               * TODO(dfrank): maybe add support for a cfunction pointer to be
-               * a prototype
-               */
-              BTRY(v7_throwf(v7, TYPE_ERROR,
-                             "Not implemented: cfunction as a prototype"));
-              goto op_done;
-            }
+  tmp_stack_push(&tf, &saved_this);
+  tmp_stack_push(&tf, &func);
+  tmp_stack_push(&tf, &args);
+  tmp_stack_push(&tf, &this_object);
+  tmp_stack_push(&tf, &r);
 
-            /* create an object with given prototype */
-            v3 = mk_object(v7, v4 /*prototype*/);
-            v4 = v7_mk_undefined();
-          }
+  /* init new bcode */
+  bcode = (struct bcode *) calloc(1, sizeof(*bcode));
+#ifndef V7_FORCE_STRICT_MODE
+  bcode_init(bcode, 0);
+#else
+  bcode_init(bcode, 1);
+#endif
 
-          if (!v7_is_callable(v7, v1)) {
-            /* tried to call non-function object: throw a TypeError */
+  retain_bcode(v7, bcode);
+  own_bcode(v7, bcode);
 
-            /*
-             * TODO(dfrank): include reasonable name of an object to the error
-             * message. Currently, we have just a value on stack, not the name
-             * of it, so, if we have the code like:
-             *
-             *      var foo = 1;
-             *      foo();
-             *
-             * We have `1` here, but not `"foo"`.
-             */
-            BTRY(v7_throwf(v7, TYPE_ERROR, "value is not a function"));
-            goto op_done;
-          } else if (is_cfunction_lite(v1) || is_cfunction_obj(v7, v1)) {
-            /* call cfunction */
+  ast_init(a, 0);
+  a->refcnt = 1;
 
-            /*
-             * In "function invocation pattern", the `this` value popped from
-             * stack is an `undefined`. And in non-strict mode, we should change
-             * it to global object.
-             */
-            if (!is_constructor && !r.bcode->strict_mode &&
-                v7_is_undefined(v3)) {
-              v3 = v7->vals.global_object;
-            }
+  /*
+   * Exceptions in "nested" script should not percolate into the "outer"
+   * script, so, hide the try stack (it will be restored later)
+   */
+  v7->call_stack->blocks_base = v7->call_stack->blocks_cnt;
 
-            BTRY(call_cfunction(v7, v1 /*func*/, v3 /*this*/, v2 /*args*/,
-                                is_constructor, &v4));
+  /*
+   * Set current call stack as the "bottom" call stack, so that bcode evaluator
+   * will exit when it reaches this "bottom"
+   */
+  v7->bottom_call_stack = v7->call_stack;
 
-            /* push value returned from C function to bcode stack */
-            PUSH(v4);
+  if (src != NULL) {
+    /* Caller provided some source code, so, handle it somehow */
 
-          } else {
-            char *ops;
-            struct v7_js_function *func = to_js_function(v1);
+    if (src_len >= sizeof(BIN_BCODE_SIGNATURE) &&
+        strncmp(BIN_BCODE_SIGNATURE, src, sizeof(BIN_BCODE_SIGNATURE)) == 0) {
+      /* we have a serialized bcode */
 
-            /*
-             * In "function invocation pattern", the `this` value popped from
-             * stack is an `undefined`. And in non-strict mode, we should change
-             * it to global object.
-             */
-            if (!is_constructor && !func->bcode->strict_mode &&
-                v7_is_undefined(v3)) {
-              v3 = v7->vals.global_object;
-            }
+      bcode_deserialize(v7, bcode, src + sizeof(BIN_BCODE_SIGNATURE));
+
+      /*
+       * Currently, we only support serialized bcode that is stored in some
+       * mmapped memory. Otherwise, we don't yet have any mechanism to free
+       * this memory at the appropriate time.
+       */
+      assert(fr == 0);
+    } else {
+      /* Maybe regular JavaScript source or binary AST data */
+
+      if (src_len >= sizeof(BIN_AST_SIGNATURE) &&
+          strncmp(BIN_AST_SIGNATURE, src, sizeof(BIN_AST_SIGNATURE)) == 0) {
+        /* we have binary AST data */
+
+        if (fr == 0) {
+          /* Unmanaged memory, usually rom or mmapped flash */
+          mbuf_free(&a->mbuf);
+          a->mbuf.buf = (char *) (src + sizeof(BIN_AST_SIGNATURE));
+          a->mbuf.size = a->mbuf.len = src_len - sizeof(BIN_AST_SIGNATURE);
+          a->refcnt++; /* prevent freeing */
+          noopt = 1;
+        } else {
+          mbuf_append(&a->mbuf, src + sizeof(BIN_AST_SIGNATURE),
+                      src_len - sizeof(BIN_AST_SIGNATURE));
+        }
+      } else {
+        /* we have regular JavaScript source, so, parse it */
+        V7_TRY(parse(v7, a, src, 1, is_json));
+      }
 
-            scope_frame = v7_mk_object(v7);
+      /* we now have binary AST, let's compile it */
 
-            /*
-             * Before actual opcodes, `ops` contains one or more
-             * null-terminated strings: first of all, the function name (if the
-             * function is anonymous, it's an empty string).
-             *
-             * Then, argument names follow. We know number of arguments, so, we
-             * know how many names to take.
-             *
-             * And then, local variable names follow. We know total number of
-             * strings (`names_cnt`), so, again, we know how many names to
-             * take.
-             */
+      if (!noopt) {
+        ast_optimize(a);
+      }
+#if V7_ENABLE__Memory__stats
+      v7->function_arena_ast_size += a->mbuf.size;
+#endif
 
-            ops = func->bcode->ops.p;
+      v7->vals.this_object =
+          v7_is_undefined(this_object) ? v7->vals.global_object : this_object;
 
-            /* populate function itself */
-            ops = bcode_next_name_v(v7, func->bcode, ops, &v4);
-            BTRY(def_property_v(v7, scope_frame, v4, V7_DESC_CONFIGURABLE(0),
-                                v1, 0 /*not assign*/, NULL));
+      if (!is_json) {
+        V7_TRY(compile_script(v7, a, bcode));
+      } else {
+        ast_off_t pos = 0;
+        V7_TRY(compile_expr(v7, a, &pos, bcode));
+      }
+    }
 
-            /* populate arguments */
-            {
-              int arg_num;
-              for (arg_num = 0; arg_num < func->bcode->args_cnt; ++arg_num) {
-                ops = bcode_next_name_v(v7, func->bcode, ops, &v4);
-                BTRY(def_property_v(
-                    v7, scope_frame, v4, V7_DESC_CONFIGURABLE(0),
-                    v7_array_get(v7, v2, arg_num), 0 /*not assign*/, NULL));
-              }
-            }
+  } else if (is_js_function(func)) {
+    /*
+     * Caller did not provide source code, so, assume we should call
+     * provided function. Here, we prepare "wrapper" bcode.
+     */
 
-            /* populate `arguments` object */
+    struct bcode_builder bbuilder;
+    lit_t lit;
+    int args_cnt = v7_array_length(v7, args);
 
-            /*
-             * TODO(dfrank): it's actually much more complicated than that:
-             * it's not an array, it's an array-like object. More, in
-             * non-strict mode, elements of `arguments` object are just aliases
-             * for actual arguments, so this one:
-             *
-             *   `(function(a){arguments[0]=2; return a;})(1);`
-             *
-             * should yield 2. Currently, it yields 1.
-             */
-            v7_def(v7, scope_frame, "arguments", 9, V7_DESC_CONFIGURABLE(0),
-                   v2);
+    bcode_builder_init(v7, &bbuilder, bcode);
 
-            /* populate local variables */
-            {
-              uint8_t loc_num;
-              uint8_t loc_cnt = func->bcode->names_cnt - func->bcode->args_cnt -
-                                1 /*func name*/;
-              for (loc_num = 0; loc_num < loc_cnt; ++loc_num) {
-                ops = bcode_next_name_v(v7, func->bcode, ops, &v4);
-                BTRY(def_property_v(v7, scope_frame, v4,
-                                    V7_DESC_CONFIGURABLE(0), v7_mk_undefined(),
-                                    0 /*not assign*/, NULL));
-              }
-            }
+    bcode_op(&bbuilder, OP_PUSH_UNDEFINED);
 
-            /* transfer control to the function */
-            V7_TRY(bcode_perform_call(v7, scope_frame, func, &r, v3 /*this*/,
-                                      ops, is_constructor));
+    /* push `this` */
+    lit = bcode_add_lit(&bbuilder, this_object);
+    bcode_push_lit(&bbuilder, lit);
 
-            scope_frame = v7_mk_undefined();
-          }
-        }
-        break;
+    /* push func literal */
+    lit = bcode_add_lit(&bbuilder, func);
+    bcode_push_lit(&bbuilder, lit);
+
+    /* push args */
+    {
+      int i;
+      for (i = 0; i < args_cnt; i++) {
+        lit = bcode_add_lit(&bbuilder, v7_array_get(v7, args, i));
+        bcode_push_lit(&bbuilder, lit);
       }
-      case OP_RET:
-        bcode_adjust_retval(v7, 1 /*explicit return*/);
-        V7_TRY(bcode_perform_return(v7, &r, 1 /*take value from stack*/));
-        break;
-      case OP_DELETE:
-      case OP_DELETE_VAR: {
-        size_t name_len;
-        struct v7_property *prop;
+    }
 
-        res = v7_mk_boolean(1);
+    bcode_op(&bbuilder, OP_CALL);
+    /* TODO(dfrank): check if args <= 0x7f */
+    bcode_op(&bbuilder, (uint8_t) args_cnt);
 
-        /* pop property name to delete */
-        v2 = POP();
+    bcode_op(&bbuilder, OP_SWAP_DROP);
 
-        if (op == OP_DELETE) {
-          /* pop object to delete the property from */
-          v1 = POP();
-        } else {
-          /* use scope as an object to delete the property from */
-          v1 = v7->vals.scope;
-        }
+    bcode_builder_finalize(&bbuilder);
+  } else if (is_cfunction_lite(func) || is_cfunction_obj(v7, func)) {
+    /* call cfunction */
+    V7_TRY(call_cfunction(v7, func, this_object, args, 0, 0 /* not a ctor */,
+                          &r));
+    goto clean;
+  } else {
+    /* value is not a function */
+    V7_TRY(v7_throwf(v7, TYPE_ERROR, "value is not a function"));
+  }
 
-        if (!v7_is_object(v1)) {
-          /*
-           * the "object" to delete a property from is not actually an object
-           * (at least this can happen with cfunction pointers), will just
-           * return `true`
-           */
-          goto delete_clean;
-        }
+  /* We now have bcode to evaluate; proceed to it */
 
-        BTRY(to_string(v7, v2, NULL, buf, sizeof(buf), &name_len));
+  release_ast(v7, a);
+  a = NULL;
 
-        prop = v7_get_property(v7, v1, buf, name_len);
-        if (prop == NULL) {
-          /* not found a property; will just return `true` */
-          goto delete_clean;
-        }
+  /* Evaluate bcode */
+  V7_TRY(eval_bcode(v7, bcode));
 
-        /* found needed property */
+/*
+ * bcode evaluated successfully. Make sure try stack is empty.
+ * (data stack will be checked below, in `clean`)
+ */
+#ifndef NDEBUG
+  {
+    unsigned int try_stack_len =
+        v7->call_stack->blocks_cnt - v7->call_stack->blocks_base;
+    if (try_stack_len != 0) {
+      fprintf(stderr, "try_stack_len=%u, should be 0\n", try_stack_len);
+    }
+    assert(try_stack_len == 0);
+  }
+#endif
 
-        if (prop->attributes & V7_PROPERTY_NON_CONFIGURABLE) {
-          /*
-           * this property is undeletable. In non-strict mode, we just
-           * return `false`; otherwise, we throw.
-           */
-          if (!r.bcode->strict_mode) {
-            res = v7_mk_boolean(0);
-          } else {
-            BTRY(v7_throwf(v7, TYPE_ERROR, "Cannot delete property '%s'", buf));
-            goto op_done;
-          }
-        } else {
-          /*
-           * delete property: when we operate on the current scope, we should
-           * walk the prototype chain when deleting property.
-           *
-           * But when we operate on a "real" object, we should delete own
-           * properties only.
-           */
-          if (op == OP_DELETE) {
-            v7_del(v7, v1, buf, name_len);
-          } else {
-            del_property_deep(v7, v1, buf, name_len);
-          }
-        }
+  /* get the value returned from the evaluated script */
+  r = POP();
 
-      delete_clean:
-        PUSH(res);
-        break;
-      }
-      case OP_TRY_PUSH_CATCH:
-      case OP_TRY_PUSH_FINALLY:
-      case OP_TRY_PUSH_LOOP:
-      case OP_TRY_PUSH_SWITCH:
-        eval_try_push(v7, op, &r);
-        break;
-      case OP_TRY_POP:
-        V7_TRY(eval_try_pop(v7));
-        break;
-      case OP_AFTER_FINALLY:
-        /*
-         * exited from `finally` block: if some value is currently being
-         * returned, continue returning it.
-         *
-         * Likewise, if some value is currently being thrown, continue
-         * unwinding stack.
-         */
-        if (v7->is_thrown) {
-          V7_TRY(
-              bcode_perform_throw(v7, &r, 0 /*don't take value from stack*/));
-          goto op_done;
-          break;
-        } else if (v7->is_returned) {
-          V7_TRY(
-              bcode_perform_return(v7, &r, 0 /*don't take value from stack*/));
-          break;
-        } else if (v7->is_breaking) {
-          bcode_perform_break(v7, &r);
-        }
-        break;
-      case OP_THROW:
-        V7_TRY(bcode_perform_throw(v7, &r, 1 /*take thrown value*/));
-        goto op_done;
-        break;
-      case OP_BREAK:
-        bcode_perform_break(v7, &r);
-        break;
-      case OP_CONTINUE:
-        v7->is_continuing = 1;
-        bcode_perform_break(v7, &r);
-        break;
-      case OP_ENTER_CATCH: {
-        /* pop thrown value from stack */
-        v1 = POP();
-        /* get the name of the thrown value */
-        v2 = bcode_decode_lit(v7, r.bcode, &r.ops);
+clean:
 
-        /*
-         * create a new stack frame (a "private" one), and set exception
-         * property on it
-         */
-        scope_frame = v7_mk_object(v7);
-        BTRY(set_property_v(v7, scope_frame, v2, v1, NULL));
+  assert(v7->bottom_call_stack == v7->call_stack);
+
+  /* free `src` if needed */
+  /*
+   * TODO(dfrank) : free it above, just after parsing, and make sure you use
+   * V7_TRY2() with custom label instead of V7_TRY()
+   */
+  if (src != NULL && fr) {
+    free((void *) src);
+  }
+
+  /* disown and release current bcode */
+  disown_bcode(v7, bcode);
+  release_bcode(v7, bcode);
+  bcode = NULL;
+
+  if (rcode != V7_OK) {
+    /* some exception happened. */
+    r = v7->vals.thrown_error;
 
-        /* Push this "private" frame on the call stack */
-        bcode_private_frame_push(v7, scope_frame);
-        break;
-      }
-      case OP_EXIT_CATCH: {
-        uint8_t is_func_frame = 0;
-        /* unwind 1 frame */
-        is_func_frame = unwind_stack_1level(v7, &r);
-        /* make sure the unwound frame is the "private" frame */
-        assert(is_func_frame == 0);
-#if defined(NDEBUG)
-        (void) is_func_frame;
-#endif
-        break;
-      }
-      default:
-        BTRY(v7_throwf(v7, INTERNAL_ERROR, "Unknown opcode: %d", (int) op));
-        goto op_done;
-        break;
+    /*
+     * if this is a top-level bcode, clear thrown error from the v7 context
+     *
+     * TODO(dfrank): do we really need to do this?
+     *
+     * If we don't clear the error, then we should clear it manually after each
+     * call to v7_exec() or friends; otherwise, all the following calls will
+     * see this error.
+     *
+     * On the other hand, user would still need to clear the error if he calls
+     * v7_exec() from some cfunction. So, currently, sometimes we don't need
+     * to clear the error, and sometimes we do, which is confusing.
+     */
+    if (v7->act_bcodes.len == 0) {
+      v7->vals.thrown_error = v7_mk_undefined();
+      v7->is_thrown = 0;
     }
 
-  op_done:
-#ifdef V7_BCODE_TRACE
-    /* print current stack state */
-    {
-      char buf[40];
-      char *str = v7_stringify(v7, TOS(), buf, sizeof(buf), V7_STRINGIFY_DEBUG);
-      fprintf(stderr, "        stack size: %u, TOS: '%s'\n",
-              (unsigned int) (v7->stack.len / sizeof(val_t)), str);
-      if (str != buf) {
-        free(str);
-      }
+    /*
+     * After an exception, stack might have any arbitrary length, so, just
+     * restore the saved length
+     */
+    v7->stack.len = saved_stack_len;
+  }
 
-#ifdef V7_BCODE_TRACE_STACK
-      {
-        size_t i;
-        for (i = 0; i < (v7->stack.len / sizeof(val_t)); i++) {
-          char *str = v7_stringify(v7, stack_at(&v7->stack, i), buf,
-                                   sizeof(buf), V7_STRINGIFY_DEBUG);
+  /*
+   * Data stack should have the same length as it was before evaluating script.
+   */
+  if (v7->stack.len != saved_stack_len) {
+    fprintf(stderr, "len=%d, saved=%d\n", (int) v7->stack.len,
+            (int) saved_stack_len);
+  }
+  assert(v7->stack.len == saved_stack_len);
 
-          fprintf(stderr, "        #: '%s'\n", str);
+  v7->bottom_call_stack = saved_bottom_call_stack;
 
-          if (str != buf) {
-            free(str);
-          }
-        }
-      }
-#endif
+  v7->call_stack->blocks_cnt = v7->call_stack->blocks_base;
+  v7->call_stack->blocks_base = saved_blocks_base;
+
+  if (a != NULL) {
+    release_ast(v7, a);
+    a = NULL;
+  }
+
+  if (is_constructor && !v7_is_object(r)) {
+    /* constructor returned non-object: replace it with `this` */
+    r = v7->vals.this_object;
+  }
+  bcode_run_jobs(v7, &r);
+  if (res != NULL) {
+    *res = r;
+  }
+  v7->vals.this_object = saved_this;
+
+#if defined(V7_ENABLE_STACK_TRACKING)
+  {
+    int diff = v7_stack_track_end(v7, &stack_track_ctx);
+    if (diff > v7->stack_stat[V7_STACK_STAT_EXEC]) {
+      v7->stack_stat[V7_STACK_STAT_EXEC] = diff;
     }
+  }
 #endif
-    if (r.need_inc_ops) {
-      r.ops++;
+
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err b_apply(struct v7 *v7, v7_val_t func, v7_val_t this_obj,
+                               v7_val_t args, uint8_t is_constructor,
+                               v7_val_t *res) {
+  /* Most calls have a few arguments: take the short way for them */
+  if (!is_constructor) {
+    val_t argv[V7_CALL_ARGV_SIZE];
+    unsigned long argc = v7_array_length(v7, args), i;
+
+    if (argc <= ARRAY_SIZE(argv)) {
+      struct v7_call_handle h;
+      for (i = 0; i < argc; i++) {
+        argv[i] = v7_array_get(v7, args, i);
+      }
+      call_handle_init(&h, func, this_obj);
+      return b_call(v7, &h, argv, (int) argc, res);
     }
   }
+  return b_exec(v7, NULL, 0, func, args, this_obj, 0, 0, is_constructor, res);
+}
 
-  /* implicit return */
-  if (v7->call_stack != v7->bottom_call_stack) {
-#ifdef V7_BCODE_TRACE
-    fprintf(stderr, "return implicitly\n");
-#endif
-    bcode_adjust_retval(v7, 0 /*implicit return*/);
-    V7_TRY(bcode_perform_return(v7, &r, 1));
-    goto restart;
+V7_PRIVATE void call_handle_init(struct v7_call_handle *h, val_t func,
+                                 val_t this_obj) {
+  h->func = func;
+  h->this_obj = this_obj;
+
+  /* never retained nor freed: it lives as long as the handle */
+  bcode_init(&h->bcode, 0);
+  h->bcode.frozen = 1;
+  h->bcode.ops_in_rom = 1;
+  h->bcode.ops.p = h->ops;
+  h->bcode.ops.len = sizeof(h->ops);
+  /* `b_call()` pushes the call itself, which leaves just the result */
+  h->bcode.max_stack = 1;
+  h->ops[0] = OP_CALL;
+  h->ops[1] = 0;
+  h->ops[2] = OP_SWAP_DROP;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err b_call(struct v7 *v7, struct v7_call_handle *h,
+                              const val_t *argv, int argc, val_t *res) {
+  val_t saved_this = v7->vals.this_object;
+  struct v7_call_frame *saved_bottom_call_stack = v7->bottom_call_stack;
+  unsigned int saved_blocks_base = v7->call_stack->blocks_base;
+  size_t saved_stack_len = v7->stack.len;
+  size_t need = (argc + 3) * sizeof(val_t);
+  enum v7_err rcode = V7_OK;
+  val_t r = v7_mk_undefined();
+  int i;
+
+  /* Like `b_exec()`, hide the try stack of the caller */
+  v7->call_stack->blocks_base = v7->call_stack->blocks_cnt;
+  v7->bottom_call_stack = v7->call_stack;
+
+  /*
+   * Push what the wrapper bcode of `b_exec()` would: a placeholder, `this`,
+   * the function and the arguments. `argv` may be the arguments of the
+   * calling cfunction, right on this stack.
+   */
+  if (v7->stack.len + need > v7->stack.size) {
+    const char *p = (const char *) argv;
+    size_t off = p - v7->stack.buf;
+    int on_stack = p >= v7->stack.buf && p < v7->stack.buf + v7->stack.len;
+
+    mbuf_resize(&v7->stack, (v7->stack.len + need) * 2);
+    if (on_stack) argv = (const val_t *) (v7->stack.buf + off);
+  }
+  PUSH(v7_mk_undefined());
+  PUSH(h->this_obj);
+  PUSH(h->func);
+  for (i = 0; i < argc; i++) {
+    PUSH(argv[i]);
+  }
+
+  if (is_js_function(h->func)) {
+    if (argc > 0xff) {
+      V7_TRY(v7_throwf(v7, RANGE_ERROR, "Too many arguments"));
+    }
+    h->ops[1] = (char) argc;
+
+    own_bcode(v7, &h->bcode);
+    rcode = eval_bcode(v7, &h->bcode);
+    disown_bcode(v7, &h->bcode);
+    if (rcode != V7_OK) goto clean;
+
+    r = POP();
+  } else if (is_cfunction_lite(h->func) || is_cfunction_obj(v7, h->func)) {
+    V7_TRY(call_cfunction(v7, h->func, h->this_obj, V7_TAG_NOVALUE,
+                          (unsigned long) argc, 0 /* not a ctor */, &r));
   } else {
-#ifdef V7_BCODE_TRACE
-    const char *s = (v7->vals.scope != v7->vals.global_object)
-                        ? "not global object"
-                        : "global object";
-    fprintf(stderr, "reached bottom_call_stack (%s)\n", s);
-#endif
+    V7_TRY(v7_throwf(v7, TYPE_ERROR, "value is not a function"));
   }
 
 clean:
-  tmp_frame_cleanup(&tf);
+  if (rcode != V7_OK) {
+    /* see `b_exec()` */
+    r = v7->vals.thrown_error;
+    if (v7->act_bcodes.len == 0) {
+      v7->vals.thrown_error = v7_mk_undefined();
+      v7->is_thrown = 0;
+    }
+  }
+  v7->stack.len = saved_stack_len;
+
+  v7->bottom_call_stack = saved_bottom_call_stack;
+  v7->call_stack->blocks_cnt = v7->call_stack->blocks_base;
+  v7->call_stack->blocks_base = saved_blocks_base;
+
+  bcode_run_jobs(v7, &r);
+  if (res != NULL) {
+    *res = r;
+  }
+  v7->vals.this_object = saved_this;
   return rcode;
 }
 
-/*
- * TODO(dfrank) this function is probably too overloaded: it handles both
- * `v7_exec` and `v7_apply`. Read below why it's written this way, but it's
- * probably a good idea to factor out common functionality in some other
- * function.
- *
- * If `src` is not `NULL`, then we behave in favour of `v7_exec`: parse,
- * compile, and evaluate the script. The `func` and `args` are ignored.
- *
- * If, however, `src` is `NULL`, then we behave in favour of `v7_apply`: we
- * call the provided `func` with `args`. But unlike interpreter, we can't just
- * call the provided function: we need to setup environment for this call.
- *
- * Currently, we just quickly generate the "wrapper" bcode for the function.
- * This wrapper bcode looks like this:
- *
- *    OP_PUSH_UNDEFINED
- *    OP_PUSH_LIT       # push this
- *    OP_PUSH_LIT       # push function
- *    OP_PUSH_LIT       # push arg1
- *    OP_PUSH_LIT       # push arg2
- *    ...
- *    OP_PUSH_LIT       # push argN
- *    OP_CALL(N)        # call function with N arguments
- *    OP_SWAP_DROP
- *
- * and then, bcode evaluator proceeds with this code.
- *
- * In fact, both cases (eval or apply) are quite similar: we should prepare
- * environment for the bcode evaluation in exactly the same way, and the only
- * different part is where we get the bcode from. This is why that
- * functionality is baked in the single function, but it would be good to make
- * it suck less.
- */
-V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
-                              val_t func, val_t args, val_t this_object,
-                              int is_json, int fr, uint8_t is_constructor,
-                              val_t *res) {
-#if defined(V7_BCODE_TRACE_SRC)
-  fprintf(stderr, "src:'%s'\n", src);
-#endif
-
-  /* TODO(mkm): use GC pool */
-  struct ast *a = (struct ast *) malloc(sizeof(struct ast));
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err b_resume(struct v7 *v7, val_t gen, enum gen_resume how,
+                                val_t v, val_t *res, int *done) {
+  enum gen_state state = gen_get_state(v7, gen);
   val_t saved_this = v7->vals.this_object;
   struct v7_call_frame *saved_bottom_call_stack = v7->bottom_call_stack;
-  val_t saved_try_stack = v7_mk_undefined();
+  unsigned int saved_blocks_base = v7->call_stack->blocks_base;
   size_t saved_stack_len = v7->stack.len;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
   enum v7_err rcode = V7_OK;
+  struct bcode bcode;
+  char ops[3];
   val_t r = v7_mk_undefined();
-  struct gc_tmp_frame tf = new_tmp_frame(v7);
-  uint8_t noopt = 0;
-  struct bcode *bcode = NULL;
-#if defined(V7_ENABLE_STACK_TRACKING)
-  struct stack_track_ctx stack_track_ctx;
+
+  tmp_stack_push(&tf, &gen);
+  tmp_stack_push(&tf, &v);
+  tmp_stack_push(&tf, &r);
+  *done = 0;
+
+  if (state == GEN_STATE_RUNNING) {
+    rcode = v7_throwf(v7, TYPE_ERROR, "Generator is already running");
+    goto clean;
+  } else if (state == GEN_STATE_DONE ||
+             (state == GEN_STATE_START && how != GEN_RESUME_NEXT)) {
+    /* nothing to run: it has finished, or finishes without starting */
+    gen_set_state(v7, gen, GEN_STATE_DONE);
+    *done = 1;
+    if (how == GEN_RESUME_THROW) {
+      rcode = v7_throw(v7, v);
+    } else if (how == GEN_RESUME_RETURN) {
+      *res = v;
+    } else {
+      *res = v7_mk_undefined();
+    }
+    goto clean;
+  }
+
+  /* like the bcode of `call_handle_init()`, but it resumes rather than calls */
+  bcode_init(&bcode, 0);
+  bcode.frozen = 1;
+  bcode.ops_in_rom = 1;
+  bcode.ops.p = ops;
+  bcode.ops.len = sizeof(ops);
+  bcode.max_stack = 1;
+  ops[0] = OP_RESUME;
+  ops[1] = (char) how;
+  ops[2] = OP_SWAP_DROP;
+
+  /* see `b_call()` */
+  v7->call_stack->blocks_base = v7->call_stack->blocks_cnt;
+  v7->bottom_call_stack = v7->call_stack;
+  if (v7->stack.len + 3 * sizeof(val_t) > v7->stack.size) {
+    mbuf_resize(&v7->stack, (v7->stack.len + 3 * sizeof(val_t)) * 2);
+  }
+  PUSH(v7_mk_undefined());
+  PUSH(gen);
+  PUSH(v);
+
+  own_bcode(v7, &bcode);
+  rcode = eval_bcode(v7, &bcode);
+  disown_bcode(v7, &bcode);
+
+  /* if it has not suspended again, it has returned or thrown */
+  if (gen_get_state(v7, gen) == GEN_STATE_RUNNING) {
+    gen_set_state(v7, gen, GEN_STATE_DONE);
+    *done = 1;
+  }
+  if (rcode != V7_OK) {
+    /* see `b_exec()` */
+    if (v7->act_bcodes.len == 0) {
+      v7->vals.thrown_error = v7_mk_undefined();
+      v7->is_thrown = 0;
+    }
+  } else {
+    *res = POP();
+  }
+  v7->stack.len = saved_stack_len;
+
+  v7->bottom_call_stack = saved_bottom_call_stack;
+  v7->call_stack->blocks_cnt = v7->call_stack->blocks_base;
+  v7->call_stack->blocks_base = saved_blocks_base;
+  v7->vals.this_object = saved_this;
+
+clean:
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+#ifdef V7_MODULE_LINES
+#line 1 "./src/jit.c"
 #endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/jit.h" */
+/* Amalgamated: #include "v7/src/bcode.h" */
+/* Amalgamated: #include "v7/src/eval.h" */
+/* Amalgamated: #include "v7/src/object.h" */
+/* Amalgamated: #include "v7/src/varint.h" */
 
-#if defined(V7_ENABLE_STACK_TRACKING)
-  v7_stack_track_start(v7, &stack_track_ctx);
-#endif
+#ifdef V7_ENABLE_JIT
 
-  tmp_stack_push(&tf, &saved_this);
-  tmp_stack_push(&tf, &saved_try_stack);
-  tmp_stack_push(&tf, &func);
-  tmp_stack_push(&tf, &args);
-  tmp_stack_push(&tf, &this_object);
-  tmp_stack_push(&tf, &r);
+#include <sys/mman.h>
 
-  /* init new bcode */
-  bcode = (struct bcode *) calloc(1, sizeof(*bcode));
-#ifndef V7_FORCE_STRICT_MODE
-  bcode_init(bcode, 0);
-#else
-  bcode_init(bcode, 1);
-#endif
+/*
+ * Native code keeps its state in callee-saved registers, so that the helpers
+ * it calls keep them too:
+ *
+ * - rbx: `struct v7 *`;
+ * - r12: top of the data stack, past the last value;
+ * - r13: frame slots of the function;
+ * - r14: where to store r12 when leaving;
+ * - r15: the bcode.
+ *
+ * rax, rcx, rdx, xmm0 and xmm1 are scratch. The native code of an instruction
+ * checks its operands before changing anything, so when it can't go on, it
+ * leaves through the exit stub of the instruction with the stack as it was,
+ * and the interpreter runs the instruction.
+ */
+enum jit_reg {
+  JIT_RAX,
+  JIT_RCX,
+  JIT_RDX,
+  JIT_RBX,
+  JIT_RSP,
+  JIT_RBP,
+  JIT_RSI,
+  JIT_RDI,
+  JIT_R8,
+  JIT_R9,
+  JIT_R10,
+  JIT_R11,
+  JIT_R12,
+  JIT_R13,
+  JIT_R14,
+  JIT_R15
+};
 
-  retain_bcode(v7, bcode);
-  own_bcode(v7, bcode);
+#define JIT_XMM0 0
+#define JIT_XMM1 1
+
+/* Condition codes of `jcc` and `setcc` */
+enum jit_cc {
+  JIT_CC_AE = 0x3,
+  JIT_CC_E = 0x4,
+  JIT_CC_NE = 0x5,
+  JIT_CC_A = 0x7,
+  JIT_CC_P = 0xa,
+  JIT_CC_ALWAYS = -1
+};
 
-  ast_init(a, 0);
-  a->refcnt = 1;
+/* A jump to be patched once the code of its target is known */
+struct jit_fixup {
+  uint32_t at;     /* offset of the `rel32` operand in the code */
+  uint32_t target; /* bcode offset */
+  uint32_t exit;   /* 1 for the exit stub of `target`, 0 for its code */
+};
 
-  saved_try_stack = v7->call_stack->vals.try_stack;
+struct jit_builder {
+  struct v7 *v7;
+  struct bcode *bcode;
+  struct mbuf code;
+  struct mbuf fixups;
+  /* offsets of instructions and exit stubs in `code`, by bcode offset */
+  uint32_t *insns;
+  uint32_t *exits;
+  /* offset of the code leaving to the interpreter */
+  uint32_t leave;
+  /* bcode offset of the instruction being compiled */
+  uint32_t cur;
+};
 
-  /*
-   * Exceptions in "nested" script should not percolate into the "outer"
-   * script, so, reset the try stack (it will be restored later)
-   */
-  v7->call_stack->vals.try_stack = v7_mk_undefined();
+typedef uint32_t (*jit_fn_t)(struct v7 *v7, val_t *sp, val_t *slots,
+                             const char *entry, val_t **out,
+                             struct bcode *bcode);
 
-  /*
-   * Set current call stack as the "bottom" call stack, so that bcode evaluator
-   * will exit when it reaches this "bottom"
-   */
-  v7->bottom_call_stack = v7->call_stack;
+static void jit_byte(struct jit_builder *b, int c) {
+  uint8_t v = (uint8_t) c;
+  mbuf_append(&b->code, &v, 1);
+}
 
-  if (src != NULL) {
-    /* Caller provided some source code, so, handle it somehow */
+static void jit_u32(struct jit_builder *b, uint32_t v) {
+  mbuf_append(&b->code, &v, sizeof(v));
+}
 
-    if (src_len >= sizeof(BIN_BCODE_SIGNATURE) &&
-        strncmp(BIN_BCODE_SIGNATURE, src, sizeof(BIN_BCODE_SIGNATURE)) == 0) {
-      /* we have a serialized bcode */
+static void jit_u64(struct jit_builder *b, uint64_t v) {
+  mbuf_append(&b->code, &v, sizeof(v));
+}
 
-      bcode_deserialize(v7, bcode, src + sizeof(BIN_BCODE_SIGNATURE));
+/* Emits the bytes of `s`, an instruction without operands to encode */
+static void jit_bytes(struct jit_builder *b, const char *s, size_t len) {
+  mbuf_append(&b->code, s, len);
+}
 
-      /*
-       * Currently, we only support serialized bcode that is stored in some
-       * mmapped memory. Otherwise, we don't yet have any mechanism to free
-       * this memory at the appropriate time.
-       */
-      assert(fr == 0);
-    } else {
-      /* Maybe regular JavaScript source or binary AST data */
+static void jit_rex(struct jit_builder *b, int w, int reg, int rm) {
+  int rex = 0x40 | w << 3 | (reg >> 3) << 2 | rm >> 3;
+  if (rex != 0x40) jit_byte(b, rex);
+}
 
-      if (src_len >= sizeof(BIN_AST_SIGNATURE) &&
-          strncmp(BIN_AST_SIGNATURE, src, sizeof(BIN_AST_SIGNATURE)) == 0) {
-        /* we have binary AST data */
+/* Emits one or two opcode bytes, `0x0f` escape included */
+static void jit_opcode(struct jit_builder *b, int opc) {
+  if (opc > 0xff) jit_byte(b, opc >> 8);
+  jit_byte(b, opc & 0xff);
+}
 
-        if (fr == 0) {
-          /* Unmanaged memory, usually rom or mmapped flash */
-          mbuf_free(&a->mbuf);
-          a->mbuf.buf = (char *) (src + sizeof(BIN_AST_SIGNATURE));
-          a->mbuf.size = a->mbuf.len = src_len - sizeof(BIN_AST_SIGNATURE);
-          a->refcnt++; /* prevent freeing */
-          noopt = 1;
-        } else {
-          mbuf_append(&a->mbuf, src + sizeof(BIN_AST_SIGNATURE),
-                      src_len - sizeof(BIN_AST_SIGNATURE));
-        }
-      } else {
-        /* we have regular JavaScript source, so, parse it */
-        V7_TRY(parse(v7, a, src, 1, is_json));
-      }
+/* `opc reg, [base + disp]`, with a legacy `prefix` if not 0 and REX.W if `w` */
+static void jit_mem(struct jit_builder *b, int prefix, int w, int opc, int reg,
+                    int base, int32_t disp) {
+  if (prefix != 0) jit_byte(b, prefix);
+  jit_rex(b, w, reg, base);
+  jit_opcode(b, opc);
+  jit_byte(b, 0x80 | (reg & 7) << 3 | (base & 7));
+  if ((base & 7) == JIT_RSP) jit_byte(b, 0x24); /* SIB of rsp and r12 */
+  jit_u32(b, (uint32_t) disp);
+}
 
-      /* we now have binary AST, let's compile it */
+/* `opc reg, rm` of registers */
+static void jit_rr(struct jit_builder *b, int prefix, int w, int opc, int reg,
+                   int rm) {
+  if (prefix != 0) jit_byte(b, prefix);
+  jit_rex(b, w, reg, rm);
+  jit_opcode(b, opc);
+  jit_byte(b, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
 
-      if (!noopt) {
-        ast_optimize(a);
-      }
-#if V7_ENABLE__Memory__stats
-      v7->function_arena_ast_size += a->mbuf.size;
-#endif
+static void jit_load(struct jit_builder *b, int reg, int base, int32_t disp) {
+  jit_mem(b, 0, 1, 0x8b, reg, base, disp);
+}
 
-      v7->vals.this_object =
-          v7_is_undefined(this_object) ? v7->vals.global_object : this_object;
+static void jit_store(struct jit_builder *b, int base, int32_t disp, int reg) {
+  jit_mem(b, 0, 1, 0x89, reg, base, disp);
+}
 
-      if (!is_json) {
-        V7_TRY(compile_script(v7, a, bcode));
-      } else {
-        ast_off_t pos = 0;
-        V7_TRY(compile_expr(v7, a, &pos, bcode));
-      }
-    }
+static void jit_mov(struct jit_builder *b, int dst, int src) {
+  jit_rr(b, 0, 1, 0x89, src, dst);
+}
 
-  } else if (is_js_function(func)) {
-    /*
-     * Caller did not provide source code, so, assume we should call
-     * provided function. Here, we prepare "wrapper" bcode.
-     */
+static void jit_imm(struct jit_builder *b, int reg, uint64_t v) {
+  jit_rex(b, 1, 0, reg);
+  jit_byte(b, 0xb8 + (reg & 7));
+  jit_u64(b, v);
+}
 
-    struct bcode_builder bbuilder;
-    lit_t lit;
-    int args_cnt = v7_array_length(v7, args);
+/* Moves the top of the data stack by `n` values, keeping the flags */
+static void jit_sp(struct jit_builder *b, int n) {
+  jit_bytes(b, "\x4d\x8d\x64\x24", 4); /* lea r12, [r12 + disp8] */
+  jit_byte(b, n * (int) sizeof(val_t));
+}
 
-    bcode_builder_init(v7, &bbuilder, bcode);
+/* Pushes the value in `reg` */
+static void jit_push(struct jit_builder *b, int reg) {
+  jit_store(b, JIT_R12, 0, reg);
+  jit_sp(b, 1);
+}
 
-    bcode_op(&bbuilder, OP_PUSH_UNDEFINED);
+/*
+ * Jumps, if `cc` holds, to the instruction at bcode offset `target`, or to its
+ * exit stub if `exit`
+ */
+static void jit_jmp(struct jit_builder *b, int cc, uint32_t target, int exit) {
+  struct jit_fixup f;
+  if (cc == JIT_CC_ALWAYS) {
+    jit_byte(b, 0xe9);
+  } else {
+    jit_byte(b, 0x0f);
+    jit_byte(b, 0x80 + cc);
+  }
+  f.at = b->code.len;
+  f.target = target;
+  f.exit = exit;
+  mbuf_append(&b->fixups, &f, sizeof(f));
+  jit_u32(b, 0);
+}
 
-    /* push `this` */
-    lit = bcode_add_lit(&bbuilder, this_object);
-    bcode_push_lit(&bbuilder, lit);
+/* Leaves to the interpreter at the current instruction if `cc` holds */
+static void jit_bail(struct jit_builder *b, int cc) {
+  jit_jmp(b, cc, b->cur, 1);
+}
 
-    /* push func literal */
-    lit = bcode_add_lit(&bbuilder, func);
-    bcode_push_lit(&bbuilder, lit);
+/* Loads the value `n` values below the top to `xmm`, bails unless a number */
+static void jit_num(struct jit_builder *b, int xmm, int n) {
+  jit_mem(b, 0xf2, 0, 0x0f10, xmm, JIT_R12, -n * (int) sizeof(val_t));
+  /* any tag is a NaN, and so is the NaN number: let the interpreter do it */
+  jit_rr(b, 0x66, 0, 0x0f2e, xmm, xmm); /* ucomisd xmm, xmm */
+  jit_bail(b, JIT_CC_P);
+}
 
-    /* push args */
-    {
-      int i;
-      for (i = 0; i < args_cnt; i++) {
-        lit = bcode_add_lit(&bbuilder, v7_array_get(v7, args, i));
-        bcode_push_lit(&bbuilder, lit);
-      }
-    }
+/* Stores the number in xmm0 at `[base + disp]`, see `v7_mk_number()` */
+static void jit_put_num(struct jit_builder *b, int base, int32_t disp) {
+  jit_rr(b, 0x66, 1, 0x0f7e, JIT_XMM0, JIT_RAX); /* movq rax, xmm0 */
+  jit_rr(b, 0x66, 0, 0x0f2e, JIT_XMM0, JIT_XMM0);
+  jit_bytes(b, "\x7b\x0a", 2); /* jnp over the next `mov` */
+  jit_imm(b, JIT_RAX, V7_TAG_NAN);
+  jit_store(b, base, disp, JIT_RAX);
+}
 
-    bcode_op(&bbuilder, OP_CALL);
-    /* TODO(dfrank): check if args <= 0x7f */
-    bcode_op(&bbuilder, (uint8_t) args_cnt);
+/* Stores the boolean of `cc` at `[r12 + disp]` */
+static void jit_put_bool(struct jit_builder *b, int cc, int32_t disp) {
+  jit_byte(b, 0x0f);
+  jit_byte(b, 0x90 + cc);
+  jit_byte(b, 0xc0);                  /* setcc al */
+  jit_bytes(b, "\x0f\xb6\xc0", 3);    /* movzx eax, al */
+  jit_imm(b, JIT_RCX, V7_TAG_BOOLEAN);
+  jit_rr(b, 0, 1, 0x09, JIT_RCX, JIT_RAX); /* or rax, rcx */
+  jit_store(b, JIT_R12, disp, JIT_RAX);
+}
 
-    bcode_op(&bbuilder, OP_SWAP_DROP);
+/*
+ * Sets edx to the truthiness of the value on top of the stack, if it's a
+ * boolean or a number but NaN; bails otherwise
+ */
+static void jit_truthy(struct jit_builder *b) {
+  size_t at;
+  jit_load(b, JIT_RDX, JIT_R12, -8);
+  jit_imm(b, JIT_RCX, V7_TAG_BOOLEAN);
+  jit_rr(b, 0, 1, 0x31, JIT_RCX, JIT_RDX); /* xor rdx, rcx */
+  jit_bytes(b, "\x48\x83\xfa\x01", 4);      /* cmp rdx, 1 */
+  at = b->code.len;
+  jit_bytes(b, "\x76\x00", 2); /* jbe, patched below */
+  jit_num(b, JIT_XMM0, 1);
+  jit_rr(b, 0x66, 0, 0x0f57, JIT_XMM1, JIT_XMM1); /* xorpd xmm1, xmm1 */
+  jit_rr(b, 0x66, 0, 0x0f2e, JIT_XMM0, JIT_XMM1);
+  jit_bytes(b, "\x0f\x95\xc2\x0f\xb6\xd2", 6); /* setne dl; movzx edx, dl */
+  b->code.buf[at + 1] = (char) (b->code.len - at - 2);
+}
 
-    bcode_builder_finalize(&bbuilder);
-  } else if (is_cfunction_lite(func) || is_cfunction_obj(v7, func)) {
-    /* call cfunction */
-    V7_TRY(call_cfunction(v7, func, this_object, args, 0 /* not a ctor */, &r));
-    goto clean;
+/*
+ * Calls `fn(v7, bcode, insn, sp)` which does the instruction `insn` and
+ * returns 1, or returns 0 without changing anything; bails then.
+ */
+static void jit_call(struct jit_builder *b,
+                     int (*fn)(struct v7 *, struct bcode *, char *, val_t *),
+                     const char *insn) {
+  jit_mov(b, JIT_RDI, JIT_RBX);
+  jit_mov(b, JIT_RSI, JIT_R15);
+  jit_imm(b, JIT_RDX, (uint64_t)(uintptr_t) insn);
+  jit_mov(b, JIT_RCX, JIT_R12);
+  jit_imm(b, JIT_RAX, (uint64_t)(uintptr_t) fn);
+  jit_bytes(b, "\xff\xd0\x85\xc0", 4); /* call rax; test eax, eax */
+  jit_bail(b, JIT_CC_E);
+}
+
+/*
+ * Helpers of the instructions which look properties up. They do only what's
+ * certain not to run JS code nor to throw: data properties found through the
+ * inline cache (see `bcode_ic_lookup()`).
+ */
+
+/* `OP_GET_VAR`, `OP_SAFE_GET_VAR` */
+static int jit_get_var(struct v7 *v7, struct bcode *bcode, char *insn,
+                       val_t *sp) {
+  struct bcode_ic *ic = bcode_get_ic(bcode, insn);
+  struct v7_property *p = NULL;
+  char *ops = insn;
+  val_t name = bcode_decode_lit(v7, bcode, &ops);
+
+  if (ic == NULL || !bcode_ic_lookup(v7, ic, v7->vals.scope, name, &p)) {
+    return 0;
+  }
+  if (p == NULL) {
+    if ((enum opcode) *insn != OP_SAFE_GET_VAR) return 0;
+    *sp = V7_UNDEFINED;
+  } else if (p->attributes & V7_PROPERTY_GETTER) {
+    return 0;
   } else {
-    /* value is not a function */
-    V7_TRY(v7_throwf(v7, TYPE_ERROR, "value is not a function"));
+    *sp = p->value;
   }
+  return 1;
+}
 
-  /* We now have bcode to evaluate; proceed to it */
+/* `OP_SET_VAR` of an existing variable, see `bcode_set_var()` */
+static int jit_set_var(struct v7 *v7, struct bcode *bcode, char *insn,
+                       val_t *sp) {
+  struct bcode_ic *ic = bcode_get_ic(bcode, insn);
+  struct v7_property *p = NULL;
+  char *ops = insn;
+  val_t name = bcode_decode_lit(v7, bcode, &ops);
 
-  release_ast(v7, a);
-  a = NULL;
+  if (ic == NULL || !bcode_ic_lookup(v7, ic, v7->vals.scope, name, &p) ||
+      p == NULL) {
+    return 0;
+  }
+  if (!(p->attributes & V7_PROPERTY_NON_WRITABLE)) {
+    p->value = sp[-1];
+  }
+  return 1;
+}
 
-  /* Evaluate bcode */
-  V7_TRY(eval_bcode(v7, bcode));
+/* `OP_INC_VAR`, `OP_DEC_VAR` of a number */
+static int jit_inc_var(struct v7 *v7, struct bcode *bcode, char *insn,
+                       val_t *sp) {
+  struct bcode_ic *ic = bcode_get_ic(bcode, insn);
+  struct v7_property *p = NULL;
+  char *ops = insn;
+  val_t name = bcode_decode_lit(v7, bcode, &ops);
+
+  if (ic == NULL || !bcode_ic_lookup(v7, ic, v7->vals.scope, name, &p) ||
+      p == NULL || (p->attributes & V7_PROPERTY_GETTER) ||
+      !v7_is_number(p->value)) {
+    return 0;
+  }
+  *sp = p->value;
+  if (!(p->attributes & V7_PROPERTY_NON_WRITABLE)) {
+    p->value = v7_mk_number(v7_to_number(*sp) +
+                            ((enum opcode) *insn == OP_INC_VAR ? 1 : -1));
+  }
+  return 1;
+}
+
+/* `OP_GET_PROP` and `OP_GET` of `obj[name]`, the result goes to `*res` */
+static int jit_get_prop_v(struct v7 *v7, struct bcode *bcode, char *insn,
+                          val_t obj, val_t name, val_t *res) {
+  struct bcode_ic *ic;
+  struct v7_property *p = NULL;
+  val_t o = bcode_ic_obj(v7, obj);
+
+  if (v7_is_undefined(o) || (ic = bcode_get_ic(bcode, insn)) == NULL ||
+      !bcode_ic_lookup(v7, ic, o, name, &p) ||
+      (p != NULL && (p->attributes & V7_PROPERTY_GETTER))) {
+    return 0;
+  }
+  *res = p != NULL ? p->value : V7_UNDEFINED;
+  return 1;
+}
+
+static int jit_get_prop(struct v7 *v7, struct bcode *bcode, char *insn,
+                        val_t *sp) {
+  char *ops = insn;
+  val_t name = bcode_decode_lit(v7, bcode, &ops);
+  return jit_get_prop_v(v7, bcode, insn, sp[-1], name, &sp[-1]);
+}
+
+static int jit_get(struct v7 *v7, struct bcode *bcode, char *insn,
+                   val_t *sp) {
+  return dense_array_get_v(v7, sp[-2], sp[-1], &sp[-2]) ||
+         jit_get_prop_v(v7, bcode, insn, sp[-2], sp[-1], &sp[-2]);
+}
 
 /*
- * bcode evaluated successfully. Make sure try stack is empty.
- * (data stack will be checked below, in `clean`)
+ * `OP_SET` of an element of a dense array, or of an own data property the
+ * inline cache knows
  */
-#ifndef NDEBUG
-  {
-    unsigned long try_stack_len =
-        v7_array_length(v7, v7->call_stack->vals.try_stack);
-    if (try_stack_len != 0) {
-      fprintf(stderr, "try_stack_len=%lu, should be 0\n", try_stack_len);
+static int jit_set(struct v7 *v7, struct bcode *bcode, char *insn, val_t *sp) {
+  struct bcode_ic *ic;
+  struct v7_property *p = NULL;
+
+  if (dense_array_set_v(v7, sp[-3], sp[-2], sp[-1])) {
+    sp[-3] = sp[-1];
+    return 1;
+  }
+  if (!v7_is_object(sp[-3]) || (ic = bcode_get_ic(bcode, insn)) == NULL ||
+      !bcode_ic_hit(v7, ic, sp[-3], sp[-2], &p) ||
+      (p->attributes & (V7_PROPERTY_NON_WRITABLE | V7_PROPERTY_GETTER |
+                        V7_PROPERTY_SETTER))) {
+    return 0;
+  }
+  p->value = sp[-1];
+  sp[-3] = sp[-1];
+  return 1;
+}
+
+/* Operand of `OP_JMP` and the like, see `bcode_get_target()` */
+static bcode_off_t jit_target(const char *p) {
+  bcode_off_t target;
+  memcpy(&target, p + 1, sizeof(target));
+  return target;
+}
+
+static size_t jit_varint(const char *p) {
+  int llen;
+  return decode_varint((const unsigned char *) p + 1, &llen);
+}
+
+/*
+ * Compiles the instruction at `p`. Returns 0 if there's no native code for
+ * it, emitting nothing.
+ */
+static int jit_insn(struct jit_builder *b, const char *p) {
+  struct v7 *v7 = b->v7;
+  enum opcode op = (enum opcode)(uint8_t) *p;
+  int32_t slot;
+
+  switch (op) {
+    case OP_DROP:
+      jit_sp(b, -1);
+      break;
+    case OP_DUP:
+      jit_load(b, JIT_RAX, JIT_R12, -8);
+      jit_push(b, JIT_RAX);
+      break;
+    case OP_2DUP:
+      jit_load(b, JIT_RAX, JIT_R12, -16);
+      jit_load(b, JIT_RCX, JIT_R12, -8);
+      jit_store(b, JIT_R12, 0, JIT_RAX);
+      jit_store(b, JIT_R12, 8, JIT_RCX);
+      jit_sp(b, 2);
+      break;
+    case OP_SWAP:
+      jit_load(b, JIT_RAX, JIT_R12, -16);
+      jit_load(b, JIT_RCX, JIT_R12, -8);
+      jit_store(b, JIT_R12, -16, JIT_RCX);
+      jit_store(b, JIT_R12, -8, JIT_RAX);
+      break;
+    case OP_SWAP_DROP:
+      jit_load(b, JIT_RAX, JIT_R12, -8);
+      jit_store(b, JIT_R12, -16, JIT_RAX);
+      jit_sp(b, -1);
+      break;
+    case OP_PUSH_UNDEFINED:
+    case OP_PUSH_NULL:
+    case OP_PUSH_TRUE:
+    case OP_PUSH_FALSE:
+    case OP_PUSH_ZERO:
+    case OP_PUSH_ONE: {
+      val_t v;
+      if (op == OP_PUSH_UNDEFINED) {
+        v = v7_mk_undefined();
+      } else if (op == OP_PUSH_NULL) {
+        v = v7_mk_null();
+      } else if (op == OP_PUSH_TRUE || op == OP_PUSH_FALSE) {
+        v = v7_mk_boolean(op == OP_PUSH_TRUE);
+      } else {
+        v = v7_mk_number(op == OP_PUSH_ONE);
+      }
+      jit_imm(b, JIT_RAX, v);
+      jit_push(b, JIT_RAX);
+      break;
+    }
+    case OP_PUSH_LIT: {
+      size_t idx = jit_varint(p);
+      if (idx >= BCODE_MAX_INLINE_TYPE_TAG) {
+        /* not the value itself: GC may move strings */
+        val_t *lit = &((val_t *) b->bcode->lit.p)[idx - BCODE_MAX_INLINE_TYPE_TAG];
+        if (v7_is_number(*lit)) {
+          jit_imm(b, JIT_RAX, *lit);
+        } else {
+          jit_imm(b, JIT_RAX, (uint64_t)(uintptr_t) lit);
+          jit_load(b, JIT_RAX, JIT_RAX, 0);
+        }
+      } else if (idx == BCODE_INLINE_NUMBER_TYPE_TAG) {
+        char *ops = (char *) p;
+        jit_imm(b, JIT_RAX, bcode_decode_lit(v7, b->bcode, &ops));
+      } else {
+        return 0;
+      }
+      jit_push(b, JIT_RAX);
+      break;
+    }
+    case OP_GET_LOCAL:
+      slot = (int32_t) jit_varint(p) * sizeof(val_t);
+      jit_load(b, JIT_RAX, JIT_R13, slot);
+      jit_push(b, JIT_RAX);
+      break;
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_DROP:
+      slot = (int32_t) jit_varint(p) * sizeof(val_t);
+      jit_load(b, JIT_RAX, JIT_R12, -8);
+      jit_store(b, JIT_R13, slot, JIT_RAX);
+      if (op == OP_SET_LOCAL_DROP) jit_sp(b, -1);
+      break;
+    case OP_INC_LOCAL:
+    case OP_DEC_LOCAL:
+      slot = (int32_t) jit_varint(p) * sizeof(val_t);
+      jit_mem(b, 0xf2, 0, 0x0f10, JIT_XMM0, JIT_R13, slot);
+      jit_rr(b, 0x66, 0, 0x0f2e, JIT_XMM0, JIT_XMM0);
+      jit_bail(b, JIT_CC_P);
+      jit_mem(b, 0xf2, 0, 0x0f11, JIT_XMM0, JIT_R12, 0); /* push it */
+      jit_imm(b, JIT_RAX, v7_mk_number(1));
+      jit_rr(b, 0x66, 1, 0x0f6e, JIT_XMM1, JIT_RAX); /* movq xmm1, rax */
+      jit_rr(b, 0xf2, 0, op == OP_INC_LOCAL ? 0x0f58 : 0x0f5c, JIT_XMM0,
+             JIT_XMM1);
+      jit_put_num(b, JIT_R13, slot);
+      jit_sp(b, 1);
+      break;
+    case OP_FRAME_SLOTS:
+      break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV: {
+      /* addsd, subsd, mulsd, divsd */
+      int opc = op == OP_ADD ? 0x0f58 : op == OP_SUB ? 0x0f5c : op == OP_MUL
+                                                                   ? 0x0f59
+                                                                   : 0x0f5e;
+      jit_num(b, JIT_XMM0, 2);
+      jit_num(b, JIT_XMM1, 1);
+      jit_rr(b, 0xf2, 0, opc, JIT_XMM0, JIT_XMM1);
+      jit_put_num(b, JIT_R12, -16);
+      jit_sp(b, -1);
+      break;
+    }
+    case OP_LSHIFT:
+    case OP_RSHIFT:
+    case OP_URSHIFT:
+    case OP_OR:
+    case OP_XOR:
+    case OP_AND:
+      /* see `b_int_bin_op()` */
+      jit_num(b, JIT_XMM0, 2);
+      jit_num(b, JIT_XMM1, 1);
+      jit_rr(b, 0xf2, 1, 0x0f2c, JIT_RAX, JIT_XMM0); /* cvttsd2si rax, xmm0 */
+      jit_rr(b, 0xf2, 1, 0x0f2c, JIT_RCX, JIT_XMM1);
+      switch (op) {
+        case OP_LSHIFT:
+          jit_bytes(b, "\xd3\xe0", 2); /* shl eax, cl */
+          break;
+        case OP_RSHIFT:
+          jit_bytes(b, "\xd3\xf8", 2); /* sar eax, cl */
+          break;
+        case OP_URSHIFT:
+          jit_bytes(b, "\xd3\xe8", 2); /* shr eax, cl */
+          break;
+        case OP_OR:
+          jit_bytes(b, "\x09\xc8", 2); /* or eax, ecx */
+          break;
+        case OP_XOR:
+          jit_bytes(b, "\x31\xc8", 2); /* xor eax, ecx */
+          break;
+        default:
+          jit_bytes(b, "\x21\xc8", 2); /* and eax, ecx */
+          break;
+      }
+      /* `cvtsi2sd xmm0, rax` of the zero-extended or `eax` of the signed */
+      jit_rr(b, 0xf2, op == OP_URSHIFT, 0x0f2a, JIT_XMM0, JIT_RAX);
+      jit_put_num(b, JIT_R12, -16);
+      jit_sp(b, -1);
+      break;
+    case OP_NEG:
+      jit_num(b, JIT_XMM0, 1);
+      jit_load(b, JIT_RAX, JIT_R12, -8);
+      jit_imm(b, JIT_RCX, (uint64_t) 1 << 63);
+      jit_rr(b, 0, 1, 0x31, JIT_RCX, JIT_RAX); /* xor rax, rcx */
+      jit_store(b, JIT_R12, -8, JIT_RAX);
+      break;
+    case OP_POS:
+      jit_num(b, JIT_XMM0, 1);
+      break;
+    case OP_LOGICAL_NOT:
+      jit_truthy(b);
+      jit_bytes(b, "\x83\xf2\x01", 3); /* xor edx, 1 */
+      jit_imm(b, JIT_RCX, V7_TAG_BOOLEAN);
+      jit_rr(b, 0, 1, 0x09, JIT_RCX, JIT_RDX); /* or rdx, rcx */
+      jit_store(b, JIT_R12, -8, JIT_RDX);
+      break;
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_JMP_LT:
+    case OP_JMP_LE:
+    case OP_JMP_GT:
+    case OP_JMP_GE: {
+      /* no NaN gets here, so `a < b` is `b > a` of the unsigned flags */
+      int jmp = op == OP_JMP_LT || op == OP_JMP_LE || op == OP_JMP_GT ||
+                op == OP_JMP_GE;
+      int lt = op == OP_LT || op == OP_LE || op == OP_JMP_LT || op == OP_JMP_LE;
+      int cc;
+      if (op == OP_EQ || op == OP_NE) {
+        cc = op == OP_EQ ? JIT_CC_E : JIT_CC_NE;
+      } else if (op == OP_LT || op == OP_GT || op == OP_JMP_LT ||
+                 op == OP_JMP_GT) {
+        cc = JIT_CC_A;
+      } else {
+        cc = JIT_CC_AE;
+      }
+      jit_num(b, JIT_XMM0, 2);
+      jit_num(b, JIT_XMM1, 1);
+      jit_rr(b, 0x66, 0, 0x0f2e, lt ? JIT_XMM1 : JIT_XMM0,
+             lt ? JIT_XMM0 : JIT_XMM1); /* ucomisd */
+      if (jmp) {
+        jit_sp(b, -2);
+        jit_jmp(b, cc, jit_target(p), 0);
+      } else {
+        jit_put_bool(b, cc, -16);
+        jit_sp(b, -1);
+      }
+      break;
     }
-    assert(try_stack_len == 0);
+    case OP_EQ_EQ:
+    case OP_NE_NE:
+      /* numbers are compared by their bits, see `OP_EQ_EQ` */
+      jit_num(b, JIT_XMM0, 2);
+      jit_num(b, JIT_XMM1, 1);
+      jit_load(b, JIT_RAX, JIT_R12, -16);
+      jit_load(b, JIT_RCX, JIT_R12, -8);
+      jit_rr(b, 0, 1, 0x39, JIT_RCX, JIT_RAX); /* cmp rax, rcx */
+      jit_put_bool(b, op == OP_EQ_EQ ? JIT_CC_E : JIT_CC_NE, -16);
+      jit_sp(b, -1);
+      break;
+    case OP_JMP:
+      jit_jmp(b, JIT_CC_ALWAYS, jit_target(p), 0);
+      break;
+    case OP_JMP_TRUE:
+    case OP_JMP_FALSE:
+      jit_truthy(b);
+      jit_sp(b, -1);
+      jit_bytes(b, "\x85\xd2", 2); /* test edx, edx */
+      jit_jmp(b, op == OP_JMP_TRUE ? JIT_CC_NE : JIT_CC_E, jit_target(p), 0);
+      break;
+    case OP_GET_VAR:
+    case OP_SAFE_GET_VAR:
+      jit_call(b, jit_get_var, p);
+      jit_sp(b, 1);
+      break;
+    case OP_SET_VAR:
+      jit_call(b, jit_set_var, p);
+      break;
+    case OP_INC_VAR:
+    case OP_DEC_VAR:
+      jit_call(b, jit_inc_var, p);
+      jit_sp(b, 1);
+      break;
+    case OP_GET_PROP:
+      jit_call(b, jit_get_prop, p);
+      break;
+    case OP_GET:
+      jit_call(b, jit_get, p);
+      jit_sp(b, -1);
+      break;
+    case OP_SET:
+      jit_call(b, jit_set, p);
+      jit_sp(b, -2);
+      break;
+    default:
+      return 0;
   }
-#endif
-
-  /* get the value returned from the evaluated script */
-  r = POP();
-
-clean:
-
-  assert(v7->bottom_call_stack == v7->call_stack);
+  return 1;
+}
 
-  /* free `src` if needed */
-  /*
-   * TODO(dfrank) : free it above, just after parsing, and make sure you use
-   * V7_TRY2() with custom label instead of V7_TRY()
-   */
-  if (src != NULL && fr) {
-    free((void *) src);
+/* The code lives in pages of its own, executable but not writable */
+static void jit_free_code(void *code, size_t len) {
+  mprotect(code, len, PROT_READ | PROT_WRITE);
+  free(code);
+}
+
+V7_PRIVATE void jit_compile(struct v7 *v7, struct bcode *bcode) {
+  struct jit_builder b;
+  struct jit_code *jc = NULL;
+  const char *p, *end = bcode->ops.p + bcode->ops.len;
+  size_t i, page = (size_t) sysconf(_SC_PAGESIZE), map_len;
+  uint32_t *entry = NULL;
+  void *code;
+  int cnt = 0;
+
+  if (bcode->frozen || bcode->jit != NULL) return;
+
+  memset(&b, 0, sizeof(b));
+  b.v7 = v7;
+  b.bcode = bcode;
+  mbuf_init(&b.code, 0);
+  mbuf_init(&b.fixups, 0);
+  b.insns = (uint32_t *) calloc(bcode->ops.len + 1, sizeof(uint32_t));
+  b.exits = (uint32_t *) calloc(bcode->ops.len + 1, sizeof(uint32_t));
+  entry = (uint32_t *) calloc(bcode->ops.len, sizeof(uint32_t));
+  if (b.insns == NULL || b.exits == NULL || entry == NULL) goto clean;
+
+  /* push rbx, r12-r15 */
+  jit_bytes(&b, "\x53\x41\x54\x41\x55\x41\x56\x41\x57", 9);
+  jit_mov(&b, JIT_RBX, JIT_RDI);
+  jit_mov(&b, JIT_R12, JIT_RSI);
+  jit_mov(&b, JIT_R13, JIT_RDX);
+  jit_mov(&b, JIT_R14, JIT_R8);
+  jit_mov(&b, JIT_R15, JIT_R9);
+  jit_bytes(&b, "\xff\xe1", 2); /* jmp rcx */
+
+  /* eax is the bcode offset to go on from */
+  b.leave = b.code.len;
+  jit_store(&b, JIT_R14, 0, JIT_R12);
+  /* pop r15-r12, rbx; ret */
+  jit_bytes(&b, "\x41\x5f\x41\x5e\x41\x5d\x41\x5c\x5b\xc3", 10);
+
+  for (p = bcode_end_names(bcode->ops.p, bcode->names_cnt); p < end;
+       p = bcode_next_op(bcode, p)) {
+    b.cur = p - bcode->ops.p;
+    b.insns[b.cur] = b.code.len;
+    if (jit_insn(&b, p)) {
+      entry[b.cur] = b.insns[b.cur];
+      cnt++;
+    } else {
+      jit_bail(&b, JIT_CC_ALWAYS);
+    }
   }
+  b.cur = bcode->ops.len;
+  b.insns[b.cur] = b.code.len;
+  jit_bail(&b, JIT_CC_ALWAYS);
 
-  /* disown and release current bcode */
-  disown_bcode(v7, bcode);
-  release_bcode(v7, bcode);
-  bcode = NULL;
-
-  if (rcode != V7_OK) {
-    /* some exception happened. */
-    r = v7->vals.thrown_error;
+  if (cnt == 0) goto clean;
 
-    /*
-     * if this is a top-level bcode, clear thrown error from the v7 context
-     *
-     * TODO(dfrank): do we really need to do this?
-     *
-     * If we don't clear the error, then we should clear it manually after each
-     * call to v7_exec() or friends; otherwise, all the following calls will
-     * see this error.
-     *
-     * On the other hand, user would still need to clear the error if he calls
-     * v7_exec() from some cfunction. So, currently, sometimes we don't need
-     * to clear the error, and sometimes we do, which is confusing.
-     */
-    if (v7->act_bcodes.len == 0) {
-      v7->vals.thrown_error = v7_mk_undefined();
-      v7->is_thrown = 0;
+  /* exit stubs: `mov eax, off; jmp leave` */
+  for (i = 0; i < b.fixups.len / sizeof(struct jit_fixup); i++) {
+    struct jit_fixup *f = &((struct jit_fixup *) b.fixups.buf)[i];
+    if (f->exit && b.exits[f->target] == 0) {
+      b.exits[f->target] = b.code.len;
+      jit_byte(&b, 0xb8);
+      jit_u32(&b, f->target);
+      jit_byte(&b, 0xe9);
+      jit_u32(&b, b.leave - (b.code.len + 4));
     }
-
-    /*
-     * After an exception, stack might have any arbitrary length, so, just
-     * restore the saved length
-     */
-    v7->stack.len = saved_stack_len;
   }
 
-  /*
-   * Data stack should have the same length as it was before evaluating script.
-   */
-  if (v7->stack.len != saved_stack_len) {
-    fprintf(stderr, "len=%d, saved=%d\n", (int) v7->stack.len,
-            (int) saved_stack_len);
+  for (i = 0; i < b.fixups.len / sizeof(struct jit_fixup); i++) {
+    struct jit_fixup *f = &((struct jit_fixup *) b.fixups.buf)[i];
+    uint32_t to = f->exit ? b.exits[f->target] : b.insns[f->target];
+    uint32_t rel = to - (f->at + 4);
+    /* jumps go to instructions only */
+    if (to == 0) goto clean;
+    memcpy(b.code.buf + f->at, &rel, sizeof(rel));
   }
-  assert(v7->stack.len == saved_stack_len);
-
-  v7->bottom_call_stack = saved_bottom_call_stack;
 
-  v7->call_stack->vals.try_stack = saved_try_stack;
-
-  if (a != NULL) {
-    release_ast(v7, a);
-    a = NULL;
+  map_len = (b.code.len + page - 1) & ~(page - 1);
+  if (posix_memalign(&code, page, map_len) != 0) goto clean;
+  memcpy(code, b.code.buf, b.code.len);
+  if (mprotect(code, map_len, PROT_READ | PROT_EXEC) != 0 ||
+      (jc = (struct jit_code *) calloc(1, sizeof(*jc))) == NULL) {
+    jit_free_code(code, map_len);
+    goto clean;
   }
+  jc->code = (char *) code;
+  jc->map_len = map_len;
+  jc->entry = entry;
+  entry = NULL;
+  bcode->jit = jc;
 
-  if (is_constructor && !v7_is_object(r)) {
-    /* constructor returned non-object: replace it with `this` */
-    r = v7->vals.this_object;
-  }
-  if (res != NULL) {
-    *res = r;
-  }
-  v7->vals.this_object = saved_this;
+clean:
+  free(entry);
+  free(b.insns);
+  free(b.exits);
+  mbuf_free(&b.code);
+  mbuf_free(&b.fixups);
+}
+
+V7_PRIVATE size_t jit_run(struct v7 *v7, struct bcode *bcode, size_t off,
+                          size_t slots_base) {
+  struct jit_code *jc = bcode->jit;
+  val_t *sp = (val_t *) (v7->stack.buf + v7->stack.len);
+  jit_fn_t fn;
+  uint32_t res;
+
+  memcpy(&fn, &jc->code, sizeof(fn));
+  res = fn(v7, sp, (val_t *) (v7->stack.buf + slots_base),
+           jc->code + jc->entry[off], &sp, bcode);
+  v7->stack.len = (char *) sp - v7->stack.buf;
+  return res;
+}
 
-#if defined(V7_ENABLE_STACK_TRACKING)
-  {
-    int diff = v7_stack_track_end(v7, &stack_track_ctx);
-    if (diff > v7->stack_stat[V7_STACK_STAT_EXEC]) {
-      v7->stack_stat[V7_STACK_STAT_EXEC] = diff;
-    }
+V7_PRIVATE void jit_free(struct bcode *bcode) {
+  if (bcode->jit != NULL) {
+    jit_free_code(bcode->jit->code, bcode->jit->map_len);
+    free(bcode->jit->entry);
+    free(bcode->jit);
+    bcode->jit = NULL;
   }
-#endif
-
-  tmp_frame_cleanup(&tf);
-  return rcode;
 }
 
-WARN_UNUSED_RESULT
-V7_PRIVATE enum v7_err b_apply(struct v7 *v7, v7_val_t func, v7_val_t this_obj,
-                               v7_val_t args, uint8_t is_constructor,
-                               v7_val_t *res) {
-  return b_exec(v7, NULL, 0, func, args, this_obj, 0, 0, is_constructor, res);
-}
+#endif /* V7_ENABLE_JIT */
 #ifdef V7_MODULE_LINES
 #line 1 "./src/vm.c"
 #endif
@@ -13989,6 +17703,8 @@ static void generic_object_destructor(struct v7 *v7, void *ptr) {
     }
   }
 
+  free(o->base.index);
+
 #if defined(V7_ENABLE_ENTITY_IDS)
   o->base.entity_id_base = V7_ENTITY_ID_PART_NONE;
   o->base.entity_id_spec = V7_ENTITY_ID_PART_NONE;
@@ -14003,6 +17719,7 @@ static void function_destructor(struct v7 *v7, void *ptr) {
   if (f->bcode != NULL) {
     release_bcode(v7, f->bcode);
   }
+  free(f->base.index);
 
 #if defined(V7_ENABLE_ENTITY_IDS)
   f->base.entity_id_base = V7_ENTITY_ID_PART_NONE;
@@ -14064,8 +17781,12 @@ struct v7 *v7_create_opt(struct v7_mk_opts opts) {
     v7->gc_min_asn = 0;
 #endif
 
+    v7->no_bcode_opt = !!opts.no_bcode_opt;
+
     v7->cur_dense_prop =
         (struct v7_property *) calloc(1, sizeof(struct v7_property));
+    shapes_init(v7);
+    atoms_init(v7);
     gc_arena_init(&v7->generic_object_arena, sizeof(struct v7_generic_object),
                   opts.object_arena_size, 10, "object");
     v7->generic_object_arena.destructor = generic_object_destructor;
@@ -14135,6 +17856,8 @@ void v7_destroy(struct v7 *v7) {
   gc_arena_destroy(v7, &v7->generic_object_arena);
   gc_arena_destroy(v7, &v7->function_arena);
   gc_arena_destroy(v7, &v7->property_arena);
+  shapes_destroy(v7);
+  atoms_destroy(v7);
 
   mbuf_free(&v7->owned_strings);
   mbuf_free(&v7->owned_values);
@@ -14157,7 +17880,12 @@ void v7_destroy(struct v7 *v7) {
   }
 #endif
 
-  free(v7->call_stack);
+  call_frame_free(v7, v7->call_stack);
+  while (v7->free_frames != NULL) {
+    struct v7_call_frame *frame = v7->free_frames;
+    v7->free_frames = frame->prev;
+    free(frame);
+  }
 
   free(v7->cur_dense_prop);
   free(v7);
@@ -14168,14 +17896,34 @@ v7_val_t v7_get_this(struct v7 *v7) {
 }
 
 v7_val_t v7_get_arguments(struct v7 *v7) {
+  if (v7->vals.arguments == V7_TAG_NOVALUE) {
+    /* arguments are on the stack, see `call_cfunction()` */
+    val_t arr = v7_mk_dense_array(v7);
+    unsigned long i;
+
+    v7_own(v7, &arr);
+    for (i = 0; i < v7->args_cnt; i++) {
+      v7_array_push(v7, arr, v7_arg(v7, i));
+    }
+    v7_disown(v7, &arr);
+    v7->vals.arguments = arr;
+  }
   return v7->vals.arguments;
 }
 
 v7_val_t v7_arg(struct v7 *v7, unsigned long n) {
+  if (v7->vals.arguments == V7_TAG_NOVALUE) {
+    return n < v7->args_cnt
+               ? ((val_t *) (v7->stack.buf + v7->args_base))[n]
+               : v7_mk_undefined();
+  }
   return v7_array_get(v7, v7->vals.arguments, n);
 }
 
 unsigned long v7_argc(struct v7 *v7) {
+  if (v7->vals.arguments == V7_TAG_NOVALUE) {
+    return v7->args_cnt;
+  }
   return v7_array_length(v7, v7->vals.arguments);
 }
 
@@ -14370,6 +18118,39 @@ enum v7_err v7_apply(struct v7 *v7, v7_val_t func, v7_val_t this_obj,
   return b_apply(v7, func, this_obj, args, 0, res);
 }
 
+enum v7_err v7_call(struct v7 *v7, v7_val_t func, v7_val_t this_obj,
+                    const v7_val_t *argv, int argc, v7_val_t *res) {
+  struct v7_call_handle h;
+  call_handle_init(&h, func, this_obj);
+  return b_call(v7, &h, argv, argc, res);
+}
+
+struct v7_call_handle *v7_call_prepare(struct v7 *v7, v7_val_t func,
+                                       v7_val_t this_obj) {
+  struct v7_call_handle *h;
+
+  if (!v7_is_callable(v7, func)) return NULL;
+
+  h = (struct v7_call_handle *) malloc(sizeof(*h));
+  if (h == NULL) return NULL;
+  call_handle_init(h, func, this_obj);
+  v7_own(v7, &h->func);
+  v7_own(v7, &h->this_obj);
+  return h;
+}
+
+enum v7_err v7_call_prepared(struct v7 *v7, struct v7_call_handle *h,
+                             const v7_val_t *argv, int argc, v7_val_t *res) {
+  return b_call(v7, h, argv, argc, res);
+}
+
+void v7_call_handle_free(struct v7 *v7, struct v7_call_handle *h) {
+  if (h == NULL) return;
+  v7_disown(v7, &h->this_obj);
+  v7_disown(v7, &h->func);
+  free(h);
+}
+
 #ifndef NO_LIBC
 /*
  * Compile a given JS source into a given output representation.
@@ -14710,6 +18491,116 @@ V7_PRIVATE size_t unescape(const char *s, size_t len, char *to) {
   return n;
 }
 
+static uint32_t atom_hash(const char *p, size_t len) {
+  uint32_t h = 2166136261u;
+  while (len--) {
+    h = (h ^ (uint8_t) *p++) * 16777619u;
+  }
+  return h;
+}
+
+static const char *atom_data(struct v7 *v7, uint32_t idx, size_t *len) {
+  const struct v7_vec *v;
+  if (idx < ARRAY_SIZE(v_dictionary_strings)) {
+    *len = v_dictionary_strings[idx].len;
+    return v_dictionary_strings[idx].p;
+  }
+  v = &((struct v7_vec *) v7->atoms.buf)[idx - ARRAY_SIZE(v_dictionary_strings)];
+  *len = v->len;
+  return v->p;
+}
+
+static void atom_table_put(struct v7 *v7, uint64_t entry) {
+  uint32_t i = (uint32_t)(entry >> 32) & v7->atom_table_mask;
+  while (v7->atom_table[i] != 0) i = (i + 1) & v7->atom_table_mask;
+  v7->atom_table[i] = entry;
+}
+
+/* Returns index of the atom, or -1 */
+static int atom_find(struct v7 *v7, const char *p, size_t len, uint32_t hash) {
+  uint32_t i;
+  uint64_t e;
+
+  for (i = hash & v7->atom_table_mask; (e = v7->atom_table[i]) != 0;
+       i = (i + 1) & v7->atom_table_mask) {
+    if ((uint32_t)(e >> 32) == hash) {
+      size_t n;
+      const char *s = atom_data(v7, (uint32_t) e - 1, &n);
+      if (n == len && memcmp(s, p, len) == 0) return (int) (uint32_t) e - 1;
+    }
+  }
+  return -1;
+}
+
+V7_PRIVATE void atoms_init(struct v7 *v7) {
+  size_t i;
+
+  mbuf_init(&v7->atoms, 0);
+  v7->atom_table_mask = 1023;
+  v7->atom_table = (uint64_t *) calloc(v7->atom_table_mask + 1,
+                                       sizeof(*v7->atom_table));
+  for (i = 0; i < ARRAY_SIZE(v_dictionary_strings); i++) {
+    const struct v7_vec_const *v = &v_dictionary_strings[i];
+    if (v->len <= V7_ATOM_MAX_LEN) {
+      atom_table_put(v7, (uint64_t) atom_hash(v->p, v->len) << 32 | (i + 1));
+    }
+  }
+}
+
+V7_PRIVATE void atoms_destroy(struct v7 *v7) {
+  struct v7_vec *v = (struct v7_vec *) v7->atoms.buf;
+  size_t i, cnt = v7->atoms.len / sizeof(*v);
+
+  for (i = 0; i < cnt; i++) {
+    free(v[i].p);
+  }
+  mbuf_free(&v7->atoms);
+  free(v7->atom_table);
+  v7->atom_table = NULL;
+}
+
+V7_PRIVATE val_t v7_find_atom(struct v7 *v7, const char *p, size_t len) {
+  int idx;
+  if (len <= 5 || len > V7_ATOM_MAX_LEN) return V7_UNDEFINED;
+  idx = atom_find(v7, p, len, atom_hash(p, len));
+  return idx < 0 ? V7_UNDEFINED : (val_t) idx | V7_TAG_STRING_D;
+}
+
+V7_PRIVATE val_t v7_mk_atom(struct v7 *v7, const char *p, size_t len) {
+  size_t cnt = v7->atoms.len / sizeof(struct v7_vec);
+
+  if (len > 5 && len <= V7_ATOM_MAX_LEN && cnt < V7_ATOMS_MAX) {
+    uint32_t hash = atom_hash(p, len), idx, i;
+    struct v7_vec v;
+    int found = atom_find(v7, p, len, hash);
+
+    if (found >= 0) return (val_t) found | V7_TAG_STRING_D;
+
+    v.p = (char *) malloc(len + 1);
+    memcpy(v.p, p, len);
+    v.p[len] = '\0';
+    v.len = len;
+    mbuf_append(&v7->atoms, &v, sizeof(v));
+    idx = (uint32_t)(ARRAY_SIZE(v_dictionary_strings) + cnt);
+
+    if ((idx + 1) * 4 > (v7->atom_table_mask + 1) * 3) {
+      /* keep the table at most 3/4 full */
+      uint64_t *old = v7->atom_table;
+      uint32_t old_size = v7->atom_table_mask + 1;
+      v7->atom_table_mask = old_size * 2 - 1;
+      v7->atom_table = (uint64_t *) calloc(old_size * 2, sizeof(*old));
+      for (i = 0; i < old_size; i++) {
+        if (old[i] != 0) atom_table_put(v7, old[i]);
+      }
+      free(old);
+    }
+    atom_table_put(v7, (uint64_t) hash << 32 | (idx + 1));
+    return (val_t) idx | V7_TAG_STRING_D;
+  }
+
+  return v7_mk_string(v7, p, len, 1);
+}
+
 static int v_find_string_in_dictionary(const char *s, size_t len) {
   size_t start = 0, end = ARRAY_SIZE(v_dictionary_strings);
 
@@ -14899,9 +18790,13 @@ v7_val_t v7_mk_string(struct v7 *v7, const char *p, size_t len, int copy) {
       memcpy(s, p, len);
     }
     tag = V7_TAG_STRING_5;
-  } else if ((dict_index = v_find_string_in_dictionary(p, len)) >= 0) {
-    offset = 0;
-    GET_VAL_NAN_PAYLOAD(offset)[0] = dict_index;
+  } else if (p != NULL && len <= V7_ATOM_MAX_LEN &&
+             (dict_index = atom_find(v7, p, len, atom_hash(p, len))) >= 0) {
+    offset = dict_index;
+    tag = V7_TAG_STRING_D;
+  } else if (len > V7_ATOM_MAX_LEN &&
+             (dict_index = v_find_string_in_dictionary(p, len)) >= 0) {
+    offset = dict_index;
     tag = V7_TAG_STRING_D;
   } else if (copy) {
     compute_need_gc(v7);
@@ -14968,9 +18863,7 @@ const char *v7_get_string_data(struct v7 *v7, val_t *v, size_t *sizep) {
     p = GET_VAL_NAN_PAYLOAD(*v);
     *sizep = 5;
   } else if (tag == V7_TAG_STRING_D) {
-    int index = ((unsigned char *) GET_VAL_NAN_PAYLOAD(*v))[0];
-    *sizep = v_dictionary_strings[index].len;
-    p = v_dictionary_strings[index].p;
+    p = atom_data(v7, (uint32_t) *v, sizep);
   } else if (tag == V7_TAG_STRING_O) {
     size_t offset = (size_t) gc_string_val_to_offset(*v);
     char *s = v7->owned_strings.buf + offset;
@@ -15054,46 +18947,241 @@ static int v_sprintf_s(char *buf, size_t size, const char *fmt, ...) {
 
 v7_val_t v7_mk_array(struct v7 *v7) {
   val_t a = mk_object(v7, v7->vals.array_prototype);
-#if 0
+
+  v7_own(v7, &a);
   v7_def(v7, a, "", 0, _V7_DESC_HIDDEN(1), V7_NULL);
-#endif
+
+  /*
+   * Before setting a `V7_OBJ_DENSE_ARRAY` flag, make sure we don't have
+   * `V7_OBJ_FUNCTION` flag set
+   */
+  assert(!(v7_to_object(a)->attributes & V7_OBJ_FUNCTION));
+  v7_to_object(a)->attributes |= V7_OBJ_DENSE_ARRAY;
+
+  v7_disown(v7, &a);
   return a;
 }
 
-int v7_is_array(struct v7 *v7, val_t v) {
-  return v7_is_generic_object(v) &&
-         is_prototype_of(v7, v, v7->vals.array_prototype);
+int v7_is_array(struct v7 *v7, val_t v) {
+  return v7_is_generic_object(v) &&
+         is_prototype_of(v7, v, v7->vals.array_prototype);
+}
+
+/*
+ * Dense arrays are backed by mbuf, which is the value of their first, hidden
+ * property. Missing elements (holes) are `V7_TAG_NOVALUE`: in JS missing
+ * array indices are subtly different from indices with an undefined value
+ * (key iteration).
+ *
+ * Writes a bit past the end grow the array, see `V7_DENSE_ARRAY_MAX_GAP`.
+ * Farther writes, and elements with accessors or non-default attributes,
+ * demote the array to a plain object with a property per element.
+ */
+V7_PRIVATE val_t v7_mk_dense_array(struct v7 *v7) {
+  return v7_mk_array(v7);
+}
+
+/* The hidden property is the oldest one, see `v7_mk_array()` */
+static struct v7_property *dense_array_prop(struct v7_object *o) {
+  struct v7_property *p = o->properties;
+
+  while (p != NULL && p->next != NULL) {
+    p = p->next;
+  }
+  return p;
+}
+
+V7_PRIVATE struct mbuf *dense_array_buf(struct v7_object *o) {
+  struct v7_property *p = dense_array_prop(o);
+  return p != NULL ? (struct mbuf *) v7_to_foreign(p->value) : NULL;
+}
+
+/*
+ * The elements of a dense array, and the VM the array belongs to: the public
+ * `v7_next_prop()` makes the names of the elements with it
+ */
+struct dense_array_store {
+  struct mbuf buf; /* must be first, see `dense_array_buf()` */
+  struct v7 *v7;
+};
+
+/* Appends holes to the dense array up to `len` elements */
+static struct mbuf *dense_array_fill(struct v7 *v7, struct v7_object *o,
+                                     unsigned long len) {
+  struct v7_property *p = dense_array_prop(o);
+  struct mbuf *abuf = (struct mbuf *) v7_to_foreign(p->value);
+  val_t hole = V7_TAG_NOVALUE;
+
+  if (abuf == NULL) {
+    struct dense_array_store *store =
+        (struct dense_array_store *) malloc(sizeof(*store));
+    store->v7 = v7;
+    abuf = &store->buf;
+    mbuf_init(abuf, sizeof(val_t) * len);
+    p->value = v7_mk_foreign(abuf);
+  }
+  while (abuf->len < len * sizeof(val_t)) {
+    mbuf_append(abuf, (char *) &hole, sizeof(hole));
+  }
+  return abuf;
+}
+
+/*
+ * Checks that the name is a canonical array index, i.e. "1" but not "01"
+ * or "+1".
+ */
+V7_PRIVATE int is_array_index(const char *s, size_t len, unsigned long *res) {
+  uint64_t n = 0;
+  size_t i;
+
+  if (len == 0 || len > 10 || (s[0] == '0' && len > 1)) {
+    return 0;
+  }
+  for (i = 0; i < len; i++) {
+    if (s[i] < '0' || s[i] > '9') {
+      return 0;
+    }
+    n = n * 10 + (s[i] - '0');
+  }
+  if (n >= UINT32_MAX) {
+    return 0;
+  }
+  *res = (unsigned long) n;
+  return 1;
+}
+
+/*
+ * Stores the element of a dense array. Returns 0 if the write would leave the
+ * array too sparse, or add an element to a non-extensible array: the caller
+ * has to demote it then.
+ */
+V7_PRIVATE int dense_array_put(struct v7 *v7, val_t arr, unsigned long index,
+                               val_t v) {
+  struct v7_object *o = v7_to_object(arr);
+  struct mbuf *abuf = dense_array_buf(o);
+  unsigned long len = abuf != NULL ? abuf->len / sizeof(val_t) : 0;
+  val_t *vp;
+
+  (void) v7;
+  if (index < len) {
+    vp = (val_t *) abuf->buf + index;
+    if (*vp == V7_TAG_NOVALUE && (o->attributes & V7_OBJ_NOT_EXTENSIBLE)) {
+      return 0;
+    }
+    *vp = v;
+    return 1;
+  }
+
+  if ((o->attributes & V7_OBJ_NOT_EXTENSIBLE) ||
+      (index - len > V7_DENSE_ARRAY_MAX_GAP && index - len > len)) {
+    return 0;
+  }
+  abuf = dense_array_fill(v7, o, index);
+  mbuf_append(abuf, (char *) &v, sizeof(v));
+  return 1;
+}
+
+/*
+ * Turns a dense array into a plain object, with an own property per element.
+ */
+V7_PRIVATE void dense_array_demote(struct v7 *v7, val_t arr) {
+  struct v7_object *o = v7_to_object(arr);
+  v7_obj_attr_t not_extensible = o->attributes & V7_OBJ_NOT_EXTENSIBLE;
+  int saved_inhibit_gc = v7->inhibit_gc;
+  struct mbuf *abuf;
+  unsigned long i;
+
+  if (!(o->attributes & V7_OBJ_DENSE_ARRAY)) {
+    return;
+  }
+  abuf = dense_array_buf(o);
+
+  /* the elements are only in `abuf` until they become properties */
+  v7->inhibit_gc = 1;
+  o->attributes &= ~(V7_OBJ_DENSE_ARRAY | V7_OBJ_NOT_EXTENSIBLE);
+  v7_del(v7, arr, "", 0);
+
+  /* the newest property comes first, so does the first element */
+  for (i = abuf != NULL ? abuf->len / sizeof(val_t) : 0; i > 0; i--) {
+    val_t v = ((val_t *) abuf->buf)[i - 1];
+    if (v != V7_TAG_NOVALUE) {
+      char buf[20];
+      int n = v_sprintf_s(buf, sizeof(buf), "%lu", i - 1);
+      v7_def(v7, arr, buf, n, 0, v);
+    }
+  }
+
+  o->attributes |= not_extensible;
+  v7->inhibit_gc = saved_inhibit_gc;
+
+  if (abuf != NULL) {
+    mbuf_free(abuf);
+    free(abuf);
+  }
 }
 
 /*
- * Dense arrays are backed by mbuf. Currently the array can only grow by
- * appending (i.e. setting an element whose index == array.length)
- *
- * TODO(mkm): automatically promote dense arrays to normal objects
- *            when they are used as sparse arrays or to store arbitrary keys
- *            (perhaps a hybrid approach)
- * TODO(mkm): small sparsness doesn't have to promote the array,
- *            we can just fill empty slots with a tag. In JS missing array
- *            indices are subtly different from indices with an undefined value
- *            (key iteration).
- * TODO(mkm): change the interpreter so it can set elements in dense arrays
+ * Drops the elements past `len`, or adds holes up to it. Returns 0 if the
+ * array would be too sparse, see `dense_array_put()`.
  */
-V7_PRIVATE val_t v7_mk_dense_array(struct v7 *v7) {
-  val_t a = v7_mk_array(v7);
-#ifdef V7_ENABLE_DENSE_ARRAYS
-  v7_own(v7, &a);
-  v7_def(v7, a, "", 0, _V7_DESC_HIDDEN(1), V7_NULL);
+V7_PRIVATE int dense_array_set_length(struct v7 *v7, val_t arr,
+                                      unsigned long len) {
+  struct v7_object *o = v7_to_object(arr);
+  struct mbuf *abuf = dense_array_buf(o);
+  unsigned long cur = abuf != NULL ? abuf->len / sizeof(val_t) : 0;
 
-  /*
-   * Before setting a `V7_OBJ_DENSE_ARRAY` flag, make sure we don't have
-   * `V7_OBJ_FUNCTION` flag set
-   */
-  assert(!(v7_to_object(a)->attributes & V7_OBJ_FUNCTION));
-  v7_to_object(a)->attributes |= V7_OBJ_DENSE_ARRAY;
+  (void) v7;
+  if (len <= cur) {
+    if (abuf != NULL) {
+      abuf->len = len * sizeof(val_t);
+    }
+  } else if (len - cur > V7_DENSE_ARRAY_MAX_GAP && len - cur > cur) {
+    return 0;
+  } else {
+    dense_array_fill(v7, o, len);
+  }
+  return 1;
+}
 
-  v7_disown(v7, &a);
-#endif
-  return a;
+V7_PRIVATE int dense_array_get_v(struct v7 *v7, val_t arr, val_t key,
+                                 val_t *res) {
+  struct mbuf *abuf;
+  double d;
+  val_t v;
+
+  (void) v7;
+  if (!v7_is_number(key) || !v7_is_object(arr) ||
+      !(v7_to_object(arr)->attributes & V7_OBJ_DENSE_ARRAY) ||
+      (abuf = dense_array_buf(v7_to_object(arr))) == NULL) {
+    return 0;
+  }
+  d = v7_to_number(key);
+  if (!(d >= 0 && d < abuf->len / sizeof(val_t)) ||
+      d != (double) (unsigned long) d) {
+    return 0;
+  }
+  v = ((val_t *) abuf->buf)[(unsigned long) d];
+  if (v == V7_TAG_NOVALUE) {
+    /* holes look up the prototype */
+    return 0;
+  }
+  *res = v;
+  return 1;
+}
+
+V7_PRIVATE int dense_array_set_v(struct v7 *v7, val_t arr, val_t key,
+                                 val_t v) {
+  double d;
+
+  if (!v7_is_number(key) || !v7_is_object(arr) ||
+      !(v7_to_object(arr)->attributes & V7_OBJ_DENSE_ARRAY)) {
+    return 0;
+  }
+  d = v7_to_number(key);
+  if (!(d >= 0 && d < UINT32_MAX) || d != (double) (unsigned long) d) {
+    return 0;
+  }
+  return dense_array_put(v7, arr, (unsigned long) d, v);
 }
 
 /* TODO_V7_ERR */
@@ -15111,13 +19199,8 @@ val_t v7_array_get2(struct v7 *v7, val_t arr, unsigned long index, int *has) {
   }
   if (v7_is_object(arr)) {
     if (v7_to_object(arr)->attributes & V7_OBJ_DENSE_ARRAY) {
-      struct v7_property *p =
-          v7_get_own_property2(v7, arr, "", 0, _V7_PROPERTY_HIDDEN);
-      struct mbuf *abuf = NULL;
+      struct mbuf *abuf = dense_array_buf(v7_to_object(arr));
       unsigned long len;
-      if (p != NULL) {
-        abuf = (struct mbuf *) v7_to_foreign(p->value);
-      }
       if (abuf == NULL) {
         res = v7_mk_undefined();
         goto clean;
@@ -15153,104 +19236,6 @@ clean:
   return res;
 }
 
-#if V7_ENABLE_DENSE_ARRAYS
-
-/* Create V7 strings for integers such as array indices */
-static val_t ulong_to_str(struct v7 *v7, unsigned long n) {
-  char buf[100];
-  int len;
-  len = c_snprintf(buf, sizeof(buf), "%lu", n);
-  return v7_mk_string(v7, buf, len, 1);
-}
-
-/*
- * Pack 15-bit length and 15 bit index, leaving 2 bits for tag. the LSB has to
- * be set to distinguish it from a prop pointer.
- * In alternative we just fetch the length from obj at each call to v7_next_prop
- * and just stuff the index here (e.g. on 8/16-bit platforms).
- * TODO(mkm): conditional for 16-bit platforms
- */
-#define PACK_ITER(len, idx) \
-  ((struct v7_property *) ((len) << 17 | (idx) << 1 | 1))
-
-#define UNPACK_ITER_LEN(p) (((uintptr_t) p) >> 17)
-#define UNPACK_ITER_IDX(p) ((((uintptr_t) p) >> 1) & 0x7FFF)
-#define IS_PACKED_ITER(p) ((uintptr_t) p & 1)
-
-void *v7_next_prop(struct v7 *v7, val_t obj, void *h, val_t *name, val_t *val,
-                   v7_prop_attr_t *attrs) {
-  struct v7_property *p = (struct v7_property *) h;
-
-  if (v7_to_object(obj)->attributes & V7_OBJ_DENSE_ARRAY) {
-    /* This is a dense array. Find backing mbuf and fetch values from there */
-    struct v7_property *hp =
-        v7_get_own_property2(v7, obj, "", 0, _V7_PROPERTY_HIDDEN);
-    struct mbuf *abuf = NULL;
-    unsigned long len, idx;
-    if (hp != NULL) {
-      abuf = (struct mbuf *) v7_to_foreign(hp->value);
-    }
-    if (abuf == NULL) return NULL;
-    len = abuf->len / sizeof(val_t);
-    if (len == 0) return NULL;
-    idx = (p == NULL) ? 0 : UNPACK_ITER_IDX(p) + 1;
-    p = (idx == len) ? v7_to_object(obj)->properties : PACK_ITER(len, idx);
-    if (val != NULL) *val = ((val_t *) abuf->buf)[idx];
-    if (attrs != NULL) *attrs = 0;
-    if (name != NULL) {
-      char buf[20];
-      int n = v_sprintf_s(buf, sizeof(buf), "%lu", index);
-      *name = v7_mk_string(v7, buf, n, 1);
-    }
-  } else {
-    /* Ordinary object */
-    p = (p == NULL) ? v7_to_object(obj)->properties : p->next;
-    if (p != NULL) {
-      if (name != NULL) *name = p->name;
-      if (val != NULL) *val = p->value;
-      if (attrs != NULL) *attrs = p->attributes;
-    }
-  }
-
-  return p;
-}
-
-V7_PRIVATE val_t
-v7_iter_get_value(struct v7 *v7, val_t obj, struct v7_property *p) {
-  return IS_PACKED_ITER(p) ? v7_array_get(v7, obj, UNPACK_ITER_IDX(p))
-                           : p->value;
-}
-
-V7_PRIVATE val_t v7_iter_get_name(struct v7 *v7, struct v7_property *p) {
-  return IS_PACKED_ITER(p) ? ulong_to_str(v7, UNPACK_ITER_IDX(p)) : p->name;
-}
-
-V7_PRIVATE uint8_t v7_iter_get_attrs(struct v7_property *p) {
-  return IS_PACKED_ITER(p) ? 0 : p->attributes;
-}
-
-/* return array index as number or undefined. works with iterators */
-V7_PRIVATE enum v7_err v7_iter_get_index(struct v7 *v7, struct v7_property *p,
-                                         val_t *res) {
-  enum v7_err rcode = V7_OK;
-  int ok;
-  unsigned long res;
-  if (IS_PACKED_ITER(p)) {
-    *res = v7_mk_number(UNPACK_ITER_IDX(p));
-    goto clean;
-  }
-  V7_TRY(str_to_ulong(v7, p->name, &ok, &res));
-  if (!ok || res >= UINT32_MAX) {
-    goto clean;
-  }
-  *res = v7_mk_number(res);
-  goto clean;
-
-clean:
-  return rcode;
-}
-#endif
-
 /* TODO_V7_ERR */
 unsigned long v7_array_length(struct v7 *v7, val_t v) {
   enum v7_err rcode = V7_OK;
@@ -15262,24 +19247,11 @@ unsigned long v7_array_length(struct v7 *v7, val_t v) {
     goto clean;
   }
 
-#if V7_ENABLE_DENSE_ARRAYS
   if (v7_to_object(v)->attributes & V7_OBJ_DENSE_ARRAY) {
-    struct v7_property *p =
-        v7_get_own_property2(v7, v, "", 0, _V7_PROPERTY_HIDDEN);
-    struct mbuf *abuf;
-    if (p == NULL) {
-      len = 0;
-      goto clean;
-    }
-    abuf = (struct mbuf *) v7_to_foreign(p->value);
-    if (abuf == NULL) {
-      len = 0;
-      goto clean;
-    }
-    len = abuf->len / sizeof(val_t);
+    struct mbuf *abuf = dense_array_buf(v7_to_object(v));
+    len = abuf != NULL ? abuf->len / sizeof(val_t) : 0;
     goto clean;
   }
-#endif
 
   for (p = v7_to_object(v)->properties; p != NULL; p = p->next) {
     int ok = 0;
@@ -15321,45 +19293,11 @@ enum v7_err v7_array_set_throwing(struct v7 *v7, val_t arr, unsigned long index,
   int ires = -1;
 
   if (v7_is_object(arr)) {
-    if (v7_to_object(arr)->attributes & V7_OBJ_DENSE_ARRAY) {
-      struct v7_property *p =
-          v7_get_own_property2(v7, arr, "", 0, _V7_PROPERTY_HIDDEN);
-      struct mbuf *abuf;
-      unsigned long len;
-      assert(p != NULL);
-      abuf = (struct mbuf *) v7_to_foreign(p->value);
-
-      if (v7_to_object(arr)->attributes & V7_OBJ_NOT_EXTENSIBLE) {
-        if (v7->strict_mode) {
-          rcode = v7_throwf(v7, TYPE_ERROR, "Object is not extensible");
-          goto clean;
-        }
-
-        goto clean;
-      }
-
-      if (abuf == NULL) {
-        abuf = (struct mbuf *) malloc(sizeof(*abuf));
-        mbuf_init(abuf, sizeof(val_t) * (index + 1));
-        p->value = v7_mk_foreign(abuf);
-      }
-      len = abuf->len / sizeof(val_t);
-      /* TODO(mkm): possibly promote to sparse array */
-      if (index > len) {
-        unsigned long i;
-        val_t s = V7_TAG_NOVALUE;
-        for (i = len; i < index; i++) {
-          mbuf_append(abuf, (char *) &s, sizeof(val_t));
-        }
-        len = index;
-      }
-
-      if (index == len) {
-        mbuf_append(abuf, (char *) &v, sizeof(val_t));
-      } else {
-        memcpy(abuf->buf + index * sizeof(val_t), &v, sizeof(val_t));
-      }
+    if ((v7_to_object(arr)->attributes & V7_OBJ_DENSE_ARRAY) &&
+        dense_array_put(v7, arr, index, v)) {
+      ires = 0;
     } else {
+      /* `def_property_v()` demotes dense arrays it can't put the element in */
       char buf[20];
       int n = v_sprintf_s(buf, sizeof(buf), "%lu", index);
       {
@@ -15412,87 +19350,409 @@ enum v7_err v7_array_push_throwing(struct v7 *v7, v7_val_t arr, v7_val_t v,
 /* Amalgamated: #include "v7/src/eval.h" */
 /* Amalgamated: #include "v7/src/exceptions.h" */
 
-/*
- * Default property attributes (see `v7_prop_attr_t`)
- */
-#define V7_DEFAULT_PROPERTY_ATTRS 0
+/*
+ * Default property attributes (see `v7_prop_attr_t`)
+ */
+#define V7_DEFAULT_PROPERTY_ATTRS 0
+
+V7_PRIVATE val_t mk_object(struct v7 *v7, val_t prototype) {
+  struct v7_generic_object *o = new_generic_object(v7);
+  if (o == NULL) {
+    return V7_NULL;
+  }
+  (void) v7;
+#if defined(V7_ENABLE_ENTITY_IDS)
+  o->base.entity_id_base = V7_ENTITY_ID_PART_OBJ;
+  o->base.entity_id_spec = V7_ENTITY_ID_PART_GEN_OBJ;
+#endif
+  o->base.properties = NULL;
+  obj_prototype_set(v7, &o->base, v7_to_object(prototype));
+  return v7_object_to_value(&o->base);
+}
+
+v7_val_t v7_mk_object(struct v7 *v7) {
+  return mk_object(v7, v7->vals.object_prototype);
+}
+
+V7_PRIVATE val_t v7_object_to_value(struct v7_object *o) {
+  if (o == NULL) {
+    return V7_NULL;
+  } else if (o->attributes & V7_OBJ_FUNCTION) {
+    return pointer_to_value(o) | V7_TAG_FUNCTION;
+  } else {
+    return pointer_to_value(o) | V7_TAG_OBJECT;
+  }
+}
+
+V7_PRIVATE struct v7_generic_object *v7_to_generic_object(val_t v) {
+  struct v7_generic_object *ret = NULL;
+  if (v7_is_null(v)) {
+    ret = NULL;
+  } else {
+    assert(v7_is_generic_object(v));
+    ret = (struct v7_generic_object *) v7_to_pointer(v);
+#if defined(V7_ENABLE_ENTITY_IDS)
+    if (ret->base.entity_id_base != V7_ENTITY_ID_PART_OBJ) {
+      fprintf(stderr, "not a generic object!\n");
+      abort();
+    } else if (ret->base.entity_id_spec != V7_ENTITY_ID_PART_GEN_OBJ) {
+      fprintf(stderr, "not an object (but is a generic object)!\n");
+      abort();
+    }
+#endif
+  }
+  return ret;
+}
+
+V7_PRIVATE struct v7_object *v7_to_object(val_t v) {
+  struct v7_object *ret = NULL;
+  if (v7_is_null(v)) {
+    ret = NULL;
+  } else {
+    assert(v7_is_object(v));
+    ret = (struct v7_object *) v7_to_pointer(v);
+#if defined(V7_ENABLE_ENTITY_IDS)
+    if (ret->entity_id_base != V7_ENTITY_ID_PART_OBJ) {
+      fprintf(stderr, "not an object!\n");
+      abort();
+    }
+#endif
+  }
+  return ret;
+}
+
+int v7_is_object(val_t v) {
+  return (v & V7_TAG_MASK) == V7_TAG_OBJECT ||
+         (v & V7_TAG_MASK) == V7_TAG_FUNCTION;
+}
+
+V7_PRIVATE int v7_is_generic_object(val_t v) {
+  return (v & V7_TAG_MASK) == V7_TAG_OBJECT;
+}
+
+/* Object properties {{{ */
+
+V7_PRIVATE void shapes_init(struct v7 *v7) {
+  struct v7_shape root;
+
+  memset(&root, 0, sizeof(root));
+  mbuf_init(&v7->shapes, 0);
+  mbuf_append(&v7->shapes, &root, sizeof(root));
+
+  v7->shape_buckets_cnt = 64;
+  v7->shape_buckets =
+      (uint32_t *) calloc(v7->shape_buckets_cnt, sizeof(uint32_t));
+  v7->prop_epoch = 1;
+}
+
+V7_PRIVATE void prop_epoch_bump(struct v7 *v7) {
+  /* zeroed caches must never be valid */
+  if (++v7->prop_epoch == 0) v7->prop_epoch = 1;
+}
+
+V7_PRIVATE void shapes_destroy(struct v7 *v7) {
+  struct v7_shape *sh = (struct v7_shape *) v7->shapes.buf;
+  size_t i, cnt = v7->shapes.len / sizeof(*sh);
+
+  for (i = 0; i < cnt; i++) {
+    free(sh[i].name);
+    free(sh[i].table);
+  }
+  mbuf_free(&v7->shapes);
+  free(v7->shape_buckets);
+  v7->shape_buckets = NULL;
+}
+
+static struct v7_shape *shape_get(struct v7 *v7, uint32_t id) {
+  return &((struct v7_shape *) v7->shapes.buf)[id];
+}
+
+static uint32_t shape_name_hash(const char *name, size_t len) {
+  uint32_t h = 2166136261u;
+  while (len--) {
+    h = (h ^ (uint8_t) *name++) * 16777619u;
+  }
+  return h;
+}
+
+static size_t shape_bucket(struct v7 *v7, uint32_t parent, uint32_t hash) {
+  return (hash ^ (parent * 2654435761u)) & (v7->shape_buckets_cnt - 1);
+}
+
+static int shape_is(struct v7_shape *sh, uint32_t hash, const char *name,
+                    size_t len) {
+  return sh->hash == hash && sh->name_len == len &&
+         memcmp(sh->name, name, len) == 0;
+}
+
+/*
+ * Returns the shape which adds the name to the given one, creating it if
+ * needed, or `V7_SHAPE_DICT` if there are too many shapes already.
+ */
+static uint32_t shape_add_name(struct v7 *v7, uint32_t parent,
+                               const char *name, size_t len) {
+  uint32_t hash = shape_name_hash(name, len), id;
+  size_t b = shape_bucket(v7, parent, hash);
+  struct v7_shape sh;
+
+  for (id = v7->shape_buckets[b]; id != 0; id = shape_get(v7, id - 1)->next) {
+    struct v7_shape *p = shape_get(v7, id - 1);
+    if (p->parent == parent && shape_is(p, hash, name, len)) {
+      return id - 1;
+    }
+  }
+
+  id = (uint32_t)(v7->shapes.len / sizeof(sh));
+  if (id >= V7_SHAPES_MAX) {
+    return V7_SHAPE_DICT;
+  }
+
+  memset(&sh, 0, sizeof(sh));
+  sh.parent = parent;
+  sh.count = shape_get(v7, parent)->count + 1;
+  sh.hash = hash;
+  sh.name = (char *) malloc(len + 1);
+  memcpy(sh.name, name, len);
+  sh.name_len = len;
+  sh.next = v7->shape_buckets[b];
+  v7->shape_buckets[b] = id + 1;
+  mbuf_append(&v7->shapes, &sh, sizeof(sh));
+
+  if (id >= v7->shape_buckets_cnt) {
+    /* rehash all the chains into twice as many buckets */
+    uint32_t i, cnt = id + 1;
+    free(v7->shape_buckets);
+    v7->shape_buckets_cnt *= 2;
+    v7->shape_buckets =
+        (uint32_t *) calloc(v7->shape_buckets_cnt, sizeof(uint32_t));
+    for (i = 1; i < cnt; i++) {
+      struct v7_shape *p = shape_get(v7, i);
+      b = shape_bucket(v7, p->parent, p->hash);
+      p->next = v7->shape_buckets[b];
+      v7->shape_buckets[b] = i + 1;
+    }
+  }
+
+  return id;
+}
+
+static void shape_build_table(struct v7 *v7, struct v7_shape *sh) {
+  uint32_t size = 16, id;
+  while (size < sh->count * 2) size *= 2;
+
+  sh->table = (uint32_t *) calloc(size, sizeof(uint32_t));
+  sh->table_mask = size - 1;
+  for (id = (uint32_t)(sh - shape_get(v7, 0)); id != 0;
+       id = shape_get(v7, id)->parent) {
+    uint32_t i = shape_get(v7, id)->hash & sh->table_mask;
+    while (sh->table[i] != 0) i = (i + 1) & sh->table_mask;
+    sh->table[i] = id + 1;
+  }
+}
+
+V7_PRIVATE int shape_find(struct v7 *v7, uint32_t id, const char *name,
+                          size_t len) {
+  struct v7_shape *sh = shape_get(v7, id), *p;
+  uint32_t hash = shape_name_hash(name, len), i;
+
+  if (sh->count <= V7_SHAPE_LIST_MAX) {
+    for (; id != 0; id = p->parent) {
+      p = shape_get(v7, id);
+      if (shape_is(p, hash, name, len)) return (int) p->count - 1;
+    }
+    return -1;
+  }
+
+  if (sh->table == NULL) {
+    shape_build_table(v7, sh);
+  }
+  for (i = hash & sh->table_mask; sh->table[i] != 0;
+       i = (i + 1) & sh->table_mask) {
+    p = shape_get(v7, sh->table[i] - 1);
+    if (shape_is(p, hash, name, len)) return (int) p->count - 1;
+  }
+  return -1;
+}
+
+static struct v7_prop_index *prop_index_new(uint32_t size) {
+  struct v7_prop_index *ix = (struct v7_prop_index *) calloc(
+      1, sizeof(*ix) + (size - 1) * sizeof(ix->entries[0]));
+  ix->mask = size - 1;
+  return ix;
+}
+
+static void prop_index_put(struct v7_prop_index *ix, uint32_t hash,
+                           struct v7_property *p) {
+  uint32_t i = hash & ix->mask;
+  while (ix->entries[i].prop != NULL) i = (i + 1) & ix->mask;
+  ix->entries[i].hash = hash;
+  ix->entries[i].prop = p;
+  ix->count++;
+}
+
+static void obj_index_add(struct v7 *v7, struct v7_object *o,
+                          struct v7_property *p) {
+  struct v7_prop_index *ix = o->index;
+  size_t len;
+  const char *name = v7_get_string_data(v7, &p->name, &len);
+
+  if ((ix->count + 1) * 4 > (ix->mask + 1) * 3) {
+    /* keep it at most 3/4 full */
+    uint32_t i;
+    o->index = prop_index_new((ix->mask + 1) * 2);
+    for (i = 0; i <= ix->mask; i++) {
+      if (ix->entries[i].prop != NULL) {
+        prop_index_put(o->index, ix->entries[i].hash, ix->entries[i].prop);
+      }
+    }
+    free(ix);
+    ix = o->index;
+  }
+  prop_index_put(ix, shape_name_hash(name, len), p);
+}
+
+/* Attaches the index to the object if it has enough properties */
+static void obj_index_build(struct v7 *v7, struct v7_object *o) {
+  struct v7_property *p;
+  uint32_t cnt = 0, size = 32;
+
+  for (p = o->properties; p != NULL; p = p->next) cnt++;
+  if (cnt < V7_PROP_INDEX_MIN) return;
 
-V7_PRIVATE val_t mk_object(struct v7 *v7, val_t prototype) {
-  struct v7_generic_object *o = new_generic_object(v7);
-  if (o == NULL) {
-    return V7_NULL;
+  while (size * 3 < cnt * 4) size *= 2;
+  o->index = prop_index_new(size);
+  for (p = o->properties; p != NULL; p = p->next) {
+    obj_index_add(v7, o, p);
   }
-  (void) v7;
-#if defined(V7_ENABLE_ENTITY_IDS)
-  o->base.entity_id_base = V7_ENTITY_ID_PART_OBJ;
-  o->base.entity_id_spec = V7_ENTITY_ID_PART_GEN_OBJ;
-#endif
-  o->base.properties = NULL;
-  obj_prototype_set(v7, &o->base, v7_to_object(prototype));
-  return v7_object_to_value(&o->base);
 }
 
-v7_val_t v7_mk_object(struct v7 *v7) {
-  return mk_object(v7, v7->vals.object_prototype);
+static struct v7_property *obj_index_find(struct v7 *v7, struct v7_object *o,
+                                          const char *name, size_t len) {
+  struct v7_prop_index *ix = o->index;
+  uint32_t hash = shape_name_hash(name, len), i;
+
+  for (i = hash & ix->mask; ix->entries[i].prop != NULL;
+       i = (i + 1) & ix->mask) {
+    if (ix->entries[i].hash == hash) {
+      size_t n;
+      const char *s =
+          v7_get_string_data(v7, &ix->entries[i].prop->name, &n);
+      if (n == len && memcmp(s, name, len) == 0) {
+        return ix->entries[i].prop;
+      }
+    }
+  }
+  return NULL;
 }
 
-V7_PRIVATE val_t v7_object_to_value(struct v7_object *o) {
-  if (o == NULL) {
-    return V7_NULL;
-  } else if (o->attributes & V7_OBJ_FUNCTION) {
-    return pointer_to_value(o) | V7_TAG_FUNCTION;
-  } else {
-    return pointer_to_value(o) | V7_TAG_OBJECT;
+static void obj_index_del(struct v7 *v7, struct v7_object *o,
+                          struct v7_property *p) {
+  struct v7_prop_index *ix = o->index;
+  struct v7_prop_index_entry *e = ix->entries;
+  size_t len;
+  const char *name = v7_get_string_data(v7, &p->name, &len);
+  uint32_t i, j, k;
+
+  for (i = shape_name_hash(name, len) & ix->mask; e[i].prop != p;
+       i = (i + 1) & ix->mask) {
+    if (e[i].prop == NULL) return;
+  }
+  ix->count--;
+
+  /* shift back the entries which would become unreachable */
+  for (j = i;;) {
+    j = (j + 1) & ix->mask;
+    if (e[j].prop == NULL) break;
+    k = e[j].hash & ix->mask;
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+    e[i] = e[j];
+    i = j;
   }
+  e[i].prop = NULL;
 }
 
-V7_PRIVATE struct v7_generic_object *v7_to_generic_object(val_t v) {
-  struct v7_generic_object *ret = NULL;
-  if (v7_is_null(v)) {
-    ret = NULL;
-  } else {
-    assert(v7_is_generic_object(v));
-    ret = (struct v7_generic_object *) v7_to_pointer(v);
-#if defined(V7_ENABLE_ENTITY_IDS)
-    if (ret->base.entity_id_base != V7_ENTITY_ID_PART_OBJ) {
-      fprintf(stderr, "not a generic object!\n");
-      abort();
-    } else if (ret->base.entity_id_spec != V7_ENTITY_ID_PART_GEN_OBJ) {
-      fprintf(stderr, "not an object (but is a generic object)!\n");
-      abort();
-    }
-#endif
+V7_PRIVATE void obj_shape_drop(struct v7 *v7, struct v7_object *o) {
+  o->shape = V7_SHAPE_DICT;
+  free(o->index);
+  o->index = NULL;
+  if (!(o->attributes & V7_OBJ_OFF_HEAP)) {
+    obj_index_build(v7, o);
   }
-  return ret;
+  prop_epoch_bump(v7);
 }
 
-V7_PRIVATE struct v7_object *v7_to_object(val_t v) {
-  struct v7_object *ret = NULL;
-  if (v7_is_null(v)) {
-    ret = NULL;
+V7_PRIVATE void obj_prop_unlinked(struct v7 *v7, struct v7_object *o,
+                                  struct v7_property *p) {
+  /* a shape only grows, an object losing a property leaves it */
+  if (o->index != NULL && o->shape == V7_SHAPE_DICT) {
+    obj_index_del(v7, o, p);
+    prop_epoch_bump(v7);
   } else {
-    assert(v7_is_object(v));
-    ret = (struct v7_object *) v7_to_pointer(v);
-#if defined(V7_ENABLE_ENTITY_IDS)
-    if (ret->entity_id_base != V7_ENTITY_ID_PART_OBJ) {
-      fprintf(stderr, "not an object!\n");
-      abort();
-    }
-#endif
+    obj_shape_drop(v7, o);
   }
-  return ret;
 }
 
-int v7_is_object(val_t v) {
-  return (v & V7_TAG_MASK) == V7_TAG_OBJECT ||
-         (v & V7_TAG_MASK) == V7_TAG_FUNCTION;
-}
+V7_PRIVATE struct v7_property *obj_shape_slot(struct v7 *v7,
+                                              struct v7_object *o,
+                                              uint32_t idx, val_t name) {
+  struct v7_property *p = o->properties;
+  uint32_t n;
 
-V7_PRIVATE int v7_is_generic_object(val_t v) {
-  return (v & V7_TAG_MASK) == V7_TAG_OBJECT;
+  if (o->index != NULL) {
+    size_t len;
+    const char *s = v7_get_string_data(v7, &name, &len);
+    return obj_index_find(v7, o, s, len);
+  }
+  /* the list is newest first */
+  for (n = shape_get(v7, o->shape)->count - 1 - idx; n > 0; n--) p = p->next;
+  return p;
 }
 
-/* Object properties {{{ */
+/*
+ * Moves the object to the shape with the property which was just added to the
+ * head of its list.
+ */
+static void obj_shape_add(struct v7 *v7, struct v7_object *o) {
+  struct v7_property *p = o->properties;
+  const char *name;
+  size_t len;
+  uint32_t id, cnt;
+
+  if (o->attributes & (_V7_OBJ_WATCHED | V7_OBJ_OFF_HEAP)) {
+    prop_epoch_bump(v7);
+  }
+
+  /* frozen objects may live in read only memory, they just keep the list */
+  if (o->attributes & V7_OBJ_OFF_HEAP) return;
+  if (o->shape == V7_SHAPE_DICT) {
+    if (o->index != NULL) {
+      obj_index_add(v7, o, p);
+    } else {
+      obj_index_build(v7, o);
+    }
+    return;
+  }
+  if (o->shape == 0 && p->next != NULL) {
+    /* the list wasn't built here */
+    obj_shape_drop(v7, o);
+    return;
+  }
+
+  name = v7_get_string_data(v7, &p->name, &len);
+  id = shape_add_name(v7, o->shape, name, len);
+  if (id == V7_SHAPE_DICT || shape_get(v7, id)->count > V7_SHAPE_MAX_PROPS) {
+    obj_shape_drop(v7, o);
+    return;
+  }
+  o->shape = id;
+
+  cnt = shape_get(v7, id)->count;
+  if (o->index != NULL) {
+    obj_index_add(v7, o, p);
+  } else if (cnt >= V7_PROP_INDEX_MIN) {
+    obj_index_build(v7, o);
+  }
+}
 
 V7_PRIVATE struct v7_property *v7_mk_property(struct v7 *v7) {
   struct v7_property *p = new_property(v7);
@@ -15527,14 +19787,19 @@ V7_PRIVATE struct v7_property *v7_get_own_property2(struct v7 *v7, val_t obj,
    * a zero length string anyway, so this will change.
    */
   if (o->attributes & V7_OBJ_DENSE_ARRAY && len > 0) {
-    int ok, has;
-    unsigned long i = cstr_to_ulong(name, len, &ok);
-    if (ok) {
+    int has;
+    unsigned long i;
+    if (is_array_index(name, len, &i)) {
       v7->cur_dense_prop->value = v7_array_get2(v7, obj, i, &has);
-      return has ? v7->cur_dense_prop : NULL;
+      return has && attrs == 0 ? v7->cur_dense_prop : NULL;
     }
   }
 
+  if (o->index != NULL) {
+    p = obj_index_find(v7, o, name, len);
+    return (p != NULL && (attrs == 0 || (p->attributes & attrs))) ? p : NULL;
+  }
+
   if (len <= 5) {
     ss = v7_mk_string(v7, name, len, 1);
     for (p = o->properties; p != NULL; p = p->next) {
@@ -15549,17 +19814,25 @@ V7_PRIVATE struct v7_property *v7_get_own_property2(struct v7 *v7, val_t obj,
       }
     }
   } else {
+    /* names which are atoms are equal iff their values are */
+    ss = v7_find_atom(v7, name, len);
     for (p = o->properties; p != NULL; p = p->next) {
       size_t n;
-      const char *s = v7_get_string_data(v7, &p->name, &n);
+      const char *s;
 #if defined(V7_ENABLE_ENTITY_IDS)
       if (p->entity_id != V7_ENTITY_ID_PROP) {
         fprintf(stderr, "not a prop!=0x%x\n", p->entity_id);
         abort();
       }
 #endif
-      if (n == len && strncmp(s, name, len) == 0 &&
-          (attrs == 0 || (p->attributes & attrs))) {
+      if ((p->name & V7_TAG_MASK) == V7_TAG_STRING_D &&
+          len <= V7_ATOM_MAX_LEN) {
+        if (p->name != ss) continue;
+      } else {
+        s = v7_get_string_data(v7, &p->name, &n);
+        if (n != len || strncmp(s, name, len) != 0) continue;
+      }
+      if (attrs == 0 || (p->attributes & attrs)) {
         return p;
       }
     }
@@ -15850,6 +20123,21 @@ V7_PRIVATE enum v7_err def_property_v(struct v7 *v7, val_t obj, val_t name,
     goto clean;
   }
 
+  if (v7_to_object(obj)->attributes & V7_OBJ_DENSE_ARRAY) {
+    unsigned long index;
+    if (is_array_index(n, len, &index)) {
+      if (attrs_desc == 0 && dense_array_put(v7, obj, index, val)) {
+        prop = v7->cur_dense_prop;
+        prop->value = val;
+        goto clean;
+      }
+      dense_array_demote(v7, obj);
+    } else if (len == 0) {
+      /* that's the name of the hidden property with the elements */
+      dense_array_demote(v7, obj);
+    }
+  }
+
   prop = v7_get_own_property(v7, obj, n, len);
   if (prop == NULL) {
     /*
@@ -15871,6 +20159,16 @@ V7_PRIVATE enum v7_err def_property_v(struct v7 *v7, val_t obj, val_t name,
       goto clean;
     }
 
+    /*
+     * Names of objects with a shape become atoms, so that lookups with
+     * atoms compare them as values, see `v7_get_own_property2()`
+     */
+    if ((name & V7_TAG_MASK) != V7_TAG_STRING_D &&
+        !(v7_to_object(obj)->attributes & V7_OBJ_OFF_HEAP) &&
+        v7_to_object(obj)->shape != V7_SHAPE_DICT) {
+      name = v7_mk_atom(v7, n, len);
+    }
+
     if ((prop = v7_mk_property(v7)) == NULL) {
       prop = NULL; /* LCOV_EXCL_LINE */
       goto clean;
@@ -15881,6 +20179,7 @@ V7_PRIVATE enum v7_err def_property_v(struct v7 *v7, val_t obj, val_t name,
 
     prop->next = v7_to_object(obj)->properties;
     v7_to_object(obj)->properties = prop;
+    obj_shape_add(v7, v7_to_object(obj));
     goto clean;
   } else {
     /* Property already exists */
@@ -16010,7 +20309,8 @@ V7_PRIVATE int set_cfunc_prop(struct v7 *v7, val_t o, const char *name,
  * See comments in `v7.h`
  */
 int v7_del(struct v7 *v7, val_t obj, const char *name, size_t len) {
-  struct v7_property *prop, *prev;
+  struct v7_property *prop, *prev, *found = NULL;
+  struct v7_object *o;
 
   if (!v7_is_object(obj)) {
     return -1;
@@ -16018,16 +20318,45 @@ int v7_del(struct v7 *v7, val_t obj, const char *name, size_t len) {
   if (len == (size_t) ~0) {
     len = strlen(name);
   }
-  for (prev = NULL, prop = v7_to_object(obj)->properties; prop != NULL;
+  o = v7_to_object(obj);
+  if (o->attributes & V7_OBJ_DENSE_ARRAY) {
+    struct mbuf *abuf = dense_array_buf(o);
+    unsigned long index;
+    val_t *vp;
+    if (len == 0) {
+      /* the hidden property with the elements */
+      return -1;
+    }
+    if (is_array_index(name, len, &index)) {
+      /* elements are never removed, they become holes */
+      if (abuf == NULL || index >= abuf->len / sizeof(val_t) ||
+          *(vp = (val_t *) abuf->buf + index) == V7_TAG_NOVALUE) {
+        return -1;
+      }
+      *vp = V7_TAG_NOVALUE;
+      return 0;
+    }
+  }
+  if (o->index != NULL && (found = obj_index_find(v7, o, name, len)) == NULL) {
+    return -1;
+  }
+  for (prev = NULL, prop = o->properties; prop != NULL;
        prev = prop, prop = prop->next) {
-    size_t n;
-    const char *s = v7_get_string_data(v7, &prop->name, &n);
-    if (n == len && strncmp(s, name, len) == 0) {
+    int match;
+    if (found != NULL) {
+      match = (prop == found);
+    } else {
+      size_t n;
+      const char *s = v7_get_string_data(v7, &prop->name, &n);
+      match = (n == len && strncmp(s, name, len) == 0);
+    }
+    if (match) {
       if (prev) {
         prev->next = prop->next;
       } else {
-        v7_to_object(obj)->properties = prop->next;
+        o->properties = prop->next;
       }
+      obj_prop_unlinked(v7, o, prop);
       v7_destroy_property(&prop);
       return 0;
     }
@@ -16061,9 +20390,11 @@ clean:
   return rcode;
 }
 
-void *v7_next_prop(void *handle, v7_val_t obj, v7_val_t *name, v7_val_t *value,
-                   v7_prop_attr_t *attrs) {
+/* Steps over the property list only, see `v7_next_prop()` */
+static void *obj_next_list_prop(void *handle, val_t obj, val_t *name,
+                                val_t *value, v7_prop_attr_t *attrs) {
   struct v7_property *p;
+
   if (handle == NULL) {
     p = v7_to_object(obj)->properties;
   } else {
@@ -16077,6 +20408,77 @@ void *v7_next_prop(void *handle, v7_val_t obj, v7_val_t *name, v7_val_t *value,
   return p;
 }
 
+/*
+ * Steps over the elements of a dense array, skipping holes: from the first
+ * one if `dir` is 1, from the last one if it is -1. Their handles are odd
+ * numbers with the index of the element in the upper bits. Returns NULL past
+ * the elements.
+ */
+static void *dense_array_next_elem(struct v7 *v7, void *handle, val_t obj,
+                                   int dir, val_t *name, val_t *value,
+                                   v7_prop_attr_t *attrs) {
+  struct mbuf *abuf = dense_array_buf(v7_to_object(obj));
+  uintptr_t len = abuf != NULL ? abuf->len / sizeof(val_t) : 0, i;
+
+  if (handle == NULL) {
+    i = dir > 0 ? 0 : len - 1;
+  } else {
+    i = ((uintptr_t) handle >> 1) + dir;
+  }
+  /* going down, `i` wraps past 0 */
+  for (; i < len; i += dir) {
+    val_t v = ((val_t *) abuf->buf)[i];
+    if (v != V7_TAG_NOVALUE) {
+      if (name != NULL) {
+        char buf[20];
+        int n = c_snprintf(buf, sizeof(buf), "%lu", (unsigned long) i);
+        *name = v7_mk_string(v7, buf, n, 1);
+      }
+      if (value != NULL) *value = v;
+      if (attrs != NULL) *attrs = 0;
+      return (void *) (i << 1 | 1);
+    }
+  }
+  return NULL;
+}
+
+void *v7_next_prop(void *handle, v7_val_t obj, v7_val_t *name, v7_val_t *value,
+                   v7_prop_attr_t *attrs) {
+  struct v7_object *o = v7_to_object(obj);
+
+  /*
+   * Elements of dense arrays come first, from the last one: the order in
+   * which they were listed when arrays kept them as properties
+   */
+  if ((o->attributes & V7_OBJ_DENSE_ARRAY) &&
+      (handle == NULL || ((uintptr_t) handle & 1))) {
+    struct mbuf *abuf = dense_array_buf(o);
+    if (abuf != NULL) {
+      struct v7 *v7 = ((struct dense_array_store *) abuf)->v7;
+      handle = dense_array_next_elem(v7, handle, obj, -1, name, value, attrs);
+      if (handle != NULL) return handle;
+    }
+    handle = NULL;
+  }
+
+  return obj_next_list_prop(handle, obj, name, value, attrs);
+}
+
+V7_PRIVATE void *obj_next_prop(struct v7 *v7, void *handle, val_t obj,
+                               val_t *name, val_t *value,
+                               v7_prop_attr_t *attrs) {
+  struct v7_object *o = v7_to_object(obj);
+
+  /* elements of dense arrays come first, in order */
+  if ((o->attributes & V7_OBJ_DENSE_ARRAY) &&
+      (handle == NULL || ((uintptr_t) handle & 1))) {
+    handle = dense_array_next_elem(v7, handle, obj, 1, name, value, attrs);
+    if (handle != NULL) return handle;
+  }
+
+  return obj_next_list_prop(handle, obj, name, value, attrs);
+}
+
 /* }}} Object properties */
 
 /* Object prototypes {{{ */
@@ -16084,11 +20486,13 @@ void *v7_next_prop(void *handle, v7_val_t obj, v7_val_t *name, v7_val_t *value,
 V7_PRIVATE int obj_prototype_set(struct v7 *v7, struct v7_object *obj,
                                  struct v7_object *proto) {
   int ret = -1;
-  (void) v7;
 
   if (obj->attributes & V7_OBJ_FUNCTION) {
     ret = -1;
   } else {
+    if (obj->attributes & (_V7_OBJ_WATCHED | V7_OBJ_OFF_HEAP)) {
+      prop_epoch_bump(v7);
+    }
     ((struct v7_generic_object *) obj)->prototype = proto;
     ret = 0;
   }
@@ -16965,7 +21369,7 @@ V7_PRIVATE enum v7_err to_json_or_debug(struct v7 *v7, val_t v, char *buf,
 
       mbuf_append(&v7->json_visited_stack, (char *) &v, sizeof(v));
       b += c_snprintf(b, BUF_LEFT(size, b - buf), "{");
-      while ((h = v7_next_prop(h, v, &name, &val, &attrs)) != NULL) {
+      while ((h = obj_next_prop(v7, h, v, &name, &val, &attrs)) != NULL) {
         size_t n;
         const char *s;
         if (attrs & (_V7_PROPERTY_HIDDEN | V7_PROPERTY_NON_ENUMERABLE)) {
@@ -17167,6 +21571,7 @@ static void gc_free_block(struct gc_block *b);
 static void gc_mark_mbuf_pt(struct v7 *v7, const struct mbuf *mbuf);
 static void gc_mark_mbuf_val(struct v7 *v7, const struct mbuf *mbuf);
 static void gc_mark_vec_val(struct v7 *v7, const struct v7_vec *vec);
+static void gc_mark_bcode(struct v7 *v7, const struct bcode *bcode);
 
 V7_PRIVATE struct v7_generic_object *new_generic_object(struct v7 *v7) {
   return (struct v7_generic_object *) gc_alloc_cell(v7,
@@ -17418,40 +21823,12 @@ void gc_sweep(struct v7 *v7, struct gc_arena *a, size_t start) {
   }
 }
 
-/*
- * dense arrays contain only one property pointing to an mbuf with array values.
- */
-V7_PRIVATE void gc_mark_dense_array(struct v7 *v7,
-                                    struct v7_generic_object *obj) {
-  val_t v;
-  struct mbuf *mbuf;
-  val_t *vp;
-
-#if 0
-  /* TODO(mkm): use this when dense array promotion is implemented */
-  v = obj->properties->value;
-#else
-  v = v7_get(v7, v7_object_to_value(&obj->base), "", 0);
-#endif
-
-  mbuf = (struct mbuf *) v7_to_foreign(v);
-
-  /* function scope pointer is aliased to the object's prototype pointer */
-  gc_mark(v7, v7_object_to_value(obj_prototype(v7, &obj->base)));
-  MARK(obj);
-
-  if (mbuf == NULL) return;
-  for (vp = (val_t *) mbuf->buf; (char *) vp < mbuf->buf + mbuf->len; vp++) {
-    gc_mark(v7, *vp);
-    gc_mark_string(v7, vp);
-  }
-  UNMARK(obj);
-}
-
 V7_PRIVATE void gc_mark(struct v7 *v7, val_t v) {
   struct v7_object *obj_base;
   struct v7_property *prop;
   struct v7_property *next;
+  struct mbuf *abuf = NULL;
+  val_t *vp;
 
   if (!v7_is_object(v)) {
     return;
@@ -17482,14 +21859,26 @@ V7_PRIVATE void gc_mark(struct v7 *v7, val_t v) {
   }
 #endif
 
+  /*
+   * The mark bit shares the word with the property list: read the list, and
+   * the elements of a dense array kept in it, before setting the bit
+   */
+  prop = obj_base->properties;
   if (obj_base->attributes & V7_OBJ_DENSE_ARRAY) {
-    struct v7_generic_object *obj = v7_to_generic_object(v);
-    gc_mark_dense_array(v7, obj);
+    abuf = dense_array_buf(obj_base);
+  }
+
+  /* mark object itself, the elements of a dense array, and its properties */
+  MARK(obj_base);
+
+  if (abuf != NULL) {
+    for (vp = (val_t *) abuf->buf; (char *) vp < abuf->buf + abuf->len; vp++) {
+      gc_mark(v7, *vp);
+      gc_mark_string(v7, vp);
+    }
   }
 
-  /* mark object itself, and its properties */
-  for ((prop = obj_base->properties), MARK(obj_base); prop != NULL;
-       prop = next) {
+  for (; prop != NULL; prop = next) {
     if (prop->attributes & _V7_PROPERTY_OFF_HEAP) {
       break;
     }
@@ -17519,10 +21908,12 @@ V7_PRIVATE void gc_mark(struct v7 *v7, val_t v) {
     struct v7_js_function *func = to_js_function(v);
 
     /* mark function's scope */
-    gc_mark(v7, v7_object_to_value(&func->scope->base));
+    if (func->scope != NULL) {
+      gc_mark(v7, v7_object_to_value(&func->scope->base));
+    }
 
     if (func->bcode != NULL) {
-      gc_mark_vec_val(v7, &func->bcode->lit);
+      gc_mark_bcode(v7, func->bcode);
     }
   }
 }
@@ -17907,6 +22298,14 @@ static void gc_mark_vec_val(struct v7 *v7, const struct v7_vec *vec) {
   gc_mark_val_array(v7, (val_t *) vec->p, vec->len / sizeof(val_t));
 }
 
+/*
+ * mark the literal table of a bcode, and the values made from its `ops`
+ */
+static void gc_mark_bcode(struct v7 *v7, const struct bcode *bcode) {
+  gc_mark_vec_val(v7, &bcode->lit);
+  gc_mark_val_array(v7, bcode->vals, bcode->vals_cnt);
+}
+
 /*
  * mark an mbuf containing foreign pointers to `struct bcode`
  */
@@ -17914,7 +22313,7 @@ static void gc_mark_mbuf_bcode_pt(struct v7 *v7, const struct mbuf *mbuf) {
   struct bcode **vp;
   for (vp = (struct bcode **) mbuf->buf; (char *) vp < mbuf->buf + mbuf->len;
        vp++) {
-    gc_mark_vec_val(v7, &(*vp)->lit);
+    gc_mark_bcode(v7, *vp);
   }
 }
 
@@ -17969,6 +22368,9 @@ void v7_gc(struct v7 *v7, int full) {
   gc_sweep(v7, &v7->property_arena, 0);
 #endif
 
+  /* cached lookups may refer to dead cells, and their names were moved */
+  prop_epoch_bump(v7);
+
   gc_dump_arena_stats("After GC objects", &v7->generic_object_arena);
   gc_dump_arena_stats("After GC functions", &v7->function_arena);
   gc_dump_arena_stats("After GC properties", &v7->property_arena);
@@ -18118,10 +22520,10 @@ V7_PRIVATE void freeze_obj(FILE *f, v7_val_t v) {
             );
     fprintf(f,
             "{\"type\":\"bcode\", \"addr\":\"%p\", \"args_cnt\":%d, "
-            "\"names_cnt\":%d, "
+            "\"names_cnt\":%d, \"max_stack\":%d, "
             "\"strict_mode\": %d, \"ops\":%s, \"lit\":%s}\n",
             (void *) bcode, bcode->args_cnt, bcode->names_cnt,
-            bcode->strict_mode, jops, jlit);
+            (int) bcode->max_stack, bcode->strict_mode, jops, jlit);
     free(jops);
     free(jlit);
   } else {
@@ -18275,6 +22677,7 @@ enum my_fid {
   /* parse_prefix function */
   fid_parse_prefix,
   fid_p_prefix_1,
+  fid_p_prefix_2,
 
   /* parse_postfix function */
   fid_parse_postfix,
@@ -18292,6 +22695,7 @@ enum my_fid {
   fid_p_newexpr_2,
   fid_p_newexpr_3,
   fid_p_newexpr_4,
+  fid_p_newexpr_5,
 
   /* parse_terminal function */
   fid_parse_terminal,
@@ -18469,6 +22873,7 @@ typedef struct fid_parse_body_locals {
   struct fid_parse_body_arg arg;
 
   ast_off_t start;
+  uint8_t kind;
 } fid_parse_body_locals_t;
 
 #define CALL_PARSE_BODY(_end, _label) \
@@ -18824,6 +23229,8 @@ typedef cr_zero_size_type_t fid_parse_ident_allow_reserved_words_locals_t;
 typedef struct fid_parse_funcdecl_arg {
   uint8_t require_named;
   uint8_t reserved_name;
+  /* `AST_GENERATOR`, `AST_ASYNC` or `AST_NOP`, see `parse_function_kind()` */
+  uint8_t kind;
 } fid_parse_funcdecl_arg_t;
 
 /* parse_funcdecl's data on stack */
@@ -18834,13 +23241,16 @@ typedef struct fid_parse_funcdecl_locals {
   ast_off_t outer_last_var_node;
   uint8_t saved_in_function;
   uint8_t saved_in_strict;
+  uint8_t saved_in_generator;
+  uint8_t saved_in_async;
 } fid_parse_funcdecl_locals_t;
 
-#define CALL_PARSE_FUNCDECL(_require_named, _reserved_name, _label) \
-  do {                                                              \
-    N.fid_parse_funcdecl.require_named = (_require_named);          \
-    N.fid_parse_funcdecl.reserved_name = (_reserved_name);          \
-    CR_CALL(fid_parse_funcdecl, _label);                            \
+#define CALL_PARSE_FUNCDECL(_require_named, _reserved_name, _kind, _label) \
+  do {                                                                     \
+    N.fid_parse_funcdecl.require_named = (_require_named);                 \
+    N.fid_parse_funcdecl.reserved_name = (_reserved_name);                 \
+    N.fid_parse_funcdecl.kind = (_kind);                                   \
+    CR_CALL(fid_parse_funcdecl, _label);                                   \
   } while (0)
 /* }}} */
 
@@ -19181,6 +23591,8 @@ static const struct cr_func_desc _fid_descrs[MY_FID_CNT] = {
     {CR_LOCALS_SIZEOF(fid_parse_prefix_locals_t)},
     /* fid_p_prefix_1 */
     {CR_LOCALS_SIZEOF(fid_parse_prefix_locals_t)},
+    /* fid_p_prefix_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_prefix_locals_t)},
 
     /* fid_parse_postfix ----------------------------------------- */
     /* fid_parse_postfix */
@@ -19209,6 +23621,8 @@ static const struct cr_func_desc _fid_descrs[MY_FID_CNT] = {
     {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
     /* fid_p_newexpr_4 */
     {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
+    /* fid_p_newexpr_5 */
+    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
 
     /* fid_parse_terminal ----------------------------------------- */
     /* fid_parse_terminal */
@@ -19468,6 +23882,46 @@ static enum v7_tok lookahead(const struct v7 *v7) {
   return get_tok(&s, &d, v7->cur_tok);
 }
 
+/* Whether the tokens are `async function` */
+static int is_async_function(struct v7 *v7) {
+  return v7->cur_tok == TOK_IDENTIFIER && v7->tok_len == 5 &&
+         strncmp(v7->tok, "async", 5) == 0 && lookahead(v7) == TOK_FUNCTION;
+}
+
+/*
+ * Skips `function`, `function *` or `async function` and returns the marker
+ * of the body of such a function: `AST_NOP` for a plain one.
+ */
+static enum ast_tag parse_function_kind(struct v7 *v7) {
+  enum ast_tag kind = AST_NOP;
+  if (v7->cur_tok == TOK_IDENTIFIER) {
+    kind = AST_ASYNC;
+    next_tok(v7);
+  }
+  next_tok(v7);
+  if (kind == AST_NOP && v7->cur_tok == TOK_MUL) {
+    kind = AST_GENERATOR;
+    next_tok(v7);
+  }
+  return kind;
+}
+
+/* Whether `yield` goes without the value */
+static int is_bare_yield(struct v7 *v7) {
+  switch (v7->cur_tok) {
+    case TOK_CLOSE_PAREN:
+    case TOK_CLOSE_BRACKET:
+    case TOK_CLOSE_CURLY:
+    case TOK_COMMA:
+    case TOK_SEMICOLON:
+    case TOK_COLON:
+    case TOK_END_OF_INPUT:
+      return 1;
+    default:
+      return v7->after_newline;
+  }
+}
+
 static int parse_optional(struct v7 *v7, struct ast *a,
                           enum v7_tok terminator) {
   if (v7->cur_tok != terminator) {
@@ -19565,6 +24019,7 @@ _cr_iter_begin:
 
     CR_DEFINE_ENTRY_POINT(fid_parse_prefix);
     CR_DEFINE_ENTRY_POINT(fid_p_prefix_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_prefix_2);
 
     CR_DEFINE_ENTRY_POINT(fid_parse_postfix);
     CR_DEFINE_ENTRY_POINT(fid_p_postfix_1);
@@ -19579,6 +24034,7 @@ _cr_iter_begin:
     CR_DEFINE_ENTRY_POINT(fid_p_newexpr_2);
     CR_DEFINE_ENTRY_POINT(fid_p_newexpr_3);
     CR_DEFINE_ENTRY_POINT(fid_p_newexpr_4);
+    CR_DEFINE_ENTRY_POINT(fid_p_newexpr_5);
 
     CR_DEFINE_ENTRY_POINT(fid_parse_terminal);
     CR_DEFINE_ENTRY_POINT(fid_p_terminal_1);
@@ -19724,7 +24180,8 @@ fid_parse_body :
 #define L CR_CUR_LOCALS_PT(fid_parse_body_locals_t)
 {
   while (v7->cur_tok != L->arg.end) {
-    if (ACCEPT(TOK_FUNCTION)) {
+    if (v7->cur_tok == TOK_FUNCTION || is_async_function(v7)) {
+      L->kind = parse_function_kind(v7);
       if (v7->cur_tok != TOK_IDENTIFIER) {
         CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
       }
@@ -19735,7 +24192,7 @@ fid_parse_body :
       v7->last_var_node = L->start;
       ast_add_inlined_node(a, AST_FUNC_DECL, v7->tok, v7->tok_len);
 
-      CALL_PARSE_FUNCDECL(1, 0, fid_p_body_1);
+      CALL_PARSE_FUNCDECL(1, 0, L->kind, fid_p_body_1);
       ast_set_skip(a, L->start, AST_END_SKIP);
     } else {
       CALL_PARSE_STATEMENT(fid_p_body_2);
@@ -19973,6 +24430,25 @@ fid_parse_prefix :
         next_tok(v7);
         ast_add_node(a, AST_TYPEOF);
         break;
+      case TOK_IDENTIFIER:
+        /* `yield` and `await` are only special in such functions */
+        if (v7->pstate.in_generator && v7->tok_len == 5 &&
+            strncmp(v7->tok, "yield", 5) == 0) {
+          next_tok(v7);
+          ast_add_node(a, AST_YIELD);
+          if (is_bare_yield(v7)) {
+            ast_add_node(a, AST_UNDEFINED);
+          } else {
+            CALL_PARSE_ASSIGN(fid_p_prefix_2);
+          }
+          CR_RETURN_VOID();
+        } else if (v7->pstate.in_async && v7->tok_len == 5 &&
+                   strncmp(v7->tok, "await", 5) == 0) {
+          next_tok(v7);
+          ast_add_node(a, AST_AWAIT);
+          break;
+        }
+      /* fall through */
       default:
         CALL_PARSE_POSTFIX(fid_p_prefix_1);
         CR_RETURN_VOID();
@@ -20049,10 +24525,13 @@ fid_parse_newexpr :
       ast_set_skip(a, L->start, AST_END_SKIP);
       break;
     case TOK_FUNCTION:
-      next_tok(v7);
-      CALL_PARSE_FUNCDECL(0, 0, fid_p_newexpr_2);
+      CALL_PARSE_FUNCDECL(0, 0, parse_function_kind(v7), fid_p_newexpr_2);
       break;
     default:
+      if (is_async_function(v7)) {
+        CALL_PARSE_FUNCDECL(0, 0, parse_function_kind(v7), fid_p_newexpr_5);
+        break;
+      }
       CALL_PARSE_TERMINAL(fid_p_newexpr_1);
       break;
   }
@@ -20227,6 +24706,8 @@ fid_parse_funcdecl :
   L->outer_last_var_node = v7->last_var_node;
   L->saved_in_function = v7->pstate.in_function;
   L->saved_in_strict = v7->pstate.in_strict;
+  L->saved_in_generator = v7->pstate.in_generator;
+  L->saved_in_async = v7->pstate.in_async;
 
   v7->last_var_node = L->start;
   ast_modify_skip(a, L->start, L->start, AST_FUNC_FIRST_VAR_SKIP);
@@ -20258,6 +24739,13 @@ fid_parse_funcdecl :
   v7->pstate.in_function = 1;
   EXPECT(TOK_OPEN_CURLY);
 
+  /* the marker goes first in the body, see `compile_body()` */
+  if (L->arg.kind != AST_NOP) {
+    ast_add_node(a, (enum ast_tag) L->arg.kind);
+  }
+  v7->pstate.in_generator = (L->arg.kind == AST_GENERATOR);
+  v7->pstate.in_async = (L->arg.kind == AST_ASYNC);
+
   CR_TRY(fid_p_funcdecl_5);
   {
     CALL_PARSE_USE_STRICT(fid_p_funcdecl_7);
@@ -20270,6 +24758,8 @@ fid_parse_funcdecl :
   EXPECT(TOK_CLOSE_CURLY);
   v7->pstate.in_strict = L->saved_in_strict;
   v7->pstate.in_function = L->saved_in_function;
+  v7->pstate.in_generator = L->saved_in_generator;
+  v7->pstate.in_async = L->saved_in_async;
   ast_set_skip(a, L->start, AST_END_SKIP);
   v7->last_var_node = L->outer_last_var_node;
 
@@ -20377,19 +24867,19 @@ fid_parse_prop :
       strncmp(v7->tok, "get", v7->tok_len) == 0 && lookahead(v7) != TOK_COLON) {
     next_tok(v7);
     ast_add_node(a, AST_GETTER);
-    CALL_PARSE_FUNCDECL(1, 1, fid_p_prop_1_getter);
+    CALL_PARSE_FUNCDECL(1, 1, AST_NOP, fid_p_prop_1_getter);
   } else
 #endif
       if (v7->cur_tok == TOK_IDENTIFIER && lookahead(v7) == TOK_OPEN_PAREN) {
     /* ecmascript 6 feature */
-    CALL_PARSE_FUNCDECL(1, 1, fid_p_prop_2);
+    CALL_PARSE_FUNCDECL(1, 1, AST_NOP, fid_p_prop_2);
 #ifdef V7_ENABLE_JS_SETTERS
   } else if (v7->cur_tok == TOK_IDENTIFIER && v7->tok_len == 3 &&
              strncmp(v7->tok, "set", v7->tok_len) == 0 &&
              lookahead(v7) != TOK_COLON) {
     next_tok(v7);
     ast_add_node(a, AST_SETTER);
-    CALL_PARSE_FUNCDECL(1, 1, fid_p_prop_3_setter);
+    CALL_PARSE_FUNCDECL(1, 1, AST_NOP, fid_p_prop_3_setter);
 #endif
   } else {
     /* Allow reserved words as property names. */
@@ -20946,6 +25436,7 @@ clean:
   return rcode;
 }
 
+/* Adds the name at `pos` to the literals, as an atom */
 static lit_t string_lit(struct bcode_builder *bbuilder, struct ast *a,
                         ast_off_t *pos) {
   size_t i, name_len;
@@ -20974,7 +25465,81 @@ static lit_t string_lit(struct bcode_builder *bbuilder, struct ast *a,
   (void) v;
   (void) m;
 #endif
-  return bcode_add_lit(bbuilder, v7_mk_string(bbuilder->v7, name, name_len, 1));
+  return bcode_add_lit(bbuilder, v7_mk_atom(bbuilder->v7, name, name_len));
+}
+
+/* Returns index of the named frame slot, or -1 if there is no such slot */
+static int frame_slot_find(struct mbuf *slots, const char *name, size_t len) {
+  struct frame_slot *fs = (struct frame_slot *) slots->buf;
+  int i, cnt = (int) (slots->len / sizeof(*fs));
+  for (i = 0; i < cnt; i++) {
+    if (fs[i].len == len && memcmp(fs[i].name, name, len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Variable reference: either a frame slot of the current function, or a name
+ * literal to look up in the scope chain.
+ */
+struct var_ref {
+  int slot;
+  lit_t lit;
+};
+
+/* Like `string_lit()`, but for an identifier which names a variable */
+static struct var_ref var_ref(struct bcode_builder *bbuilder, struct ast *a,
+                              ast_off_t *pos) {
+  struct var_ref ref;
+  size_t name_len;
+  char *name = ast_get_inlined_data(a, *pos, &name_len);
+
+  memset(&ref, 0, sizeof(ref));
+  ref.slot = frame_slot_find(&bbuilder->slots, name, name_len);
+  if (ref.slot >= 0) {
+    ast_move_to_children(a, pos);
+  } else {
+    ref.lit = string_lit(bbuilder, a, pos);
+  }
+  return ref;
+}
+
+/*
+ * Emits a variable access, `op` is one of `OP_GET_VAR`, `OP_SAFE_GET_VAR` and
+ * `OP_SET_VAR`. Frame slots always exist, so `OP_SAFE_GET_VAR` of a slot is
+ * just an `OP_GET_LOCAL`.
+ */
+static void bcode_op_var(struct bcode_builder *bbuilder, uint8_t op,
+                         const struct var_ref *ref) {
+  if (ref->slot < 0) {
+    bcode_op_lit(bbuilder, op, ref->lit);
+  } else {
+    bcode_op(bbuilder, op == OP_SET_VAR ? OP_SET_LOCAL : OP_GET_LOCAL);
+    bcode_add_varint(bbuilder, (size_t) ref->slot);
+  }
+}
+
+/*
+ * Emits `++a`, `a++`, `--a` or `a--` of a variable. `OP_INC_VAR` and the like
+ * leave the value the variable had, as a number; the prefix forms add one to
+ * it again (`bcode_optimize()` drops that when the value isn't used).
+ */
+static void bcode_op_inc_var(struct bcode_builder *bbuilder, enum ast_tag tag,
+                             const struct var_ref *ref) {
+  int inc = (tag == AST_PREINC || tag == AST_POSTINC);
+
+  if (ref->slot < 0) {
+    bcode_op_lit(bbuilder, inc ? OP_INC_VAR : OP_DEC_VAR, ref->lit);
+  } else {
+    bcode_op(bbuilder, inc ? OP_INC_LOCAL : OP_DEC_LOCAL);
+    bcode_add_varint(bbuilder, (size_t) ref->slot);
+  }
+  if (tag == AST_PREINC || tag == AST_PREDEC) {
+    bcode_op(bbuilder, OP_PUSH_ONE);
+    bcode_op(bbuilder, inc ? OP_ADD : OP_SUB);
+  }
 }
 
 #if V7_ENABLE__RegExp
@@ -21056,6 +25621,7 @@ clean:
 static enum v7_err compile_assign(struct bcode_builder *bbuilder, struct ast *a,
                                   ast_off_t *pos, enum ast_tag tag) {
   lit_t lit;
+  struct var_ref ref;
   enum ast_tag ntag;
   enum v7_err rcode = V7_OK;
   struct v7 *v7 = bbuilder->v7;
@@ -21064,13 +25630,17 @@ static enum v7_err compile_assign(struct bcode_builder *bbuilder, struct ast *a,
 
   switch (ntag) {
     case AST_IDENT:
-      lit = string_lit(bbuilder, a, pos);
+      ref = var_ref(bbuilder, a, pos);
+      if (tag >= AST_PREINC && tag <= AST_POSTDEC) {
+        bcode_op_inc_var(bbuilder, tag, &ref);
+        break;
+      }
       if (tag != AST_ASSIGN) {
-        bcode_op_lit(bbuilder, OP_GET_VAR, lit);
+        bcode_op_var(bbuilder, OP_GET_VAR, &ref);
       }
 
       V7_TRY(eval_assign_rhs(bbuilder, a, pos, tag));
-      bcode_op_lit(bbuilder, OP_SET_VAR, lit);
+      bcode_op_var(bbuilder, OP_SET_VAR, &ref);
 
       fixup_post_op(bbuilder, tag);
       break;
@@ -21120,7 +25690,7 @@ static enum v7_err compile_local_vars(struct bcode_builder *bbuilder,
   ast_off_t next, fvar_end;
   char *name;
   size_t name_len;
-  lit_t lit;
+  struct var_ref ref;
   enum v7_err rcode = V7_OK;
   struct v7 *v7 = bbuilder->v7;
   size_t names_end = 0;
@@ -21163,9 +25733,9 @@ static enum v7_err compile_local_vars(struct bcode_builder *bbuilder,
            * tag is an AST_FUNC_DECL: since functions in JS are hoisted,
            * we compile it and put `OP_SET_VAR` directly here
            */
-          lit = string_lit(bbuilder, a, &fvar);
+          ref = var_ref(bbuilder, a, &fvar);
           V7_TRY(compile_expr_builder(bbuilder, a, &fvar));
-          bcode_op_lit(bbuilder, OP_SET_VAR, lit);
+          bcode_op_var(bbuilder, OP_SET_VAR, &ref);
 
           /* function declarations are stack-neutral */
           bcode_op(bbuilder, OP_DROP);
@@ -21360,9 +25930,11 @@ V7_PRIVATE enum v7_err compile_expr_builder(struct bcode_builder *bbuilder,
       V7_TRY(compile_expr_builder(bbuilder, a, pos));
       bcode_op(bbuilder, OP_NEG);
       break;
-    case AST_IDENT:
-      bcode_op_lit(bbuilder, OP_GET_VAR, string_lit(bbuilder, a, pos));
+    case AST_IDENT: {
+      struct var_ref ref = var_ref(bbuilder, a, pos);
+      bcode_op_var(bbuilder, OP_GET_VAR, &ref);
       break;
+    }
     case AST_MEMBER:
     case AST_INDEX:
       /*
@@ -21384,8 +25956,10 @@ V7_PRIVATE enum v7_err compile_expr_builder(struct bcode_builder *bbuilder,
     case AST_TYPEOF: {
       ast_off_t peek = *pos;
       if ((tag = ast_fetch_tag(a, &peek)) == AST_IDENT) {
+        struct var_ref ref;
         *pos = peek;
-        bcode_op_lit(bbuilder, OP_SAFE_GET_VAR, string_lit(bbuilder, a, pos));
+        ref = var_ref(bbuilder, a, pos);
+        bcode_op_var(bbuilder, OP_SAFE_GET_VAR, &ref);
       } else {
         V7_TRY(compile_expr_builder(bbuilder, a, pos));
       }
@@ -21703,6 +26277,12 @@ V7_PRIVATE enum v7_err compile_expr_builder(struct bcode_builder *bbuilder,
       bcode_op(bbuilder, OP_DROP);
       bcode_op(bbuilder, OP_PUSH_UNDEFINED);
       break;
+    case AST_YIELD:
+    case AST_AWAIT:
+      /* `await` yields the value to the driver of the async function */
+      V7_TRY(compile_expr_builder(bbuilder, a, pos));
+      bcode_op(bbuilder, OP_YIELD);
+      break;
     case AST_NULL:
       bcode_op(bbuilder, OP_PUSH_NULL);
       break;
@@ -21729,9 +26309,15 @@ V7_PRIVATE enum v7_err compile_expr_builder(struct bcode_builder *bbuilder,
       }
       break;
     }
-    case AST_STRING:
-      bcode_push_lit(bbuilder, string_lit(bbuilder, a, pos));
+    case AST_STRING: {
+      /* unlike names, string values don't become atoms */
+      size_t len;
+      char *s = ast_get_inlined_data(a, *pos, &len);
+      ast_move_to_children(a, pos);
+      bcode_push_lit(bbuilder,
+                     bcode_add_lit(bbuilder, v7_mk_string(v7, s, len, 1)));
       break;
+    }
     case AST_REGEX:
 #if V7_ENABLE__RegExp
     {
@@ -21780,6 +26366,46 @@ clean:
 V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
                                     struct ast *a, ast_off_t *pos);
 
+/*
+ * Compiles the condition of a loop, and the jump to the body which is taken
+ * if the condition is true; the caller adds the target. `a < b` and the like
+ * make a single compare-and-branch instruction, `OP_JMP_LT` and friends.
+ */
+static enum v7_err compile_cond_jmp(struct bcode_builder *bbuilder,
+                                    struct ast *a, ast_off_t *pos) {
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+  ast_off_t peek = *pos;
+  uint8_t op;
+
+  switch (ast_fetch_tag(a, &peek)) {
+    case AST_LT:
+      op = OP_JMP_LT;
+      break;
+    case AST_LE:
+      op = OP_JMP_LE;
+      break;
+    case AST_GT:
+      op = OP_JMP_GT;
+      break;
+    case AST_GE:
+      op = OP_JMP_GE;
+      break;
+    default:
+      V7_TRY(compile_expr_builder(bbuilder, a, pos));
+      bcode_op(bbuilder, OP_JMP_TRUE);
+      goto clean;
+  }
+
+  *pos = peek;
+  V7_TRY(compile_expr_builder(bbuilder, a, pos));
+  V7_TRY(compile_expr_builder(bbuilder, a, pos));
+  bcode_op(bbuilder, op);
+
+clean:
+  return rcode;
+}
+
 V7_PRIVATE enum v7_err compile_stmts(struct bcode_builder *bbuilder,
                                      struct ast *a, ast_off_t *pos,
                                      ast_off_t end) {
@@ -21798,13 +26424,40 @@ clean:
   return rcode;
 }
 
+/*
+ * Fills `c` with the value of the case label at `pos`, if it's a number
+ * (maybe negated) or a string literal. Returns 0 if it isn't.
+ */
+static int compile_switch_case(struct ast *a, ast_off_t pos,
+                               struct bcode_switch_case *c) {
+  enum ast_tag tag = ast_fetch_tag(a, &pos);
+  int neg = 0;
+
+  memset(c, 0, sizeof(*c));
+  if (tag == AST_NEGATIVE) {
+    neg = 1;
+    tag = ast_fetch_tag(a, &pos);
+  }
+  switch (tag) {
+    case AST_NUM:
+      ast_get_num(a, pos, &c->num);
+      if (neg) c->num = -c->num;
+      return 1;
+    case AST_STRING:
+      c->str = ast_get_inlined_data(a, pos, &c->len);
+      return !neg;
+    default:
+      return 0;
+  }
+}
+
 V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
                                     struct ast *a, ast_off_t *pos) {
   ast_off_t end;
   enum ast_tag tag;
   ast_off_t cond, pos_start;
   bcode_off_t body_target, body_label, cond_label;
-  struct mbuf case_labels;
+  struct mbuf case_labels, switch_cases;
   enum v7_err rcode = V7_OK;
   struct v7 *v7 = bbuilder->v7;
 
@@ -21812,6 +26465,7 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
   tag = ast_fetch_tag(a, pos);
 
   mbuf_init(&case_labels, 0);
+  mbuf_init(&switch_cases, 0);
 
   switch (tag) {
     /*
@@ -21911,8 +26565,8 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
       continue_target = bcode_pos(bbuilder);
       bcode_patch_target(bbuilder, cond_label, continue_target);
 
-      V7_TRY(compile_expr_builder(bbuilder, a, &cond));
-      body_label = bcode_op_target(bbuilder, OP_JMP_TRUE);
+      V7_TRY(compile_cond_jmp(bbuilder, a, &cond));
+      body_label = bcode_add_target(bbuilder);
       bcode_patch_target(bbuilder, body_label, body_target);
 
       bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
@@ -22134,14 +26788,18 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
      * If the default case is missing we treat it as if had an empty body and
      * placed in last position (i.e. `dfl` label is replaced with `end`).
      *
+     * If all of C1, C2... are number or string constants, the `DUP` chain is
+     * preceded by a jump table (see `bcode_op_switch()`) to `dfl`, `l1`,
+     * `l2`..., which leaves the other types of `E` to the chain.
+     *
      * Before emitting a case/default block (except the first one) we have to
      * drop the TOS resulting from evaluating the last expression
      */
     case AST_SWITCH: {
-      bcode_off_t dfl_label, end_label;
+      bcode_off_t dfl_label, end_label, table_label = 0;
       ast_off_t case_end, case_start;
       enum ast_tag case_tag;
-      int i, has_default = 0, cases = 0;
+      int i, has_default = 0, cases = 0, is_const = 1;
 
       end = ast_get_skip(a, *pos, AST_END_SKIP);
       ast_move_to_children(a, pos);
@@ -22151,6 +26809,25 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
       V7_TRY(compile_expr_builder(bbuilder, a, pos));
 
       case_start = *pos;
+      /* the constant labels, for the jump table */
+      while (is_const && *pos < end) {
+        struct bcode_switch_case c;
+        case_tag = ast_fetch_tag(a, pos);
+        case_end = ast_get_skip(a, *pos, AST_END_SKIP);
+        ast_move_to_children(a, pos);
+        if (case_tag == AST_CASE) {
+          is_const = compile_switch_case(a, *pos, &c);
+          mbuf_append(&switch_cases, &c, sizeof(c));
+        }
+        *pos = case_end;
+      }
+      if (is_const) {
+        table_label = bcode_op_switch(
+            bbuilder, (struct bcode_switch_case *) switch_cases.buf,
+            switch_cases.len / sizeof(struct bcode_switch_case));
+      }
+
+      *pos = case_start;
       /* first pass: evaluate case expression and generate jump table */
       while (*pos < end) {
         case_tag = ast_fetch_tag(a, pos);
@@ -22198,11 +26875,20 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
           case AST_DEFAULT:
             has_default = 1;
             bcode_patch_target(bbuilder, dfl_label, bcode_pos(bbuilder));
+            if (table_label != 0) {
+              bcode_patch_target(bbuilder, table_label, bcode_pos(bbuilder));
+            }
             V7_TRY(compile_stmts(bbuilder, a, pos, case_end));
             break;
           case AST_CASE: {
-            bcode_off_t case_label = ((bcode_off_t *) case_labels.buf)[i++];
+            bcode_off_t case_label = ((bcode_off_t *) case_labels.buf)[i];
             bcode_patch_target(bbuilder, case_label, bcode_pos(bbuilder));
+            if (table_label != 0 &&
+                (case_label = ((struct bcode_switch_case *)
+                                   switch_cases.buf)[i].label) != 0) {
+              bcode_patch_target(bbuilder, case_label, bcode_pos(bbuilder));
+            }
+            i++;
             ast_skip_tree(a, pos);
             V7_TRY(compile_stmts(bbuilder, a, pos, case_end));
             break;
@@ -22214,9 +26900,13 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
         *pos = case_end;
       }
       mbuf_free(&case_labels);
+      mbuf_free(&switch_cases);
 
       if (!has_default) {
         bcode_patch_target(bbuilder, dfl_label, bcode_pos(bbuilder));
+        if (table_label != 0) {
+          bcode_patch_target(bbuilder, table_label, bcode_pos(bbuilder));
+        }
       }
 
       bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
@@ -22263,7 +26953,7 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
        */
       if (tag == AST_VAR) {
         ast_off_t fvar_end;
-        lit_t lit;
+        struct var_ref ref;
 
         *pos = lookahead;
         fvar_end = ast_get_skip(a, *pos, AST_END_SKIP);
@@ -22277,11 +26967,11 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
           tag = ast_fetch_tag(a, pos);
           /* Only var declarations are allowed (not function declarations) */
           V7_CHECK_INTERNAL(tag == AST_VAR_DECL);
-          lit = string_lit(bbuilder, a, pos);
+          ref = var_ref(bbuilder, a, pos);
           V7_TRY(compile_expr_builder(bbuilder, a, pos));
 
           /* Just like an assigment */
-          bcode_op_lit(bbuilder, OP_SET_VAR, lit);
+          bcode_op_var(bbuilder, OP_SET_VAR, &ref);
 
           /* INIT is stack-neutral */
           bcode_op(bbuilder, OP_DROP);
@@ -22317,8 +27007,7 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
       if (tag == AST_NOP) {
         bcode_op(bbuilder, OP_JMP);
       } else {
-        V7_TRY(compile_expr_builder(bbuilder, a, &cond));
-        bcode_op(bbuilder, OP_JMP_TRUE);
+        V7_TRY(compile_cond_jmp(bbuilder, a, &cond));
       }
       body_label = bcode_add_target(bbuilder);
       bcode_patch_target(bbuilder, body_label, body_target);
@@ -22374,7 +27063,7 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
      *
      */
     case AST_FOR_IN: {
-      lit_t lit;
+      struct var_ref ref;
       bcode_off_t loop_label, loop_target, end_label, brend_label,
           continue_label, pop_label, continue_target;
       ast_off_t end = ast_get_skip(a, *pos, AST_END_SKIP);
@@ -22387,11 +27076,11 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
         ast_move_to_children(a, pos);
         tag = ast_fetch_tag(a, pos);
         V7_CHECK_INTERNAL(tag == AST_VAR_DECL);
-        lit = string_lit(bbuilder, a, pos);
+        ref = var_ref(bbuilder, a, pos);
         ast_skip_tree(a, pos);
       } else {
         V7_CHECK_INTERNAL(tag == AST_IDENT);
-        lit = string_lit(bbuilder, a, pos);
+        ref = var_ref(bbuilder, a, pos);
       }
 
       /*
@@ -22431,7 +27120,7 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
 
       bcode_op(bbuilder, OP_NEXT_PROP);
       end_label = bcode_op_target(bbuilder, OP_JMP_FALSE);
-      bcode_op_lit(bbuilder, OP_SET_VAR, lit);
+      bcode_op_var(bbuilder, OP_SET_VAR, &ref);
 
       /*
        * The stash register contains the value of the previous statement,
@@ -22512,8 +27201,8 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
       V7_TRY(compile_stmts(bbuilder, a, pos, end));
 
       continue_target = bcode_pos(bbuilder);
-      V7_TRY(compile_expr_builder(bbuilder, a, pos));
-      body_label = bcode_op_target(bbuilder, OP_JMP_TRUE);
+      V7_TRY(compile_cond_jmp(bbuilder, a, pos));
+      body_label = bcode_add_target(bbuilder);
       bcode_patch_target(bbuilder, body_label, body_target);
 
       bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
@@ -22532,7 +27221,7 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
        * no new variables should be created in it. A var decl thus
        * behaves as a normal assignment at runtime.
        */
-      lit_t lit;
+      struct var_ref ref;
       end = ast_get_skip(a, *pos, AST_END_SKIP);
       ast_move_to_children(a, pos);
       while (*pos < end) {
@@ -22555,9 +27244,9 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
            * stack-neutral: `1; var a = 5;` yields `1`, not `5`.
            */
           V7_CHECK_INTERNAL(tag == AST_VAR_DECL);
-          lit = string_lit(bbuilder, a, pos);
+          ref = var_ref(bbuilder, a, pos);
           V7_TRY(compile_expr_builder(bbuilder, a, pos));
-          bcode_op_lit(bbuilder, OP_SET_VAR, lit);
+          bcode_op_var(bbuilder, OP_SET_VAR, &ref);
 
           /* `var` declaration is stack-neutral */
           bcode_op(bbuilder, OP_DROP);
@@ -22581,6 +27270,7 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
 
 clean:
   mbuf_free(&case_labels);
+  mbuf_free(&switch_cases);
   return rcode;
 }
 
@@ -22590,6 +27280,20 @@ static enum v7_err compile_body(struct bcode_builder *bbuilder, struct ast *a,
   enum v7_err rcode = V7_OK;
   struct v7 *v7 = bbuilder->v7;
 
+  /*
+   * The body of a generator or an async function starts with a marker: the
+   * call just makes the generator, see `OP_GEN_START`
+   */
+  if (*pos < end) {
+    ast_off_t tmp_pos = body;
+    enum ast_tag tag = ast_fetch_tag(a, &tmp_pos);
+    if (tag == AST_GENERATOR || tag == AST_ASYNC) {
+      bcode_op(bbuilder, OP_GEN_START);
+      bcode_op(bbuilder, tag == AST_ASYNC);
+      body = tmp_pos;
+    }
+  }
+
 #ifndef V7_FORCE_STRICT_MODE
   /* check 'use strict' */
   if (*pos < end) {
@@ -22648,6 +27352,9 @@ V7_PRIVATE enum v7_err compile_script(struct v7 *v7, struct ast *a,
 
 clean:
 
+  if (rcode == V7_OK) {
+    bcode_optimize(&bbuilder);
+  }
   bcode_builder_finalize(&bbuilder);
 
 #ifdef V7_BCODE_DUMP
@@ -22660,16 +27367,173 @@ clean:
   return rcode;
 }
 
+static void frame_slot_add(struct mbuf *m, const char *name, size_t len) {
+  struct frame_slot fs;
+  fs.name = name;
+  fs.len = len;
+  mbuf_append(m, &fs, sizeof(fs));
+}
+
+/*
+ * Decides which arguments and locals of the function go to frame slots
+ * instead of the scope object, and emits the `OP_FRAME_SLOTS` prologue if
+ * any do. Should be called after the argument names are added, and before
+ * `compile_body()` adds the local ones.
+ *
+ * A name stays on the scope object if something may look it up by name at
+ * runtime: a nested function uses it, it's a `catch` parameter or it's
+ * deleted; the function name and `arguments` stay there as well. Functions
+ * which contain `with` or mention `eval` keep all their names on the scope.
+ *
+ * The same walk tells whether the function needs `arguments` at all, see
+ * `no_arguments` of `struct bcode`.
+ */
+static enum v7_err compile_frame_slots(struct bcode_builder *bbuilder,
+                                       struct ast *a, ast_off_t start,
+                                       ast_off_t args, ast_off_t body,
+                                       ast_off_t end, ast_off_t fvar,
+                                       const char *fname, size_t fname_len) {
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+  struct mbuf names, dynamic;
+  ast_off_t pos, nested_end = 0;
+  enum ast_tag tag;
+  char *name;
+  size_t name_len, i, cnt;
+  int slot, uses_arguments = 0;
+
+  mbuf_init(&names, 0);
+  mbuf_init(&dynamic, 0);
+
+  /* names in the same order as they'll be in `ops`, args first */
+  for (pos = args; pos < body;) {
+    tag = ast_fetch_tag(a, &pos);
+    V7_CHECK_INTERNAL(tag == AST_IDENT);
+    name = ast_get_inlined_data(a, pos, &name_len);
+    frame_slot_add(&names, name, name_len);
+    ast_move_to_children(a, &pos);
+  }
+
+  /* then declarations, see `compile_local_vars()` */
+  if (fvar != start) {
+    ast_off_t next, fvar_end;
+    do {
+      V7_CHECK_INTERNAL(ast_fetch_tag(a, &fvar) == AST_VAR);
+      next = ast_get_skip(a, fvar, AST_VAR_NEXT_SKIP);
+      if (next == fvar) {
+        next = 0;
+      }
+      fvar_end = ast_get_skip(a, fvar, AST_END_SKIP);
+      ast_move_to_children(a, &fvar);
+      while (fvar < fvar_end) {
+        tag = ast_fetch_tag(a, &fvar);
+        V7_CHECK_INTERNAL(tag == AST_VAR_DECL || tag == AST_FUNC_DECL);
+        name = ast_get_inlined_data(a, fvar, &name_len);
+        frame_slot_add(&names, name, name_len);
+        ast_move_to_children(a, &fvar);
+        ast_skip_tree(a, &fvar);
+      }
+      if (next > 0) {
+        fvar = next - 1;
+      }
+    } while (next != 0);
+  }
+
+  frame_slot_add(&dynamic, fname, fname_len);
+  frame_slot_add(&dynamic, "arguments", 9);
+
+  /* the AST is flat, so walking it node by node visits the whole body */
+  for (pos = body; pos < end;) {
+    ast_off_t node = pos, tmp;
+    tag = ast_fetch_tag(a, &pos);
+    switch (tag) {
+      case AST_WITH:
+        goto no_slots;
+      case AST_FUNC:
+        if (node >= nested_end) {
+          nested_end = ast_get_skip(a, pos, AST_END_SKIP);
+        }
+        break;
+      case AST_IDENT:
+      case AST_MEMBER:
+        name = ast_get_inlined_data(a, pos, &name_len);
+        if (name_len == 4 && memcmp(name, "eval", 4) == 0) {
+          goto no_slots;
+        }
+        if (tag == AST_IDENT && name_len == 9 &&
+            memcmp(name, "arguments", 9) == 0) {
+          /* nested functions have their own, but it's rare enough */
+          uses_arguments = 1;
+        }
+        if (tag == AST_IDENT && node < nested_end) {
+          frame_slot_add(&dynamic, name, name_len);
+        }
+        break;
+      case AST_TRY:
+        tmp = ast_get_skip(a, pos, AST_TRY_CATCH_SKIP);
+        if (tmp != ast_get_skip(a, pos, AST_TRY_FINALLY_SKIP) &&
+            ast_fetch_tag(a, &tmp) == AST_IDENT) {
+          name = ast_get_inlined_data(a, tmp, &name_len);
+          frame_slot_add(&dynamic, name, name_len);
+        }
+        break;
+      case AST_DELETE:
+        tmp = pos;
+        ast_move_to_children(a, &tmp);
+        if (ast_fetch_tag(a, &tmp) == AST_IDENT) {
+          name = ast_get_inlined_data(a, tmp, &name_len);
+          frame_slot_add(&dynamic, name, name_len);
+        }
+        break;
+      default:
+        break;
+    }
+    ast_move_to_children(a, &pos);
+  }
+
+  /* duplicate names share a slot */
+  cnt = names.len / sizeof(struct frame_slot);
+  for (i = 0; i < cnt; i++) {
+    struct frame_slot *fs = &((struct frame_slot *) names.buf)[i];
+    if (frame_slot_find(&dynamic, fs->name, fs->len) < 0 &&
+        frame_slot_find(&bbuilder->slots, fs->name, fs->len) < 0) {
+      frame_slot_add(&bbuilder->slots, fs->name, fs->len);
+    }
+  }
+
+  if (bbuilder->slots.len > 0) {
+    bcode_op(bbuilder, OP_FRAME_SLOTS);
+    bcode_add_varint(bbuilder,
+                     bbuilder->slots.len / sizeof(struct frame_slot));
+    for (i = 0; i < cnt; i++) {
+      struct frame_slot *fs = &((struct frame_slot *) names.buf)[i];
+      slot = frame_slot_find(&bbuilder->slots, fs->name, fs->len);
+      bcode_add_varint(bbuilder, (size_t)(slot + 1));
+    }
+  }
+
+  bbuilder->bcode->no_arguments = !uses_arguments;
+  goto clean;
+
+no_slots:
+  bbuilder->slots.len = 0;
+
+clean:
+  mbuf_free(&names);
+  mbuf_free(&dynamic);
+  return rcode;
+}
+
 /*
  * Compiles a given function and populates a bcode structure.
  * The AST must contain an AST_FUNC node at offset ast_off.
  */
 V7_PRIVATE enum v7_err compile_function(struct v7 *v7, struct ast *a,
                                         ast_off_t *pos, struct bcode *bcode) {
-  ast_off_t start, end, body, fvar;
+  ast_off_t start, end, body, fvar, args;
   enum ast_tag tag = ast_fetch_tag(a, pos);
-  const char *name;
-  size_t name_len;
+  const char *name, *fname = "";
+  size_t name_len, fname_len = 0;
   size_t args_cnt;
   enum v7_err rcode = V7_OK;
   struct bcode_builder bbuilder;
@@ -22687,15 +27551,16 @@ V7_PRIVATE enum v7_err compile_function(struct v7 *v7, struct ast *a,
   tag = ast_fetch_tag(a, pos);
   if (tag == AST_IDENT) {
     /* function name is provided */
-    name = ast_get_inlined_data(a, *pos, &name_len);
+    fname = ast_get_inlined_data(a, *pos, &fname_len);
     ast_move_to_children(a, pos);
-    V7_TRY(bcode_add_name(&bbuilder, name, name_len, NULL));
+    V7_TRY(bcode_add_name(&bbuilder, fname, fname_len, NULL));
   } else {
     /* no name: anonymous function */
     V7_TRY(bcode_add_name(&bbuilder, "", 0, NULL));
   }
 
   /* retrieve function's argument names */
+  args = *pos;
   for (args_cnt = 0; *pos < body; args_cnt++) {
     if (args_cnt > V7_ARGS_CNT_MAX) {
       /* too many arguments */
@@ -22712,9 +27577,15 @@ V7_PRIVATE enum v7_err compile_function(struct v7 *v7, struct ast *a,
 
   bcode->args_cnt = args_cnt;
 
+  V7_TRY(compile_frame_slots(&bbuilder, a, start, args, body, end, fvar, fname,
+                             fname_len));
+
   V7_TRY(compile_body(&bbuilder, a, start, end, body, fvar, pos));
 
 clean:
+  if (rcode == V7_OK) {
+    bcode_optimize(&bbuilder);
+  }
   bcode_builder_finalize(&bbuilder);
 
 #ifdef V7_BCODE_DUMP
@@ -22757,6 +27628,7 @@ V7_PRIVATE enum v7_err compile_expr(struct v7 *v7, struct ast *a,
 /* Amalgamated: #include "v7/src/std_date.h" */
 /* Amalgamated: #include "v7/src/std_error.h" */
 /* Amalgamated: #include "v7/src/std_function.h" */
+/* Amalgamated: #include "v7/src/std_generator.h" */
 /* Amalgamated: #include "v7/src/std_json.h" */
 /* Amalgamated: #include "v7/src/std_math.h" */
 /* Amalgamated: #include "v7/src/std_number.h" */
@@ -23050,6 +27922,7 @@ V7_PRIVATE void init_stdlib(struct v7 *v7) {
   init_date(v7);
 #endif
   init_function(v7);
+  init_generator(v7);
   init_js_stdlib(v7);
 }
 #ifdef V7_MODULE_LINES
@@ -23166,6 +28039,143 @@ static const char js_Blob[] = STRINGIFY(
     });
 #endif
 
+#if V7_ENABLE__Promise
+/*
+ * Promises, and the driver of async functions: it steps the generator of the
+ * call with the values its `await`s wait for. The jobs of settled promises
+ * are queued here and run when the outermost script or call from C is over,
+ * see `bcode_run_jobs()`. Evaluates to `[driver, jobs, runner]`.
+ */
+static const char js_promise[] = STRINGIFY(
+    (function() {
+      var jobs = [];
+      function isFunc(f) { return typeof f === "function"; }
+      function isPromise(x) {
+        return x !== null && typeof x === "object" &&
+               x.constructor === Promise && x._reactions !== undefined;
+      }
+      function settle(p, state, v) {
+        var rs = p._reactions;
+        if (p._state !== 0) return;
+        p._state = state;
+        p._value = v;
+        p._reactions = [];
+        for (var i = 0; i < rs.length; i++) schedule(p, rs[i]);
+      }
+      function resolvers(p) {
+        var done = false;
+        return [function(x) { if (!done) { done = true; resolve(p, x); } },
+                function(e) { if (!done) { done = true; settle(p, 2, e); } }];
+      }
+      function resolve(p, x) {
+        var then;
+        if (x === p) {
+          settle(p, 2, new TypeError("Promise resolved with itself"));
+          return;
+        }
+        if (x !== null && (typeof x === "object" || isFunc(x))) {
+          try { then = x.then; } catch (e) { settle(p, 2, e); return; }
+          if (isFunc(then)) {
+            jobs.push(function() {
+              var r = resolvers(p);
+              try { then.apply(x, r); } catch (e) { r[1](e); }
+            });
+            return;
+          }
+        }
+        settle(p, 1, x);
+      }
+      function schedule(p, r) {
+        jobs.push(function() {
+          var f = p._state === 1 ? r.ok : r.fail, x;
+          if (!isFunc(f)) {
+            if (p._state === 1) resolve(r.p, p._value);
+            else settle(r.p, 2, p._value);
+            return;
+          }
+          try { x = f(p._value); } catch (e) { settle(r.p, 2, e); return; }
+          resolve(r.p, x);
+        });
+      }
+      function Promise(executor) {
+        var r;
+        if (!isFunc(executor)) {
+          throw new TypeError("Promise resolver is not a function");
+        }
+        this._state = 0;
+        this._value = undefined;
+        this._reactions = [];
+        r = resolvers(this);
+        try { executor(r[0], r[1]); } catch (e) { r[1](e); }
+      }
+      Promise.prototype.then = function(ok, fail) {
+        var r = {ok: ok, fail: fail, p: new Promise(function() {})};
+        if (this._state === 0) this._reactions.push(r);
+        else schedule(this, r);
+        return r.p;
+      };
+      Promise.prototype["catch"] = function(fail) {
+        return this.then(undefined, fail);
+      };
+      Promise.resolve = function(x) {
+        if (isPromise(x)) return x;
+        return new Promise(function(ok) { ok(x); });
+      };
+      Promise.reject = function(e) {
+        return new Promise(function(ok, fail) { fail(e); });
+      };
+      Promise.all = function(a) {
+        return new Promise(function(ok, fail) {
+          var res = [], left = a.length;
+          function wait(i) {
+            Promise.resolve(a[i]).then(function(x) {
+              res[i] = x;
+              if (--left === 0) ok(res);
+            }, fail);
+          }
+          if (left === 0) ok(res);
+          for (var i = 0; i < a.length; i++) wait(i);
+        });
+      };
+      Promise.race = function(a) {
+        return new Promise(function(ok, fail) {
+          for (var i = 0; i < a.length; i++) {
+            Promise.resolve(a[i]).then(ok, fail);
+          }
+        });
+      };
+      global.Promise = Promise;
+
+      function run(g) {
+        return new Promise(function(ok, fail) {
+          function step(how, v) {
+            var r;
+            try {
+              r = how === 0 ? g.next(v) : g["throw"](v);
+            } catch (e) {
+              fail(e);
+              return;
+            }
+            if (r.done) {
+              ok(r.value);
+            } else {
+              Promise.resolve(r.value).then(function(x) { step(0, x); },
+                                            function(e) { step(1, e); });
+            }
+          }
+          step(0, undefined);
+        });
+      }
+      function runJobs() {
+        while (jobs.length > 0) {
+          var q = jobs.splice(0, jobs.length);
+          for (var i = 0; i < q.length; i++) q[i]();
+        }
+      }
+      return [run, jobs, runJobs];
+    })());
+#endif
+
 static const char * const js_functions[] = {
 #if V7_ENABLE__Blob
   js_Blob,
@@ -23196,6 +28206,23 @@ static const char * const js_functions[] = {
     }
   }
 
+  v7->vals.async_run = v7_mk_undefined();
+  v7->vals.jobs = v7_mk_undefined();
+  v7->vals.run_jobs = v7_mk_undefined();
+#if V7_ENABLE__Promise
+  if (v7_exec(v7, js_promise, &res) == V7_OK) {
+    struct gc_tmp_frame tf = new_tmp_frame(v7);
+    tmp_stack_push(&tf, &res);
+    v7->vals.async_run = v7_array_get(v7, res, 0);
+    v7->vals.jobs = v7_array_get(v7, res, 1);
+    v7->vals.run_jobs = v7_array_get(v7, res, 2);
+    tmp_frame_cleanup(&tf);
+  } else {
+    fprintf(stderr, "ex: %s:\n", js_promise);
+    v7_fprintln(stderr, v7, res);
+  }
+#endif
+
   /* TODO(lsm): re-enable in a separate PR */
 #if 0
   v7_exec(v7, &res, STRINGIFY(
@@ -25393,7 +30420,18 @@ static enum v7_err _Obj_ownKeys(struct v7 *v7, unsigned int ignore_flags,
     goto clean;
   }
 
-  _Obj_append_reverse(v7, v7_to_object(obj)->properties, *res, 0, ignore_flags);
+  {
+    /* elements of dense arrays are not in the list, see `obj_next_prop()` */
+    void *h = NULL;
+    val_t name = V7_UNDEFINED;
+    int i = 0;
+    while ((h = obj_next_prop(v7, h, obj, &name, NULL, NULL)) != NULL &&
+           ((uintptr_t) h & 1)) {
+      v7_array_set(v7, *res, i++, name);
+    }
+    _Obj_append_reverse(v7, v7_to_object(obj)->properties, *res, i,
+                        ignore_flags);
+  }
 
 clean:
   return rcode;
@@ -25716,7 +30754,7 @@ V7_PRIVATE enum v7_err Obj_valueOf(struct v7 *v7, v7_val_t *res) {
   }
 
   p = v7_get_own_property2(v7, this_obj, "", 0, _V7_PROPERTY_HIDDEN);
-  if (p != NULL) {
+  if (p != NULL && !(v7_to_object(this_obj)->attributes & V7_OBJ_DENSE_ARRAY)) {
     *res = p->value;
     goto clean;
   }
@@ -26298,11 +31336,6 @@ V7_PRIVATE enum v7_err Array_ctor(struct v7 *v7, v7_val_t *res) {
 
   (void) v7;
   *res = v7_mk_array(v7);
-  /*
-   * The interpreter passes dense array to C functions.
-   * However dense array implementation is not yet complete
-   * so we don't want to propagate them at each call to Array()
-   */
   len = v7_argc(v7);
   for (i = 0; i < len; i++) {
     rcode = v7_array_set_throwing(v7, *res, i, v7_arg(v7, i), NULL);
@@ -26374,10 +31407,16 @@ V7_PRIVATE enum v7_err Array_set_length(struct v7 *v7, v7_val_t *res) {
               (isnan(v7_to_number(arg0)) || isinf(v7_to_number(arg0))))) {
     rcode = v7_throwf(v7, RANGE_ERROR, "Invalid array length");
     goto clean;
+  } else if ((v7_to_object(this_obj)->attributes & V7_OBJ_DENSE_ARRAY) &&
+             dense_array_set_length(v7, this_obj, new_len)) {
+    /* elements past `new_len` are dropped, or holes are added up to it */
   } else {
     struct v7_property **p, **next;
     long index, max_index = -1;
 
+    /* too long for the elements it has, the array becomes sparse */
+    dense_array_demote(v7, this_obj);
+
     /* Remove all items with an index higher than new_len */
     for (p = &v7_to_object(this_obj)->properties; *p != NULL; p = next) {
       size_t n;
@@ -26392,6 +31431,7 @@ V7_PRIVATE enum v7_err Array_set_length(struct v7 *v7, v7_val_t *res) {
         max_index = index;
       }
     }
+    obj_shape_drop(v7, v7_to_object(this_obj));
 
     /* If we have to expand, insert an item with appropriate index */
     if (new_len > 0 && max_index < new_len - 1) {
@@ -26416,11 +31456,16 @@ static enum v7_err a_cmp(struct v7 *v7, void *user_data, const void *pa,
 
   if (v7_is_callable(v7, func)) {
     int saved_inhibit_gc = v7->inhibit_gc;
-    val_t vres = v7_mk_undefined(), args = v7_mk_dense_array(v7);
-    v7_array_push(v7, args, a);
-    v7_array_push(v7, args, b);
+    val_t vres = v7_mk_undefined(), argv[2];
+    struct v7_call_handle h;
+    struct gc_tmp_frame vf = new_tmp_frame(v7);
+    argv[0] = a;
+    argv[1] = b;
+    call_handle_init(&h, func, V7_UNDEFINED);
+    tmp_stack_push(&vf, &h.func);
     v7->inhibit_gc = 0;
-    rcode = b_apply(v7, func, V7_UNDEFINED, args, 0, &vres);
+    rcode = b_call(v7, &h, argv, ARRAY_SIZE(argv), &vres);
+    tmp_frame_cleanup(&vf);
     if (rcode != V7_OK) {
       goto clean;
     }
@@ -26708,20 +31753,24 @@ static enum v7_err a_splice(struct v7 *v7, int mutate, v7_val_t *res) {
      * space allocated for future appends.
      * TODO(mkm): figure out if trimming is better
      */
-    struct v7_property *p =
-        v7_get_own_property2(v7, this_obj, "", 0, _V7_PROPERTY_HIDDEN);
-    struct mbuf *abuf;
-    if (p == NULL) {
-      goto clean;
-    }
-    abuf = (struct mbuf *) v7_to_foreign(p->value);
-    if (abuf == NULL) {
-      goto clean;
+    struct mbuf *abuf = dense_array_buf(v7_to_object(this_obj));
+    if (arg1 > len) arg1 = len;
+    if (abuf != NULL && arg1 > arg0) {
+      memmove(abuf->buf + arg0 * sizeof(val_t),
+              abuf->buf + arg1 * sizeof(val_t), (len - arg1) * sizeof(val_t));
+      abuf->len -= (arg1 - arg0) * sizeof(val_t);
     }
 
-    memmove(abuf->buf + arg0 * sizeof(val_t), abuf->buf + arg1 * sizeof(val_t),
-            (len - arg1) * sizeof(val_t));
-    abuf->len -= (arg1 - arg0) * sizeof(val_t);
+    /* Insert optional extra elements */
+    for (i = 2; i < num_args; i++) {
+      val_t v = v7_arg(v7, i);
+      if (abuf == NULL) {
+        /* the array is empty, so inserting is appending */
+        dense_array_put(v7, this_obj, i - 2, v);
+      } else {
+        mbuf_insert(abuf, (arg0 + i - 2) * sizeof(val_t), &v, sizeof(v));
+      }
+    }
   } else if (mutate) {
     /* If splicing, modify this_obj array: remove spliced sub-array */
     struct v7_property **p, **next;
@@ -26745,6 +31794,7 @@ static enum v7_err a_splice(struct v7 *v7, int mutate, v7_val_t *res) {
         p[0]->name = v7_mk_string(v7, key, n, 1);
       }
     }
+    obj_shape_drop(v7, v7_to_object(this_obj));
 
     /* Insert optional extra elements */
     for (i = 2; i < num_args; i++) {
@@ -26780,36 +31830,26 @@ static void a_prep1(struct v7 *v7, val_t t, val_t *a0, val_t *a1) {
 }
 
 /*
- * Call callback function `cb`, passing `this_obj` as `this`, with the
- * following arguments:
+ * Call callback function of the prepared call `cb`, passing its `this_obj` as
+ * `this`, with the following arguments:
  *
  *   cb(v, n, this_obj);
  *
  */
 WARN_UNUSED_RESULT
-static enum v7_err a_prep2(struct v7 *v7, val_t cb, val_t v, val_t n,
-                           val_t this_obj, val_t *res) {
+static enum v7_err a_prep2(struct v7 *v7, struct v7_call_handle *cb, val_t v,
+                           val_t n, val_t *res) {
   enum v7_err rcode = V7_OK;
   int saved_inhibit_gc = v7->inhibit_gc;
-  val_t args = v7_mk_dense_array(v7);
-
-  *res = v7_mk_dense_array(v7);
-
-  v7_own(v7, &args);
+  val_t argv[3];
 
-  v7_array_push(v7, args, v);
-  v7_array_push(v7, args, n);
-  v7_array_push(v7, args, this_obj);
+  argv[0] = v;
+  argv[1] = n;
+  argv[2] = cb->this_obj;
 
   v7->inhibit_gc = 0;
-  rcode = b_apply(v7, cb, this_obj, args, 0, res);
-  if (rcode != V7_OK) {
-    goto clean;
-  }
-
-clean:
+  rcode = b_call(v7, cb, argv, ARRAY_SIZE(argv), res);
   v7->inhibit_gc = saved_inhibit_gc;
-  v7_disown(v7, &args);
 
   return rcode;
 }
@@ -26819,6 +31859,7 @@ V7_PRIVATE enum v7_err Array_forEach(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t this_obj = v7_get_this(v7);
   val_t v = v7_mk_undefined(), cb = v7_arg(v7, 0);
+  struct v7_call_handle h;
   unsigned long len, i;
   int has;
   /* a_prep2 uninhibits GC when calling cb */
@@ -26835,13 +31876,17 @@ V7_PRIVATE enum v7_err Array_forEach(struct v7 *v7, v7_val_t *res) {
   }
 
   tmp_stack_push(&vf, &v);
+  call_handle_init(&h, cb, this_obj);
+  /* the GC may move the values of the handle between the calls */
+  tmp_stack_push(&vf, &h.func);
+  tmp_stack_push(&vf, &h.this_obj);
 
   len = v7_array_length(v7, this_obj);
   for (i = 0; i < len; i++) {
     v = v7_array_get2(v7, this_obj, i, &has);
     if (!has) continue;
 
-    rcode = a_prep2(v7, cb, v, v7_mk_number(i), this_obj, res);
+    rcode = a_prep2(v7, &h, v, v7_mk_number(i), res);
     if (rcode != V7_OK) {
       goto clean;
     }
@@ -26857,6 +31902,7 @@ V7_PRIVATE enum v7_err Array_map(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t this_obj = v7_get_this(v7);
   val_t arg0, arg1, el, v;
+  struct v7_call_handle h;
   unsigned long len, i;
   int has;
   /* a_prep2 uninhibits GC when calling cb */
@@ -26873,11 +31919,15 @@ V7_PRIVATE enum v7_err Array_map(struct v7 *v7, v7_val_t *res) {
     tmp_stack_push(&vf, &arg0);
     tmp_stack_push(&vf, &arg1);
     tmp_stack_push(&vf, &v);
+    call_handle_init(&h, arg0, arg1);
+    /* the GC may move a string `this` between the calls */
+    tmp_stack_push(&vf, &h.func);
+    tmp_stack_push(&vf, &h.this_obj);
 
     for (i = 0; i < len; i++) {
       v = v7_array_get2(v7, this_obj, i, &has);
       if (!has) continue;
-      rcode = a_prep2(v7, arg0, v, v7_mk_number(i), arg1, &el);
+      rcode = a_prep2(v7, &h, v, v7_mk_number(i), &el);
       if (rcode != V7_OK) {
         goto clean;
       }
@@ -26899,6 +31949,7 @@ V7_PRIVATE enum v7_err Array_every(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t this_obj = v7_get_this(v7);
   val_t arg0, arg1, el, v;
+  struct v7_call_handle h;
   unsigned long i, len;
   int has;
   /* a_prep2 uninhibits GC when calling cb */
@@ -26915,12 +31966,16 @@ V7_PRIVATE enum v7_err Array_every(struct v7 *v7, v7_val_t *res) {
     tmp_stack_push(&vf, &arg0);
     tmp_stack_push(&vf, &arg1);
     tmp_stack_push(&vf, &v);
+    call_handle_init(&h, arg0, arg1);
+    /* the GC may move a string `this` between the calls */
+    tmp_stack_push(&vf, &h.func);
+    tmp_stack_push(&vf, &h.this_obj);
 
     len = v7_array_length(v7, this_obj);
     for (i = 0; i < len; i++) {
       v = v7_array_get2(v7, this_obj, i, &has);
       if (!has) continue;
-      rcode = a_prep2(v7, arg0, v, v7_mk_number(i), arg1, &el);
+      rcode = a_prep2(v7, &h, v, v7_mk_number(i), &el);
       if (rcode != V7_OK) {
         goto clean;
       }
@@ -26943,6 +31998,7 @@ V7_PRIVATE enum v7_err Array_some(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t this_obj = v7_get_this(v7);
   val_t arg0, arg1, el, v;
+  struct v7_call_handle h;
   unsigned long i, len;
   int has;
   /* a_prep2 uninhibits GC when calling cb */
@@ -26959,12 +32015,16 @@ V7_PRIVATE enum v7_err Array_some(struct v7 *v7, v7_val_t *res) {
     tmp_stack_push(&vf, &arg0);
     tmp_stack_push(&vf, &arg1);
     tmp_stack_push(&vf, &v);
+    call_handle_init(&h, arg0, arg1);
+    /* the GC may move a string `this` between the calls */
+    tmp_stack_push(&vf, &h.func);
+    tmp_stack_push(&vf, &h.this_obj);
 
     len = v7_array_length(v7, this_obj);
     for (i = 0; i < len; i++) {
       v = v7_array_get2(v7, this_obj, i, &has);
       if (!has) continue;
-      rcode = a_prep2(v7, arg0, v, v7_mk_number(i), arg1, &el);
+      rcode = a_prep2(v7, &h, v, v7_mk_number(i), &el);
       if (rcode != V7_OK) {
         goto clean;
       }
@@ -26987,6 +32047,7 @@ V7_PRIVATE enum v7_err Array_filter(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t this_obj = v7_get_this(v7);
   val_t arg0, arg1, el, v;
+  struct v7_call_handle h;
   unsigned long len, i;
   int has;
   /* a_prep2 uninhibits GC when calling cb */
@@ -27003,11 +32064,15 @@ V7_PRIVATE enum v7_err Array_filter(struct v7 *v7, v7_val_t *res) {
     tmp_stack_push(&vf, &arg0);
     tmp_stack_push(&vf, &arg1);
     tmp_stack_push(&vf, &v);
+    call_handle_init(&h, arg0, arg1);
+    /* the GC may move a string `this` between the calls */
+    tmp_stack_push(&vf, &h.func);
+    tmp_stack_push(&vf, &h.this_obj);
 
     for (i = 0; i < len; i++) {
       v = v7_array_get2(v7, this_obj, i, &has);
       if (!has) continue;
-      rcode = a_prep2(v7, arg0, v, v7_mk_number(i), arg1, &el);
+      rcode = a_prep2(v7, &h, v, v7_mk_number(i), &el);
       if (rcode != V7_OK) {
         goto clean;
       }
@@ -30018,7 +35083,7 @@ V7_PRIVATE enum v7_err Function_name(struct v7 *v7, v7_val_t *res) {
   assert(func->bcode != NULL);
 
   assert(func->bcode->names_cnt >= 1);
-  bcode_next_name_v(v7, func->bcode, func->bcode->ops.p, res);
+  bcode_next_name_v(v7, func->bcode, 0, func->bcode->ops.p, res);
 
 clean:
   return rcode;
@@ -30122,6 +35187,89 @@ V7_PRIVATE void init_function(struct v7 *v7) {
          v7_mk_cfunction(Function_name));
 }
 
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+#ifdef V7_MODULE_LINES
+#line 1 "./src/std_generator.c"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/std_generator.h" */
+/* Amalgamated: #include "v7/src/eval.h" */
+/* Amalgamated: #include "v7/src/object.h" */
+/* Amalgamated: #include "v7/src/gc.h" */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Resumes the generator `this` with the first argument, see `b_resume()`,
+ * and makes the result object `{value, done}` of the iterator protocol.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err gen_step(struct v7 *v7, enum gen_resume how,
+                            v7_val_t *res) {
+  enum v7_err rcode = V7_OK;
+  val_t this_obj = v7_get_this(v7);
+  val_t value = v7_mk_undefined();
+  struct v7_property *p = NULL;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+  int done = 0;
+
+  tmp_stack_push(&tf, &value);
+
+  if (v7_is_object(this_obj) &&
+      obj_prototype_v(v7, this_obj) == v7->vals.generator_prototype) {
+    p = v7_get_own_property2(v7, this_obj, "", 0, _V7_PROPERTY_HIDDEN);
+  }
+  if (p == NULL) {
+    rcode = v7_throwf(v7, TYPE_ERROR, "Not a generator");
+    goto clean;
+  }
+
+  rcode = b_resume(v7, p->value, how, v7_arg(v7, 0), &value, &done);
+  if (rcode != V7_OK) {
+    goto clean;
+  }
+
+  *res = v7_mk_object(v7);
+  v7_set(v7, *res, "done", 4, v7_mk_boolean(done));
+  v7_set(v7, *res, "value", 5, value);
+
+clean:
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err Generator_next(struct v7 *v7, v7_val_t *res) {
+  return gen_step(v7, GEN_RESUME_NEXT, res);
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err Generator_return(struct v7 *v7, v7_val_t *res) {
+  return gen_step(v7, GEN_RESUME_RETURN, res);
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err Generator_throw(struct v7 *v7, v7_val_t *res) {
+  return gen_step(v7, GEN_RESUME_THROW, res);
+}
+
+V7_PRIVATE void init_generator(struct v7 *v7) {
+  v7->vals.generator_prototype = v7_mk_object(v7);
+
+  set_method(v7, v7->vals.generator_prototype, "next", Generator_next, 1);
+  set_method(v7, v7->vals.generator_prototype, "return", Generator_return, 1);
+  set_method(v7, v7->vals.generator_prototype, "throw", Generator_throw, 1);
+}
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -30504,6 +35652,7 @@ static void show_usage(char *argv[]) {
   fprintf(stderr, "%s\n", "  -t                   dump generated text AST");
   fprintf(stderr, "%s\n", "  -b                   dump generated binary AST");
   fprintf(stderr, "%s\n", "  -c                   dump compiled binary bcode");
+  fprintf(stderr, "%s\n", "  --no-opt             don't optimize compiled bcode");
   fprintf(stderr, "%s\n", "  -mm                  dump memory stats");
   fprintf(stderr, "%s\n", "  -vo <n>              object arena size");
   fprintf(stderr, "%s\n", "  -vf <n>              function arena size");
@@ -30570,6 +35719,8 @@ int v7_main(int argc, char *argv[], void (*pre_freeze_init)(struct v7 *),
       show_usage(argv);
     } else if (strcmp(argv[i], "-j") == 0) {
       as_json = 1;
+    } else if (strcmp(argv[i], "--no-opt") == 0) {
+      opts.no_bcode_opt = 1;
 #if V7_ENABLE__Memory__stats
     } else if (strcmp(argv[i], "-mm") == 0) {
       dump_stats = 1;
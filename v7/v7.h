@@ -163,6 +163,8 @@ struct v7_mk_opts {
   /* if not NULL, dump JS heap after init */
   char *freeze_file;
 #endif
+  /* if non-zero, compiled code is run as is, without optimizing it */
+  int no_bcode_opt;
 };
 struct v7 *v7_create_opt(struct v7_mk_opts opts);
 
@@ -495,7 +497,8 @@ int v7_set_method(struct v7 *, v7_val_t obj, const char *name,
 int v7_del(struct v7 *v7, v7_val_t obj, const char *name, size_t name_len);
 
 /*
- * Iterate over the `obj`'s properties.
+ * Iterate over the `obj`'s properties. Elements of arrays come first, from
+ * the last one, with their indices as strings in `name`.
  *
  * Usage example:
  *
@@ -642,6 +645,34 @@ WARN_UNUSED_RESULT
 enum v7_err v7_apply(struct v7 *v7, v7_val_t func, v7_val_t this_obj,
                      v7_val_t args, v7_val_t *res);
 
+/*
+ * Call function `func` with `argc` arguments from `argv`, using `this_obj` as
+ * `this`. Unlike `v7_apply()`, no array is made for the arguments.
+ *
+ * `res` can be `NULL` if return value is not required.
+ */
+WARN_UNUSED_RESULT
+enum v7_err v7_call(struct v7 *v7, v7_val_t func, v7_val_t this_obj,
+                    const v7_val_t *argv, int argc, v7_val_t *res);
+
+/*
+ * Prepared call, for C code which calls the same function again and again,
+ * e.g. a callback per entry or per event. The handle keeps `func` and
+ * `this_obj` from being garbage collected until it's freed.
+ *
+ * Returns NULL if `func` is not callable.
+ */
+struct v7_call_handle *v7_call_prepare(struct v7 *v7, v7_val_t func,
+                                       v7_val_t this_obj);
+
+/* Like `v7_call()`, calls the function of a prepared call. */
+WARN_UNUSED_RESULT
+enum v7_err v7_call_prepared(struct v7 *v7, struct v7_call_handle *h,
+                             const v7_val_t *argv, int argc, v7_val_t *res);
+
+/* Free a prepared call made by `v7_call_prepare()`. */
+void v7_call_handle_free(struct v7 *v7, struct v7_call_handle *h);
+
 /* Throw an exception with an already existing value. */
 WARN_UNUSED_RESULT
 enum v7_err v7_throw(struct v7 *v7, v7_val_t v);